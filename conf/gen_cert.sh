@@ -0,0 +1,7 @@
+#!/bin/sh
+# 生成本地测试用的自签名证书，输出到conf/server.crt和conf/server.key
+cd "$(dirname "$0")"
+openssl req -x509 -newkey rsa:2048 -nodes -days 365 \
+    -keyout server.key -out server.crt \
+    -subj "/CN=localhost" \
+    -addext "subjectAltName=DNS:localhost,IP:127.0.0.1"
@@ -0,0 +1,286 @@
+#include "fcgi_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+int fcgi_pool::connect() const {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    // Unix域socket的连接要么立即完成，要么因为队列满返回EAGAIN
+    if (::connect(fd, addr.get(), addr.len) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+fcgi_table::~fcgi_table() {
+    for (size_t i = 0; i < m_pools.size(); ++i) {
+        delete m_pools[i];
+    }
+}
+
+// 一行配置：模式 socket路径 进程数 命令 [参数...]
+static fcgi_pool* parse_pool(char* text) {
+    char* save = NULL;
+    const char* pattern = strtok_r(text, " \t", &save);
+    const char* path = strtok_r(NULL, " \t", &save);
+    const char* count = strtok_r(NULL, " \t", &save);
+    if (!pattern || !path || !count || pattern[0] != '/') {
+        return NULL;
+    }
+    fcgi_pool* p = new fcgi_pool;
+    p->pattern = pattern;
+    p->path = path;
+    p->workers = atoi(count);
+    bool any;
+    if (path[0] != '/' || !p->addr.parse(std::string("unix:") + path, false, &any) ||
+        p->workers <= 0 || p->workers > fcgi_table::MAX_WORKERS) {
+        delete p;
+        return NULL;
+    }
+    char* word;
+    while ((word = strtok_r(NULL, " \t", &save))) {
+        p->argv.push_back(word);
+    }
+    if (p->argv.empty()) {
+        delete p;
+        return NULL;
+    }
+    return p;
+}
+
+int fcgi_table::load(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        return 0;
+    }
+    int count = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        char* text = line + strspn(line, " \t");
+        text[strcspn(text, "\r\n#")] = '\0';
+        if (text[strspn(text, " \t")] == '\0') {
+            continue;
+        }
+        std::string spec = text;
+        fcgi_pool* p = parse_pool(text);
+        if (!p) {
+            printf("bad fastcgi pool in %s: %s\n", path, spec.c_str());
+            count = -1;
+            break;
+        }
+        m_pools.push_back(p);
+        ++count;
+    }
+    fclose(fp);
+    return count;
+}
+
+const fcgi_pool* fcgi_table::find(const char* pattern) const {
+    for (size_t i = 0; pattern && i < m_pools.size(); ++i) {
+        if (m_pools[i]->pattern == pattern) {
+            return m_pools[i];
+        }
+    }
+    return NULL;
+}
+
+// socket文件可能是上一次运行留下的，也可能属于正在升级的旧进程，都直接替换：
+// 旧进程的应用进程继续服务已经连上的请求，之后的连接都到新的池
+bool fcgi_table::open_socket(fcgi_pool* p) {
+    struct stat st;
+    if (lstat(p->path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            printf("%s exists and is not a socket\n", p->path.c_str());
+            return false;
+        }
+        unlink(p->path.c_str());
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, p->addr.get(), p->addr.len) < 0 || listen(fd, BACKLOG) < 0 ||
+        stat(p->path.c_str(), &st) < 0) {
+        perror(p->path.c_str());
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    p->listen_fd = fd;
+    p->inode = st.st_ino;
+    return true;
+}
+
+bool fcgi_table::start() {
+    if (m_pools.empty()) {
+        return true;
+    }
+    for (size_t i = 0; i < m_pools.size(); ++i) {
+        if (!open_socket(m_pools[i])) {
+            return false;
+        }
+    }
+    fflush(stdout);             // 缓冲中的输出不能被子进程再写一遍
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != parent) {
+            _exit(0);
+        }
+        supervise();
+        _exit(0);
+    }
+    m_supervisor = pid;
+    for (size_t i = 0; i < m_pools.size(); ++i) {
+        close(m_pools[i]->listen_fd);
+        m_pools[i]->listen_fd = -1;
+    }
+    return true;
+}
+
+static volatile sig_atomic_t supervisor_stop = 0;
+
+static void on_stop(int sig) {
+    supervisor_stop = 1;
+}
+
+// 监管进程只保留标准输入输出和池的监听socket，服务器的其他fd(平滑升级继承的监听socket等)都关闭
+static void close_inherited(const std::vector<fcgi_pool*>& pools) {
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return;
+    }
+    std::vector<int> fds;
+    struct dirent* e;
+    while ((e = readdir(dir))) {
+        int fd = atoi(e->d_name);
+        if (fd > 2 && fd != dirfd(dir)) {
+            fds.push_back(fd);
+        }
+    }
+    closedir(dir);
+    for (size_t i = 0; i < fds.size(); ++i) {
+        bool keep = false;
+        for (size_t j = 0; j < pools.size() && !keep; ++j) {
+            keep = pools[j]->listen_fd == fds[i];
+        }
+        if (!keep) {
+            close(fds[i]);
+        }
+    }
+}
+
+void fcgi_table::supervise() {
+    // 不设SA_RESTART，waitpid被信号打断后检查标志
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGQUIT, &sa, NULL);
+    signal(SIGHUP, SIG_IGN);
+    close_inherited(m_pools);
+
+    std::vector<app> apps;
+    for (size_t i = 0; i < m_pools.size(); ++i) {
+        app a;
+        a.pool = m_pools[i];
+        a.pid = 0;
+        a.started = 0;
+        apps.insert(apps.end(), m_pools[i]->workers, a);
+    }
+    for (size_t i = 0; i < apps.size(); ++i) {
+        spawn(&apps[i]);
+    }
+    fflush(stdout);
+    while (!supervisor_stop) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sleep(RESTART_DELAY);       // 所有应用进程都没能启动，稍后再试
+        }
+        for (size_t i = 0; i < apps.size() && !supervisor_stop; ++i) {
+            if (pid > 0 && apps[i].pid != pid) {
+                continue;
+            }
+            if (pid > 0) {
+                printf("fastcgi %s: process %d exited (status %d), restarting\n",
+                       apps[i].pool->path.c_str(), pid, status);
+                apps[i].pid = 0;
+                if (time(NULL) - apps[i].started < RESTART_DELAY) {
+                    sleep(RESTART_DELAY);
+                }
+            }
+            if (apps[i].pid == 0) {
+                spawn(&apps[i]);
+            }
+        }
+        fflush(stdout);
+    }
+
+    // 服务器退出：结束应用进程，删除自己的socket文件
+    for (size_t i = 0; i < apps.size(); ++i) {
+        if (apps[i].pid > 0) {
+            kill(apps[i].pid, SIGTERM);
+        }
+    }
+    while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {
+    }
+    for (size_t i = 0; i < m_pools.size(); ++i) {
+        struct stat st;
+        if (stat(m_pools[i]->path.c_str(), &st) == 0 && st.st_ino == m_pools[i]->inode) {
+            unlink(m_pools[i]->path.c_str());
+        }
+    }
+}
+
+// 应用进程：监听socket放在fd 0，恢复默认的信号处理，监管进程退出时随之退出
+void fcgi_table::spawn(app* a) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    if (pid > 0) {
+        a->pid = pid;
+        a->started = time(NULL);
+        return;
+    }
+    if (dup2(a->pool->listen_fd, 0) < 0) {
+        _exit(127);
+    }
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    std::vector<char*> argv;
+    for (size_t i = 0; i < a->pool->argv.size(); ++i) {
+        argv.push_back((char*)a->pool->argv[i].c_str());
+    }
+    argv.push_back(NULL);
+    execvp(argv[0], &argv[0]);
+    perror(argv[0]);
+    _exit(127);
+}
@@ -0,0 +1,71 @@
+#ifndef FCGI_POOL_H
+#define FCGI_POOL_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "../net/sock_addr.h"
+
+/*
+    FastCGI应用的常驻进程池：每个池一个Unix域监听socket，启动时由服务器创建，
+    作为fd 0(FCGI_LISTENSOCK_FILENO，php-cgi等都按这个约定运行)交给池中的每个应用进程
+    - 空闲的应用进程在这个socket上accept，一个进程同时只处理一个连接，请求自然分给空闲的进程
+    - 所有工作线程(prefork模式下所有工作进程)的请求共用这一个队列；队列满时非阻塞connect立即失败，回应503
+    - 应用进程由单独的监管进程fork/exec，退出后重新启动。监听socket一直由监管进程持有，
+      应用进程重启期间到达的连接在队列中等待，不会被拒绝
+*/
+struct fcgi_pool {
+    fcgi_pool() : workers(0), listen_fd(-1), inode(0) {}
+
+    // 非阻塞连接，失败返回-1，errno为EAGAIN表示队列已满
+    int connect() const;
+
+    std::string pattern;        // 注册到路由表的模式，路由表保存指针，不能再修改
+    std::string path;           // Unix域socket的路径
+    sock_addr addr;
+    int workers;
+    std::vector<std::string> argv;
+    int listen_fd;              // 服务器进程在启动监管进程之后关闭
+    ino_t inode;                // socket文件，监管进程退出时文件还是它(没有被升级后的新进程替换)才删除
+};
+
+// FastCGI配置，一行一个池，#开头为注释：路由模式 socket路径 进程数 命令 [参数...]
+//   /*.php /tmp/webserver-php.sock 4 /usr/bin/php-cgi
+//   /api/* /tmp/webserver-api.sock 2 /usr/local/bin/api-server --fastcgi
+// 模式的写法见http/router.h，匹配的GET/HEAD/POST/PUT/DELETE/OPTIONS请求都交给这个池
+class fcgi_table {
+public:
+    static const int BACKLOG = 128;         // 等待空闲应用进程的连接数
+    static const int RESTART_DELAY = 1;     // 应用进程启动后这么多秒内就退出时，推迟这么久再重启
+    static const int MAX_WORKERS = 256;
+
+    fcgi_table() : m_supervisor(0) {}
+    ~fcgi_table();
+
+    // 文件不存在返回0，有错误的行返回-1，否则返回池数
+    int load(const char* path);
+    // 按路由模式查找
+    const fcgi_pool* find(const char* pattern) const;
+    const std::vector<fcgi_pool*>& pools() const { return m_pools; }
+
+    // 创建监听socket并fork出监管进程，在创建线程和prefork之前调用。监管进程在服务器进程退出时结束
+    bool start();
+
+private:
+    struct app {
+        fcgi_pool* pool;
+        pid_t pid;
+        time_t started;
+    };
+
+    bool open_socket(fcgi_pool* p);
+    void supervise();
+    void spawn(app* a);
+
+private:
+    std::vector<fcgi_pool*> m_pools;
+    pid_t m_supervisor;
+};
+
+#endif
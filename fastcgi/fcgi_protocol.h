@@ -0,0 +1,96 @@
+#ifndef FCGI_PROTOCOL_H
+#define FCGI_PROTOCOL_H
+
+#include <stddef.h>
+#include <string>
+
+/*
+    FastCGI记录的编码和解码：记录头8字节，内容最长65535字节，填充到8字节对齐
+    每个连接上同一时刻只有一个请求，请求ID固定为1
+*/
+enum FCGI_TYPE {
+    FCGI_BEGIN_REQUEST = 1,
+    FCGI_ABORT_REQUEST = 2,
+    FCGI_END_REQUEST = 3,
+    FCGI_PARAMS = 4,
+    FCGI_STDIN = 5,
+    FCGI_STDOUT = 6,
+    FCGI_STDERR = 7,
+};
+
+static const int FCGI_HEADER_LEN = 8;
+static const size_t FCGI_MAX_CONTENT = 65535;
+static const int FCGI_REQUEST_ID = 1;
+static const int FCGI_RESPONDER = 1;
+
+// 记录头，content为空时仍然写出(空的PARAMS和STDIN表示结束)
+inline void fcgi_append_header(std::string& out, int type, size_t len, int padding) {
+    char h[FCGI_HEADER_LEN] = {
+        1, (char)type, 0, (char)FCGI_REQUEST_ID, (char)(len >> 8), (char)(len & 0xff), (char)padding, 0
+    };
+    out.append(h, FCGI_HEADER_LEN);
+}
+
+// 按65535字节切成多条记录；len为0时写一条空记录
+inline void fcgi_append_records(std::string& out, int type, const char* data, size_t len) {
+    do {
+        size_t n = len < FCGI_MAX_CONTENT ? len : FCGI_MAX_CONTENT;
+        int padding = (8 - n % 8) % 8;
+        fcgi_append_header(out, type, n, padding);
+        out.append(data, n);
+        out.append(padding, '\0');
+        data += n;
+        len -= n;
+    } while (len > 0);
+}
+
+// BEGIN_REQUEST：响应者角色，不要求保持连接，应用写完响应后关闭连接
+inline void fcgi_append_begin(std::string& out) {
+    static const char body[8] = { 0, (char)FCGI_RESPONDER, 0, 0, 0, 0, 0, 0 };
+    fcgi_append_header(out, FCGI_BEGIN_REQUEST, sizeof(body), 0);
+    out.append(body, sizeof(body));
+}
+
+// 名字-值对，长度小于128时1字节，否则4字节(最高位为1)
+inline void fcgi_append_length(std::string& out, size_t len) {
+    if (len < 128) {
+        out += (char)len;
+        return;
+    }
+    out += (char)((len >> 24) | 0x80);
+    out += (char)(len >> 16);
+    out += (char)(len >> 8);
+    out += (char)len;
+}
+
+inline void fcgi_append_param(std::string& out, const char* name, size_t name_len, const char* value, size_t value_len) {
+    fcgi_append_length(out, name_len);
+    fcgi_append_length(out, value_len);
+    out.append(name, name_len);
+    out.append(value, value_len);
+}
+
+// 解析记录头，不足8字节时返回false
+struct fcgi_record {
+    bool parse(const char* p, size_t len) {
+        if (len < (size_t)FCGI_HEADER_LEN) {
+            return false;
+        }
+        const unsigned char* h = (const unsigned char*)p;
+        version = h[0];
+        type = h[1];
+        request_id = (h[2] << 8) | h[3];
+        content_len = (h[4] << 8) | h[5];
+        padding = h[6];
+        return true;
+    }
+    size_t total() const { return FCGI_HEADER_LEN + content_len + padding; }
+
+    int version;
+    int type;
+    int request_id;
+    size_t content_len;
+    int padding;
+};
+
+#endif
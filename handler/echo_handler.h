@@ -0,0 +1,29 @@
+#ifndef ECHO_HANDLER_H
+#define ECHO_HANDLER_H
+
+#include "../http/request_handler.h"
+
+// 把请求体原样返回，用于调试上传和客户端的chunked编码
+class echo_handler : public request_handler {
+public:
+    static const long MAX_BODY = 1024 * 1024;
+
+    static request_handler* create() { return new echo_handler; }
+
+    long max_body_size() const { return MAX_BODY; }
+
+    bool on_body(const char* data, size_t len) {
+        m_body.append(data, len);
+        return true;
+    }
+
+    void on_complete(response& resp) {
+        resp.content_type = "application/octet-stream";
+        resp.body.swap(m_body);
+    }
+
+private:
+    std::string m_body;
+};
+
+#endif
@@ -0,0 +1,475 @@
+#include "fastcgi_handler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include "../fastcgi/fcgi_protocol.h"
+#include "../http/http_conn.h"
+#include "../http/url_path.h"
+
+extern const char* doc_root;
+
+fcgi_table* fastcgi_handler::m_pools = NULL;
+const char* fastcgi_handler::m_script_root = NULL;
+
+// 响应体生产者，生命周期由发送队列管理，数据都来自处理器
+class fastcgi_body : public response_writer::producer {
+public:
+    explicit fastcgi_body(fastcgi_handler* owner) : m_owner(owner) {}
+    STATUS produce(response_writer& w) { return m_owner->produce(w); }
+
+private:
+    fastcgi_handler* m_owner;
+};
+
+static void add_param(std::string& out, const char* name, const char* value) {
+    fcgi_append_param(out, name, strlen(name), value, strlen(value));
+}
+
+// CGI响应头中由服务器重新生成或者只在一跳上有意义的头部
+static bool dropped_header(const char* name, size_t len) {
+    static const char* const names[] = {
+        "Status", "Content-Length", "Connection", "Keep-Alive", "Transfer-Encoding", "Trailer", "Upgrade", "TE",
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strlen(names[i]) == len && strncasecmp(names[i], name, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 响应头结束的位置(空行之后)，CGI应用可能只用LF换行；还没有读到空行时返回0
+static size_t head_length(const std::string& s) {
+    for (size_t pos = s.find('\n'); pos != std::string::npos; pos = s.find('\n', pos + 1)) {
+        size_t next = pos + 1;
+        if (next < s.size() && s[next] == '\r') {
+            ++next;
+        }
+        if (next < s.size() && s[next] == '\n') {
+            return next + 1;
+        }
+    }
+    return 0;
+}
+
+fastcgi_handler::fastcgi_handler()
+    : m_pool(NULL), m_fd(-1), m_failed(false), m_busy(false), m_wait_events(0), m_method(0),
+      m_chunked_body(false), m_stdin_done(false), m_out_pos(0), m_ended(false), m_remaining(-1) {}
+
+fastcgi_handler::~fastcgi_handler() {
+    finish();
+}
+
+bool fastcgi_handler::on_begin(int method, const char* url, long content_length) {
+    m_pool = m_pools ? m_pools->find(m_params.pattern) : NULL;
+    if (!m_pool) {
+        return false;
+    }
+    m_method = method;
+    m_chunked_body = content_length < 0;
+    build_params(url);
+    // chunked请求体的长度要等收完才知道，到on_complete再发出请求
+    if (!m_chunked_body) {
+        start_request(content_length);
+    }
+    return true;
+}
+
+void fastcgi_handler::build_params(const char* url) {
+    std::string& p = m_cgi_params;
+    const char* query = url + strcspn(url, "?");
+    std::string path(url, query);
+    std::string uri;
+    encode_url(uri, url);
+    add_param(p, "GATEWAY_INTERFACE", "CGI/1.1");
+    add_param(p, "SERVER_SOFTWARE", "webserver");
+    add_param(p, "SERVER_PROTOCOL", "HTTP/1.1");
+    add_param(p, "REQUEST_METHOD", http_conn::method_name(m_method));
+    add_param(p, "REQUEST_URI", uri.c_str());
+    add_param(p, "SCRIPT_NAME", path.c_str());
+    const char* root = m_script_root ? m_script_root : doc_root;
+    add_param(p, "SCRIPT_FILENAME", (root + path).c_str());
+    add_param(p, "DOCUMENT_ROOT", root);
+    add_param(p, "QUERY_STRING", *query ? query + 1 : "");
+    add_param(p, "REDIRECT_STATUS", "200");     // php-cgi的cgi.force_redirect要求
+    if (m_tls) {
+        add_param(p, "HTTPS", "on");
+    }
+    char ip[INET6_ADDRSTRLEN];
+    if (m_client.host(ip, sizeof(ip))) {
+        char port[8];
+        snprintf(port, sizeof(port), "%u", m_client.port());
+        add_param(p, "REMOTE_ADDR", ip);
+        add_param(p, "REMOTE_PORT", port);
+    }
+    str_view host = header(H_HOST);
+    std::string server_name(host.data(), host.size());
+    if (server_name.empty() || server_name[0] != '[') {
+        server_name.erase(std::min(server_name.find(':'), server_name.size()));
+    }
+    add_param(p, "SERVER_NAME", server_name.empty() ? "localhost" : server_name.c_str());
+    str_view type = header(H_CONTENT_TYPE);
+    if (!type.empty()) {
+        fcgi_append_param(p, "CONTENT_TYPE", 12, type.data(), type.size());
+    }
+
+    // 其他请求头按CGI的约定变成HTTP_XXX；名字中有'-'以外符号的请求头丢弃，
+    // 免得"X_Foo"冒充"X-Foo"。Proxy头会被当作代理设置(httpoxy)，同样丢弃
+    size_t pos = 0;
+    const char* line;
+    size_t len;
+    while (next_header(&pos, &line, &len)) {
+        const char* colon = (const char*)memchr(line, ':', len);
+        if (!colon) {
+            continue;
+        }
+        size_t name_len = colon - line;
+        if ((name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) ||
+            (name_len == 12 && strncasecmp(line, "Content-Type", 12) == 0) ||
+            (name_len == 5 && strncasecmp(line, "Proxy", 5) == 0)) {
+            continue;
+        }
+        std::string name = "HTTP_";
+        bool valid = name_len > 0;
+        for (size_t i = 0; i < name_len && valid; ++i) {
+            char c = line[i];
+            valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-';
+            name += c == '-' ? '_' : (char)toupper(c);
+        }
+        if (!valid) {
+            continue;
+        }
+        const char* value = colon + 1;
+        value += strspn(value, " \t");
+        fcgi_append_param(p, name.data(), name.size(), value, line + len - value);
+    }
+}
+
+// 连接到池，放入BEGIN_REQUEST、CGI变量和已经知道的请求体
+void fastcgi_handler::start_request(long content_length) {
+    m_fd = m_pool->connect();
+    if (m_fd < 0) {
+        m_busy = errno == EAGAIN;
+        m_failed = !m_busy;
+        return;
+    }
+    if (content_length > 0) {
+        char len[24];
+        snprintf(len, sizeof(len), "%ld", content_length);
+        add_param(m_cgi_params, "CONTENT_LENGTH", len);
+    }
+    fcgi_append_begin(m_out);
+    fcgi_append_records(m_out, FCGI_PARAMS, m_cgi_params.data(), m_cgi_params.size());
+    fcgi_append_records(m_out, FCGI_PARAMS, NULL, 0);
+    std::string().swap(m_cgi_params);
+    if (!m_body.empty()) {
+        fcgi_append_records(m_out, FCGI_STDIN, m_body.data(), m_body.size());
+        std::string().swap(m_body);
+    }
+    if (content_length == 0 || m_chunked_body) {
+        fcgi_append_records(m_out, FCGI_STDIN, NULL, 0);
+        m_stdin_done = true;
+    }
+    m_failed = !send_pending();
+}
+
+// 写出待发送的记录，应用的接收缓冲满时等待EPOLLOUT；出错返回false
+bool fastcgi_handler::send_pending() {
+    while (m_out_pos < m_out.size()) {
+        ssize_t n = send(m_fd, m_out.data() + m_out_pos, m_out.size() - m_out_pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                m_wait_events = EPOLLOUT;
+                return true;
+            }
+            return false;
+        }
+        m_out_pos += n;
+    }
+    m_out.clear();
+    m_out_pos = 0;
+    return true;
+}
+
+int fastcgi_handler::wait_fd(uint32_t* events) const {
+    if (m_wait_events == 0 || m_fd < 0) {
+        return -1;
+    }
+    *events = m_wait_events;
+    return m_fd;
+}
+
+bool fastcgi_handler::on_ready() {
+    m_wait_events = 0;
+    if (!m_failed && !send_pending()) {
+        m_failed = true;
+    }
+    return !m_failed;
+}
+
+bool fastcgi_handler::on_body(const char* data, size_t len) {
+    if (m_failed || m_busy) {
+        return true;            // 读完请求体后回应502或503
+    }
+    if (m_chunked_body) {
+        m_body.append(data, len);
+        return true;
+    }
+    fcgi_append_records(m_out, FCGI_STDIN, data, len);
+    // 应用读得慢时数据先留在m_out中，连接随后挂起，不再读取请求体
+    if (m_wait_events == 0 && !send_pending()) {
+        m_failed = true;
+    }
+    return true;
+}
+
+void fastcgi_handler::on_complete(response& resp) {
+    m_wait_events = 0;
+    if (!m_failed && !m_busy && m_fd < 0) {
+        start_request(m_body.size());
+    } else if (!m_failed && !m_busy && !m_stdin_done) {
+        fcgi_append_records(m_out, FCGI_STDIN, NULL, 0);
+        m_stdin_done = true;
+    }
+    if (m_busy) {
+        service_unavailable(resp);
+        return;
+    }
+    if (!m_failed && send_pending()) {
+        if (m_wait_events != 0) {
+            return;             // 请求还没有发完
+        }
+        int ret = read_head();
+        if (ret == 0) {
+            m_wait_events = EPOLLIN;
+            return;
+        }
+        if (ret > 0 && parse_head(resp)) {
+            return;
+        }
+    }
+    bad_gateway(resp);
+}
+
+// 从m_in中取出完整的记录：STDOUT的内容接到m_stdout后面，STDERR写到日志。格式错误返回false
+bool fastcgi_handler::take_records() {
+    size_t pos = 0;
+    fcgi_record r;
+    while (!m_ended && r.parse(m_in.data() + pos, m_in.size() - pos) && m_in.size() - pos >= r.total()) {
+        if (r.version != 1 || r.request_id != FCGI_REQUEST_ID) {
+            return false;
+        }
+        const char* content = m_in.data() + pos + FCGI_HEADER_LEN;
+        if (r.type == FCGI_STDOUT) {
+            m_stdout.append(content, r.content_len);
+        } else if (r.type == FCGI_STDERR && r.content_len > 0) {
+            fprintf(stderr, "fastcgi %s: %.*s", m_pool->path.c_str(), (int)r.content_len, content);
+        } else if (r.type == FCGI_END_REQUEST) {
+            m_ended = true;
+        }
+        pos += r.total();
+    }
+    m_in.erase(0, pos);
+    return true;
+}
+
+// 读到完整的响应头返回1，需要等待返回0，应用关闭或出错返回-1
+int fastcgi_handler::read_head() {
+    char buf[4096];
+    while (true) {
+        if (!take_records()) {
+            return -1;
+        }
+        if (head_length(m_stdout) > 0) {
+            return 1;
+        }
+        if (m_ended || m_stdout.size() > HEAD_MAX) {
+            return -1;
+        }
+        ssize_t n = recv(m_fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            m_in.append(buf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+// CGI响应头：Status给出状态码，只有Location时是302，否则是200
+bool fastcgi_handler::parse_head(response& resp) {
+    size_t head_len = head_length(m_stdout);
+    int status = 0;
+    bool location = false;
+    long length = -1;
+    m_reason.clear();
+    m_resp_headers.clear();
+    const char* p = m_stdout.data();
+    const char* end = p + head_len;
+    while (p < end) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        const char* line_end = eol > p && eol[-1] == '\r' ? eol - 1 : eol;
+        if (line_end == p) {
+            break;              // 空行
+        }
+        const char* colon = (const char*)memchr(p, ':', line_end - p);
+        if (!colon) {
+            return false;
+        }
+        size_t name_len = colon - p;
+        const char* value = colon + 1;
+        value += strspn(value, " \t");
+        std::string text(value, line_end > value ? line_end - value : 0);
+        if (name_len == 6 && strncasecmp(p, "Status", 6) == 0) {
+            // Status: 404 Not Found
+            status = atoi(text.c_str());
+            size_t sp = text.find(' ');
+            m_reason = sp == std::string::npos ? "" : text.substr(sp + 1);
+        } else if (name_len == 8 && strncasecmp(p, "Location", 8) == 0) {
+            location = true;
+        } else if (name_len == 14 && strncasecmp(p, "Content-Length", 14) == 0) {
+            char* num_end;
+            length = strtol(text.c_str(), &num_end, 10);
+            if (num_end == text.c_str() || length < 0) {
+                return false;
+            }
+        }
+        if (!dropped_header(p, name_len)) {
+            m_resp_headers.append(p, line_end - p);
+            m_resp_headers += "\r\n";
+        }
+        p = eol + 1;
+    }
+    if (status == 0) {
+        status = location ? 302 : 200;
+    }
+    if (status < 200 || status > 999) {
+        return false;
+    }
+    if (m_reason.empty()) {
+        m_reason = status == 200 ? "OK" : status == 302 ? "Found" : "Unknown";
+    }
+    m_stdout.erase(0, head_len);
+    resp.status = status;
+    resp.title = m_reason.c_str();
+
+    char line[48];
+    if (m_method == http_conn::HEAD || status == 204 || status == 304) {
+        // HEAD的Content-Length描述的是完整的响应，原样告诉客户端
+        if (length >= 0 && status != 204 && status != 304) {
+            snprintf(line, sizeof(line), "Content-Length: %ld\r\n", length);
+            m_resp_headers += line;
+        }
+        finish();
+    } else if (take_records() && m_ended) {
+        // 响应已经完整(小页面的常见情况)，不必分块
+        if (length >= 0 && (long)m_stdout.size() > length) {
+            m_stdout.resize(length);
+        }
+        snprintf(line, sizeof(line), "Content-Length: %zu\r\n", m_stdout.size());
+        m_resp_headers += line;
+        resp.body.swap(m_stdout);
+        finish();
+    } else {
+        m_remaining = length;
+        resp.producer = new fastcgi_body(this);
+        resp.stream_length = length;
+    }
+    resp.raw_headers = m_resp_headers.data();
+    resp.raw_headers_len = m_resp_headers.size();
+    return true;
+}
+
+// 交给发送队列，应用给出了Content-Length时多出的数据丢弃
+bool fastcgi_handler::emit(const char* data, size_t len, response_writer& w) {
+    if (m_remaining >= 0) {
+        if ((long)len > m_remaining) {
+            len = m_remaining;
+        }
+        m_remaining -= len;
+    }
+    return len == 0 || w.append(data, len);
+}
+
+response_writer::producer::STATUS fastcgi_handler::produce(response_writer& w) {
+    m_wait_events = 0;
+    // 读到的可能只是半条记录，读到响应体数据(或者结束)为止，MORE总要带着数据返回
+    while (m_stdout.empty() && !m_ended) {
+        if (m_fd < 0) {
+            return response_writer::producer::FAILED;
+        }
+        char buf[16 * 1024];
+        ssize_t n = recv(m_fd, buf, sizeof(buf), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            m_wait_events = EPOLLIN;
+            return response_writer::producer::WAIT;
+        }
+        if (n <= 0) {
+            // 没有END_REQUEST就关闭，响应体不完整，客户端只能从连接关闭知道出错了
+            finish();
+            return response_writer::producer::FAILED;
+        }
+        m_in.append(buf, n);
+        if (!take_records()) {
+            finish();
+            return response_writer::producer::FAILED;
+        }
+    }
+    bool ok = emit(m_stdout.data(), m_stdout.size(), w);
+    m_stdout.clear();
+    if (!ok) {
+        finish();
+        return response_writer::producer::FAILED;
+    }
+    if (!m_ended) {
+        return response_writer::producer::MORE;
+    }
+    finish();
+    return m_remaining > 0 ? response_writer::producer::FAILED : response_writer::producer::DONE;
+}
+
+// 应用写完响应后自己关闭连接，这边直接关闭即可
+void fastcgi_handler::finish() {
+    if (m_fd < 0) {
+        return;
+    }
+    http_conn::forget_fd(m_fd);
+    close(m_fd);
+    m_fd = -1;
+    m_wait_events = 0;
+}
+
+void fastcgi_handler::bad_gateway(response& resp) {
+    finish();
+    resp.release();
+    resp = response();
+    resp.status = 502;
+    resp.title = "Bad Gateway";
+    resp.content_type = "text/plain";
+    resp.body = "The FastCGI application failed to answer the request.\n";
+}
+
+// 所有应用进程都忙，队列也满了；让客户端稍后重试
+void fastcgi_handler::service_unavailable(response& resp) {
+    static const char body[] = "All FastCGI workers are busy, please retry later.\n";
+    char headers[96];
+    int len = snprintf(headers, sizeof(headers), "Content-Type: text/plain\r\nRetry-After: 1\r\nContent-Length: %zu\r\n",
+                       sizeof(body) - 1);
+    resp.release();
+    resp = response();
+    resp.status = 503;
+    resp.title = "Service Unavailable";
+    m_resp_headers.assign(headers, len);
+    resp.raw_headers = m_resp_headers.data();
+    resp.raw_headers_len = m_resp_headers.size();
+    resp.body.assign(body, sizeof(body) - 1);
+}
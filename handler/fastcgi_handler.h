@@ -0,0 +1,73 @@
+#ifndef FASTCGI_HANDLER_H
+#define FASTCGI_HANDLER_H
+
+#include <string>
+#include "../http/request_handler.h"
+#include "../fastcgi/fcgi_pool.h"
+
+/*
+    FastCGI：把路由到这里的请求交给按路由模式找到的应用进程池，应用的CGI响应转换成HTTP响应流式发回客户端
+    - 每个请求一个到池的Unix域连接，应用写完响应后关闭它；池的队列满时回应503，不在工作线程里排队
+    - 连接读写不了时不阻塞工作线程，通过wait_fd挂起客户端连接，超时由连接的STAGE_UPSTREAM定时器负责
+    - Content-Length请求体边收边转成STDIN记录发出，应用处理不过来时连接暂停读取请求体；
+      chunked请求体先缓存，收完后以CONTENT_LENGTH发出(CGI要求事先知道长度)
+    - 读到END_REQUEST时响应已经完整的，按Content-Length一次发出，否则以chunked编码(或应用给出的Content-Length)流式发送
+*/
+class fastcgi_handler : public request_handler {
+public:
+    static const long MAX_BODY = 16L * 1024 * 1024;
+    static const size_t HEAD_MAX = 16 * 1024;       // CGI响应头的上限
+    static fcgi_table* m_pools;
+    static const char* m_script_root;   // 脚本所在目录，在doc_root之外，静态文件处理器读不到脚本源码
+
+    static request_handler* create() { return new fastcgi_handler; }
+
+    fastcgi_handler();
+    ~fastcgi_handler();
+
+    long max_body_size() const { return MAX_BODY; }
+    bool on_begin(int method, const char* url, long content_length);
+    bool on_body(const char* data, size_t len);
+    void on_complete(response& resp);
+    int wait_fd(uint32_t* events) const;
+    bool on_ready();
+
+    // 响应体的生产者调用
+    response_writer::producer::STATUS produce(response_writer& w);
+
+private:
+    void build_params(const char* url);
+    void start_request(long content_length);
+    bool send_pending();
+    bool take_records();
+    int read_head();
+    bool parse_head(response& resp);
+    bool emit(const char* data, size_t len, response_writer& w);
+    void finish();
+    void bad_gateway(response& resp);
+    void service_unavailable(response& resp);
+
+private:
+    const fcgi_pool* m_pool;
+    int m_fd;
+    bool m_failed;              // 应用出错，请求体读完后回应502
+    bool m_busy;                // 池的队列已满，请求体读完后回应503
+    uint32_t m_wait_events;     // 不为0时在等待应用连接上的这些事件
+
+    int m_method;
+    bool m_chunked_body;
+    bool m_stdin_done;          // 结束请求体的空STDIN记录已经放入待发送的数据
+    std::string m_cgi_params;   // 除CONTENT_LENGTH以外的CGI变量(名字-值对)
+    std::string m_body;         // 缓存的chunked请求体
+    std::string m_out;          // 待写给应用的记录
+    size_t m_out_pos;
+
+    std::string m_in;           // 读到的还不完整的记录
+    std::string m_stdout;       // STDOUT记录的内容：响应头，以及还没有交给发送队列的响应体
+    bool m_ended;               // 读到了END_REQUEST
+    std::string m_reason;
+    std::string m_resp_headers; // 转发给客户端的响应头
+    long m_remaining;           // 应用给出Content-Length时还没有发出的响应体字节数，否则为-1
+};
+
+#endif
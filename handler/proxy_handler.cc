@@ -0,0 +1,550 @@
+#include "proxy_handler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "../http/http_conn.h"
+#include "../http/url_path.h"
+
+upstream_table* proxy_handler::m_upstreams = NULL;
+
+// 响应体生产者，生命周期由发送队列管理，数据都来自处理器
+class proxy_body : public response_writer::producer {
+public:
+    explicit proxy_body(proxy_handler* owner) : m_owner(owner) {}
+    STATUS produce(response_writer& w) { return m_owner->produce(w); }
+
+private:
+    proxy_handler* m_owner;
+};
+
+// 逐跳的头部只在一跳上有意义，不转发；Content-Length和X-Forwarded-*由代理重新生成
+static bool hop_by_hop(const char* name, size_t len) {
+    static const char* const names[] = {
+        "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate", "Proxy-Authorization", "TE",
+        "Trailer", "Transfer-Encoding", "Upgrade", "HTTP2-Settings", "Expect", "Content-Length",
+        "X-Forwarded-For", "X-Forwarded-Proto",
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strlen(names[i]) == len && strncasecmp(names[i], name, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Connection头中列出的名字同样是逐跳的
+static bool listed(const str_view& connection, const char* name, size_t len) {
+    const char* p = connection.data();
+    const char* end = p + connection.size();
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            ++p;
+        }
+        const char* token = p;
+        while (p < end && *p != ',' && *p != ' ' && *p != '\t') {
+            ++p;
+        }
+        if ((size_t)(p - token) == len && strncasecmp(token, name, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+proxy_handler::proxy_handler()
+    : m_group(NULL), m_server(NULL), m_fd(-1), m_reused(false), m_attempts(0), m_failed(false), m_wait_events(0),
+      m_method(0), m_has_body(false), m_chunked_body(false), m_body_done(false), m_out_pos(0), m_piped(0), m_sent(0),
+      m_head_len(0), m_body_mode(BODY_NONE), m_remaining(0), m_keep(false), m_splice_resp(false) {
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
+proxy_handler::~proxy_handler() {
+    finish(false);
+    if (m_pipe[0] != -1) {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+    }
+}
+
+bool proxy_handler::on_begin(int method, const char* url, long content_length) {
+    m_group = m_upstreams ? m_upstreams->find(url) : NULL;
+    if (!m_group) {
+        return false;
+    }
+    m_method = method;
+    m_has_body = content_length != 0;
+    m_chunked_body = content_length < 0;
+    build_request(url, content_length);
+    m_out = m_head;
+    // 请求头先发出去，后端可以和请求体的接收并行地开始处理
+    if (!connect_upstream() || !send_pending()) {
+        m_failed = !retry();
+    }
+    return true;
+}
+
+void proxy_handler::build_request(const char* url, long content_length) {
+    std::string& h = m_head;
+    h = http_conn::method_name(m_method);
+    h += ' ';
+    encode_url(h, url);
+    h += " HTTP/1.1\r\n";
+    str_view connection = header(H_CONNECTION);
+    size_t pos = 0;
+    const char* line;
+    size_t len;
+    while (next_header(&pos, &line, &len)) {
+        const char* colon = (const char*)memchr(line, ':', len);
+        if (!colon || hop_by_hop(line, colon - line) || listed(connection, line, colon - line)) {
+            continue;
+        }
+        h.append(line, len);
+        h += "\r\n";
+    }
+    if (header(H_HOST).empty()) {
+        h += "Host: localhost\r\n";
+    }
+    // 追加在客户端(或前面的代理)给出的列表之后
+    char ip[INET6_ADDRSTRLEN];
+    const char* client = m_client.host(ip, sizeof(ip));
+    str_view forwarded = header(H_X_FORWARDED_FOR);
+    if (!forwarded.empty() || client) {
+        h += "X-Forwarded-For: ";
+        h.append(forwarded.data(), forwarded.size());
+        if (client) {
+            h += forwarded.empty() ? "" : ", ";
+            h += client;
+        }
+        h += "\r\n";
+    }
+    h += m_tls ? "X-Forwarded-Proto: https\r\n" : "X-Forwarded-Proto: http\r\n";
+    if (content_length > 0) {
+        char line_buf[48];
+        snprintf(line_buf, sizeof(line_buf), "Content-Length: %ld\r\n", content_length);
+        h += line_buf;
+    } else if (content_length < 0) {
+        h += "Transfer-Encoding: chunked\r\n";
+    }
+    h += "\r\n";
+}
+
+// 选一台后端并取得连接；连接立即失败的后端计入失败，换下一台
+bool proxy_handler::connect_upstream() {
+    while (m_attempts < MAX_ATTEMPTS) {
+        m_server = m_group->pick();
+        m_fd = m_server->connect(&m_reused);
+        if (m_fd >= 0) {
+            return true;
+        }
+        ++m_attempts;
+        m_server->failed();
+        m_server->done();
+        m_server = NULL;
+    }
+    return false;
+}
+
+// 上游连接出错：能安全重发时换一个连接从头发送，否则返回false
+bool proxy_handler::retry() {
+    bool replayable = m_sent == 0 || (!m_has_body && m_method != http_conn::POST);
+    // 复用的连接被后端关闭是正常的，不算后端的失败，也不占尝试次数
+    if (m_server && !m_reused) {
+        m_server->failed();
+        ++m_attempts;
+    }
+    finish(false);
+    if (!replayable || !m_in.empty() || !connect_upstream()) {
+        return false;
+    }
+    if (m_sent > 0) {
+        m_out = m_head;
+    }
+    m_out_pos = 0;
+    m_sent = 0;
+    return send_pending();
+}
+
+// 写出待发送的请求数据和管道中的请求体，上游写不进去时等待EPOLLOUT；出错返回false
+bool proxy_handler::send_pending() {
+    while (m_out_pos < m_out.size()) {
+        ssize_t n = send(m_fd, m_out.data() + m_out_pos, m_out.size() - m_out_pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                m_wait_events = EPOLLOUT;       // 包括非阻塞connect还没有完成
+                return true;
+            }
+            return false;
+        }
+        m_out_pos += n;
+        m_sent += n;
+    }
+    m_out.clear();
+    m_out_pos = 0;
+    while (m_piped > 0) {
+        ssize_t n = splice(m_pipe[0], NULL, m_fd, NULL, m_piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            m_wait_events = EPOLLOUT;
+            return true;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        m_piped -= n;
+        m_sent += n;
+    }
+    return true;
+}
+
+int proxy_handler::wait_fd(uint32_t* events) const {
+    if (m_wait_events == 0 || m_fd < 0) {
+        return -1;
+    }
+    *events = m_wait_events;
+    return m_fd;
+}
+
+bool proxy_handler::on_ready() {
+    m_wait_events = 0;
+    if (m_failed) {
+        return false;
+    }
+    if (!send_pending() && !retry()) {
+        m_failed = true;
+        return false;
+    }
+    return true;
+}
+
+// 和请求头一起到达的请求体，以及chunked请求体
+bool proxy_handler::on_body(const char* data, size_t len) {
+    if (m_failed) {
+        return true;            // 上游已经出错，读完请求体后回应502
+    }
+    if (m_chunked_body) {
+        char size_line[24];
+        int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+        m_out.append(size_line, n);
+        m_out.append(data, len);
+        m_out += "\r\n";
+    } else {
+        m_out.append(data, len);
+    }
+    // 上游写不进去时数据先留在m_out中，连接随后挂起，不再读取请求体
+    if (m_wait_events == 0 && !send_pending() && !retry()) {
+        m_failed = true;
+    }
+    return true;
+}
+
+bool proxy_handler::open_pipe() {
+    if (m_pipe[0] != -1) {
+        return true;
+    }
+    if (pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        m_pipe[0] = m_pipe[1] = -1;
+        return false;
+    }
+    fcntl(m_pipe[1], F_SETPIPE_SZ, PIPE_SIZE);
+    return true;
+}
+
+// 客户端socket -> 管道 -> 上游，管道里上一次没有写完的数据先写出去
+long proxy_handler::splice_body(int sockfd, long max) {
+    if (m_failed || !open_pipe()) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (m_wait_events != 0 || m_out_pos < m_out.size() || m_piped > 0) {
+        if (m_wait_events == 0 && !send_pending()) {
+            m_failed = true;
+            errno = EPIPE;
+            return -1;
+        }
+        if (m_wait_events != 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    if (max > PIPE_SIZE) {
+        max = PIPE_SIZE;
+    }
+    ssize_t moved = splice(sockfd, NULL, m_pipe[1], NULL, max, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved <= 0) {
+        return moved;
+    }
+    m_piped += moved;
+    if (!send_pending()) {
+        m_failed = true;
+        errno = EPIPE;
+        return -1;
+    }
+    return moved;
+}
+
+void proxy_handler::on_complete(response& resp) {
+    m_wait_events = 0;
+    if (!m_failed && m_chunked_body && !m_body_done) {
+        m_out += "0\r\n\r\n";
+        m_body_done = true;
+    }
+    while (!m_failed) {
+        if (!send_pending()) {
+            m_failed = !retry();
+            continue;
+        }
+        if (m_wait_events != 0) {
+            return;             // 请求还没有发完
+        }
+        int ret = read_head();
+        if (ret == 0) {
+            m_wait_events = EPOLLIN;
+            return;
+        }
+        if (ret < 0) {
+            m_failed = !retry();
+            continue;
+        }
+        HEAD_RESULT head = parse_head(resp);
+        if (head == HEAD_OK) {
+            return;
+        }
+        if (head == HEAD_BAD) {
+            break;
+        }
+    }
+    bad_gateway(resp);
+}
+
+// 读到完整的响应头返回1，需要等待返回0，上游关闭或出错返回-1
+int proxy_handler::read_head() {
+    char buf[4096];
+    while (true) {
+        size_t end = m_in.find("\r\n\r\n");
+        if (end != std::string::npos) {
+            m_head_len = end + 4;
+            return 1;
+        }
+        if (m_in.size() > HEAD_MAX) {
+            return -1;
+        }
+        ssize_t n = recv(m_fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            m_in.append(buf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+proxy_handler::HEAD_RESULT proxy_handler::parse_head(response& resp) {
+    // HTTP/1.1 200 OK
+    const char* p = m_in.data();
+    const char* head_end = p + m_head_len - 2;      // 最后一行之后的CRLF
+    if (m_head_len < 14 || strncmp(p, "HTTP/1.", 7) != 0 || p[8] != ' ') {
+        return HEAD_BAD;
+    }
+    const char* eol = (const char*)memmem(p, m_head_len, "\r\n", 2);
+    int status = atoi(p + 9);
+    if (status < 100 || status > 999 || status == 101) {
+        return HEAD_BAD;        // 没有转发Upgrade，不会有合法的101
+    }
+    if (status < 200) {
+        m_in.erase(0, m_head_len);
+        return HEAD_INFO;
+    }
+    const char* reason = p + 12;
+    reason += strspn(reason, " ");
+    m_reason.assign(reason, eol > reason ? eol - reason : 0);
+    bool close_after = p[7] == '0';         // HTTP/1.0默认不保持连接
+    bool chunked = false;
+    long length = -1;
+    m_resp_headers.clear();
+    for (const char* line = eol + 2; line < head_end; line = eol + 2) {
+        eol = (const char*)memmem(line, head_end + 2 - line, "\r\n", 2);
+        const char* colon = (const char*)memchr(line, ':', eol - line);
+        if (!colon) {
+            return HEAD_BAD;
+        }
+        size_t name_len = colon - line;
+        std::string value(colon + 1, eol);
+        value.erase(0, value.find_first_not_of(" \t"));
+        if (name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+            char* end;
+            long n = strtol(value.c_str(), &end, 10);
+            if (end == value.c_str() || n < 0 || (length >= 0 && n != length)) {
+                return HEAD_BAD;
+            }
+            length = n;
+        } else if (name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+            chunked = strcasestr(value.c_str(), "chunked") != NULL;
+        } else if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+            if (strcasestr(value.c_str(), "close")) {
+                close_after = true;
+            } else if (strcasestr(value.c_str(), "keep-alive")) {
+                close_after = false;
+            }
+        }
+        if (!hop_by_hop(line, name_len)) {
+            m_resp_headers.append(line, eol - line);
+            m_resp_headers += "\r\n";
+        }
+    }
+    m_keep = !close_after;
+    m_in.erase(0, m_head_len);
+    if (m_method == http_conn::HEAD || status == 204 || status == 304) {
+        m_body_mode = BODY_NONE;
+    } else if (chunked) {
+        m_body_mode = BODY_CHUNKED;
+    } else if (length >= 0) {
+        m_body_mode = length > 0 ? BODY_LENGTH : BODY_NONE;
+        m_remaining = length;
+    } else {
+        m_body_mode = BODY_CLOSE;
+        m_keep = false;
+    }
+    m_server->succeeded();
+
+    resp.status = status;
+    resp.title = m_reason.c_str();
+    if (m_body_mode == BODY_NONE) {
+        // HEAD和304的Content-Length描述的是完整的响应，原样告诉客户端
+        if (length >= 0 && !chunked) {
+            char line_buf[48];
+            snprintf(line_buf, sizeof(line_buf), "Content-Length: %ld\r\n", length);
+            m_resp_headers += line_buf;
+        }
+        finish(m_keep && m_in.empty());
+    } else {
+        resp.producer = new proxy_body(this);
+        resp.stream_length = m_body_mode == BODY_LENGTH ? m_remaining : -1;
+        m_splice_resp = resp.can_splice && m_body_mode != BODY_CHUNKED && open_pipe();
+    }
+    resp.raw_headers = m_resp_headers.data();
+    resp.raw_headers_len = m_resp_headers.size();
+    return HEAD_OK;
+}
+
+// 把一段上游数据按响应体的结束方式交给发送队列
+response_writer::producer::STATUS proxy_handler::take_body(const char* data, size_t len, response_writer& w) {
+    if (m_body_mode == BODY_CHUNKED) {
+        while (len > 0) {
+            size_t used = 0;
+            const char* piece = NULL;
+            size_t piece_len = 0;
+            chunked_decoder::RESULT res = m_decoder.decode(data, len, &used, &piece, &piece_len);
+            data += used;
+            len -= used;
+            if (res == chunked_decoder::BAD || (piece_len > 0 && !w.append(piece, piece_len))) {
+                finish(false);
+                return response_writer::producer::FAILED;
+            }
+            if (res == chunked_decoder::DONE) {
+                finish(m_keep && len == 0);
+                return response_writer::producer::DONE;
+            }
+            if (res == chunked_decoder::NEED_MORE) {
+                break;
+            }
+        }
+        return response_writer::producer::MORE;
+    }
+    if (m_body_mode == BODY_LENGTH && (long)len >= m_remaining) {
+        // 多出来的数据说明上游的响应有问题，连接不再复用
+        bool ok = w.append(data, m_remaining);
+        finish(m_keep && (long)len == m_remaining);
+        m_remaining = 0;
+        return ok ? response_writer::producer::DONE : response_writer::producer::FAILED;
+    }
+    m_remaining -= len;
+    return w.append(data, len) ? response_writer::producer::MORE : response_writer::producer::FAILED;
+}
+
+response_writer::producer::STATUS proxy_handler::produce(response_writer& w) {
+    m_wait_events = 0;
+    if (m_fd < 0) {
+        return response_writer::producer::FAILED;
+    }
+    if (!m_in.empty()) {
+        std::string early;
+        early.swap(m_in);
+        return take_body(early.data(), early.size(), w);
+    }
+    size_t want = PIPE_SIZE;
+    if (m_body_mode == BODY_LENGTH && (long)want > m_remaining) {
+        want = m_remaining;
+    }
+    ssize_t n;
+    if (m_splice_resp) {
+        if (w.piping()) {
+            return response_writer::producer::MORE;     // 管道中的上一段还没有发给客户端
+        }
+        n = splice(m_fd, NULL, m_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } else {
+        char buf[16 * 1024];
+        n = recv(m_fd, buf, want < sizeof(buf) ? want : sizeof(buf), 0);
+        if (n > 0) {
+            return take_body(buf, n, w);
+        }
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        m_wait_events = EPOLLIN;
+        return response_writer::producer::WAIT;
+    }
+    if (n == 0 && m_body_mode == BODY_CLOSE) {
+        finish(false);
+        return response_writer::producer::DONE;
+    }
+    if (n <= 0) {
+        // 响应体不完整，客户端只能从连接关闭知道出错了
+        finish(false);
+        return response_writer::producer::FAILED;
+    }
+    if (!w.append_pipe(m_pipe[0], n)) {
+        finish(false);
+        return response_writer::producer::FAILED;
+    }
+    if (m_body_mode == BODY_LENGTH) {
+        m_remaining -= n;
+        if (m_remaining == 0) {
+            finish(m_keep);
+            return response_writer::producer::DONE;
+        }
+    }
+    return response_writer::producer::MORE;
+}
+
+// 上游连接用完：可以复用时放回连接池，否则关闭
+void proxy_handler::finish(bool keep) {
+    if (m_fd < 0) {
+        return;
+    }
+    http_conn::forget_fd(m_fd);
+    if (keep) {
+        m_server->put(m_fd);
+    } else {
+        close(m_fd);
+    }
+    m_fd = -1;
+    m_server->done();
+    m_server = NULL;
+    m_wait_events = 0;
+}
+
+void proxy_handler::bad_gateway(response& resp) {
+    finish(false);
+    resp.release();
+    resp = response();
+    resp.status = 502;
+    resp.title = "Bad Gateway";
+    resp.content_type = "text/plain";
+    resp.body = "The upstream server failed to answer the request.\n";
+}
@@ -0,0 +1,99 @@
+#ifndef PROXY_HANDLER_H
+#define PROXY_HANDLER_H
+
+#include <string>
+#include "../http/request_handler.h"
+#include "../http/chunked_decoder.h"
+#include "../upstream/upstream.h"
+
+/*
+    反向代理：把路由到这里的请求转发给上游后端(HTTP/1.1)，响应流式地发回客户端
+    - 上游连接取自后端的keep-alive连接池，响应完整且后端没有要求关闭时放回池中
+    - 上游读写不了时不阻塞工作线程，通过wait_fd挂起客户端连接，上游fd就绪后继续
+    - Content-Length请求体经过管道从客户端socket直接splice到上游；Content-Length或以关闭结束的响应体
+      从上游splice进管道，再由发送队列splice到客户端socket，数据不进入用户态(HTTPS连接没有kTLS时除外)
+    - chunked的请求体原样以chunked转发，chunked的响应体解码后重新分块发给客户端
+    - 逐跳的请求头和响应头不转发，请求加上X-Forwarded-For、X-Forwarded-Proto
+    - 还没有收到响应时上游连接出错(例如复用的连接恰好被后端关闭)，换一个连接重发：
+      请求还没有发出任何字节，或者没有请求体且不是POST
+*/
+class proxy_handler : public request_handler {
+public:
+    static const long MAX_BODY = 1024L * 1024 * 1024;
+    static const int PIPE_SIZE = 256 * 1024;        // 管道容量，决定每次splice搬运的字节数
+    static const size_t HEAD_MAX = 16 * 1024;       // 上游响应头的上限
+    static const int MAX_ATTEMPTS = 3;              // 一个请求最多尝试的上游连接数
+    static upstream_table* m_upstreams;
+
+    static request_handler* create() { return new proxy_handler; }
+
+    proxy_handler();
+    ~proxy_handler();
+
+    long max_body_size() const { return MAX_BODY; }
+    bool on_begin(int method, const char* url, long content_length);
+    bool on_body(const char* data, size_t len);
+    bool wants_splice() const { return true; }
+    long splice_body(int sockfd, long max);
+    void on_complete(response& resp);
+    int wait_fd(uint32_t* events) const;
+    bool on_ready();
+
+    // 响应体的生产者调用
+    response_writer::producer::STATUS produce(response_writer& w);
+
+private:
+    /*
+        上游响应体的结束方式
+        BODY_NONE       :   没有响应体(HEAD、204、304、Content-Length为0)
+        BODY_LENGTH     :   Content-Length
+        BODY_CHUNKED    :   chunked编码
+        BODY_CLOSE      :   读到上游关闭为止
+    */
+    enum BODY_MODE { BODY_NONE, BODY_LENGTH, BODY_CHUNKED, BODY_CLOSE };
+    // 响应头的解析结果，HEAD_INFO是1xx临时响应，跳过后继续读
+    enum HEAD_RESULT { HEAD_OK, HEAD_INFO, HEAD_BAD };
+
+    void build_request(const char* url, long content_length);
+    bool connect_upstream();
+    bool send_pending();
+    bool retry();
+    int read_head();
+    HEAD_RESULT parse_head(response& resp);
+    response_writer::producer::STATUS take_body(const char* data, size_t len, response_writer& w);
+    bool open_pipe();
+    void finish(bool keep);
+    void bad_gateway(response& resp);
+
+private:
+    upstream_group* m_group;
+    upstream_server* m_server;
+    int m_fd;                   // 上游连接
+    bool m_reused;              // 连接来自连接池
+    int m_attempts;
+    bool m_failed;              // 上游出错，请求体读完后回应502
+    uint32_t m_wait_events;     // 不为0时在等待上游fd上的这些事件
+    int m_pipe[2];
+
+    int m_method;
+    bool m_has_body;
+    bool m_chunked_body;
+    bool m_body_done;           // chunked请求体的结束块已经放入待发送的数据
+    std::string m_head;         // 转发的请求行和请求头，重试时重新发送
+    std::string m_out;          // 待写给上游的请求数据
+    size_t m_out_pos;
+    size_t m_piped;             // 管道中还没有写给上游的请求体字节数
+    size_t m_sent;              // 已经写给上游的字节数
+
+    std::string m_in;           // 从上游读到的响应头，以及和它一起读到的响应体
+    size_t m_head_len;
+    std::string m_reason;
+    std::string m_resp_headers; // 转发给客户端的响应头
+    BODY_MODE m_body_mode;
+    long m_remaining;           // Content-Length响应体还没有读到的字节数
+    bool m_keep;                // 响应结束后上游连接可以复用
+    bool m_splice_resp;         // 响应体经过管道splice给客户端
+    chunked_decoder m_decoder;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef STATIC_HANDLER_H
+#define STATIC_HANDLER_H
+
+#include "../http/http_conn.h"
+#include "../http/request_handler.h"
+
+// 静态文件：先查资源包，没有命中时把url映射为doc_root下的文件，挂在路由表的"/*"上，HEAD共用这个处理器。
+// 连接复用同一个对象，keep-alive连接上的静态请求不分配内存
+class static_handler : public request_handler {
+public:
+    static const long MAX_BODY = 64 * 1024;     // GET请求带的请求体被读取后丢弃
+
+    static request_handler* create() { return new static_handler; }
+
+    static_handler() : m_url(NULL) {}
+
+    long max_body_size() const { return MAX_BODY; }
+
+    bool on_begin(int method, const char* url, long content_length) {
+        m_url = url;
+        return true;
+    }
+
+    bool on_body(const char* data, size_t len) { return true; }
+
+    bool serves_h2() const { return true; }
+
+    bool recycle() {
+        m_url = NULL;
+        return true;
+    }
+
+    void on_complete(response& resp) {
+        if (http_conn::serve_asset(m_url, m_accept_encoding, header(H_IF_NONE_MATCH), resp)) {
+            return;
+        }
+        http_conn::HTTP_CODE code = http_conn::serve_file(m_url, m_accept_encoding, resp);
+        if (code != http_conn::FILE_REQUEST && code != http_conn::PARKED_REQUEST) {
+            // 错误页面是静态字符串，作为共享数据发送，不拷贝
+            const char* form;
+            resp.status = http_conn::error_page(code, &resp.title, &form);
+            resp.content_type = "text/html";
+            resp.shared_data = form;
+            resp.shared_len = strlen(form);
+        }
+    }
+
+private:
+    const char* m_url;
+};
+
+#endif
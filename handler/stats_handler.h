@@ -0,0 +1,56 @@
+#ifndef STATS_HANDLER_H
+#define STATS_HANDLER_H
+
+#include <stdio.h>
+#include "../http/http_conn.h"
+#include "../http/request_handler.h"
+
+// 服务器的计数器：合计(包括已经退出的工作进程)加上每个工作进程一行，读共享内存不加锁
+class stats_handler : public request_handler {
+public:
+    static request_handler* create() { return new stats_handler; }
+
+    bool on_body(const char* data, size_t len) { return true; }
+
+    bool serves_h2() const { return true; }
+
+    void on_complete(response& resp) {
+        const server_stats* stats = http_conn::m_server_stats;
+        resp.content_type = "text/plain";
+        if (!stats) {
+            resp.status = 404;
+            resp.title = "Not Found";
+            return;
+        }
+        uint64_t accepted = stats->retired.accepted.load(std::memory_order_relaxed);
+        uint64_t responses = stats->retired.responses.load(std::memory_order_relaxed);
+        uint64_t bytes = stats->retired.bytes_sent.load(std::memory_order_relaxed);
+        int64_t active = 0;
+        std::string workers;
+        char line[256];
+        for (int i = 0; i < server_stats::MAX_WORKERS; ++i) {
+            const worker_stats& w = stats->workers[i];
+            int pid = w.pid.load(std::memory_order_relaxed);
+            if (pid == 0) {
+                continue;
+            }
+            accepted += w.accepted.load(std::memory_order_relaxed);
+            active += w.active.load(std::memory_order_relaxed);
+            responses += w.responses.load(std::memory_order_relaxed);
+            bytes += w.bytes_sent.load(std::memory_order_relaxed);
+            snprintf(line, sizeof(line), "worker %d pid=%d generation=%llu active=%lld responses=%llu\n", i, pid,
+                     (unsigned long long)w.generation.load(std::memory_order_relaxed),
+                     (long long)w.active.load(std::memory_order_relaxed),
+                     (unsigned long long)w.responses.load(std::memory_order_relaxed));
+            workers += line;
+        }
+        snprintf(line, sizeof(line), "generation %llu\nrestarts %llu\naccepted %llu\nactive %lld\nresponses %llu\nbytes_sent %llu\n",
+                 (unsigned long long)stats->generation.load(std::memory_order_relaxed),
+                 (unsigned long long)stats->restarts.load(std::memory_order_relaxed),
+                 (unsigned long long)accepted, (long long)active, (unsigned long long)responses, (unsigned long long)bytes);
+        resp.body = line;
+        resp.body += workers;
+    }
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef UPLOAD_HANDLER_H
+#define UPLOAD_HANDLER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "../http/request_handler.h"
+#include "../http/http_conn.h"
+
+extern const char* doc_root;
+
+/*
+    PUT上传：请求体写入目标目录下的临时文件，接收完整后rename到doc_root + url
+    Content-Length请求体用splice经过管道从socket直接搬进文件，数据不进入用户态；
+    中途失败或连接关闭时删除临时文件，目标文件要么是旧内容要么是完整的新内容
+*/
+class upload_handler : public request_handler {
+public:
+    static const long MAX_BODY = 32L * 1024 * 1024 * 1024;    // 单个文件的上限
+    static const int PIPE_SIZE = 1024 * 1024;                 // 管道容量，决定每次splice搬运的字节数
+    static const long PREALLOC_STEP = 8L * 1024 * 1024;       // 每次预分配的磁盘空间
+
+    static request_handler* create() { return new upload_handler; }
+
+    upload_handler() : m_fd(-1), m_url(NULL), m_length(0), m_reserved(0), m_written(0) {
+        m_pipe[0] = m_pipe[1] = -1;
+        m_tmp[0] = m_path[0] = '\0';
+    }
+    ~upload_handler() {
+        if (m_fd != -1) {
+            close(m_fd);
+            unlink(m_tmp);
+        }
+        if (m_pipe[0] != -1) {
+            close(m_pipe[0]);
+            close(m_pipe[1]);
+        }
+    }
+
+    long max_body_size() const { return MAX_BODY; }
+
+    bool on_begin(int method, const char* url, long content_length) {
+        m_url = url;
+        // 不允许跳出doc_root，也不允许写目录
+        size_t len = strlen(url);
+        if (len < 2 || url[len - 1] == '/' || strstr(url, "/../") ||
+            (len >= 3 && strcmp(url + len - 3, "/..") == 0)) {
+            return false;
+        }
+        if (snprintf(m_path, sizeof(m_path), "%s%s", doc_root, url) >= (int)sizeof(m_path) ||
+            snprintf(m_tmp, sizeof(m_tmp), "%s.upload.XXXXXX", m_path) >= (int)sizeof(m_tmp)) {
+            return false;
+        }
+        // 临时文件和目标在同一目录，rename是原子的
+        m_fd = mkostemp(m_tmp, O_CLOEXEC);
+        if (m_fd == -1) {
+            return false;
+        }
+        fchmod(m_fd, 0644);
+        // Content-Length由客户端声明，不能据此一次性占满磁盘，随写入分段预分配
+        m_length = content_length > 0 ? content_length : 0;
+        m_reserved = m_written = 0;
+        if (pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+            m_pipe[0] = m_pipe[1] = -1;
+            return false;
+        }
+        fcntl(m_pipe[1], F_SETPIPE_SZ, PIPE_SIZE);
+        return true;
+    }
+
+    // 和请求头一起到达的那部分请求体
+    bool on_body(const char* data, size_t len) {
+        reserve(len);
+        while (len > 0) {
+            ssize_t n = write(m_fd, data, len);
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            len -= n;
+            m_written += n;
+        }
+        return true;
+    }
+
+    bool wants_splice() const { return true; }
+
+    long splice_body(int sockfd, long max) {
+        if (max > PIPE_SIZE) {
+            max = PIPE_SIZE;
+        }
+        ssize_t moved = splice(sockfd, NULL, m_pipe[1], NULL, max, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved <= 0) {
+            return moved;
+        }
+        // 管道里的数据全部写进文件，管道在两次调用之间总是空的
+        reserve(moved);
+        ssize_t left = moved;
+        while (left > 0) {
+            ssize_t n = splice(m_pipe[0], NULL, m_fd, NULL, left, SPLICE_F_MOVE);
+            if (n <= 0) {
+                errno = EIO;
+                return -1;
+            }
+            left -= n;
+        }
+        m_written += moved;
+        return moved;
+    }
+
+    void on_complete(response& resp) {
+        // 预分配的空间按实际写入的长度截断
+        off_t size = lseek(m_fd, 0, SEEK_CUR);
+        ftruncate(m_fd, size);
+        struct stat st;
+        bool existed = stat(m_path, &st) == 0;
+        int ret = close(m_fd);
+        m_fd = -1;
+        if (ret != 0 || rename(m_tmp, m_path) != 0) {
+            unlink(m_tmp);
+            resp.status = 500;
+            resp.title = "Internal Error";
+            resp.body = "Failed to store the uploaded file.\n";
+            return;
+        }
+        http_conn::file_created(m_url);
+        resp.status = existed ? 200 : 201;
+        resp.title = existed ? "OK" : "Created";
+        resp.content_type = "text/plain";
+        resp.body = existed ? "Updated\n" : "Created\n";
+    }
+
+private:
+    // 即将写入len字节，已预分配的空间不够时再向后预分配一段，不超过Content-Length
+    void reserve(long len) {
+        if (m_written + len <= m_reserved || m_reserved >= m_length) {
+            return;
+        }
+        long end = m_written + len + PREALLOC_STEP;
+        if (end > m_length) {
+            end = m_length;
+        }
+        posix_fallocate(m_fd, m_reserved, end - m_reserved);
+        m_reserved = end;
+    }
+
+    int m_fd;                   // 临时文件
+    int m_pipe[2];
+    const char* m_url;
+    char m_path[PATH_MAX];
+    char m_tmp[PATH_MAX];
+    long m_length;              // 声明的Content-Length
+    long m_reserved;            // 已预分配到的偏移
+    long m_written;             // 已写入的字节数
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "asset_bundle.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+std::shared_ptr<asset_bundle> asset_bundle::open(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return std::shared_ptr<asset_bundle>();
+    }
+    std::shared_ptr<asset_bundle> bundle(new asset_bundle);
+    if (fstat(fd, &bundle->m_stat) < 0 || bundle->m_stat.st_size < (off_t)sizeof(bundle_header)) {
+        close(fd);
+        printf("asset bundle %s: too small\n", path);
+        return std::shared_ptr<asset_bundle>();
+    }
+    bundle->m_size = bundle->m_stat.st_size;
+    void* map = mmap(NULL, bundle->m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return std::shared_ptr<asset_bundle>();
+    }
+    bundle->m_base = (char*)map;
+    bundle->m_header = (const bundle_header*)map;
+    if (!bundle->validate()) {
+        printf("asset bundle %s: bad format\n", path);
+        return std::shared_ptr<asset_bundle>();
+    }
+    bundle->m_slots = (const uint32_t*)(bundle->m_base + bundle->m_header->slots_offset);
+    bundle->m_entries = (const bundle_entry*)(bundle->m_base + bundle->m_header->entries_offset);
+    // 索引会在每次请求时访问，提前读入
+    madvise(bundle->m_base, bundle->m_header->entries_offset + bundle->m_header->entry_count * sizeof(bundle_entry),
+            MADV_WILLNEED);
+    return bundle;
+}
+
+asset_bundle::~asset_bundle() {
+    if (m_base) {
+        munmap(m_base, m_size);
+    }
+}
+
+bool asset_bundle::valid_span(const bundle_span& span, bool string) const {
+    if (span.offset > m_size || span.length > m_size - span.offset) {
+        return false;
+    }
+    // 字符串必须以'\0'结尾，可以直接作为C字符串使用
+    return !string || (span.length < m_size - span.offset && m_base[span.offset + span.length] == '\0');
+}
+
+// 校验一次所有的偏移，之后查找和发送时不再检查边界
+bool asset_bundle::validate() const {
+    const bundle_header* h = m_header;
+    if (memcmp(h->magic, BUNDLE_MAGIC, sizeof(h->magic)) != 0 || h->version != BUNDLE_VERSION ||
+        h->file_size != m_size || h->slot_count == 0 || (h->slot_count & (h->slot_count - 1)) != 0 ||
+        h->entry_count >= h->slot_count) {
+        return false;
+    }
+    bundle_span slots = { h->slots_offset, (uint64_t)h->slot_count * sizeof(uint32_t) };
+    bundle_span entries = { h->entries_offset, (uint64_t)h->entry_count * sizeof(bundle_entry) };
+    if (!valid_span(slots, false) || !valid_span(entries, false) ||
+        h->slots_offset % sizeof(uint32_t) != 0 || h->entries_offset % sizeof(uint64_t) != 0) {
+        return false;
+    }
+    const uint32_t* slot = (const uint32_t*)(m_base + h->slots_offset);
+    for (uint32_t i = 0; i < h->slot_count; ++i) {
+        if (slot[i] > h->entry_count) {
+            return false;
+        }
+    }
+    const bundle_entry* e = (const bundle_entry*)(m_base + h->entries_offset);
+    for (uint32_t i = 0; i < h->entry_count; ++i) {
+        if (!valid_span(e[i].path, true) || !valid_span(e[i].content_type, true)) {
+            return false;
+        }
+        for (int v = 0; v < VARIANT_COUNT; ++v) {
+            if (!valid_span(e[i].body[v], false) || !valid_span(e[i].etag[v], true) ||
+                !valid_span(e[i].headers[v], true)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+const bundle_entry* asset_bundle::find(const char* path, size_t len) const {
+    uint64_t h = bundle_hash(path, len);
+    uint32_t mask = m_header->slot_count - 1;
+    // 装载率低于1，总能遇到空槽
+    for (uint32_t i = h & mask; ; i = (i + 1) & mask) {
+        uint32_t slot = m_slots[i];
+        if (slot == 0) {
+            return NULL;
+        }
+        const bundle_entry* e = &m_entries[slot - 1];
+        if (e->hash == h && e->path.length == len && memcmp(at(e->path), path, len) == 0) {
+            return e;
+        }
+    }
+}
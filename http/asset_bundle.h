@@ -0,0 +1,46 @@
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <memory>
+#include "asset_format.h"
+
+/*
+    mmap的静态资源包，格式见asset_format.h
+    - 打开时整体映射并校验所有偏移，之后的查找只访问映射的内存，不再有stat、open、mmap
+    - 响应体直接指向映射的内存，发送队列通过shared_ptr持有资源包，
+      新版本替换旧版本后，旧的映射在最后一个引用它的响应发送完之后才解除
+*/
+class asset_bundle {
+public:
+    // 映射并校验资源包，失败时返回空指针
+    static std::shared_ptr<asset_bundle> open(const char* path);
+    ~asset_bundle();
+
+    // 按规范化的url路径查找，不存在时返回NULL
+    const bundle_entry* find(const char* path, size_t len) const;
+    const char* at(const bundle_span& span) const { return m_base + span.offset; }
+    size_t entry_count() const { return m_header->entry_count; }
+
+    // 文件是否还是打开时的那一个，替换或修改后需要重新打开
+    bool same_file(const struct stat& st) const {
+        return st.st_dev == m_stat.st_dev && st.st_ino == m_stat.st_ino &&
+               st.st_mtim.tv_sec == m_stat.st_mtim.tv_sec && st.st_mtim.tv_nsec == m_stat.st_mtim.tv_nsec;
+    }
+
+private:
+    asset_bundle() : m_base(NULL), m_size(0), m_header(NULL), m_slots(NULL), m_entries(NULL) {}
+    bool validate() const;
+    bool valid_span(const bundle_span& span, bool string) const;
+
+private:
+    char* m_base;
+    size_t m_size;
+    const bundle_header* m_header;
+    const uint32_t* m_slots;
+    const bundle_entry* m_entries;
+    struct stat m_stat;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef ASSET_FORMAT_H
+#define ASSET_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    静态资源包的文件格式，由tools/pack_assets生成，服务器整体mmap后直接使用
+    [bundle_header][槽位数组][bundle_entry数组][字符串区][页对齐的内容...]
+    - 所有偏移都相对于文件开头，整数按本机字节序，只在同一种机器上生成和使用
+    - 槽位是按路径哈希开放定址(线性探测)的表，值为条目下标+1，0表示空槽，槽位数是2的幂
+    - 字符串(路径、类型、校验值、响应头)后面都跟着'\0'，长度不含'\0'
+    - 每个条目的各个版本(原文、gzip、br)都从页边界开始
+*/
+static const char BUNDLE_MAGIC[8] = { 'W', 'S', 'A', 'S', 'S', 'E', 'T', 'S' };
+static const uint32_t BUNDLE_VERSION = 1;
+static const uint64_t BUNDLE_ALIGN = 4096;
+
+// 同一个资源的不同编码，下标即版本
+enum BUNDLE_VARIANT { VARIANT_IDENTITY = 0, VARIANT_GZIP, VARIANT_BR, VARIANT_COUNT };
+
+struct bundle_span {
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct bundle_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t slot_count;
+    uint32_t reserved;
+    uint64_t slots_offset;          // uint32_t[slot_count]
+    uint64_t entries_offset;        // bundle_entry[entry_count]
+    uint64_t file_size;
+};
+
+struct bundle_entry {
+    uint64_t hash;                          // 路径的bundle_hash
+    bundle_span path;                       // 规范化的url路径，以'/'开头
+    bundle_span content_type;
+    uint32_t compressible;                  // 内容随Accept-Encoding变化
+    uint32_t reserved;
+    // 原文总是存在；其他版本length为0表示没有
+    bundle_span body[VARIANT_COUNT];
+    bundle_span etag[VARIANT_COUNT];        // 带引号的强校验值，不同编码的校验值不同
+    // HTTP/1.1的实体头：Content-Type、Content-Length、Content-Encoding、Vary、ETag，每行以CRLF结尾
+    bundle_span headers[VARIANT_COUNT];
+};
+
+// 64位FNV-1a
+inline uint64_t bundle_hash(const char* s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <vector>
+#include <atomic>
+#include "../pthreadpool/lcoker.h"
+
+/*
+    固定大小内存块的池，请求体等大块数据只在传输期间借用一块，用完归还
+    空闲块最多保留max_free个，多余的直接释放
+    启动时可以用reserve预先分配一批块，放在一段大页映射中，这些块归还时总是回到空闲列表
+*/
+class buffer_pool {
+public:
+    static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+
+    buffer_pool(size_t block_size, int max_free)
+        : m_block_size(block_size), m_max_free(max_free), m_arena(NULL), m_arena_len(0), m_in_use(0) {}
+    ~buffer_pool() {
+        for (size_t i = 0; i < m_free.size(); ++i) {
+            if (!in_arena(m_free[i])) {
+                free(m_free[i]);
+            }
+        }
+        if (m_arena) {
+            munmap(m_arena, m_arena_len);
+        }
+    }
+
+    size_t block_size() const { return m_block_size; }
+    // 借出还没有归还的块数
+    long in_use() const { return m_in_use.load(std::memory_order_relaxed); }
+
+    // 预先分配count块并立即建立页表，优先使用hugetlbfs大页，不可用时用普通映射并建议透明大页；
+    // lock为true时锁定在内存中(受RLIMIT_MEMLOCK限制，失败时不锁定)。返回锁定的字节数
+    size_t reserve(int count, bool lock) {
+        if (m_arena || count <= 0) {
+            return 0;
+        }
+        size_t len = (m_block_size * count + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        void* arena = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (arena == MAP_FAILED) {
+            arena = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (arena == MAP_FAILED) {
+                return 0;
+            }
+            madvise(arena, len, MADV_HUGEPAGE);
+            madvise(arena, len, MADV_WILLNEED);
+        }
+        bool locked = lock && mlock(arena, len) == 0;
+        m_lock.lock();
+        m_arena = (char*)arena;
+        m_arena_len = len;
+        for (size_t off = 0; off + m_block_size <= len; off += m_block_size) {
+            m_free.push_back(m_arena + off);
+        }
+        m_lock.unlock();
+        return locked ? len : 0;
+    }
+
+    // 取一块，内存不足时返回NULL
+    char* acquire() {
+        m_lock.lock();
+        if (!m_free.empty()) {
+            char* block = m_free.back();
+            m_free.pop_back();
+            m_lock.unlock();
+            m_in_use.fetch_add(1, std::memory_order_relaxed);
+            return block;
+        }
+        m_lock.unlock();
+        char* block = (char*)malloc(m_block_size);
+        if (block) {
+            m_in_use.fetch_add(1, std::memory_order_relaxed);
+        }
+        return block;
+    }
+
+    void release(char* block) {
+        if (!block) {
+            return;
+        }
+        m_in_use.fetch_sub(1, std::memory_order_relaxed);
+        m_lock.lock();
+        if (in_arena(block) || (int)m_free.size() < m_max_free) {
+            m_free.push_back(block);
+            block = NULL;
+        }
+        m_lock.unlock();
+        free(block);
+    }
+
+private:
+    bool in_arena(const char* block) const { return block >= m_arena && block < m_arena + m_arena_len; }
+
+private:
+    size_t m_block_size;
+    int m_max_free;
+    std::vector<char*> m_free;
+    char* m_arena;              // 预分配的块所在的映射
+    size_t m_arena_len;
+    std::atomic<long> m_in_use;
+    locker m_lock;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef CHUNKED_DECODER_H
+#define CHUNKED_DECODER_H
+
+#include <stddef.h>
+
+/*
+    Transfer-Encoding: chunked请求体的增量解码器，数据可以在任意位置被切开
+    块扩展和结尾的trailer都被忽略
+*/
+class chunked_decoder {
+public:
+    /*
+        DATA        :   解出一段数据
+        NEED_MORE   :   输入已经用完，需要更多数据
+        DONE        :   遇到结束块和结尾的空行
+        BAD         :   格式错误
+    */
+    enum RESULT { DATA, NEED_MORE, DONE, BAD };
+
+    chunked_decoder() { reset(); }
+    void reset() {
+        m_state = SIZE;
+        m_remaining = 0;
+        m_digits = 0;
+    }
+
+    // 从data开始解码，*used返回消耗的字节数；返回DATA时[*chunk, *chunk + *chunk_len)是一段请求体
+    RESULT decode(const char* data, size_t len, size_t* used, const char** chunk, size_t* chunk_len) {
+        size_t i = 0;
+        *chunk_len = 0;
+        while (i < len) {
+            char c = data[i];
+            switch (m_state) {
+                case SIZE:
+                {
+                    int v = hex(c);
+                    if (v >= 0) {
+                        // 块长度最多15位十六进制数，防止溢出
+                        if (++m_digits > 15) {
+                            return BAD;
+                        }
+                        m_remaining = m_remaining * 16 + v;
+                        ++i;
+                    } else if (m_digits == 0) {
+                        return BAD;
+                    } else if (c == ';' || c == ' ' || c == '\t') {
+                        m_state = EXT;
+                    } else if (c == '\r') {
+                        m_state = SIZE_LF;
+                        ++i;
+                    } else {
+                        return BAD;
+                    }
+                    break;
+                }
+                case EXT:
+                {
+                    if (c == '\r') {
+                        m_state = SIZE_LF;
+                    }
+                    ++i;
+                    break;
+                }
+                case SIZE_LF:
+                {
+                    if (c != '\n') {
+                        return BAD;
+                    }
+                    ++i;
+                    m_state = m_remaining == 0 ? TRAILER : BODY;
+                    break;
+                }
+                case BODY:
+                {
+                    size_t n = len - i;
+                    if ((unsigned long long)n > m_remaining) {
+                        n = m_remaining;
+                    }
+                    *chunk = data + i;
+                    *chunk_len = n;
+                    m_remaining -= n;
+                    i += n;
+                    if (m_remaining == 0) {
+                        m_state = BODY_CR;
+                    }
+                    *used = i;
+                    return DATA;
+                }
+                case BODY_CR:
+                {
+                    if (c != '\r') {
+                        return BAD;
+                    }
+                    m_state = BODY_LF;
+                    ++i;
+                    break;
+                }
+                case BODY_LF:
+                {
+                    if (c != '\n') {
+                        return BAD;
+                    }
+                    m_state = SIZE;
+                    m_digits = 0;
+                    ++i;
+                    break;
+                }
+                case TRAILER:
+                {
+                    m_state = c == '\r' ? END_LF : TRAILER_LINE;
+                    ++i;
+                    break;
+                }
+                case TRAILER_LINE:
+                {
+                    if (c == '\n') {
+                        m_state = TRAILER;
+                    }
+                    ++i;
+                    break;
+                }
+                case END_LF:
+                {
+                    if (c != '\n') {
+                        return BAD;
+                    }
+                    m_state = FINISHED;
+                    *used = i + 1;
+                    return DONE;
+                }
+                default:
+                {
+                    *used = i;
+                    return DONE;
+                }
+            }
+        }
+        *used = i;
+        return NEED_MORE;
+    }
+
+private:
+    static int hex(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+private:
+    enum STATE { SIZE, EXT, SIZE_LF, BODY, BODY_CR, BODY_LF, TRAILER, TRAILER_LINE, END_LF, FINISHED };
+    STATE m_state;
+    unsigned long long m_remaining;     // 当前块还没有收到的字节数
+    int m_digits;
+};
+
+#endif
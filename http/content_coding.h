@@ -0,0 +1,59 @@
+#ifndef CONTENT_CODING_H
+#define CONTENT_CODING_H
+
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+
+// 客户端可以接受的内容编码，按位组合
+enum CONTENT_CODING { CODING_GZIP = 1, CODING_BR = 2 };
+
+/*
+    解析Accept-Encoding，例如"gzip, deflate, br;q=0.8"
+    - q=0表示明确拒绝该编码
+    - "*"表示接受所有没有单独列出的编码
+    - 不认识的编码忽略，identity总是可以作为退路
+*/
+inline int parse_accept_encoding(const char* text) {
+    int accepted = 0;
+    int listed = 0;
+    bool star = false;
+    const char* p = text;
+    while (*p) {
+        p += strspn(p, " \t,");
+        if (!*p) {
+            break;
+        }
+        const char* name = p;
+        int name_len = strcspn(p, " \t;,");
+        p += name_len;
+        // 只关心q参数，其他参数跳过
+        bool refused = false;
+        while (*p && *p != ',') {
+            p += strspn(p, " \t;");
+            if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                refused = strtod(p + 2, NULL) <= 0.0;
+            }
+            p += strcspn(p, ";,");
+        }
+        int bit = 0;
+        if (name_len == 4 && strncasecmp(name, "gzip", 4) == 0) {
+            bit = CODING_GZIP;
+        } else if (name_len == 2 && strncasecmp(name, "br", 2) == 0) {
+            bit = CODING_BR;
+        } else if (name_len == 1 && name[0] == '*') {
+            star = !refused;
+            continue;
+        }
+        listed |= bit;
+        if (!refused) {
+            accepted |= bit;
+        }
+    }
+    if (star) {
+        accepted |= (CODING_GZIP | CODING_BR) & ~listed;
+    }
+    return accepted;
+}
+
+#endif
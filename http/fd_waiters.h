@@ -0,0 +1,63 @@
+#ifndef FD_WAITERS_H
+#define FD_WAITERS_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <atomic>
+
+/*
+    处理器等待的外部fd(上游连接等)：fd以EPOLLONESHOT注册在主线程的epoll中，key就是fd本身(代数为0)，
+    等待它的连接句柄按fd记在表中。主线程收到事件后取出句柄，像wake_queue一样把连接重新交给线程池，
+    已经关闭的连接的句柄代数不匹配，自然被丢弃
+    - 一个fd同一时刻只有一个等待者，fd在使用期间只属于一个请求
+    - 关闭fd或把它放回连接池之前必须forget，事件不会再唤醒旧的等待者
+*/
+class fd_waiters {
+public:
+    fd_waiters() {
+        struct rlimit rl;
+        m_size = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY ? rl.rlim_cur : 65536;
+        m_owners = new std::atomic<uint64_t>[m_size];
+        for (int i = 0; i < m_size; ++i) {
+            m_owners[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    ~fd_waiters() { delete[] m_owners; }
+
+    // 任意线程调用；登记成功之后连接随时可能在另一个线程中被处理，调用者不能再访问连接
+    bool wait(int epollfd, int fd, uint32_t events, uint64_t handle) {
+        if (fd < 0 || fd >= m_size) {
+            return false;
+        }
+        m_owners[fd].store(handle);
+        epoll_event event;
+        event.data.u64 = fd;
+        event.events = events | EPOLLRDHUP | EPOLLONESHOT;
+        if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) < 0 &&
+            (errno != ENOENT || epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) < 0)) {
+            m_owners[fd].store(0);
+            return false;
+        }
+        return true;
+    }
+
+    // 主线程收到fd上的事件时调用，返回等待者的句柄，没有等待者时返回0
+    uint64_t take(int fd) {
+        return fd >= 0 && fd < m_size ? m_owners[fd].exchange(0) : 0;
+    }
+
+    void forget(int epollfd, int fd) {
+        if (fd >= 0 && fd < m_size) {
+            m_owners[fd].store(0);
+            epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+        }
+    }
+
+private:
+    int m_size;
+    std::atomic<uint64_t>* m_owners;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "file_cache.h"
+#include <algorithm>
+
+bool file_cache::same_file(const struct stat& a, const struct stat& b) {
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size && a.st_mode == b.st_mode &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+void file_cache::erase(lru_list::iterator it) {
+    m_bytes -= it->file->size();
+    m_index.erase(it->url);
+    m_lru.erase(it);
+}
+
+file_cache::file_ptr file_cache::find(const char* url, size_t len) {
+    std::string key(url, len);
+    time_t now = time(NULL);
+    m_lock.lock();
+    std::map<std::string, lru_list::iterator>::iterator found = m_index.find(key);
+    if (found == m_index.end()) {
+        m_lock.unlock();
+        return file_ptr();
+    }
+    lru_list::iterator it = found->second;
+    m_lru.splice(m_lru.begin(), m_lru, it);
+    ++it->hits;
+    file_ptr file = it->file;
+    bool stale = m_revalidate && now - it->checked >= REVALIDATE_INTERVAL;
+    if (stale) {
+        it->checked = now;              // 同一时刻只需要一个线程去检查
+    }
+    m_lock.unlock();
+
+    if (stale) {
+        struct stat st;
+        if (stat(file->real_file.c_str(), &st) < 0 || !same_file(st, file->st)) {
+            invalidate(url, len, false);
+            return file_ptr();
+        }
+    }
+    return file;
+}
+
+void file_cache::insert(const char* url, size_t len, const file_ptr& file) {
+    if (file->size() > m_max_bytes / 4) {
+        return;
+    }
+    entry e;
+    e.url.assign(url, len);
+    e.file = file;
+    e.checked = time(NULL);
+    e.hits = 0;
+    m_lock.lock();
+    std::map<std::string, lru_list::iterator>::iterator found = m_index.find(e.url);
+    if (found != m_index.end()) {
+        e.hits = found->second->hits;   // 文件被修改后仍然是热点
+        erase(found->second);
+    }
+    while (!m_lru.empty() && (m_bytes + file->size() > m_max_bytes || m_lru.size() >= m_max_entries)) {
+        erase(--m_lru.end());
+    }
+    m_lru.push_front(e);
+    m_index[e.url] = m_lru.begin();
+    m_bytes += file->size();
+    m_lock.unlock();
+}
+
+void file_cache::invalidate(const char* url, size_t len, bool tree) {
+    std::string key(url, len);
+    m_lock.lock();
+    std::map<std::string, lru_list::iterator>::iterator it = m_index.find(key);
+    if (it != m_index.end()) {
+        erase(it->second);
+    }
+    if (tree) {
+        // 子树中的路径都以"url/"开头，在有序的索引中是连续的一段
+        std::string prefix = (!key.empty() && key[key.size() - 1] == '/') ? key : key + "/";
+        it = m_index.lower_bound(prefix);
+        while (it != m_index.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+            lru_list::iterator victim = it->second;
+            ++it;
+            erase(victim);
+        }
+    }
+    m_lock.unlock();
+}
+
+void file_cache::clear() {
+    m_lock.lock();
+    m_lru.clear();
+    m_index.clear();
+    m_bytes = 0;
+    m_lock.unlock();
+}
+
+static bool hotter(const std::pair<uint64_t, std::string>& a, const std::pair<uint64_t, std::string>& b) {
+    return a.first > b.first;
+}
+
+void file_cache::hottest(size_t n, std::vector<std::string>* urls) {
+    std::vector<std::pair<uint64_t, std::string> > all;
+    m_lock.lock();
+    all.reserve(m_lru.size());
+    for (lru_list::iterator it = m_lru.begin(); it != m_lru.end(); ++it) {
+        all.push_back(std::make_pair(it->hits, it->url));
+    }
+    m_lock.unlock();
+    // 命中次数相同时保持LRU的顺序，最近使用的在前
+    std::stable_sort(all.begin(), all.end(), hotter);
+    urls->clear();
+    for (size_t i = 0; i < all.size() && i < n; ++i) {
+        urls->push_back(all[i].second);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stddef.h>
+#include <time.h>
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../pthreadpool/lcoker.h"
+
+// 打开过的静态文件：stat的结果和只读映射，最后一个引用释放时munmap
+struct cached_file {
+    cached_file(const char* path, const struct stat& file_stat, char* address)
+        : real_file(path), st(file_stat), data(address) {}
+    ~cached_file() {
+        if (data) {
+            munmap(data, st.st_size);
+        }
+    }
+    size_t size() const { return st.st_size; }
+
+    std::string real_file;
+    struct stat st;
+    char* data;             // 空文件为NULL
+};
+
+/*
+    静态文件的stat结果和映射，按规范化的url路径缓存，命中时不再stat、open、mmap
+    - 文件的变化由inotify通知(invalidate)，响应中持有的映射不受影响，发送完后才解除
+    - inotify不可用或监视数超出上限时改为定期重新验证：命中的记录超过REVALIDATE_INTERVAL秒没有检查过时stat一次
+    - 按映射的总字节数和记录数限制，超出时淘汰最久没有使用的文件
+    - 记录每个文件的命中次数，退出时据此保存热点列表，下次启动时预热
+*/
+class file_cache {
+public:
+    typedef std::shared_ptr<const cached_file> file_ptr;
+    static const int REVALIDATE_INTERVAL = 1;
+
+    file_cache(size_t max_bytes, size_t max_entries)
+        : m_bytes(0), m_max_bytes(max_bytes), m_max_entries(max_entries), m_revalidate(true) {}
+
+    file_ptr find(const char* url, size_t len);
+    // 超过总量的文件不缓存
+    void insert(const char* url, size_t len, const file_ptr& file);
+    // 删除url对应的记录，tree为true时同时删除url下的整棵子树
+    void invalidate(const char* url, size_t len, bool tree);
+    void clear();
+    // 命中次数最多的n个文件的url，从热到冷
+    void hottest(size_t n, std::vector<std::string>* urls);
+
+    // 所有目录都在inotify的监视中时关闭定期重新验证
+    void set_revalidate(bool on) { m_revalidate = on; }
+
+private:
+    struct entry {
+        std::string url;
+        file_ptr file;
+        time_t checked;         // 最近一次确认文件没有变化的时间
+        uint64_t hits;
+    };
+    typedef std::list<entry> lru_list;
+
+    static bool same_file(const struct stat& a, const struct stat& b);
+    void erase(lru_list::iterator it);
+
+private:
+    lru_list m_lru;                     // 队头是最近使用的文件
+    std::map<std::string, lru_list::iterator> m_index;
+    size_t m_bytes;
+    size_t m_max_bytes;
+    size_t m_max_entries;
+    volatile bool m_revalidate;
+    locker m_lock;
+};
+
+#endif
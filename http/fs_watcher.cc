@@ -0,0 +1,116 @@
+#include "fs_watcher.h"
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+static const uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+fs_watcher::~fs_watcher() {
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+bool fs_watcher::init(const char* root, change_callback callback) {
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        return false;
+    }
+    m_root = root;
+    m_callback = callback;
+    m_complete = true;
+    watch_tree("");
+    return true;
+}
+
+// 监视url目录和它下面的所有子目录
+void fs_watcher::watch_tree(const std::string& url) {
+    std::string dir = m_root + url;
+    int wd = inotify_add_watch(m_fd, dir.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            if (m_complete) {
+                printf("inotify watch limit reached at %s, falling back to revalidation\n", dir.c_str());
+            }
+            m_complete = false;
+        }
+        return;
+    }
+    m_dirs[wd] = url;
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        std::string child = url + "/" + ent->d_name;
+        struct stat st;
+        if (ent->d_type == DT_DIR ||
+            (ent->d_type == DT_UNKNOWN && stat((m_root + child).c_str(), &st) == 0 && S_ISDIR(st.st_mode))) {
+            watch_tree(child);
+        }
+    }
+    closedir(d);
+}
+
+// 目录被移走后，它和子目录上的监视跟着目录走，路径已经不对了，全部取消
+void fs_watcher::unwatch_tree(const std::string& url) {
+    std::string prefix = url + "/";
+    for (std::map<int, std::string>::iterator it = m_dirs.begin(); it != m_dirs.end(); ) {
+        if (it->second == url || it->second.compare(0, prefix.size(), prefix) == 0) {
+            inotify_rm_watch(m_fd, it->first);
+            m_dirs.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void fs_watcher::notify(const std::string& url, bool tree) {
+    const char* p = url.empty() ? "/" : url.c_str();
+    m_callback(p, strlen(p), tree);
+}
+
+void fs_watcher::dispatch() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t len = read(m_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            return;                     // EAGAIN：事件已经读完
+        }
+        for (char* p = buf; p < buf + len; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // 丢失了事件，无法知道哪些文件变了
+                notify("", true);
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                m_dirs.erase(ev->wd);   // 目录被删除，内核已经移除了监视
+                continue;
+            }
+            std::map<int, std::string>::iterator dir = m_dirs.find(ev->wd);
+            if (dir == m_dirs.end() || ev->len == 0) {
+                continue;
+            }
+            std::string url = dir->second + "/" + ev->name;
+            bool is_dir = ev->mask & IN_ISDIR;
+            if (is_dir && (ev->mask & IN_MOVED_FROM)) {
+                unwatch_tree(url);
+            }
+            if (is_dir && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+                watch_tree(url);
+            }
+            notify(url, is_dir);
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef FS_WATCHER_H
+#define FS_WATCHER_H
+
+#include <stddef.h>
+#include <map>
+#include <string>
+
+/*
+    用inotify递归监视一棵目录树，fd注册在主线程的epoll中，可读时调用dispatch
+    - 文件被修改、属性变化、创建、删除、移入移出时回调变化的url(相对于根目录，以'/'开头)
+    - 目录的创建、删除、移动按整棵子树回调；新出现的目录自动加入监视，移走的目录取消监视
+    - 事件队列溢出时按整棵树回调
+    - 监视数达到系统上限(fs.inotify.max_user_watches)时complete()变为false，
+      使用者应对没有监视到的部分改为定期重新验证
+*/
+class fs_watcher {
+public:
+    // tree为true表示url下的整棵子树都可能变化
+    typedef void (*change_callback)(const char* url, size_t len, bool tree);
+
+    fs_watcher() : m_fd(-1), m_complete(false), m_callback(NULL) {}
+    ~fs_watcher();
+
+    // 监视root下的所有目录，inotify不可用时返回false
+    bool init(const char* root, change_callback callback);
+    int fd() const { return m_fd; }
+    bool complete() const { return m_complete; }
+
+    // 读出并处理所有待处理的事件
+    void dispatch();
+
+private:
+    void watch_tree(const std::string& url);
+    void unwatch_tree(const std::string& url);
+    void notify(const std::string& url, bool tree);
+
+private:
+    int m_fd;
+    bool m_complete;                    // 所有目录都在监视中
+    std::string m_root;
+    std::map<int, std::string> m_dirs;  // 监视描述符 -> 目录的url，根目录为""
+    change_callback m_callback;
+};
+
+#endif
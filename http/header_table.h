@@ -0,0 +1,66 @@
+#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include "perfect_hash.h"
+
+/*
+    已知的请求头，解析后按ID放在固定大小的数组中，处理器按ID直接取值
+    HEADER_NAMES的顺序必须和HEADER_ID一致
+*/
+enum HEADER_ID {
+    H_ACCEPT = 0, H_ACCEPT_ENCODING, H_ACCEPT_LANGUAGE, H_AUTHORIZATION, H_CACHE_CONTROL,
+    H_CONNECTION, H_CONTENT_LENGTH, H_CONTENT_TYPE, H_COOKIE, H_EXPECT, H_HOST, H_HTTP2_SETTINGS,
+    H_IF_MODIFIED_SINCE, H_IF_NONE_MATCH, H_ORIGIN, H_RANGE, H_REFERER, H_TRANSFER_ENCODING,
+    H_UPGRADE, H_USER_AGENT, H_X_FORWARDED_FOR,
+    HEADER_COUNT
+};
+
+struct header_name {
+    const char* key;
+    HEADER_ID id;
+};
+
+static constexpr header_name HEADER_NAMES[] = {
+    { "Accept",             H_ACCEPT },
+    { "Accept-Encoding",    H_ACCEPT_ENCODING },
+    { "Accept-Language",    H_ACCEPT_LANGUAGE },
+    { "Authorization",      H_AUTHORIZATION },
+    { "Cache-Control",      H_CACHE_CONTROL },
+    { "Connection",         H_CONNECTION },
+    { "Content-Length",     H_CONTENT_LENGTH },
+    { "Content-Type",       H_CONTENT_TYPE },
+    { "Cookie",             H_COOKIE },
+    { "Expect",             H_EXPECT },
+    { "Host",               H_HOST },
+    { "HTTP2-Settings",     H_HTTP2_SETTINGS },
+    { "If-Modified-Since",  H_IF_MODIFIED_SINCE },
+    { "If-None-Match",      H_IF_NONE_MATCH },
+    { "Origin",             H_ORIGIN },
+    { "Range",              H_RANGE },
+    { "Referer",            H_REFERER },
+    { "Transfer-Encoding",  H_TRANSFER_ENCODING },
+    { "Upgrade",            H_UPGRADE },
+    { "User-Agent",         H_USER_AGENT },
+    { "X-Forwarded-For",    H_X_FORWARDED_FOR },
+};
+
+// 按顺序排列时下标即ID
+static constexpr bool header_ids_in_order(int i) {
+    return i >= (int)HEADER_COUNT || (HEADER_NAMES[i].id == i && header_ids_in_order(i + 1));
+}
+
+static_assert(sizeof(HEADER_NAMES) / sizeof(HEADER_NAMES[0]) == HEADER_COUNT, "HEADER_NAMES must list every HEADER_ID");
+static_assert(header_ids_in_order(0), "HEADER_NAMES must be in HEADER_ID order");
+
+static const int HEADER_BITS = 7;
+static constexpr uint32_t HEADER_SEED = ph_find_seed(HEADER_NAMES, HEADER_COUNT, HEADER_BITS);
+static_assert(HEADER_SEED != PH_NO_SEED, "no perfect hash seed for HEADER_NAMES, increase HEADER_BITS");
+
+// 请求头名字对应的ID，不认识的请求头返回HEADER_COUNT
+static inline HEADER_ID find_header(const char* name, size_t len) {
+    static const perfect_hash_table<header_name, HEADER_COUNT, HEADER_BITS, HEADER_SEED> table(HEADER_NAMES);
+    const header_name* h = table.find(name, len);
+    return h ? h->id : HEADER_COUNT;
+}
+
+#endif
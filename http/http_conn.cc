@@ -1,5 +1,7 @@
 #include "http_conn.h"
 #include "../timer/lst_timer.h"
+#include "../http2/h2_session.h"
+#include "../net/proxy_protocol.h"
 // 网站的根目录
 const char* doc_root = "/home/master/Desktop/WebServer/resources";
 // 定义HTTP响应的一些状态信息
@@ -10,11 +12,40 @@ const char* error_403_title = "Forbidden";
 const char* error_403_form = "You do not have permission to get file from this server.\n";
 const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
+const char* error_405_title = "Method Not Allowed";
+const char* error_405_form = "The requested method is not supported for this resource.\n";
+const char* error_413_title = "Payload Too Large";
+const char* error_413_form = "The request body is larger than the server is willing to process.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+const char* error_502_title = "Bad Gateway";
+const char* error_502_form = "The upstream server failed to answer the request.\n";
 
 int http_conn::m_epollfd = -1;      // 所有的socket上的事件都被注册到同意epollfd上
 int http_conn::m_user_count = 0;   // 统计已连接用户的数量
+ip_limiter* http_conn::m_limiter = NULL;
+int http_conn::m_max_conn = 65535;
+long http_conn::m_mem_budget = 256L * 1024 * 1024;
+int http_conn::m_tls_count = 0;
+wake_queue* http_conn::m_wake = NULL;
+prefetch_pool* http_conn::m_prefetch = NULL;
+server_stats* http_conn::m_server_stats = NULL;
+worker_stats* http_conn::m_stats = NULL;
+shm_stat_cache* http_conn::m_stat_cache = NULL;
+volatile bool http_conn::m_draining = false;
+fd_waiters* http_conn::m_fd_waiters = NULL;
+http_conn* http_conn::m_idle_head = NULL;
+http_conn* http_conn::m_idle_tail = NULL;
+locker http_conn::m_idle_lock;
+router http_conn::m_router;
+negative_cache http_conn::m_missing(MISSING_TTL);
+variant_cache http_conn::m_variants(variant_cache::DEFAULT_BUDGET);
+file_cache http_conn::m_files(FILE_CACHE_BYTES, FILE_CACHE_ENTRIES);
+single_flight http_conn::m_loads;
+std::shared_ptr<asset_bundle> http_conn::m_assets;
+std::string http_conn::m_assets_path;
+locker http_conn::m_assets_lock;
+buffer_pool http_conn::m_body_pool(BODY_BUFFER_SIZE, 256);
 static sort_timer_lst timer_lst;
 
 void setnonblocking(int fd) {
@@ -23,10 +54,10 @@ void setnonblocking(int fd) {
     fcntl(fd, F_SETFL, new_flag);
 }
 
-// 修改文件描述符到epoll中
-void addfd(int epollfd, int fd, bool one_shot) {
+// 修改文件描述符到epoll中，key为事件携带的标识：连接使用slot_map句柄，其他fd直接使用fd本身
+void addfd(int epollfd, int fd, bool one_shot, uint64_t key) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = key;
     event.events = EPOLLIN | EPOLLRDHUP;  // EPOLLRDHUP，当连接断开时，触发挂起，断开异常时
 
     if (one_shot) {                       // EPOLLONESHOT确保将缓冲区数据一次全部读取完成
@@ -44,65 +75,295 @@ void removefd(int epollfd, int fd) {
 }
 
 // 修改文件描述符(epoll)，重置文件描述符EPOLLONESHOT，当下一次读可用时，确保EPOLLIN事件被触发
-void modfd(int epollfd, int fd, int ev) {
+void modfd(int epollfd, int fd, int ev, uint64_t key) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = key;
     event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-void http_conn::init(int socketfd, sockaddr_in& addr) {
+void http_conn::init(int socketfd, const sock_addr& addr, uint64_t handle, bool counted) {
     m_socketfd = socketfd;
     m_saddr = addr;
+    m_counted = counted;
+    m_proxy_pending = false;
+    m_handle = handle;
+    m_ssl = NULL;
+    m_tls_ready = false;
+    m_ktls_tx = false;
+    m_ktls_rx = false;
     // 端口复用
 
     int reuse = 1;
     setsockopt(m_socketfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
     // 添加epoll对象中
-    addfd(m_epollfd, m_socketfd, true);
+    addfd(m_epollfd, m_socketfd, true, m_handle);
     ++m_user_count;       
+    if (m_stats) {
+        m_stats->accepted.fetch_add(1, std::memory_order_relaxed);
+        m_stats->active.fetch_add(1, std::memory_order_relaxed);
+    }
     //util_timer* timer = new util_timer;
     init();
+    // 新连接还没有发送任何数据，请求头的时限从accept开始计算
+    set_stage(STAGE_HEADER);
+}
+
+void http_conn::start_tls(SSL* ssl) {
+    // 握手计入请求头阶段的时限，握手不完成的连接和发送请求头过慢的连接一样被关闭
+    m_ssl = ssl;
+    m_tls_ready = false;
+    ++m_tls_count;
 }
 
 void http_conn::init() {
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
+    m_upgrade_h2c = false;
+    m_h2_settings = 0;
+    m_accept_encoding = 0;
+    for (int i = 0; i < HEADER_COUNT; ++i) {
+        m_headers[i] = str_view();
+    }
 
     m_method = GET;         // 默认请求方式为GET
     m_url = 0;              
+    m_header_start = 0;
+    m_header_end = 0;
     m_version = 0;
     m_content_length = 0;
+    m_chunked_body = false;
+    m_expect_continue = false;
+    release_handler();
+    m_response.release();
+    m_response = request_handler::response();
+    m_body_remaining = 0;
+    m_body_received = 0;
+    m_body_pool.release(m_body_buf);
+    m_body_buf = NULL;
+    m_body_len = 0;
+    m_parked = false;
+    m_prefetching = false;
+    m_prefetched = false;
+    m_handler_wait = WAIT_NONE;
     m_host = 0;
     m_start_line = 0;
     m_checked_index = 0;
     m_read_idx = 0;
-    m_write_idx = 0;
+    m_writer.reset();
+
+    // 缓冲区不再整体清零：读缓冲区每次recv后补'\0'
+    m_read_buf[0] = '\0';
+
+    set_stage(STAGE_IDLE);
+}
 
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, READ_BUFFER_SIZE);
-    bzero(m_read_file, FILENAME_LEN);
+void http_conn::set_stage(CONN_STAGE stage) {
+    m_stage = stage;
+    m_stage_start = time(NULL);
+    m_stage_bytes = 0;
+    if (stage == STAGE_IDLE) {
+        idle_enter();
+    } else {
+        idle_leave();
+    }
+}
+
+// 加入空闲链表尾部
+void http_conn::idle_enter() {
+    idle_leave();
+    m_idle_lock.lock();
+    m_idle = true;
+    m_idle_prev = m_idle_tail;
+    m_idle_next = NULL;
+    if (m_idle_tail) {
+        m_idle_tail->m_idle_next = this;
+    } else {
+        m_idle_head = this;
+    }
+    m_idle_tail = this;
+    m_idle_lock.unlock();
+}
+
+void http_conn::idle_leave() {
+    m_idle_lock.lock();
+    if (!m_idle) {
+        m_idle_lock.unlock();
+        return;
+    }
+    if (m_idle_prev) {
+        m_idle_prev->m_idle_next = m_idle_next;
+    } else {
+        m_idle_head = m_idle_next;
+    }
+    if (m_idle_next) {
+        m_idle_next->m_idle_prev = m_idle_prev;
+    } else {
+        m_idle_tail = m_idle_prev;
+    }
+    m_idle = false;
+    m_idle_prev = m_idle_next = NULL;
+    m_idle_lock.unlock();
+}
+
+http_conn* http_conn::idle_acquire() {
+    m_idle_lock.lock();
+    http_conn* oldest = m_idle_head;
+    // 只尝试加锁，不和持有连接、正在等m_idle_lock的工作线程互相等待
+    while (oldest && !oldest->try_own()) {
+        oldest = oldest->m_idle_next;
+    }
+    m_idle_lock.unlock();
+    return oldest;
+}
+
+bool http_conn::over_budget() {
+    long mem = (long)(m_user_count + 1) * (long)sizeof(http_conn) + m_body_pool.in_use() * BODY_BUFFER_SIZE +
+               (long)m_tls_count * TLS_MEMORY + h2_session::memory_total() + response_writer::owned_total();
+    return m_user_count >= m_max_conn || mem > m_mem_budget;
+}
+
+time_t http_conn::deadline() const {
+    switch (m_stage) {
+        case STAGE_HEADER:
+            return m_stage_start + HEADER_TIMEOUT;
+        case STAGE_BODY:
+            // 每收到BODY_MIN_RATE字节，截止时间延后1秒
+            return m_stage_start + BODY_TIMEOUT + m_stage_bytes / BODY_MIN_RATE;
+        case STAGE_WRITE:
+            return m_stage_start + WRITE_TIMEOUT;
+        case STAGE_UPSTREAM:
+            return m_stage_start + UPSTREAM_TIMEOUT;
+        default:
+        {
+            // 连接数超过预算的一半后，keep-alive空闲时间随占用率线性收缩
+            int timeout = KEEPALIVE_TIMEOUT;
+            int half = m_max_conn / 2;
+            if (half > 0 && m_user_count > half) {
+                timeout -= (long)(KEEPALIVE_TIMEOUT - KEEPALIVE_MIN_TIMEOUT) * (m_user_count - half) / half;
+                if (timeout < KEEPALIVE_MIN_TIMEOUT) {
+                    timeout = KEEPALIVE_MIN_TIMEOUT;
+                }
+            }
+            return m_stage_start + timeout;
+        }
+    }
 }
 
 // 关闭连接
 void http_conn::close_conn() {
     if (m_socketfd != -1) {
+        if (m_ssl) {
+            // 尽力发送close_notify，不等待对端回应
+            if (m_tls_ready) {
+                SSL_shutdown(m_ssl);
+            }
+            SSL_free(m_ssl);
+            m_ssl = NULL;
+            --m_tls_count;
+        }
         removefd(m_epollfd, m_socketfd);
         m_socketfd = -1;
+        delete m_h2;
+        m_h2 = NULL;
+        m_writer.reset();
+        m_response.release();
+        delete m_handler;
+        m_handler = NULL;
+        delete m_spare_handler;
+        m_spare_handler = NULL;
+        m_body_pool.release(m_body_buf);
+        m_body_buf = NULL;
+        m_handle = 0;           // 让还在队列中的任务失效
         --m_user_count;
+        if (m_stats) {
+            m_stats->active.fetch_sub(1, std::memory_order_relaxed);
+        }
+        idle_leave();
+        if (m_limiter && m_counted) {
+            m_limiter->on_close(m_saddr);
+        }
+        m_counted = false;
     }
 }
 
+bool http_conn::read_proxy() {
+    // 先窥视，只从socket中取走头部本身，之后的请求数据(或TLS握手)留给正常的读取
+    char buf[PROXY_V2_MAX];
+    ssize_t n = recv(m_socketfd, buf, sizeof(buf), MSG_PEEK);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return false;
+    }
+    size_t consumed = 0;
+    sock_addr client;
+    PROXY_PARSE ret = n < 0 ? PROXY_INCOMPLETE : parse_proxy_v2(buf, n, &consumed, &client);
+    if (ret == PROXY_INCOMPLETE) {
+        modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+        return true;
+    }
+    if (ret == PROXY_INVALID || recv(m_socketfd, buf, consumed, 0) != (ssize_t)consumed) {
+        return false;
+    }
+    m_proxy_pending = false;
+    if (client.len == 0) {
+        return true;                    // LOCAL命令，保留代理自己的地址
+    }
+    // 准入改按真实的客户端地址计算
+    if (m_limiter && m_counted) {
+        m_limiter->on_close(m_saddr);
+    }
+    m_saddr = client;
+    m_counted = false;
+    return !m_limiter || m_limiter->on_accept(m_saddr, &m_counted) == ip_limiter::ADMIT;
+}
+
+void http_conn::reject_overloaded() {
+    static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    if (!m_h2 && (!m_ssl || m_tls_ready) && m_writer.empty() && !m_prefetching) {
+        sock_send(busy, sizeof(busy) - 1);
+    }
+    shutdown(m_socketfd, SHUT_RDWR);
+    modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+}
+
 // 循环读取缓冲区，一次性读完
 bool http_conn::read() {
-    if (m_read_idx >= READ_BUFFER_SIZE) {
+    if (m_check_state == CHECK_STATE_CONTENT && splicing()) {
+        // 数据留在socket中，由工作线程splice
+        return true;
+    }
+    if (m_check_state == CHECK_STATE_CONTENT && m_handler) {
+        // 请求体读到借来的缓冲块中，由工作线程交给处理器后归还，读缓冲区中的请求头保持不变
+        if (!m_body_buf && !(m_body_buf = m_body_pool.acquire())) {
+            return false;
+        }
+        int start_len = m_body_len;
+        while (m_body_len < BODY_BUFFER_SIZE) {
+            int n = sock_recv(m_body_buf + m_body_len, BODY_BUFFER_SIZE - m_body_len);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                return false;
+            } else if (n == 0) {
+                return false;
+            }
+            m_body_len += n;
+        }
+        m_stage_bytes += m_body_len - start_len;
+        return true;
+    }
+
+    // 留出一个字节保存结尾的'\0'
+    if (m_read_idx >= READ_BUFFER_SIZE - 1) {
         return false;
     }
 
     int bytes_read = 0;
+    int start_idx = m_read_idx;
     while (true) {
-        bytes_read = recv(m_socketfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = sock_recv(m_read_buf + m_read_idx, READ_BUFFER_SIZE - 1 - m_read_idx);
         if (bytes_read == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 // 没有数据了
@@ -114,6 +375,20 @@ bool http_conn::read() {
             return false;
         }
         m_read_idx += bytes_read;
+        if (m_read_idx >= READ_BUFFER_SIZE - 1) {
+            break;
+        }
+    }
+    m_read_buf[m_read_idx] = '\0';
+    // 新请求的第一个字节，解析之前先检查该IP的请求速率(HTTP/2按流计入，见h2_session)
+    if (!m_h2 && start_idx == 0 && m_read_idx > 0 && m_limiter && !m_limiter->on_request(m_saddr)) {
+        return false;
+    }
+    if (m_stage == STAGE_IDLE && m_read_idx > 0) {
+        set_stage(STAGE_HEADER);
+    }
+    else if (m_stage == STAGE_BODY) {
+        m_stage_bytes += m_read_idx - start_idx;
     }
     printf("读取到了数据:\n %s", m_read_buf);
     return true;
@@ -146,20 +421,23 @@ http_conn::HTTP_CODE http_conn::process_read() {
             case CHECK_STATE_HEADER:
             {
                 ret = parse_headers(text);
-                if (ret == BAD_REQUEST) {
-                    return BAD_REQUEST;
-                }
-                else if (ret == GET_REQUEST) {
+                if (ret == GET_REQUEST) {
                     return do_request();        // 解析具体信息
                 }
+                else if (ret != NO_REQUEST) {
+                    return ret;
+                }
                 break;
             }
             case CHECK_STATE_CONTENT:
             {
-                ret = parse_content(text);
+                ret = parse_content();
                 if (ret == GET_REQUEST) {
                     return do_request();
                 }
+                else if (ret != NO_REQUEST) {
+                    return ret;
+                }
                 line_status = LINE_OPEN;
                 break;
             }
@@ -214,6 +492,21 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
     if (strcasecmp(method, "GET") == 0) {
         m_method = GET;
     }
+    else if (strcasecmp(method, "HEAD") == 0) {
+        m_method = HEAD;
+    }
+    else if (strcasecmp(method, "POST") == 0) {
+        m_method = POST;
+    }
+    else if (strcasecmp(method, "PUT") == 0) {
+        m_method = PUT;
+    }
+    else if (strcasecmp(method, "DELETE") == 0) {
+        m_method = DELETE;
+    }
+    else if (strcasecmp(method, "OPTIONS") == 0) {
+        m_method = OPTIONS;
+    }
     else {
         return BAD_REQUEST;
     }
@@ -236,133 +529,876 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
     if (!m_url || m_url[0] != '/') {
         return BAD_REQUEST;
     }
+    // 解码并规范化，之后的路由和文件查找都使用规范化的路径，跳出根目录的请求直接拒绝
+    if (!canonicalize_url(m_url)) {
+        return BAD_REQUEST;
+    }
 
     m_check_state = CHECK_STATE_HEADER;         // 主状态机状态变为检查请求头
+    m_header_start = m_checked_index;
     return NO_REQUEST;                          // 仍需要解析
 } 
 
 // 解析请求头
+// 请求头的名字经过一次完美哈希和一次比较得到ID，值按ID存入m_headers，不认识的请求头忽略
 http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
-    // m_url = strpbrk(text, " \t");
     if (text[0] == '\0') {
-        if (m_content_length != 0) {
-            m_check_state = CHECK_STATE_CONTENT;
-            return NO_REQUEST;
-        }
-        return GET_REQUEST;
+        m_header_end = text - m_read_buf;
+        return begin_body();
     }
-    // Connection: keep-alive
-    else if (strncasecmp(text, "Connection:", 11) == 0) {
-        text += 11;
-        text += strspn(text, " \t");                // keep-alive
-        if (strcasecmp(text, "keep-alive") == 0) {
-            m_linger = true;
-        }
+    char* colon = strchr(text, ':');
+    // 名字为空或名字和冒号之间有空白(RFC 7230 3.2.4)：代理可能按另一个名字理解，是走私的常见手法
+    if (!colon || colon == text || colon[-1] == ' ' || colon[-1] == '\t') {
+        return BAD_REQUEST;
     }
-    else if (strncasecmp(text, "Connection-Length:", 15) == 0) {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+    HEADER_ID id = find_header(text, colon - text);
+    if (id == HEADER_COUNT) {
+        return NO_REQUEST;
     }
-    else if (strncasecmp(text, "Host:", 5) == 0) {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+    text = colon + 1;
+    text += strspn(text, " \t");
+    if (id == H_CONTENT_LENGTH && !m_headers[id].empty() && !m_headers[id].equals(text)) {
+        return BAD_REQUEST;             // 多个不一致的Content-Length，可能是请求走私
     }
-    else {
-        printf("oop! unknow header %s\n", text);
+    m_headers[id] = str_view(text, strlen(text));
+    switch (id) {
+        // Connection: keep-alive
+        case H_CONNECTION:
+            if (strcasecmp(text, "keep-alive") == 0) {
+                m_linger = true;
+            }
+            break;
+        case H_CONTENT_LENGTH:
+        {
+            char* end = NULL;
+            m_content_length = strtol(text, &end, 10);
+            if (end == text || *end != '\0' || m_content_length < 0) {
+                return BAD_REQUEST;
+            }
+            break;
+        }
+        // Expect: 100-continue
+        case H_EXPECT:
+            m_expect_continue = strcasecmp(text, "100-continue") == 0;
+            break;
+        // Transfer-Encoding: chunked
+        case H_TRANSFER_ENCODING:
+            if (strcasecmp(text, "chunked") != 0) {
+                return BAD_REQUEST;         // 其他传输编码不支持
+            }
+            m_chunked_body = true;
+            break;
+        // Accept-Encoding: gzip, deflate, br
+        case H_ACCEPT_ENCODING:
+            m_accept_encoding = parse_accept_encoding(text);
+            break;
+        case H_HOST:
+            m_host = text;
+            break;
+        // Upgrade: h2c
+        case H_UPGRADE:
+            if (strcasecmp(text, "h2c") == 0) {
+                m_upgrade_h2c = true;
+            }
+            break;
+        case H_HTTP2_SETTINGS:
+            m_h2_settings = text;
+            break;
+        default:
+            break;
     }
     return NO_REQUEST;
 }
 
-// 解析请求体
-http_conn::HTTP_CODE http_conn::parse_content(char* text) {
-    if (m_read_idx >= (m_content_length + m_checked_index)) {
-        text[m_content_length] = '\0';
+// 请求结束：可以复用的处理器留给这个连接上的下一个请求，其余的删除
+void http_conn::release_handler() {
+    if (m_handler && m_handler->recycle()) {
+        delete m_spare_handler;
+        m_spare_handler = m_handler;
+        m_spare_factory = m_handler_factory;
+    } else {
+        delete m_handler;
+    }
+    m_handler = NULL;
+}
+
+// 请求头解析完成，找到处理请求体的处理器
+http_conn::HTTP_CODE http_conn::begin_body() {
+    bool has_body = m_chunked_body || m_content_length > 0;
+    handler_factory factory = NULL;
+    route_params params;
+    router::RESULT found = m_router.match(m_method, m_url, &factory, &params);
+    if (found != router::FOUND) {
+        if (has_body) {
+            m_linger = false;           // 请求体没有读取，响应后关闭连接
+        }
+        return found == router::METHOD_NOT_ALLOWED ? METHOD_NOT_ALLOWED : NO_RESOURCE;
+    }
+    if (m_spare_handler && m_spare_factory == factory) {
+        m_handler = m_spare_handler;
+        m_spare_handler = NULL;
+    } else {
+        m_handler = factory();
+    }
+    m_handler_factory = factory;
+    m_handler->set_params(params);
+    m_handler->set_headers(m_headers);
+    m_handler->set_accept_encoding(m_accept_encoding);
+    m_handler->set_header_block(m_read_buf + m_header_start, m_header_end - m_header_start);
+    m_handler->set_client(m_saddr, m_ssl != NULL);
+    if (m_content_length > m_handler->max_body_size()) {
+        m_linger = false;
+        return BODY_TOO_LARGE;
+    }
+    if (!m_handler->on_begin(m_method, m_url, m_chunked_body ? -1 : m_content_length)) {
+        m_linger = false;
+        return BAD_REQUEST;
+    }
+    if (!has_body) {
         return GET_REQUEST;
     }
+    m_body_remaining = m_content_length;
+    m_body_received = 0;
+    m_chunked.reset();
+    if (m_expect_continue && m_read_idx == m_checked_index) {
+        // 处理器接受了请求，通知客户端开始发送请求体，不必等客户端超时
+        static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        sock_send(cont, sizeof(cont) - 1);
+    }
+    m_check_state = CHECK_STATE_CONTENT;
+    set_stage(STAGE_BODY);
+    m_stage_bytes = m_read_idx - m_checked_index;   // 和请求头一起到达的部分请求体
     return NO_REQUEST;
 }
 
-// 当得到一个完整的HTTP请求时，分析目标文件的属性。如果目标文件存在，对所有的用户可读，且不是目录，则使用mmap将其映射到内存地址m_file_address处，
-// 并告诉调用者获取文件成功
+// 把收到的请求体交给处理器：先是读缓冲区中和请求头一起到达的部分，再是缓冲块中的数据
+http_conn::HTTP_CODE http_conn::parse_content() {
+    HTTP_CODE ret = feed_body(m_read_buf + m_checked_index, m_read_idx - m_checked_index);
+    m_checked_index = m_read_idx;
+    if (ret == NO_REQUEST && m_body_len > 0) {
+        ret = feed_body(m_body_buf, m_body_len);
+    }
+    // 缓冲块中的数据已经交给处理器，归还缓冲块，空闲的连接不占用请求体内存
+    m_body_len = 0;
+    m_body_pool.release(m_body_buf);
+    m_body_buf = NULL;
+    if (ret == NO_REQUEST && splicing() && !handler_waiting()) {
+        ret = splice_body();
+    }
+    if (ret == NO_REQUEST && handler_waiting()) {
+        // 上游写不进去，暂停读取请求体，socket中的数据留到上游可写之后
+        m_handler_wait = WAIT_BODY;
+        ret = HANDLER_WAIT;
+    }
+    if (ret != NO_REQUEST && ret != GET_REQUEST && ret != HANDLER_WAIT) {
+        m_linger = false;
+    }
+    return ret;
+}
+
+// 按Content-Length或chunked编码切出请求体交给处理器，请求体完整时返回GET_REQUEST
+http_conn::HTTP_CODE http_conn::feed_body(const char* data, size_t len) {
+    bool done = false;
+    while (len > 0 && !done) {
+        const char* piece = data;
+        size_t piece_len = 0;
+        if (m_chunked_body) {
+            size_t used = 0;
+            chunked_decoder::RESULT res = m_chunked.decode(data, len, &used, &piece, &piece_len);
+            data += used;
+            len -= used;
+            if (res == chunked_decoder::BAD) {
+                return BAD_REQUEST;
+            }
+            done = res == chunked_decoder::DONE;
+            if (res == chunked_decoder::NEED_MORE) {
+                break;
+            }
+        } else {
+            piece_len = len < (size_t)m_body_remaining ? len : m_body_remaining;
+            data += piece_len;
+            len -= piece_len;
+            m_body_remaining -= piece_len;
+            done = m_body_remaining == 0;
+        }
+        if (piece_len > 0) {
+            m_body_received += piece_len;
+            if (m_body_received > m_handler->max_body_size()) {
+                return BODY_TOO_LARGE;
+            }
+            if (!m_handler->on_body(piece, piece_len)) {
+                return BAD_REQUEST;
+            }
+        }
+    }
+    // 请求体之后多余的数据(流水线请求)被丢弃
+    return done ? GET_REQUEST : NO_REQUEST;
+}
+
+bool http_conn::splicing() const {
+    // splice只能直接读明文socket，内核解密的kTLS连接也可以
+    return m_handler && !m_chunked_body && (!m_ssl || m_ktls_rx) && m_handler->wants_splice();
+}
+
+// 零拷贝接收请求体，直到socket暂时没有数据或用完本次预算；进度计入请求体阶段的最低速率
+http_conn::HTTP_CODE http_conn::splice_body() {
+    long budget = SPLICE_BUDGET;
+    while (m_body_remaining > 0 && budget > 0) {
+        long n = m_handler->splice_body(m_socketfd, m_body_remaining < budget ? m_body_remaining : budget);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return NO_REQUEST;      // socket暂时没有数据，或者处理器在等待上游(由调用者检查)
+            }
+            return errno == EPIPE ? BAD_GATEWAY : INTERNAL_ERROR;
+        }
+        if (n == 0) {
+            return CLOSED_CONNECTION;
+        }
+        m_body_remaining -= n;
+        m_body_received += n;
+        m_stage_bytes += n;
+        budget -= n;
+    }
+    // 预算用完时重新注册EPOLLIN，socket中剩余的数据会立即再次触发
+    return m_body_remaining == 0 ? GET_REQUEST : NO_REQUEST;
+}
+
+bool http_conn::handler_waiting() const {
+    uint32_t events;
+    return m_handler && m_handler->wait_fd(&events) >= 0;
+}
+
+// 登记成功之后连接随时可能在另一个线程中被处理，调用者不能再访问连接的任何状态
+bool http_conn::wait_handler() {
+    uint32_t events = 0;
+    int fd = m_handler->wait_fd(&events);
+    if (!m_fd_waiters || fd < 0) {
+        return false;
+    }
+    if (m_handler_wait != WAIT_BODY) {
+        set_stage(STAGE_UPSTREAM);      // 请求体阶段仍按最低速率计时
+    }
+    return m_fd_waiters->wait(m_epollfd, fd, events, m_handle);
+}
+
+// 等待的fd就绪(也可能是虚假唤醒，处理器自己判断)
+http_conn::HTTP_CODE http_conn::resume_handler() {
+    WAIT_POINT point = m_handler_wait;
+    m_handler_wait = WAIT_NONE;
+    if (point == WAIT_RESPONSE) {
+        return do_request();
+    }
+    // 请求体阶段
+    if (!m_handler->on_ready()) {
+        m_linger = false;
+        return BAD_GATEWAY;
+    }
+    HTTP_CODE ret = NO_REQUEST;
+    if (splicing() && !handler_waiting()) {
+        ret = splice_body();
+        if (ret == GET_REQUEST) {
+            return do_request();
+        }
+    }
+    if (ret == NO_REQUEST && handler_waiting()) {
+        m_handler_wait = WAIT_BODY;
+        return HANDLER_WAIT;
+    }
+    if (ret != NO_REQUEST) {
+        m_linger = false;
+    }
+    return ret;
+}
+
+const char* http_conn::method_name(int method) {
+    static const char* const names[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
+    return method >= 0 && method <= CONNECT ? names[method] : "GET";
+}
+
+bool http_conn::add_handler(METHOD method, const char* pattern, handler_factory factory) {
+    return m_router.add(method, pattern, factory);
+}
+
+bool http_conn::add_routes(const router::route* routes, int count) {
+    return m_router.add(routes, count);
+}
+
+void http_conn::allowed_methods(const char* url, char* buf, size_t len) {
+    int mask = m_router.allowed(url);
+    size_t used = 0;
+    buf[0] = '\0';
+    for (int m = GET; m <= CONNECT; ++m) {
+        if (mask & (1 << m)) {
+            int n = snprintf(buf + used, len - used, "%s%s", used ? ", " : "", method_name(m));
+            if (n < 0 || (size_t)n >= len - used) {
+                break;
+            }
+            used += n;
+        }
+    }
+}
+
+// 请求完整之后由处理器生成响应
 http_conn::HTTP_CODE http_conn::do_request() {
-    strcpy(m_read_file, doc_root);
+    if (m_upgrade_h2c && m_h2_settings) {
+        // h2c升级请求的目标由HTTP/2会话在流1上响应
+        return UPGRADE_REQUEST;
+    }
+    if (!m_handler) {
+        return NO_RESOURCE;
+    }
+    m_response.can_wait = m_wake != NULL;
+    m_response.can_splice = !m_ssl || m_ktls_tx;
+    m_handler->on_complete(m_response);
+    if (!m_response.wait_for.empty()) {
+        m_wait_key.swap(m_response.wait_for);
+        m_response.release();
+        m_response = request_handler::response();
+        return PARKED_REQUEST;
+    }
+    if (handler_waiting()) {
+        m_response.release();
+        m_response = request_handler::response();
+        m_handler_wait = WAIT_RESPONSE;
+        return HANDLER_WAIT;
+    }
+    return HANDLER_REQUEST;
+}
+
+// 分析目标文件的属性：文件存在，对所有的用户可读，且不是目录时返回FILE_REQUEST。
+// url必须是规范化之后的路径，只使用前path_len个字节(不含查询字符串)
+http_conn::HTTP_CODE http_conn::stat_file(const char* url, int path_len, char* real_file, struct stat* file_stat) {
     int len = strlen(doc_root);
-    strncpy(m_read_file + len, m_url, FILENAME_LEN - len - 1);          // doc_root/m_url
+    if (len + path_len >= FILENAME_LEN) {
+        return NO_RESOURCE;             // 截断后可能指向另一个文件
+    }
+    // 最近确认过不存在的路径不再stat，扫描器反复探测也不会变成文件系统的负载
+    if (m_missing.contains(url, path_len)) {
+        return NO_RESOURCE;
+    }
+    memcpy(real_file, doc_root, len);
+    memcpy(real_file + len, url, path_len);         // doc_root/m_url
+    real_file[len + path_len] = '\0';
 
-    if (stat(m_read_file, &m_file_stat) < 0) {
+    // 其他工作进程最近stat过的结果
+    shm_stat_cache::LOOKUP shared = m_stat_cache ? m_stat_cache->find(url, path_len, file_stat) : shm_stat_cache::MISS;
+    if (shared == shm_stat_cache::ABSENT) {
+        m_missing.insert(url, path_len);
         return NO_RESOURCE;
     }
-    if (!(m_file_stat.st_mode & S_IROTH)) {
+    if (shared == shm_stat_cache::MISS) {
+        shm_stat_cache::version ver = {0, 0};
+        if (m_stat_cache) {
+            ver = m_stat_cache->snapshot(url, path_len);
+        }
+        if (stat(real_file, file_stat) < 0) {
+            if (errno == ENOENT || errno == ENOTDIR) {
+                m_missing.insert(url, path_len);
+                if (m_stat_cache) {
+                    m_stat_cache->store(url, path_len, NULL, ver);
+                }
+            }
+            return NO_RESOURCE;
+        }
+        if (m_stat_cache) {
+            m_stat_cache->store(url, path_len, file_stat, ver);
+        }
+    }
+    if (!(file_stat->st_mode & S_IROTH)) {
         return FORBIDDEN_REQUEST;
     }
-    if (S_ISDIR(m_file_stat.st_mode)) {
+    if (S_ISDIR(file_stat->st_mode)) {
         return BAD_REQUEST;
     }
+    return FILE_REQUEST;
+}
 
-    int fd = open(m_read_file, O_RDONLY);
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+// 使用mmap将文件映射到内存地址file_address处，空文件不映射
+http_conn::HTTP_CODE http_conn::mmap_file(const char* real_file, struct stat* file_stat, char** file_address) {
+    *file_address = 0;
+    int fd = open(real_file, O_RDONLY);
+    if (fd < 0) {
+        return NO_RESOURCE;
+    }
+    // stat的结果可能来自共享的元数据缓存，按打开的文件重新取一次，映射的长度不会超出文件
+    if (fstat(fd, file_stat) < 0 || !S_ISREG(file_stat->st_mode)) {
+        close(fd);
+        return NO_RESOURCE;
+    }
+    if (file_stat->st_size == 0) {
+        close(fd);
+        return FILE_REQUEST;
+    }
+    *file_address = (char*)mmap(0, file_stat->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    if (*file_address == MAP_FAILED) {
+        *file_address = 0;
+        return INTERNAL_ERROR;
+    }
+    return FILE_REQUEST;
+}
 
-    return FILE_REQUEST;    
+// 先查文件缓存。没有命中时同一个文件只由第一个请求者加载，其他能挂起的请求者等待它加载完成，
+// 不能挂起的(HTTP/2的流)自己加载一份，不进入等待
+file_cache::file_ptr http_conn::open_file(const char* url, int path_len, HTTP_CODE* code, request_handler::response& resp) {
+    file_cache::file_ptr file = m_files.find(url, path_len);
+    if (file) {
+        return file;
+    }
+    // 负缓存中的路径没有什么可加载的，不进入single_flight(登记加载要分配内存)
+    if (m_missing.contains(url, path_len)) {
+        *code = NO_RESOURCE;
+        return file;
+    }
+    std::string key(url, path_len);
+    if (!m_loads.begin(key)) {
+        if (resp.can_wait) {
+            resp.wait_for.swap(key);
+            *code = PARKED_REQUEST;
+            return file;
+        }
+        return load_file(url, path_len, code);
+    }
+    file = load_file(url, path_len, code);
+    // 失败时等待者重新查找，不存在的文件已经进入负缓存
+    std::vector<uint64_t> waiters;
+    m_loads.finish(key, &waiters);
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        m_wake->push(waiters[i]);
+    }
+    return file;
 }
 
-// 一次性写缓冲区，写完
-bool http_conn::write() {
-    int temp;
-    int byte_have_send = 0;
-    int bytes_to_send = m_write_idx;
-    if (bytes_to_send == 0) {
-        modfd(m_epollfd, m_socketfd, EPOLLIN);
-        init();
+// stat、映射并放入缓存
+file_cache::file_ptr http_conn::load_file(const char* url, int path_len, HTTP_CODE* code) {
+    file_cache::file_ptr file;
+    char real_file[FILENAME_LEN];
+    struct stat st;
+    char* addr = NULL;
+    *code = stat_file(url, path_len, real_file, &st);
+    if (*code == FILE_REQUEST) {
+        *code = mmap_file(real_file, &st, &addr);
+    }
+    if (*code != FILE_REQUEST) {
+        return file;
+    }
+    file.reset(new cached_file(real_file, st, addr));
+    m_files.insert(url, path_len, file);
+    return file;
+}
+
+// 响应体指向缓存的映射，由响应持有引用
+static void use_body(request_handler::response& resp, const response_writer::holder& owner, const char* data, size_t len) {
+    resp.shared = owner;
+    resp.shared_data = data;
+    resp.shared_len = len;
+}
+
+// 预压缩的文件(url + ext，例如index.html.br)存在且不比原文件旧时使用它作为响应体
+bool http_conn::use_sidecar(const char* url, int path_len, const char* ext, const struct stat& origin,
+                            request_handler::response& resp) {
+    char side_url[FILENAME_LEN];
+    int ext_len = strlen(ext);
+    if (path_len + ext_len >= FILENAME_LEN) {
+        return false;
+    }
+    memcpy(side_url, url, path_len);
+    memcpy(side_url + path_len, ext, ext_len + 1);
+    // 不存在的预压缩文件同样进入负缓存，之后的请求不再为它stat
+    HTTP_CODE code;
+    file_cache::file_ptr side = open_file(side_url, path_len + ext_len, &code, resp);
+    if (!side || side->size() == 0 || side->st.st_mtime < origin.st_mtime) {
+        return false;
+    }
+    use_body(resp, side, side->data, side->size());
+    return true;
+}
+
+// 依次尝试.br、.gz预压缩文件和gzip压缩的缓存版本，都不可用时发送原文件。
+// 压缩在调用者所在的工作线程中进行，结果按文件缓存，之后的请求直接共享
+http_conn::HTTP_CODE http_conn::serve_file(const char* url, int accept_encoding, request_handler::response& resp) {
+    int path_len = strcspn(url, "?");
+    HTTP_CODE code;
+    file_cache::file_ptr file = open_file(url, path_len, &code, resp);
+    if (!file) {
+        return code;
+    }
+    const struct stat& st = file->st;
+    const mime_type* type = find_mime_type(file->real_file.c_str());
+    resp.content_type = type->name;
+    // 可压缩的类型无论这次是否压缩都带上Vary，缓存不会把压缩版本发给不支持的客户端
+    resp.vary_encoding = type->compressible;
+    if (type->compressible && st.st_size > 0) {
+        if ((accept_encoding & CODING_BR) && use_sidecar(url, path_len, ".br", st, resp)) {
+            resp.content_encoding = "br";
+            return FILE_REQUEST;
+        }
+        if ((accept_encoding & CODING_GZIP) && use_sidecar(url, path_len, ".gz", st, resp)) {
+            resp.content_encoding = "gzip";
+            return FILE_REQUEST;
+        }
+        if (!resp.wait_for.empty()) {
+            return PARKED_REQUEST;      // 预压缩文件正在被其他请求加载
+        }
+    }
+    bool want_gzip = type->compressible && (accept_encoding & CODING_GZIP) &&
+                     st.st_size >= COMPRESS_MIN && st.st_size <= COMPRESS_MAX;
+    response_writer::blob zipped;
+    if (want_gzip && !m_variants.find(file->real_file.c_str(), st, &zipped)) {
+        zipped = variant_cache::gzip(file->data, st.st_size);
+        if (zipped) {
+            if ((off_t)zipped->size() >= st.st_size) {
+                zipped = response_writer::blob(new std::string);    // 已知压缩后不会变小
+            }
+            m_variants.insert(file->real_file.c_str(), st, zipped);
+        }
+    }
+    if (zipped && !zipped->empty()) {
+        use_body(resp, zipped, zipped->data(), zipped->size());
+        resp.content_encoding = "gzip";
+        return FILE_REQUEST;
+    }
+    use_body(resp, file, file->data, file->size());
+    return FILE_REQUEST;
+}
+
+// 由fs_watcher在主线程中回调
+void http_conn::file_changed(const char* url, size_t len, bool tree) {
+    m_files.invalidate(url, len, tree);
+    if (m_stat_cache) {
+        m_stat_cache->invalidate(url, len, tree);
+    }
+    if (tree) {
+        m_missing.clear();              // 负缓存只按哈希保存，无法按前缀删除
+    } else {
+        m_missing.erase(url, len);
+    }
+}
+
+size_t http_conn::reserve_buffers(int count, size_t lock_budget) {
+    return m_body_pool.reserve(count, (size_t)count * BODY_BUFFER_SIZE <= lock_budget);
+}
+
+void http_conn::prewarm(const char* list, size_t lock_budget) {
+    FILE* fp = fopen(list, "r");
+    if (!fp) {
+        return;                         // 第一次启动时还没有热点列表
+    }
+    char line[FILENAME_LEN + 2];
+    size_t count = 0;
+    size_t locked = 0;
+    while (count < FILE_CACHE_ENTRIES && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        // 列表可能被手工编辑过，按请求的url同样规范化；'#'开头的是注释
+        if (!canonicalize_url(line)) {
+            continue;
+        }
+        int path_len = strcspn(line, "?");
+        HTTP_CODE code;
+        file_cache::file_ptr file = load_file(line, path_len, &code);
+        if (!file || file->size() == 0) {
+            continue;
+        }
+        ++count;
+        // 不进入文件缓存的大文件只预读，映射随预读结束解除，锁定没有意义
+        bool lock = file->size() <= FILE_CACHE_BYTES / 4 && locked + file->size() <= lock_budget;
+        if (lock) {
+            locked += file->size();
+        }
+        if (m_prefetch) {
+            m_prefetch->submit(file->data, file->size(), file, 0, lock);
+        }
+    }
+    fclose(fp);
+    printf("prewarm %s: %zu files, %zu bytes to lock\n", list, count, locked);
+}
+
+bool http_conn::save_hot_list(const char* list, size_t count) {
+    std::vector<std::string> urls;
+    m_files.hottest(count, &urls);
+    if (urls.empty()) {
+        return true;                    // 没有流量时保留上一次的列表
+    }
+    // 多个工作进程同时退出时各自写自己的临时文件
+    char tmp[FILENAME_LEN];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", list, (int)getpid());
+    FILE* fp = fopen(tmp, "w");
+    if (!fp) {
+        return false;
+    }
+    fprintf(fp, "# hot files, hottest first\n");
+    for (size_t i = 0; i < urls.size(); ++i) {
+        fprintf(fp, "%s\n", urls[i].c_str());
+    }
+    bool ok = fflush(fp) == 0 && !ferror(fp);
+    fclose(fp);
+    if (!ok || rename(tmp, list) < 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+bool http_conn::load_assets(const char* path) {
+    m_assets_path = path;
+    std::shared_ptr<asset_bundle> bundle = asset_bundle::open(path);
+    if (!bundle) {
+        return false;
+    }
+    printf("asset bundle %s: %zu entries\n", path, bundle->entry_count());
+    m_assets_lock.lock();
+    m_assets = bundle;
+    m_assets_lock.unlock();
+    return true;
+}
+
+// 由主线程定时调用，每次一个stat；文件没有变化时什么都不做
+void http_conn::reload_assets() {
+    if (m_assets_path.empty()) {
+        return;
+    }
+    struct stat st;
+    if (stat(m_assets_path.c_str(), &st) < 0) {
+        return;                         // 部署过程中暂时不存在时继续使用旧版本
+    }
+    m_assets_lock.lock();
+    std::shared_ptr<asset_bundle> current = m_assets;
+    m_assets_lock.unlock();
+    if (current && current->same_file(st)) {
+        return;
+    }
+    load_assets(m_assets_path.c_str());
+}
+
+// If-None-Match中是否有与etag相同的校验值，弱校验值"W/"前缀忽略
+static bool etag_matches(const str_view& if_none_match, const char* etag, size_t etag_len) {
+    const char* p = if_none_match.data();
+    const char* end = p + if_none_match.size();
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            ++p;
+        }
+        const char* tag = p;
+        while (p < end && *p != ',') {
+            ++p;
+        }
+        const char* tag_end = p;
+        while (tag_end > tag && (tag_end[-1] == ' ' || tag_end[-1] == '\t')) {
+            --tag_end;
+        }
+        if (tag_end - tag == 1 && *tag == '*') {
+            return true;
+        }
+        if (tag_end - tag > 2 && tag[0] == 'W' && tag[1] == '/') {
+            tag += 2;
+        }
+        if ((size_t)(tag_end - tag) == etag_len && memcmp(tag, etag, etag_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 资源包命中时不访问文件系统，响应头和内容都直接来自映射的内存
+bool http_conn::serve_asset(const char* url, int accept_encoding, const str_view& if_none_match,
+                            request_handler::response& resp) {
+    m_assets_lock.lock();
+    std::shared_ptr<asset_bundle> bundle = m_assets;
+    m_assets_lock.unlock();
+    if (!bundle) {
+        return false;
+    }
+    const bundle_entry* e = bundle->find(url, strcspn(url, "?"));
+    if (!e) {
+        return false;
+    }
+    int v = VARIANT_IDENTITY;
+    if ((accept_encoding & CODING_BR) && e->body[VARIANT_BR].length > 0) {
+        v = VARIANT_BR;
+    } else if ((accept_encoding & CODING_GZIP) && e->body[VARIANT_GZIP].length > 0) {
+        v = VARIANT_GZIP;
+    }
+    static const char* const encodings[VARIANT_COUNT] = { NULL, "gzip", "br" };
+    resp.content_type = bundle->at(e->content_type);
+    resp.content_encoding = encodings[v];
+    resp.vary_encoding = e->compressible != 0;
+    resp.etag = bundle->at(e->etag[v]);
+    resp.shared = bundle;
+    if (!if_none_match.empty() && etag_matches(if_none_match, resp.etag, e->etag[v].length)) {
+        resp.status = 304;
+        resp.title = "Not Modified";
         return true;
     }
-    
+    resp.raw_headers = bundle->at(e->headers[v]);
+    resp.raw_headers_len = e->headers[v].length;
+    resp.shared_data = bundle->at(e->body[v]);
+    resp.shared_len = e->body[v].length;
+    return true;
+}
+
+int http_conn::error_page(HTTP_CODE code, const char** title, const char** form) {
+    switch (code) {
+        case BAD_REQUEST:
+            *title = error_400_title;
+            *form = error_400_form;
+            return 400;
+        case NO_RESOURCE:
+            *title = error_404_title;
+            *form = error_404_form;
+            return 404;
+        case FORBIDDEN_REQUEST:
+            *title = error_403_title;
+            *form = error_403_form;
+            return 403;
+        case METHOD_NOT_ALLOWED:
+            *title = error_405_title;
+            *form = error_405_form;
+            return 405;
+        case BODY_TOO_LARGE:
+            *title = error_413_title;
+            *form = error_413_form;
+            return 413;
+        case BAD_GATEWAY:
+            *title = error_502_title;
+            *form = error_502_form;
+            return 502;
+        default:
+            *title = error_500_title;
+            *form = error_500_form;
+            return 500;
+    }
+}
+
+// EPOLLOUT时由主线程调用
+bool http_conn::write() {
+    if (m_h2) {
+        return write_h2();
+    }
+    return after_flush(flush());
+}
+
+// 写出发送队列，队列有空间时调用生产者补充数据。进度记录在队列的各段中，
+// EAGAIN之后从内核停下的位置继续；每次最多写WRITE_BUDGET字节，大文件不会独占事件循环
+http_conn::FLUSH_RESULT http_conn::flush() {
+    struct iovec iv[response_writer::MAX_IOV];
+    int budget = WRITE_BUDGET;
     while (true) {
-        temp = writev(m_socketfd, m_iv, m_iv_count);
-        if (temp <= -1) {
-            if (errno == EAGAIN) {
-                modfd(m_epollfd, m_socketfd, EPOLLOUT);
-                return true;
+        if (!m_writer.pump()) {
+            return FLUSH_ERROR;
+        }
+        if (m_writer.empty()) {
+            return m_writer.producing() ? FLUSH_WAIT : FLUSH_DONE;
+        }
+        if (budget <= 0) {
+            return FLUSH_BUDGET;
+        }
+        if (m_prefetch && !m_prefetched) {
+            // 缺页会阻塞当前线程(EPOLLOUT时是主线程)，冷数据先交给I/O线程读入
+            const char* cold;
+            size_t cold_len;
+            response_writer::holder owner;
+            if (m_writer.find_cold(PREFETCH_CHECK, PREFETCH_MAX, &cold, &cold_len, &owner)) {
+                // 提交之后连接随时可能被唤醒，标记要在提交之前设置
+                m_prefetching = true;
+                if (m_prefetch->submit(cold, cold_len, owner, m_handle)) {
+                    return FLUSH_COLD;
+                }
+                m_prefetching = false;
             }
-            unmmap();
-            return false;
         }
+        m_prefetched = false;
+        size_t pipe_len;
+        int pipe = m_writer.front_pipe(&pipe_len);
+        if (pipe >= 0) {
+            // 管道中的数据直接splice到socket
+            size_t want = pipe_len < (size_t)budget ? pipe_len : budget;
+            ssize_t n = splice(pipe, NULL, m_socketfd, NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n <= 0) {
+                return n < 0 && errno == EAGAIN ? FLUSH_AGAIN : FLUSH_ERROR;
+            }
+            m_writer.consume(n);
+            budget -= n;
+            if (m_stats) {
+                m_stats->bytes_sent.fetch_add(n, std::memory_order_relaxed);
+            }
+            m_stage_start = time(NULL);
+            if ((size_t)n < want) {
+                return FLUSH_AGAIN;
+            }
+            continue;
+        }
+        int count = m_writer.fill_iov(iv, response_writer::MAX_IOV);
+        // 按剩余预算截断
+        int want = 0;
+        for (int i = 0; i < count; ++i) {
+            if ((int)iv[i].iov_len >= budget - want) {
+                iv[i].iov_len = budget - want;
+                count = i + 1;
+            }
+            want += iv[i].iov_len;
+        }
+        int temp = sock_writev(iv, count);
+        if (temp <= -1) {
+            return errno == EAGAIN ? FLUSH_AGAIN : FLUSH_ERROR;
+        }
+        m_writer.consume(temp);
+        budget -= temp;
+        if (m_stats) {
+            m_stats->bytes_sent.fetch_add(temp, std::memory_order_relaxed);
+        }
+        m_stage_start = time(NULL);     // 有写出进度，重新计算写超时
+        if (temp < want) {
+            // 只写出了一部分，发送缓冲区已满，不必再试一次writev
+            return FLUSH_AGAIN;
+        }
+    }
+}
 
-        bytes_to_send -= temp;
-        byte_have_send += temp;
-        if (bytes_to_send <= byte_have_send) {
-            unmmap();
+// 只有队列里还有数据时才注册EPOLLOUT
+bool http_conn::after_flush(FLUSH_RESULT ret) {
+    switch (ret) {
+        case FLUSH_AGAIN:
+        case FLUSH_BUDGET:
+            modfd(m_epollfd, m_socketfd, EPOLLOUT, m_handle);
+            return true;
+        case FLUSH_WAIT:
+            // 生产者在等待处理器的fd时由连接挂起等待；其他生产者在数据就绪后由它的所有者重新注册EPOLLOUT
+            if (handler_waiting()) {
+                m_handler_wait = WAIT_PRODUCER;
+                return wait_handler();
+            }
+            return true;
+        case FLUSH_COLD:
+            // 连接已经交给I/O线程，不能再访问
+            return true;
+        case FLUSH_DONE:
             if (m_linger) {
                 init();
-                modfd(m_epollfd, m_socketfd, EPOLLIN);
+                modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
                 return true;
             }
-            else {
-                modfd(m_epollfd, m_socketfd, EPOLLIN);
-                return false;
-            }
-        }
+            return false;
+        default:
+            return false;
     }
 }
 
 bool http_conn::add_response(const char* format, ...) {
-    if (m_write_idx >= WRITE_BUFFER_SIZE) {
-        return false;
-    }
+    char line[WRITE_BUFFER_SIZE];
     va_list arg_list;
     va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= WRITE_BUFFER_SIZE - 1 - m_write_idx) {
+    int len = vsnprintf(line, sizeof(line), format, arg_list);
+    va_end(arg_list);
+    if (len < 0 || len >= (int)sizeof(line)) {
         return false;
     }
-    m_write_idx += len;
-    va_end(arg_list);
-    return true;
+    return m_writer.append(line, len);
 }
 
 bool http_conn::add_content(const char* content) {
+    if (m_method == HEAD) {
+        return true;            // HEAD只有响应头
+    }
     return add_response("%s", content);
 }
 
@@ -375,25 +1411,49 @@ bool http_conn::add_status_line(int status, const char* title) {
 }
 
 bool http_conn::add_headers(int content_length) {
-    add_content_length(content_length);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_length) && add_content_type() && add_linger() && add_blank_line();
 }
 
 
-bool http_conn::add_content_length(int content_length) {
-    return add_response("Content-Length: %d\r\n", content_length);
+bool http_conn::add_content_length(long content_length) {
+    return add_response("Content-Length: %ld\r\n", content_length);
 }
 
 bool http_conn::add_linger() {  
     return add_response("Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
 
+bool http_conn::add_allow() {
+    char methods[64];
+    allowed_methods(m_url, methods, sizeof(methods));
+    return add_response("Allow: %s\r\n", methods);
+}
+
 bool http_conn::add_blank_line() {
     return add_response("%s", "\r\n");
 }
 
+bool http_conn::start_stream(request_handler::response& resp, response_writer::producer* p) {
+    bool chunked = resp.stream_length < 0;
+    if (!add_status_line(resp.status, resp.title) ||
+        (resp.raw_headers ? !m_writer.append(resp.raw_headers, resp.raw_headers_len)
+                          : !add_response("Content-Type:%s\r\n", resp.content_type)) ||
+        (chunked ? !add_response("Transfer-Encoding: chunked\r\n") : !add_content_length(resp.stream_length)) ||
+        !add_linger() || !add_blank_line()) {
+        delete p;
+        return false;
+    }
+    if (m_method == HEAD) {
+        delete p;
+        return true;
+    }
+    if (chunked) {
+        m_writer.start_chunked();
+    }
+    m_writer.set_producer(p);
+    return true;
+}
+
 // 根据服务器处理HTTP请求的结果，返回客户想要的内容
 bool http_conn::process_write(HTTP_CODE ret) {
     switch(ret) {
@@ -409,7 +1469,7 @@ bool http_conn::process_write(HTTP_CODE ret) {
         case BAD_REQUEST:
         {
             add_status_line(400, error_400_title);
-            add_headers(strlen(error_403_form));
+            add_headers(strlen(error_400_form));
             if (!add_content(error_400_form)) {
                 return false;
             }
@@ -433,59 +1493,377 @@ bool http_conn::process_write(HTTP_CODE ret) {
             }
             break;
         }
-        case FILE_REQUEST:
+        case METHOD_NOT_ALLOWED:
+        case BODY_TOO_LARGE:
+        case BAD_GATEWAY:
         {
-            // add_status_line(200, ok_200_title);
-            // if (m_file_stat.st_size != 0) {
-            //     add_headers(strlen(ok_200_title));
-            //     m_iv[0].iov_base = m_write_buf;
-            //     m_iv[0].iov_len = m_write_idx;
-            //     m_iv[1].iov_base = m_file_address;
-            //     m_iv[1].iov_len = m_file_stat.st_size;
-            //     return true;
-            // }
-            add_status_line(200, ok_200_title);
-            add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf;
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            return true;
+            const char* title;
+            const char* form;
+            int status = error_page(ret, &title, &form);
+            add_status_line(status, title);
+            if (ret == METHOD_NOT_ALLOWED) {
+                add_allow();
+            }
+            add_headers(strlen(form));
+            if (!add_content(form)) {
+                return false;
+            }
+            break;
+        }
+        case HANDLER_REQUEST:
+        {
+            request_handler::response& resp = m_response;
+            if (resp.producer) {
+                response_writer::producer* p = resp.producer;
+                resp.producer = NULL;
+                return start_stream(resp, p);
+            }
+            if (resp.status == 304 && !resp.raw_headers) {
+                // 304没有响应体，只带校验值
+                if (!add_status_line(304, resp.title) ||
+                    (resp.etag && !add_response("ETag: %s\r\n", resp.etag)) ||
+                    (resp.vary_encoding && !add_response("Vary: Accept-Encoding\r\n")) ||
+                    !add_linger() || !add_blank_line()) {
+                    return false;
+                }
+                resp.release();
+                break;
+            }
+            if (!add_status_line(resp.status, resp.title)) {
+                return false;
+            }
+            if (resp.raw_headers) {
+                if (!m_writer.append(resp.raw_headers, resp.raw_headers_len)) {
+                    return false;
+                }
+            } else if (!add_response("Content-Type:%s\r\n", resp.content_type) ||
+                       !add_content_length(resp.body.size() + resp.file_len + resp.shared_len) ||
+                       (resp.content_encoding && !add_response("Content-Encoding: %s\r\n", resp.content_encoding)) ||
+                       (resp.vary_encoding && !add_response("Vary: Accept-Encoding\r\n")) ||
+                       (resp.etag && !add_response("ETag: %s\r\n", resp.etag))) {
+                return false;
+            }
+            if (!add_linger() || !add_blank_line()) {
+                return false;
+            }
+            if (m_method == HEAD) {
+                resp.release();
+                break;
+            }
+            if (!m_writer.append(resp.body.data(), resp.body.size())) {
+                return false;
+            }
+            if (resp.file_map) {
+                // 映射交给发送队列，发送完后由队列munmap
+                void* map = resp.file_map;
+                resp.file_map = NULL;
+                if (!m_writer.append_mapping(map, resp.file_len, 0, resp.file_len)) {
+                    return false;
+                }
+            }
+            if (resp.shared_len > 0) {
+                if (!m_writer.append_shared(resp.shared_data, resp.shared_len, resp.shared)) {
+                    return false;
+                }
+                resp.shared.reset();
+            }
+            break;
         }
         default:
         {
             return false;
         }
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
     return true;
 }
 
-// 由线程池中的工作线程调用
-void http_conn::process() {
-    printf("pares request, create response\n");
-    // 解析http请求
-    HTTP_CODE read_ret  = process_read();    
+// 由线程池中的工作线程调用，handle为入队时连接的句柄
+void http_conn::process(uint64_t handle) {
+    // 持有连接期间主线程不会因超时或淘汰关闭它，句柄的检查和之后的处理之间不会被打断
+    m_busy.lock();
+    if (handle == m_handle) {
+        process_task(handle);
+    }
+    // 入队之后连接已被关闭时丢弃过期的任务，槽位可能已经分给了新的客户端
+    m_busy.unlock();
+}
+
+void http_conn::process_task(uint64_t handle) {
+    if (tls_handshaking()) {
+        handshake(handle);
+        return;
+    }
+    if (m_prefetching) {
+        // 预读完成，继续发送
+        m_prefetching = false;
+        m_prefetched = true;
+        if (!after_flush(flush())) {
+            shutdown(m_socketfd, SHUT_RDWR);
+            modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+        }
+        return;
+    }
+    if (m_h2) {
+        process_h2(handle);
+        return;
+    }
+    if (m_read_idx > 0 && h2_session::is_preface(m_read_buf, m_read_idx)) {
+        // 先知模式：客户端直接发送HTTP/2连接前言
+        if (m_read_idx < (int)strlen("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n")) {
+            modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+            return;
+        }
+        m_h2 = new h2_session(m_saddr, m_ssl != NULL);
+        process_h2(handle);
+        return;
+    }
+    if (m_handler_wait == WAIT_PRODUCER) {
+        // 生产者等待的fd就绪，继续发送响应体
+        m_handler_wait = WAIT_NONE;
+        set_stage(STAGE_WRITE);
+        m_writer.resume();
+        if (!after_flush(flush())) {
+            shutdown(m_socketfd, SHUT_RDWR);
+            modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+        }
+        return;
+    }
+    HTTP_CODE read_ret;
+    if (m_parked) {
+        // 等待的文件已经加载完成，重新生成响应
+        m_parked = false;
+        read_ret = do_request();
+    } else if (m_handler_wait != WAIT_NONE) {
+        read_ret = resume_handler();
+    } else {
+        printf("pares request, create response\n");
+        // 解析http请求
+        read_ret = process_read();
+    }
+    while (read_ret == PARKED_REQUEST) {
+        // 挂到正在进行的加载上，加载结束后主线程把连接重新交给线程池。
+        // 登记成功之后连接随时可能在另一个线程中被处理，不能再访问连接的任何状态
+        m_parked = true;
+        if (m_loads.park(m_wait_key, handle)) {
+            return;
+        }
+        // 加载已经结束，直接重试
+        m_parked = false;
+        read_ret = do_request();
+    }
+    if (read_ret == HANDLER_WAIT) {
+        // 和挂起等待文件一样，登记之后不能再访问连接
+        if (wait_handler()) {
+            return;
+        }
+        m_handler_wait = WAIT_NONE;
+        m_linger = false;
+        read_ret = INTERNAL_ERROR;
+    }
+    if (read_ret == UPGRADE_REQUEST) {
+        // h2c升级，请求之后已经到达的数据(通常是连接前言)交给会话继续解析
+        m_h2 = new h2_session(m_saddr, m_ssl != NULL);
+        m_h2->upgrade(m_h2_settings, m_method, m_url, m_headers);
+        memmove(m_read_buf, m_read_buf + m_checked_index, m_read_idx - m_checked_index);
+        m_read_idx -= m_checked_index;
+        process_h2(handle);
+        return;
+    }
     if (read_ret == NO_REQUEST) {
         // 请求不完整，再次读取
-        modfd(m_epollfd, m_socketfd, EPOLLIN);
+        if (handle == m_handle) {
+            modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+        }
         return ;
     }
 
+    if (m_stats) {
+        m_stats->responses.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (m_draining) {
+        m_linger = false;               // 告诉客户端之后的请求换一个连接
+    }
     bool write_ret = process_write(read_ret);
+    if (handle != m_handle) {
+        return;
+    }
+    if (write_ret) {
+        // 直接在工作线程中写出响应，写不完时才注册EPOLLOUT交给主线程
+        set_stage(STAGE_WRITE);
+        write_ret = after_flush(flush());
+    }
     if (!write_ret) {
-        close_conn();
+        // 连接只能由主线程关闭，这里关闭读写两端，主线程收到EPOLLRDHUP后回收连接
+        shutdown(m_socketfd, SHUT_RDWR);
+        modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+        return;
     }
-    modfd(m_epollfd, m_socketfd, EPOLLOUT);
     printf("213213123\n");
 }
 
-void http_conn::unmmap() {
-    if (m_file_address) {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+// HTTP/2连接：把读缓冲区中的数据全部交给会话，生成的帧由主线程在EPOLLOUT时写出
+void http_conn::process_h2(uint64_t handle) {
+    bool ok = m_h2->feed(m_read_buf, m_read_idx);
+    m_read_idx = 0;
+    m_checked_index = 0;
+    m_start_line = 0;
+    // SSL_read可能已经把socket中的记录读进了OpenSSL的缓冲区，这部分数据不会再触发EPOLLIN，在这里读完
+    while (ok && m_ssl && !m_ktls_rx && SSL_pending(m_ssl) > 0 && read()) {
+        ok = m_h2->feed(m_read_buf, m_read_idx);
+        m_read_idx = 0;
+    }
+    if (ok) {
+        m_h2->fill();
+    }
+    if (handle != m_handle) {
+        return;
+    }
+    // 直接写出生成的帧，写不完时write_h2才注册EPOLLOUT
+    if (!write_h2()) {
+        shutdown(m_socketfd, SHUT_RDWR);
+        modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+    }
+}
+
+// 推进TLS握手，需要等待对端数据或socket可写时重新注册对应事件后返回
+void http_conn::handshake(uint64_t handle) {
+    int ret = SSL_do_handshake(m_ssl);
+    if (handle != m_handle) {
+        return;
     }
-}
\ No newline at end of file
+    if (ret == 1) {
+        m_tls_ready = true;
+        // 内核支持时OpenSSL在握手完成后已经把密钥装入socket(TLS_TX/TLS_RX)
+        m_ktls_tx = tls_context::ktls_send(m_ssl);
+        m_ktls_rx = tls_context::ktls_recv(m_ssl);
+        if (tls_context::alpn_h2(m_ssl)) {
+            m_h2 = new h2_session(m_saddr, m_ssl != NULL);
+        }
+        modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+        return;
+    }
+    int err = SSL_get_error(m_ssl, ret);
+    if (err == SSL_ERROR_WANT_READ) {
+        modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+    }
+    else if (err == SSL_ERROR_WANT_WRITE) {
+        modfd(m_epollfd, m_socketfd, EPOLLOUT, m_handle);
+    }
+    else {
+        // 握手失败，由主线程在EPOLLRDHUP时回收连接
+        ERR_clear_error();
+        shutdown(m_socketfd, SHUT_RDWR);
+        modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+    }
+}
+
+// 返回值与recv相同：数据不足时返回-1且errno为EAGAIN，对端关闭返回0
+int http_conn::sock_recv(char* buf, int len) {
+    if (!m_ssl || m_ktls_rx) {
+        return recv(m_socketfd, buf, len, 0);
+    }
+    int n = SSL_read(m_ssl, buf, len);
+    if (n > 0) {
+        return n;
+    }
+    int err = SSL_get_error(m_ssl, n);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    ERR_clear_error();
+    if (err == SSL_ERROR_ZERO_RETURN) {
+        return 0;
+    }
+    errno = EIO;
+    return -1;
+}
+
+// 返回值与writev相同。没有kTLS时逐段SSL_write，直到写完或socket缓冲区满
+int http_conn::sock_writev(struct iovec* iv, int count) {
+    if (!m_ssl || m_ktls_tx) {
+        return writev(m_socketfd, iv, count);
+    }
+    int total = 0;
+    for (int i = 0; i < count; ++i) {
+        int len = iv[i].iov_len;
+        int off = 0;
+        while (off < len) {
+            int n = sock_send((char*)iv[i].iov_base + off, len - off);
+            if (n < 0) {
+                return total > 0 ? total : -1;
+            }
+            off += n;
+            total += n;
+        }
+    }
+    return total;
+}
+
+int http_conn::sock_send(const char* buf, int len) {
+    if (!m_ssl || m_ktls_tx) {
+        return send(m_socketfd, buf, len, 0);
+    }
+    int n = SSL_write(m_ssl, buf, len);
+    if (n > 0) {
+        return n;
+    }
+    int err = SSL_get_error(m_ssl, n);
+    if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+        errno = EAGAIN;
+        return -1;
+    }
+    ERR_clear_error();
+    errno = EIO;
+    return -1;
+}
+
+// 写出HTTP/2会话的发送缓冲区，每次最多写WRITE_BUDGET字节，避免一个连接占满事件循环
+bool http_conn::write_h2() {
+    int budget = WRITE_BUDGET;
+    while (true) {
+        if (m_h2->out_len() == 0) {
+            m_h2->fill();
+        }
+        int len = m_h2->out_len();
+        if (len == 0) {
+            break;
+        }
+        if (m_stage != STAGE_WRITE) {
+            set_stage(STAGE_WRITE);
+        }
+        int n = sock_send(m_h2->out_data(), len);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                modfd(m_epollfd, m_socketfd, EPOLLIN | EPOLLOUT, m_handle);
+                return true;
+            }
+            return false;
+        }
+        m_h2->consume(n);
+        if (m_stats) {
+            m_stats->bytes_sent.fetch_add(n, std::memory_order_relaxed);
+        }
+        m_stage_start = time(NULL);     // 有写出进度，重新计算写超时
+        budget -= n;
+        if (budget <= 0) {
+            modfd(m_epollfd, m_socketfd, EPOLLIN | EPOLLOUT, m_handle);
+            return true;
+        }
+    }
+    if (m_h2->want_close()) {
+        return false;
+    }
+    // 没有待发送的数据：流都发完了就进入keep-alive空闲，否则在等对端的WINDOW_UPDATE
+    if (m_h2->idle()) {
+        if (m_h2->reading_frame()) {
+            if (m_stage != STAGE_HEADER) {
+                set_stage(STAGE_HEADER);
+            }
+        } else if (m_stage != STAGE_IDLE) {
+            set_stage(STAGE_IDLE);
+        }
+    }
+    modfd(m_epollfd, m_socketfd, EPOLLIN, m_handle);
+    return true;
+}
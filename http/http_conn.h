@@ -16,19 +16,65 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <stdint.h>
 #include "../timer/lst_timer.h"
+#include "../limit/ip_limiter.h"
+#include "../tls/tls_context.h"
+#include "../net/sock_addr.h"
+#include "response_writer.h"
+#include "request_handler.h"
+#include "router.h"
+#include "chunked_decoder.h"
+#include "buffer_pool.h"
+#include "url_path.h"
+#include "negative_cache.h"
+#include "content_coding.h"
+#include "mime_types.h"
+#include "variant_cache.h"
+#include "header_table.h"
+#include "asset_bundle.h"
+#include "file_cache.h"
+#include "single_flight.h"
+#include "wake_queue.h"
+#include "prefetch_pool.h"
+#include "shm_stats.h"
+#include "shm_stat_cache.h"
+#include "fd_waiters.h"
 class util_timer;
+class h2_session;
 
 class http_conn {
 public:
     static int m_epollfd ;      // 所有的socket上的事件都被注册到同意epollfd上
     static int m_user_count ;   // 统计已连接用户的数量
-    // util_timer* timer;
-    util_timer* timer;
+    static ip_limiter* m_limiter;   // 按IP限流，为NULL时不限制
+    static int m_max_conn;          // 连接数预算
+    static long m_mem_budget;       // 连接占用内存的预算(字节)，计算方法见over_budget
+    static int m_tls_count;         // HTTPS连接数，只在主线程中修改
+    static wake_queue* m_wake;      // 挂起的连接由主线程从这里取出重新处理，为NULL时连接不挂起
+    static prefetch_pool* m_prefetch;   // 发送前预读冷数据，为NULL时直接发送
+    static server_stats* m_server_stats;    // 共享内存中所有工作进程的计数器
+    static worker_stats* m_stats;           // 本进程的计数器，为NULL时不统计
+    static shm_stat_cache* m_stat_cache;    // 工作进程共用的文件元数据缓存，为NULL时直接stat
+    static volatile bool m_draining;        // 进程正在排空，响应后关闭连接
+    static fd_waiters* m_fd_waiters;        // 处理器等待的外部fd，为NULL时处理器不能挂起连接
+    util_timer timer;           // 连接的定时器，随连接对象一起分配
     static const int FILENAME_LEN = 200;        // 文件名的最大长度
     static const int READ_BUFFER_SIZE = 2048;
-    static const int WRITE_BUFFER_SIZE = 1024;
-    // HTTP请求方法，这里只支持GET
+    static const int WRITE_BUFFER_SIZE = 1024;     // 单行响应头格式化的最大长度
+    static const int WRITE_BUDGET = 256 * 1024;     // 一个连接每次写事件最多写出的字节数，超出后让出事件循环
+    static const long TLS_MEMORY = 32 * 1024;   // 一个TLS连接在OpenSSL中占用的内存(读写缓冲区和会话状态，估计值)
+    static const int BODY_BUFFER_SIZE = 64 * 1024;  // 请求体缓冲块的大小，块从缓冲池借用
+    static const int MISSING_TTL = 10;          // 不存在的路径在负缓存中保留的时间(秒)
+    static const long SPLICE_BUDGET = 8 * 1024 * 1024;  // 工作线程每次最多splice的请求体字节数
+    static const long COMPRESS_MIN = 256;       // 小于该大小的文件压缩不划算
+    static const long COMPRESS_MAX = 4 * 1024 * 1024;   // 大于该大小的文件不在工作线程中压缩，直接发送原文件
+    static const size_t FILE_CACHE_BYTES = 256 * 1024 * 1024;   // 文件缓存中映射的总字节数
+    static const size_t FILE_CACHE_ENTRIES = 8192;
+    static const size_t PREFETCH_CHECK = 256 * 1024;        // 每次writev前检查是否在页缓存中的字节数
+    static const size_t PREFETCH_MAX = 4 * 1024 * 1024;     // 一次预读的最大字节数
+    // HTTP请求方法，支持GET、HEAD，以及交给处理器的POST、PUT、DELETE、OPTIONS
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
 
     /*
@@ -49,53 +95,206 @@ public:
         FILE_REQUEST        :   文件请求,获取文件成功
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
+        UPGRADE_REQUEST     :   h2c升级请求，交给HTTP/2会话处理
+        HANDLER_REQUEST     :   处理器已经生成了响应
+        BODY_TOO_LARGE      :   请求体超过处理器允许的大小
+        METHOD_NOT_ALLOWED  :   没有处理该方法的处理器
+        PARKED_REQUEST      :   需要的文件正在被其他请求加载，连接挂起等待
+        HANDLER_WAIT        :   处理器在等待外部fd，连接挂起，fd就绪后继续
+        BAD_GATEWAY         :   处理器依赖的上游出错
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, UPGRADE_REQUEST,
+                     HANDLER_REQUEST, BODY_TOO_LARGE, METHOD_NOT_ALLOWED, PARKED_REQUEST, HANDLER_WAIT, BAD_GATEWAY };
     
     // 从状态机的三种可能状态，即行的读取状态，分别表示
     // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
 
+    /*
+        连接所处的阶段，每个阶段有各自的截止时间，读写事件不会无条件地延长定时器
+        STAGE_IDLE      :   keep-alive空闲，等待下一个请求
+        STAGE_HEADER    :   正在接收请求行和请求头，从第一个字节开始计时，不因收到数据而延长
+        STAGE_BODY      :   正在接收请求体，截止时间随收到的字节数按最低速率延长
+        STAGE_WRITE     :   正在发送响应，每次写出数据后重新计时
+        STAGE_UPSTREAM  :   处理器在等待上游的响应，每次有进度后重新计时
+    */
+    enum CONN_STAGE { STAGE_IDLE = 0, STAGE_HEADER, STAGE_BODY, STAGE_WRITE, STAGE_UPSTREAM };
+
+    /*
+        处理器挂起连接的位置，fd就绪后从这里继续
+        WAIT_BODY       :   接收请求体期间，上游暂时写不进去
+        WAIT_RESPONSE   :   on_complete，响应头还没有准备好
+        WAIT_PRODUCER   :   发送响应体期间，生产者暂时没有数据
+    */
+    enum WAIT_POINT { WAIT_NONE = 0, WAIT_BODY, WAIT_RESPONSE, WAIT_PRODUCER };
+
+    /*
+        写出发送队列的结果
+        FLUSH_DONE      :   响应全部写出
+        FLUSH_AGAIN     :   socket发送缓冲区已满，等待EPOLLOUT
+        FLUSH_BUDGET    :   本次的写预算用完，重新注册EPOLLOUT排到其他连接之后
+        FLUSH_WAIT      :   生产者暂时没有数据
+        FLUSH_ERROR     :   写出错或生产者失败，需要关闭连接
+        FLUSH_COLD      :   待发送的数据不在页缓存中，已交给I/O线程预读，读完后连接被重新提交给线程池
+    */
+    enum FLUSH_RESULT { FLUSH_DONE = 0, FLUSH_AGAIN, FLUSH_BUDGET, FLUSH_WAIT, FLUSH_ERROR, FLUSH_COLD };
+    static const int HEADER_TIMEOUT = 10;       // 请求头必须在该时间(秒)内接收完整
+    static const int BODY_TIMEOUT = 10;         // 请求体的基础时限(秒)
+    static const int BODY_MIN_RATE = 1024;      // 超过基础时限后请求体的最低速率(字节/秒)
+    static const int WRITE_TIMEOUT = 10;        // 发送响应时两次写出进度之间的最长间隔(秒)
+    static const int UPSTREAM_TIMEOUT = 30;     // 等待上游时两次进度之间的最长间隔(秒)
+    static const int KEEPALIVE_TIMEOUT = 15;    // keep-alive连接的最长空闲时间(秒)
+    static const int KEEPALIVE_MIN_TIMEOUT = 1; // 连接数接近预算时keep-alive空闲时间收缩到的下限(秒)
+
 public:
-    http_conn() {}
+    http_conn() : m_ssl(NULL), m_h2(NULL), m_handler(NULL), m_handler_factory(NULL), m_spare_handler(NULL),
+                  m_spare_factory(NULL), m_body_buf(NULL), m_parked(false),
+                  m_prefetching(false), m_prefetched(false), m_handler_wait(WAIT_NONE), m_idle(false), m_idle_prev(NULL), m_idle_next(NULL) {}
     ~http_conn() {}
-    void init(int socketfd, sockaddr_in& addr);  // 初始化新建立的连接
+    // 初始化新建立的连接，counted表示accept时on_accept为这个连接占用了并发名额
+    void init(int socketfd, const sock_addr& addr, uint64_t handle, bool counted);
     void close_conn();
-    void process(); // 主线程处理函数
+    void process(uint64_t handle); // 工作线程处理函数
+    uint64_t handle() const { return m_handle; }
+    // 工作线程在process期间持有连接，包括处理完回到空闲、重新注册事件之前的那一段。
+    // 主线程因超时、淘汰或排空关闭连接前用try_own取得它，取不到时跳过，关闭后disown
+    bool try_own() { return m_busy.try_lock(); }
+    void disown() { m_busy.unlock(); }
+    // HTTPS连接：在init之后调用，握手在工作线程中以非阻塞方式推进
+    void start_tls(SSL* ssl);
+    bool tls_handshaking() const { return m_ssl && !m_tls_ready; }
+    // 来自proxy监听的连接：在init之后调用，之后第一件事是读取PROXY协议v2头
+    void expect_proxy() { m_proxy_pending = true; }
+    bool proxy_pending() const { return m_proxy_pending; }
+    // 在主线程中读取PROXY头，用其中的客户端地址重新做IP准入；出错或被拒绝时返回false，
+    // 头还不完整时重新注册EPOLLIN并保持proxy_pending
+    bool read_proxy();
+    const sock_addr& address() const { return m_saddr; }
+    // 线程池已满，连接的任务没有入队：还没有开始响应的HTTP/1.1连接回应503，然后关闭读写两端，
+    // 主线程收到EPOLLRDHUP后回收。挂起的连接可能还被刚登记它的工作线程持有，所以不直接关闭
+    void reject_overloaded();
 
     // 非阻塞读写
     bool read();
     bool write();
 
+    time_t deadline() const;                  // 当前阶段的截止时间
+
+    // 把url映射为doc_root下的文件并按Accept-Encoding选择发送的版本，填充resp的响应体和实体头，
+    // HTTP/1.1和HTTP/2共用同一条文件路径。成功时返回FILE_REQUEST；
+    // 文件正在被其他请求加载且resp.can_wait时返回PARKED_REQUEST
+    static HTTP_CODE serve_file(const char* url, int accept_encoding, request_handler::response& resp);
+    // 在资源包中查找url，命中时按Accept-Encoding选择版本并填充resp，if_none_match与校验值相同时回应304
+    static bool serve_asset(const char* url, int accept_encoding, const str_view& if_none_match,
+                            request_handler::response& resp);
+    // 启动时加载资源包；之后定时调用reload_assets，文件被替换(rename)后原子地切换到新版本
+    static bool load_assets(const char* path);
+    static void reload_assets();
+    // 文件被创建或替换后调用，清除缓存中对应的记录，url为规范化之后的路径
+    static void file_created(const char* url) { file_changed(url, strcspn(url, "?"), false); }
+    // doc_root下的路径发生变化(inotify通知)，tree表示整棵子树
+    static void file_changed(const char* url, size_t len, bool tree);
+    // doc_root的所有目录都在inotify监视中时，文件缓存不再定期stat
+    static void set_watched(bool complete) { m_files.set_revalidate(!complete); }
+    // 启动预热：预先分配count个请求体缓冲块，在lock_budget字节内锁定，返回锁定的字节数
+    static size_t reserve_buffers(int count, size_t lock_budget);
+    // 按热点列表(每行一个url，从热到冷)把文件载入文件缓存并交给I/O线程预读，
+    // 最热的文件在lock_budget字节内锁定在内存中
+    static void prewarm(const char* list, size_t lock_budget);
+    // 把文件缓存中命中最多的count个url写入热点列表，退出时调用
+    static bool save_hot_list(const char* list, size_t count);
+    // 压缩版本的快照，平滑升级时旧进程保存，新进程启动时载入
+    static bool save_variants(const char* file) { return m_variants.save(file); }
+    static size_t load_variants(const char* file) { return m_variants.load(file); }
+    // 错误码对应的状态码、标题和页面内容
+    static int error_page(HTTP_CODE code, const char** title, const char** form);
+    // METHOD对应的名字，转发请求时使用
+    static const char* method_name(int method);
+    // 处理器关闭或归还它等待过的fd之前调用，之后fd上的事件不再唤醒任何连接
+    static void forget_fd(int fd) {
+        if (m_fd_waiters) {
+            m_fd_waiters->forget(m_epollfd, fd);
+        }
+    }
+
+    // 注册处理器，pattern的写法见router，在启动时调用；静态文件也是挂在"/*"上的一个处理器
+    static bool add_handler(METHOD method, const char* pattern, handler_factory factory);
+    static bool add_routes(const router::route* routes, int count);
+    // HTTP/2的流和HTTP/1.1的请求查同一张路由表
+    static router::RESULT route(int method, const char* url, handler_factory* factory, route_params* params) {
+        return m_router.match(method, url, factory, params);
+    }
+    // 路径上注册了处理器的方法，逗号分隔写入buf(64字节足够)，用于405响应的Allow头
+    static void allowed_methods(const char* url, char* buf, size_t len);
+
+    // 空闲的keep-alive连接按进入空闲的先后顺序组成LRU链表，由m_idle_lock保护。
+    // 工作线程处理完请求时就把连接放入链表，这时连接还归工作线程所有，淘汰时跳过
+    // 再接受一个连接是否会超出连接数或内存预算。内存包括连接对象本身和各连接动态占用的部分：
+    // 借出的请求体缓冲块、TLS状态、HTTP/2会话和发送队列的自有缓冲区
+    static bool over_budget();
+    // 最早进入空闲、且没有被工作线程持有的连接，返回时已经try_own，没有时返回NULL
+    static http_conn* idle_acquire();
+
 private:
     void init();                              // 初始化解析的设置
+    void set_stage(CONN_STAGE stage);
+    void idle_enter();
+    void idle_leave();
+    void process_task(uint64_t handle);
 
     HTTP_CODE process_read();                  // 解析http请求
     // 下面这一组函数被process_read调用以分析HTTP请求
     HTTP_CODE parse_request_line( char* text );
     HTTP_CODE parse_headers( char* text );
-    HTTP_CODE parse_content( char* text );
+    HTTP_CODE parse_content();
+    HTTP_CODE begin_body();
+    void release_handler();
+    HTTP_CODE feed_body(const char* data, size_t len);
+    HTTP_CODE splice_body();
+    bool splicing() const;                    // 请求体由处理器直接从socket搬运
+    bool handler_waiting() const;             // 处理器在等待外部fd
+    bool wait_handler();                      // 挂起连接等待处理器的fd，返回false表示无法等待
+    HTTP_CODE resume_handler();               // 处理器等待的fd就绪，从挂起的位置继续
+    static HTTP_CODE stat_file(const char* url, int path_len, char* real_file, struct stat* file_stat);
+    static HTTP_CODE mmap_file(const char* real_file, struct stat* file_stat, char** file_address);
+    static file_cache::file_ptr open_file(const char* url, int path_len, HTTP_CODE* code, request_handler::response& resp);
+    static file_cache::file_ptr load_file(const char* url, int path_len, HTTP_CODE* code);
+    static bool use_sidecar(const char* url, int path_len, const char* ext, const struct stat& origin,
+                            request_handler::response& resp);
     HTTP_CODE do_request();
+    void process_h2(uint64_t handle);
+    void handshake(uint64_t handle);
+    // socket读写，HTTPS连接在没有kTLS时经过SSL_read/SSL_write，语义与recv/writev/send一致
+    int sock_recv(char* buf, int len);
+    int sock_writev(struct iovec* iv, int count);
+    int sock_send(const char* buf, int len);
+    bool write_h2();
+    FLUSH_RESULT flush();                     // 从上次停下的位置继续写出发送队列
+    bool after_flush(FLUSH_RESULT ret);       // 按写出结果注册事件，返回false表示需要关闭连接
     char* get_line() { return m_read_buf + m_start_line; }
     LINE_STATUS parse_line();
 
     bool process_write(HTTP_CODE ret);    // 填充HTTP应答
     // 这一组函数被process_write调用以填充HTTP应答。
-    void unmmap();
     bool add_response( const char* format, ... );
     bool add_content( const char* content );
     bool add_content_type();
     bool add_status_line( int status, const char* title );
     bool add_headers( int content_length );
-    bool add_content_length( int content_length );
+    bool add_content_length( long content_length );
     bool add_linger();
+    bool add_allow();
     bool add_blank_line();
+    // 流式发送生成的响应体，写入响应头后由生产者按需填充
+    bool start_stream(request_handler::response& resp, response_writer::producer* p);
 
 private:
     int m_socketfd;           // 该http连接的socket
-    sockaddr_in m_saddr;    // 通信的socket的地址
+    volatile uint64_t m_handle; // 连接在slot_map中的句柄，槽位被复用后随之改变
+    sock_addr m_saddr;      // 客户端地址，PROXY头中的地址优先
+    bool m_counted;         // m_saddr在限流器中占用了一个并发名额，只有这时关闭才归还
+    bool m_proxy_pending;   // 还没有读到PROXY头
     char m_read_buf[READ_BUFFER_SIZE];
-    char m_write_buf[WRITE_BUFFER_SIZE];
     int m_read_idx;          // 读取的字符在缓冲区的位置
 
     int m_checked_index;        // 当前正在解析的字符在读缓冲区的位置
@@ -103,18 +302,64 @@ private:
     CHECK_STATE m_check_state;  // 主状态机当前所处的位置
 
     METHOD m_method;            // 请求方法
-    char m_read_file[FILENAME_LEN];       // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
     char* m_url;                // 请求的目标文件名
+    int m_header_start;         // 请求头原文在读缓冲区中的范围
+    int m_header_end;
     char* m_version;            // HTTP协议版本号，我们仅支持http1.1
     char* m_host;               // 主机名
-    int m_content_length;       // HTTP请求的消息体的长度
+    long m_content_length;      // HTTP请求的消息体的长度
+    bool m_chunked_body;        // 请求体使用chunked编码
+    bool m_expect_continue;     // 客户端等待100 Continue之后才发送请求体
     bool m_linger;              // HTTP请求是否要求保持连接
+    bool m_upgrade_h2c;         // 请求头中带有Upgrade: h2c
+    char* m_h2_settings;        // HTTP2-Settings请求头
+    int m_accept_encoding;      // Accept-Encoding解析出的CONTENT_CODING
+    str_view m_headers[HEADER_COUNT];   // 已知请求头的值，按HEADER_ID索引，指向读缓冲区
+    SSL* m_ssl;                 // HTTPS连接的TLS状态，明文连接为NULL
+    bool m_tls_ready;           // TLS握手是否已完成
+    bool m_ktls_tx;             // 发送方向是否已交给内核加密，是则直接写socket
+    bool m_ktls_rx;             // 接收方向是否已交给内核解密，是则直接读socket
+    h2_session* m_h2;           // 升级为HTTP/2后的会话，连接关闭时释放
+
+    request_handler* m_handler;         // 当前请求的处理器，没有时按静态文件处理
+    handler_factory m_handler_factory;
+    request_handler* m_spare_handler;   // 上一个请求留下的可复用处理器，同一个工厂的请求直接使用
+    handler_factory m_spare_factory;
+    request_handler::response m_response;
+    chunked_decoder m_chunked;
+    long m_body_remaining;      // Content-Length请求体还没有收到的字节数
+    long m_body_received;       // 已经交给处理器的请求体字节数
+    char* m_body_buf;           // 接收请求体期间从缓冲池借用的内存块
+    int m_body_len;
+    bool m_parked;              // 挂起等待文件加载，被唤醒后重新生成响应
+    std::string m_wait_key;     // 等待的文件的url
+    bool m_prefetching;         // 等待I/O线程预读发送队列中的数据
+    bool m_prefetched;          // 刚预读完，下一次writev不再检查，保证有进度
+    WAIT_POINT m_handler_wait;  // 处理器挂起连接的位置
+
+    response_writer m_writer;   // 待发送的响应：响应头、文件映射和生成的内容组成的段链
+
+    CONN_STAGE m_stage;         // 连接当前所处的阶段
+    time_t m_stage_start;       // 进入当前阶段的时间，写阶段为最近一次写出数据的时间
+    long m_stage_bytes;         // 当前阶段收到的字节数，用于计算请求体的最低速率
+
+    bool m_idle;                // 是否在空闲LRU链表中
+    http_conn* m_idle_prev;
+    http_conn* m_idle_next;
+    static http_conn* m_idle_head;  // 最早进入空闲的连接，预算不足时最先被关闭
+    static http_conn* m_idle_tail;
+    static locker m_idle_lock;      // 工作线程写完响应后直接进入空闲阶段，空闲链表需要加锁
+    locker m_busy;              // 工作线程处理期间持有
 
-    char* m_file_address;       // 客户请求的目标文件被mmap映射到内存中的起始位置
-    int m_write_idx;            // 写缓冲区中待发送的字节数
-    struct stat m_file_stat;    // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2];       // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
-    int m_iv_count;
+    static router m_router;         // 启动时建好，之后只读
+    static negative_cache m_missing;    // 最近stat失败的路径
+    static variant_cache m_variants;    // 静态文件gzip压缩后的版本
+    static file_cache m_files;          // 静态文件的stat结果和映射
+    static single_flight m_loads;       // 正在加载的文件，同一个文件同时只有一个请求在stat、mmap
+    static std::shared_ptr<asset_bundle> m_assets;  // 当前的资源包，没有时为空
+    static std::string m_assets_path;
+    static locker m_assets_lock;        // 只保护m_assets指针的读取和替换
+    static buffer_pool m_body_pool;     // 请求体缓冲块，连接只在接收请求体期间借用
 };
 
 #endif // !HTTP_CONN_H
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef MIME_TYPES_H
+#define MIME_TYPES_H
+
+#include <string.h>
+#include "perfect_hash.h"
+
+// 文件扩展名(key)对应的Content-Type，compressible表示值得压缩(文本类)
+struct mime_type {
+    const char* key;
+    const char* name;
+    bool compressible;
+};
+
+static constexpr mime_type MIME_TYPES[] = {
+    { "html",  "text/html; charset=utf-8",              true  },
+    { "htm",   "text/html; charset=utf-8",              true  },
+    { "css",   "text/css; charset=utf-8",               true  },
+    { "js",    "text/javascript; charset=utf-8",        true  },
+    { "mjs",   "text/javascript; charset=utf-8",        true  },
+    { "json",  "application/json",                      true  },
+    { "map",   "application/json",                      true  },
+    { "xml",   "application/xml",                       true  },
+    { "txt",   "text/plain; charset=utf-8",             true  },
+    { "csv",   "text/csv; charset=utf-8",               true  },
+    { "md",    "text/markdown; charset=utf-8",          true  },
+    { "svg",   "image/svg+xml",                         true  },
+    { "ico",   "image/x-icon",                          true  },
+    { "wasm",  "application/wasm",                      true  },
+    { "ttf",   "font/ttf",                              true  },
+    { "otf",   "font/otf",                              true  },
+    { "woff",  "font/woff",                             false },
+    { "woff2", "font/woff2",                            false },
+    { "png",   "image/png",                             false },
+    { "jpg",   "image/jpeg",                            false },
+    { "jpeg",  "image/jpeg",                            false },
+    { "gif",   "image/gif",                             false },
+    { "webp",  "image/webp",                            false },
+    { "avif",  "image/avif",                            false },
+    { "mp3",   "audio/mpeg",                            false },
+    { "mp4",   "video/mp4",                             false },
+    { "webm",  "video/webm",                            false },
+    { "pdf",   "application/pdf",                       false },
+    { "zip",   "application/zip",                       false },
+    { "gz",    "application/gzip",                      false },
+};
+
+static const int MIME_COUNT = sizeof(MIME_TYPES) / sizeof(MIME_TYPES[0]);
+static const int MIME_BITS = 7;
+static constexpr uint32_t MIME_SEED = ph_find_seed(MIME_TYPES, MIME_COUNT, MIME_BITS);
+static_assert(MIME_SEED != PH_NO_SEED, "no perfect hash seed for MIME_TYPES, increase MIME_BITS");
+
+static const mime_type MIME_DEFAULT = { "", "application/octet-stream", false };
+
+// 按路径最后一段的扩展名查找，没有扩展名或不认识时返回application/octet-stream
+static inline const mime_type* find_mime_type(const char* path) {
+    static const perfect_hash_table<mime_type, MIME_COUNT, MIME_BITS, MIME_SEED> table(MIME_TYPES);
+    const char* slash = strrchr(path, '/');
+    const char* dot = strrchr(slash ? slash : path, '.');
+    if (!dot) {
+        return &MIME_DEFAULT;
+    }
+    const mime_type* type = table.find(dot + 1, strlen(dot + 1));
+    return type ? type : &MIME_DEFAULT;
+}
+
+#endif
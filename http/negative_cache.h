@@ -0,0 +1,96 @@
+#ifndef NEGATIVE_CACHE_H
+#define NEGATIVE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "../pthreadpool/lcoker.h"
+
+/*
+    不存在的路径的缓存，命中时不再调用stat
+    - 按路径的64位哈希直接映射到固定数量的槽位，新记录覆盖旧记录，占用的内存固定
+    - 每条记录在ttl秒后过期；文件被创建时由创建者调用erase
+    - 分片加锁，工作线程之间很少竞争
+*/
+class negative_cache {
+public:
+    static const int SHARDS = 16;
+    static const int SLOTS = 1024;          // 每个分片的槽位数
+
+    explicit negative_cache(int ttl) : m_ttl(ttl) {
+        for (int i = 0; i < SHARDS; ++i) {
+            for (int j = 0; j < SLOTS; ++j) {
+                m_shards[i].slots[j].hash = 0;
+                m_shards[i].slots[j].expire = 0;
+            }
+        }
+    }
+
+    bool contains(const char* key, size_t len) {
+        uint64_t h = hash(key, len);
+        shard& s = m_shards[h % SHARDS];
+        entry& e = s.slots[(h / SHARDS) % SLOTS];
+        s.lock.lock();
+        bool hit = e.hash == h && e.expire > time(NULL);
+        s.lock.unlock();
+        return hit;
+    }
+
+    void insert(const char* key, size_t len) {
+        uint64_t h = hash(key, len);
+        shard& s = m_shards[h % SHARDS];
+        entry& e = s.slots[(h / SHARDS) % SLOTS];
+        s.lock.lock();
+        e.hash = h;
+        e.expire = time(NULL) + m_ttl;
+        s.lock.unlock();
+    }
+
+    void erase(const char* key, size_t len) {
+        uint64_t h = hash(key, len);
+        shard& s = m_shards[h % SHARDS];
+        entry& e = s.slots[(h / SHARDS) % SLOTS];
+        s.lock.lock();
+        if (e.hash == h) {
+            e.hash = 0;
+        }
+        s.lock.unlock();
+    }
+
+    // 整棵目录树可能发生变化时(目录被创建、移入，或者监视事件溢出)清空
+    void clear() {
+        for (int i = 0; i < SHARDS; ++i) {
+            m_shards[i].lock.lock();
+            for (int j = 0; j < SLOTS; ++j) {
+                m_shards[i].slots[j].hash = 0;
+            }
+            m_shards[i].lock.unlock();
+        }
+    }
+
+private:
+    // FNV-1a，0留作空槽位
+    static uint64_t hash(const char* key, size_t len) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (unsigned char)key[i];
+            h *= 1099511628211ULL;
+        }
+        return h ? h : 1;
+    }
+
+    struct entry {
+        uint64_t hash;
+        time_t expire;
+    };
+    struct shard {
+        locker lock;
+        entry slots[SLOTS];
+    };
+
+private:
+    int m_ttl;
+    shard m_shards[SHARDS];
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <strings.h>
+
+/*
+    固定关键字集合的完美哈希，种子在编译期搜索
+    - 关键字不区分大小写，哈希前统一转成小写
+    - ph_find_seed在编译期逐个尝试种子，直到所有关键字落在不同的槽位上；
+      找不到时返回PH_NO_SEED，由使用者static_assert报错，此时增大槽位数即可
+    - 查找时只做一次哈希和一次比较
+    关键字表是元素带有key成员(C字符串)的数组，C++11的constexpr函数只能有一条return语句，所以都写成递归
+*/
+static const uint32_t PH_NO_SEED = 0xffffffffu;
+static const uint32_t PH_MAX_SEED = 256;
+
+constexpr uint32_t ph_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (uint32_t)(c - 'A' + 'a') : (uint32_t)(unsigned char)c;
+}
+
+// 带种子的FNV-1a
+constexpr uint32_t ph_hash(const char* s, size_t len, uint32_t h) {
+    return len == 0 ? h : ph_hash(s + 1, len - 1, (h ^ ph_lower(*s)) * 16777619u);
+}
+
+constexpr size_t ph_strlen(const char* s) {
+    return *s ? 1 + ph_strlen(s + 1) : 0;
+}
+
+// 取乘法散列的高bits位作为槽位
+constexpr uint32_t ph_slot(const char* s, size_t len, uint32_t seed, int bits) {
+    return (ph_hash(s, len, 2166136261u ^ (seed * 0x9e3779b9u)) * 0x9e3779b1u) >> (32 - bits);
+}
+
+template <typename T>
+constexpr uint32_t ph_key_slot(const T* items, int i, uint32_t seed, int bits) {
+    return ph_slot(items[i].key, ph_strlen(items[i].key), seed, bits);
+}
+
+// items[i]和items[j..n)都不在同一个槽位
+template <typename T>
+constexpr bool ph_distinct(const T* items, int n, int i, int j, uint32_t seed, int bits) {
+    return j >= n || (ph_key_slot(items, i, seed, bits) != ph_key_slot(items, j, seed, bits) &&
+                      ph_distinct(items, n, i, j + 1, seed, bits));
+}
+
+template <typename T>
+constexpr bool ph_perfect(const T* items, int n, int i, uint32_t seed, int bits) {
+    return i >= n || (ph_distinct(items, n, i, i + 1, seed, bits) && ph_perfect(items, n, i + 1, seed, bits));
+}
+
+template <typename T>
+constexpr uint32_t ph_find_seed(const T* items, int n, int bits, uint32_t seed = 0) {
+    return seed >= PH_MAX_SEED ? PH_NO_SEED :
+           ph_perfect(items, n, 0, seed, bits) ? seed : ph_find_seed(items, n, bits, seed + 1);
+}
+
+/*
+    槽位到关键字下标的映射，在第一次使用时按编译期确定的种子填充一次，之后只读
+    SEED必须是ph_find_seed的结果
+*/
+template <typename T, int N, int BITS, uint32_t SEED>
+class perfect_hash_table {
+public:
+    static const int SLOTS = 1 << BITS;
+    static_assert(N <= SLOTS, "perfect hash: more keys than slots");
+
+    explicit perfect_hash_table(const T* items) : m_items(items), m_max_len(0) {
+        for (int i = 0; i < SLOTS; ++i) {
+            m_slots[i] = -1;
+        }
+        for (int i = 0; i < N; ++i) {
+            size_t len = ph_strlen(items[i].key);
+            m_slots[ph_slot(items[i].key, len, SEED, BITS)] = i;
+            m_lens[i] = len;
+            if (len > m_max_len) {
+                m_max_len = len;
+            }
+        }
+    }
+
+    // 不在集合中时返回NULL
+    const T* find(const char* key, size_t len) const {
+        if (len == 0 || len > m_max_len) {
+            return NULL;
+        }
+        int i = m_slots[ph_slot(key, len, SEED, BITS)];
+        if (i < 0 || m_lens[i] != len || strncasecmp(m_items[i].key, key, len) != 0) {
+            return NULL;
+        }
+        return &m_items[i];
+    }
+
+private:
+    const T* m_items;
+    short m_slots[SLOTS];
+    size_t m_lens[N];
+    size_t m_max_len;
+};
+
+#endif
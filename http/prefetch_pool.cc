@@ -0,0 +1,80 @@
+#include "prefetch_pool.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <exception>
+#include <sys/mman.h>
+
+prefetch_pool::prefetch_pool(int thread_number, wake_queue* wake) : m_wake(wake), m_stop(false) {
+    for (int i = 0; i < thread_number; ++i) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, this) != 0) {
+            throw std::exception();
+        }
+        pthread_detach(tid);
+    }
+}
+
+prefetch_pool::~prefetch_pool() {
+    m_stop = true;
+}
+
+bool prefetch_pool::submit(const char* data, size_t len, const response_writer::holder& owner, uint64_t handle, bool lock) {
+    task t;
+    t.data = data;
+    t.len = len;
+    t.owner = owner;
+    t.handle = handle;
+    t.lock = lock;
+    m_lock.lock();
+    if (m_tasks.size() >= MAX_PENDING) {
+        m_lock.unlock();
+        return false;
+    }
+    m_tasks.push_back(t);
+    m_lock.unlock();
+    m_stat.post();
+    return true;
+}
+
+void* prefetch_pool::worker(void* arg) {
+    prefetch_pool* pool = (prefetch_pool*)arg;
+    pool->run();
+    return pool;
+}
+
+void prefetch_pool::run() {
+    while (!m_stop) {
+        m_stat.wait();
+        m_lock.lock();
+        if (m_tasks.empty()) {
+            m_lock.unlock();
+            continue;
+        }
+        task t = m_tasks.front();
+        m_tasks.pop_front();
+        m_lock.unlock();
+        load(t.data, t.len, t.lock);
+        t.owner.reset();
+        if (t.handle != 0) {
+            m_wake->push(t.handle);
+        }
+    }
+}
+
+// 先让内核按整个区间发起预读，再逐页读一个字节等待数据到达
+void prefetch_pool::load(const char* data, size_t len, bool lock) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)data & ~(page - 1);
+    uintptr_t end = (uintptr_t)data + len;
+    madvise((void*)begin, end - begin, MADV_WILLNEED);
+    volatile char sink = 0;
+    for (uintptr_t p = begin; p < end; p += page) {
+        sink += *(const volatile char*)(p < (uintptr_t)data ? (uintptr_t)data : p);
+    }
+    (void)sink;
+    static volatile bool warned = false;
+    if (lock && mlock((void*)begin, end - begin) < 0 && !warned) {
+        warned = true;                  // 通常是超出了RLIMIT_MEMLOCK，只提示一次
+        perror("mlock");
+    }
+}
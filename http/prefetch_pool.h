@@ -0,0 +1,50 @@
+#ifndef PREFETCH_POOL_H
+#define PREFETCH_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include "response_writer.h"
+#include "wake_queue.h"
+#include "../pthreadpool/lcoker.h"
+
+/*
+    发送前把不在页缓存中的文件内容读入内存，缺页只发生在这里的I/O线程中，不阻塞事件循环和工作线程
+    - 区间由所有者(holder)保持有效，连接在等待期间被关闭也不影响
+    - 读完后把连接句柄交给wake_queue，由主线程重新提交给线程池继续发送；句柄为0时不唤醒(启动预热)
+    - 可以要求读完后锁定在内存中，区间的映射解除时自动解锁
+    - 排队的任务达到上限时submit返回false，调用者直接发送(缺页发生在调用者的线程中)
+*/
+class prefetch_pool {
+public:
+    static const size_t MAX_PENDING = 8192;
+
+    // 创建线程失败时抛出异常
+    prefetch_pool(int thread_number, wake_queue* wake);
+    ~prefetch_pool();
+
+    bool submit(const char* data, size_t len, const response_writer::holder& owner, uint64_t handle, bool lock = false);
+
+private:
+    struct task {
+        const char* data;
+        size_t len;
+        response_writer::holder owner;
+        uint64_t handle;
+        bool lock;
+    };
+
+    static void* worker(void* arg);
+    void run();
+    static void load(const char* data, size_t len, bool lock);
+
+private:
+    wake_queue* m_wake;
+    std::deque<task> m_tasks;
+    locker m_lock;
+    sem m_stat;
+    bool m_stop;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef REQUEST_HANDLER_H
+#define REQUEST_HANDLER_H
+
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "response_writer.h"
+#include "route_params.h"
+#include "header_table.h"
+#include "../net/sock_addr.h"
+
+/*
+    带请求体的请求(POST/PUT等)的处理器，每个请求创建一个，请求结束后释放(实现了recycle的由连接留给下一个请求)
+    请求体不经过读缓冲区整体缓存，而是按Content-Length或chunked解码后分段交给on_body，
+    每一段都在借自缓冲池的内存块中，on_body返回后即被复用，需要保留的数据必须自行拷贝
+    依赖外部fd(上游连接等)的处理器不阻塞工作线程：fd暂时读写不了时由wait_fd告诉连接，
+    连接挂起，fd就绪后在工作线程中继续(请求体阶段调用on_ready，之后重新调用on_complete或生产者)
+*/
+class request_handler {
+public:
+    static const long DEFAULT_MAX_BODY = 1024 * 1024;
+
+    // 处理器生成的响应
+    struct response {
+        response() : status(200), title("OK"), content_type("text/html"), content_encoding(NULL), vary_encoding(false),
+                     etag(NULL), raw_headers(NULL), raw_headers_len(0),
+                     producer(NULL), stream_length(-1), file_map(NULL), file_len(0), shared_data(NULL), shared_len(0),
+                     can_wait(false), can_splice(false) {}
+        // 释放没有交给发送队列的生产者、文件映射和共享数据块
+        void release() {
+            delete producer;
+            producer = NULL;
+            if (file_map) {
+                munmap(file_map, file_len);
+                file_map = NULL;
+            }
+            shared.reset();
+        }
+        int status;
+        const char* title;
+        const char* content_type;
+        const char* content_encoding;           // 不为NULL时发送Content-Encoding
+        bool vary_encoding;                     // 内容随Accept-Encoding变化，发送Vary: Accept-Encoding
+        const char* etag;                       // 不为NULL时发送ETag(带引号)
+        // 预先生成的实体头(每行以CRLF结尾)，不为NULL时代替上面几个字段和Content-Length原样发送
+        const char* raw_headers;
+        size_t raw_headers_len;
+        std::string body;                       // producer为NULL时作为完整的响应体发送
+        response_writer::producer* producer;    // 不为NULL时流式发送，由发送队列释放
+        // 生产者的响应体长度：-1时以chunked编码发送，否则发送Content-Length，生产者必须恰好产生这么多字节
+        long stream_length;
+        void* file_map;                         // mmap的文件内容，接在body之后发送，由发送队列munmap
+        size_t file_len;
+        // 缓存或资源包中的内容，接在body之后发送，shared保持它有效
+        response_writer::holder shared;
+        const char* shared_data;
+        size_t shared_len;
+        // 连接可以挂起等待时为true(由连接设置)。需要的文件正在被其他请求加载时，
+        // 处理器把它的url放入wait_for并返回，连接挂起，加载结束后再次调用on_complete
+        bool can_wait;
+        std::string wait_for;
+        // 生产者可以向发送队列追加管道段时为true(由连接设置)：明文连接或内核加密的kTLS连接
+        bool can_splice;
+    };
+
+public:
+    request_handler() : m_headers(NULL), m_header_block(NULL), m_header_block_len(0), m_tls(false), m_accept_encoding(0) {}
+    virtual ~request_handler() {}
+
+    // 路由匹配出的路径参数，在on_begin之前设置
+    void set_params(const route_params& params) { m_params = params; }
+    // 已知请求头的值，按HEADER_ID索引，数组属于连接，在on_begin之前设置
+    void set_headers(const str_view* headers) { m_headers = headers; }
+    // 请求头的原文(不含请求行)，包括不认识的请求头，每行以两个'\0'结尾(解析时CRLF被替换)，在on_begin之前设置
+    void set_header_block(const char* data, size_t len) {
+        m_header_block = data;
+        m_header_block_len = len;
+    }
+    // 客户端地址(PROXY头中的地址优先)和是否是HTTPS连接，在on_begin之前设置
+    void set_client(const sock_addr& addr, bool tls) {
+        m_client = addr;
+        m_tls = tls;
+    }
+    // 客户端接受的内容编码(CONTENT_CODING按位组合)，在on_begin之前设置
+    void set_accept_encoding(int codings) { m_accept_encoding = codings; }
+
+    // 请求体的上限(字节)，超过时返回413
+    virtual long max_body_size() const { return DEFAULT_MAX_BODY; }
+
+    // 请求头解析完成，content_length为-1表示chunked请求体。返回false时回应400
+    virtual bool on_begin(int method, const char* url, long content_length) { return true; }
+
+    // 收到一段请求体，返回false时回应400
+    virtual bool on_body(const char* data, size_t len) = 0;
+
+    // 返回true时Content-Length请求体不经过用户态缓冲区，由splice_body直接从socket搬走
+    // (chunked请求体和没有kTLS的HTTPS连接仍然走on_body)
+    virtual bool wants_splice() const { return false; }
+
+    // 从socket搬运最多max字节，返回值与splice(2)相同：0表示对端关闭，-1且errno为EAGAIN表示暂时没有数据
+    // (或者在等待wait_fd)，errno为EPIPE表示上游出错，回应502
+    virtual long splice_body(int sockfd, long max) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    // 请求体接收完毕，填充响应。返回时wait_fd()不为-1表示响应还没有准备好，fd就绪后再次调用
+    virtual void on_complete(response& resp) = 0;
+
+    // 处理器正在等待的fd和事件(EPOLLIN/EPOLLOUT)，不需要等待时返回-1。
+    // on_body、splice_body、on_complete和生产者(返回WAIT时)之后由连接检查
+    virtual int wait_fd(uint32_t* events) const { return -1; }
+
+    // 请求体阶段等待的fd就绪，返回false时回应502
+    virtual bool on_ready() { return true; }
+
+    // 请求结束时清除本次请求的状态，返回true时连接保留这个对象，下一个路由到同一工厂的请求不再创建
+    virtual bool recycle() { return false; }
+
+    // 返回true表示不需要请求体、不等待外部fd，on_complete同步生成完整的响应(不使用producer)，
+    // 这样的处理器也在HTTP/2的流上提供，其余的路由在HTTP/2上要求客户端改用HTTP/1.1
+    virtual bool serves_h2() const { return false; }
+
+protected:
+    // 请求中没有该请求头时返回空片段
+    str_view header(HEADER_ID id) const { return m_headers ? m_headers[id] : str_view(); }
+
+    // 依次取出请求头原文中的每一行，没有更多时返回false
+    bool next_header(size_t* pos, const char** line, size_t* len) const {
+        const char* end = m_header_block + m_header_block_len;
+        const char* p = m_header_block + *pos;
+        while (p < end && *p == '\0') {
+            ++p;
+        }
+        if (p >= end) {
+            return false;
+        }
+        *line = p;
+        *len = strlen(p);
+        *pos = p + *len - m_header_block;
+        return true;
+    }
+
+protected:
+    route_params m_params;
+    const str_view* m_headers;
+    const char* m_header_block;
+    size_t m_header_block_len;
+    sock_addr m_client;
+    bool m_tls;
+    int m_accept_encoding;
+};
+
+// 创建处理器的工厂函数，按方法和路径模式注册到路由表
+typedef request_handler* (*handler_factory)();
+
+#endif
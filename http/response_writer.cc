@@ -0,0 +1,344 @@
+#include "response_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+std::atomic<long> response_writer::m_owned_total(0);
+
+void response_writer::reset() {
+    while (m_count > 0) {
+        pop_front();
+    }
+    m_queued = 0;
+    m_chunked = false;
+    m_piping = false;
+    delete m_producer;
+    m_producer = NULL;
+    m_waiting = false;
+}
+
+void response_writer::release(segment& seg) {
+    if (seg.owned) {
+        m_owned_total.fetch_sub(seg.cap, std::memory_order_relaxed);
+        free(seg.owned);
+    }
+    if (seg.map) {
+        munmap(seg.map, seg.map_len);
+    }
+    if (seg.head && --m_head_segs == 0) {
+        m_head_used = 0;
+    }
+    seg = segment();
+}
+
+void response_writer::pop_front() {
+    release(m_segs[m_first]);
+    m_first = (m_first + 1) % MAX_SEGS;
+    --m_count;
+}
+
+// 段数已满时释放seg并返回false
+bool response_writer::push(segment& seg) {
+    if (seg.head) {
+        ++m_head_segs;
+    }
+    if (m_count == MAX_SEGS) {
+        release(seg);
+        return false;
+    }
+    at(m_count++) = seg;
+    m_queued += seg.len;
+    return true;
+}
+
+// 拷贝到队尾的自有缓冲区；先用内嵌缓冲区，都放不下时再分配一块
+bool response_writer::append_raw(const char* data, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    if (m_count > 0) {
+        segment& tail = at(m_count - 1);
+        char* end = (char*)tail.data + tail.len;
+        if ((tail.owned && end + len <= tail.owned + tail.cap) ||
+            (tail.head && end == m_head + m_head_used && m_head_used + len <= HEAD_BUFFER)) {
+            memcpy(end, data, len);
+            tail.len += len;
+            m_queued += len;
+            if (tail.head) {
+                m_head_used += len;
+            }
+            return true;
+        }
+    }
+    segment seg;
+    if (m_head_used + len <= HEAD_BUFFER) {
+        seg.head = true;
+        seg.data = m_head + m_head_used;
+        seg.len = len;
+        memcpy(m_head + m_head_used, data, len);
+        m_head_used += len;
+        return push(seg);
+    }
+    seg.cap = len > OWNED_CHUNK ? len : OWNED_CHUNK;
+    seg.owned = (char*)malloc(seg.cap);
+    if (!seg.owned) {
+        return false;
+    }
+    m_owned_total.fetch_add(seg.cap, std::memory_order_relaxed);
+    memcpy(seg.owned, data, len);
+    seg.data = seg.owned;
+    seg.len = len;
+    return push(seg);
+}
+
+bool response_writer::append(const char* data, size_t len) {
+    if (!m_chunked) {
+        return append_raw(data, len);
+    }
+    if (len == 0) {
+        // 长度为0的块表示结束，不能用来发送空数据
+        return true;
+    }
+    char line[24];
+    int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+    return append_raw(line, n) && append_raw(data, len) && append_raw("\r\n", 2);
+}
+
+bool response_writer::append_printf(const char* format, ...) {
+    char buf[1024];
+    va_list arg_list;
+    va_start(arg_list, format);
+    va_list copy;
+    va_copy(copy, arg_list);
+    int len = vsnprintf(buf, sizeof(buf), format, arg_list);
+    va_end(arg_list);
+    if (len < 0) {
+        va_end(copy);
+        return false;
+    }
+    if (len < (int)sizeof(buf)) {
+        va_end(copy);
+        return append(buf, len);
+    }
+    // 超出栈上缓冲区的长度，按实际长度分配
+    char* big = (char*)malloc(len + 1);
+    if (!big) {
+        va_end(copy);
+        return false;
+    }
+    vsnprintf(big, len + 1, format, copy);
+    va_end(copy);
+    bool ret = append(big, len);
+    free(big);
+    return ret;
+}
+
+bool response_writer::append_mapping(void* map, size_t map_len, size_t offset, size_t len) {
+    segment seg;
+    seg.map = map;
+    seg.map_len = map_len;
+    seg.data = (const char*)map + offset;
+    seg.len = len;
+    if (len == 0) {
+        release(seg);
+        return true;
+    }
+    if (m_chunked) {
+        char line[24];
+        int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+        if (!append_raw(line, n)) {
+            release(seg);
+            return false;
+        }
+        return push(seg) && append_raw("\r\n", 2);
+    }
+    return push(seg);
+}
+
+bool response_writer::append_file(int fd, off_t offset, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    // mmap的偏移必须按页对齐
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t aligned = offset & ~(page - 1);
+    size_t map_len = len + (offset - aligned);
+    void* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, aligned);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    return append_mapping(map, map_len, offset - aligned, len);
+}
+
+bool response_writer::append_blob(const blob& data, size_t offset, size_t len) {
+    return append_shared(data->data() + offset, len, data);
+}
+
+bool response_writer::append_shared(const char* data, size_t len, const holder& owner) {
+    if (len == 0) {
+        return true;
+    }
+    segment seg;
+    seg.shared = owner;
+    seg.data = data;
+    seg.len = len;
+    if (m_chunked) {
+        char line[24];
+        int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+        if (!append_raw(line, n)) {
+            return false;
+        }
+        return push(seg) && append_raw("\r\n", 2);
+    }
+    return push(seg);
+}
+
+bool response_writer::append_pipe(int pipe_fd, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    segment seg;
+    seg.pipe = pipe_fd;
+    seg.len = len;
+    if (m_chunked) {
+        char line[24];
+        int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+        if (!append_raw(line, n)) {
+            return false;
+        }
+        if (!push(seg)) {
+            return false;
+        }
+        m_piping = true;
+        return append_raw("\r\n", 2);
+    }
+    if (!push(seg)) {
+        return false;
+    }
+    m_piping = true;
+    return true;
+}
+
+int response_writer::front_pipe(size_t* len) const {
+    if (m_count == 0 || at(0).pipe < 0) {
+        return -1;
+    }
+    *len = at(0).len;
+    return at(0).pipe;
+}
+
+bool response_writer::end_chunked() {
+    if (!m_chunked) {
+        return true;
+    }
+    m_chunked = false;
+    return append_raw("0\r\n\r\n", 5);
+}
+
+void response_writer::set_producer(producer* p) {
+    delete m_producer;
+    m_producer = p;
+    m_waiting = false;
+}
+
+bool response_writer::pump() {
+    while (m_producer && !m_waiting && !full()) {
+        size_t before = m_queued;
+        producer::STATUS status = m_producer->produce(*this);
+        if (status == producer::FAILED) {
+            return false;
+        }
+        if (status == producer::DONE) {
+            delete m_producer;
+            m_producer = NULL;
+            return end_chunked();
+        }
+        if (status == producer::WAIT) {
+            m_waiting = true;
+            break;
+        }
+        if (m_queued == before) {
+            // 返回MORE却没有产生数据，等下一次可写时再调用，避免空转
+            break;
+        }
+    }
+    return true;
+}
+
+int response_writer::fill_iov(struct iovec* iv, int max) const {
+    int count = 0;
+    for (int i = 0; i < m_count && count < max; ++i) {
+        const segment& seg = at(i);
+        if (seg.pipe >= 0) {
+            break;
+        }
+        iv[count].iov_base = (void*)seg.data;
+        iv[count].iov_len = seg.len;
+        ++count;
+    }
+    return count;
+}
+
+void response_writer::consume(size_t n) {
+    while (n > 0 && m_count > 0) {
+        segment& seg = at(0);
+        if (n < seg.len) {
+            seg.data += n;
+            seg.len -= n;
+            m_queued -= n;
+            return;
+        }
+        n -= seg.len;
+        m_queued -= seg.len;
+        if (seg.pipe >= 0) {
+            m_piping = false;
+        }
+        pop_front();
+    }
+}
+
+// 返回[data, data+len)中第一个不在内存中的页相对于data的偏移，都在内存中时返回len
+static size_t first_cold(const char* data, size_t len) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)data & ~(page - 1);
+    uintptr_t end = (uintptr_t)data + len;
+    unsigned char vec[128];
+    while (begin < end) {
+        size_t pages = (end - begin + page - 1) / page;
+        if (pages > sizeof(vec)) {
+            pages = sizeof(vec);
+        }
+        if (mincore((void*)begin, pages * page, vec) < 0) {
+            return len;                 // 无法判断时按在内存中处理
+        }
+        for (size_t i = 0; i < pages; ++i, begin += page) {
+            if (!(vec[i] & 1)) {
+                return begin > (uintptr_t)data ? begin - (uintptr_t)data : 0;
+            }
+        }
+    }
+    return len;
+}
+
+bool response_writer::find_cold(size_t window, size_t max_len, const char** data, size_t* len, holder* owner) const {
+    for (int i = 0; i < m_count && window > 0; ++i) {
+        const segment& seg = at(i);
+        size_t n = seg.len < window ? seg.len : window;
+        window -= n;
+        if (!seg.shared) {
+            continue;
+        }
+        size_t cold = first_cold(seg.data, n);
+        if (cold < n) {
+            *data = seg.data + cold;
+            *len = seg.len - cold < max_len ? seg.len - cold : max_len;
+            *owner = seg.shared;
+            return true;
+        }
+    }
+    return false;
+}
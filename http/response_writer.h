@@ -0,0 +1,137 @@
+#ifndef RESPONSE_WRITER_H
+#define RESPONSE_WRITER_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <atomic>
+
+/*
+    HTTP/1.1响应的发送队列，由若干iovec段组成
+    - 自有缓冲区：格式化的响应头、生成的内容，小块数据合并到队尾的缓冲区中。
+      先使用内嵌的缓冲区，放不下时才分配内存；段放在固定大小的环形数组中，普通的响应不分配内存
+    - 文件区间：mmap映射的文件内容，发送完后munmap
+    - 共享数据块：缓存或资源包中的内容，以引用计数的方式持有其所有者，不拷贝
+    - 管道段：生产者splice进管道的数据，发送时从管道直接splice到socket，不经过用户态
+    开启chunked后，之后追加的每一段数据都按Transfer-Encoding: chunked分块。
+    生成内容的一方以producer的形式挂在队列上，只有排队的数据低于高水位时才会被调用，
+    socket写不动时生产者随之暂停，内容生成多少就发送多少，不需要先缓存整个响应体。
+*/
+class response_writer {
+public:
+    typedef std::shared_ptr<const std::string> blob;
+    typedef std::shared_ptr<const void> holder;     // 共享内存的所有者，最后一个引用释放时回收
+
+    static const size_t HIGH_WATERMARK = 64 * 1024;    // 排队的字节数达到该值时暂停生产者
+    static const size_t OWNED_CHUNK = 4096;            // 自有缓冲区的分配粒度
+    static const size_t HEAD_BUFFER = 1024;            // 内嵌缓冲区的大小，响应头和小的生成内容放在这里
+    static const int MAX_SEGS = 16;                     // 队列中最多的段数
+    static const int MAX_IOV = 64;                      // 一次writev最多的段数
+
+    // 响应体的生产者，由发送方在队列有空间时调用
+    class producer {
+    public:
+        /*
+            MORE    :   还有数据，队列有空间时继续调用
+            WAIT    :   暂时没有数据，由生产者的所有者在数据就绪后重新注册EPOLLOUT
+            DONE    :   响应体结束
+            FAILED  :   生成失败，连接需要关闭
+        */
+        enum STATUS { MORE, WAIT, DONE, FAILED };
+        virtual ~producer() {}
+        virtual STATUS produce(response_writer& w) = 0;
+    };
+
+public:
+    response_writer() : m_first(0), m_count(0), m_head_used(0), m_head_segs(0), m_queued(0), m_chunked(false),
+                        m_piping(false), m_producer(NULL), m_waiting(false) {}
+    ~response_writer() { reset(); }
+
+    // 释放所有段和生产者，连接复用或关闭时调用
+    void reset();
+
+    // 追加数据，开启chunked时自动加上分块的长度行和结尾的CRLF
+    bool append(const char* data, size_t len);
+    bool append_printf(const char* format, ...);
+    // 追加一段已经mmap的文件内容，发送完后由队列munmap(map, map_len)
+    bool append_mapping(void* map, size_t map_len, size_t offset, size_t len);
+    // 映射文件的[offset, offset+len)区间并追加
+    bool append_file(int fd, off_t offset, size_t len);
+    // 追加共享数据块的[offset, offset+len)区间
+    bool append_blob(const blob& data, size_t offset, size_t len);
+    // 追加由owner保持有效的一段内存
+    bool append_shared(const char* data, size_t len, const holder& owner);
+    // 追加管道中的len字节。管道属于生产者，段发送完之前必须保持打开；队列中同时只能有一个管道段
+    bool append_pipe(int pipe_fd, size_t len);
+    bool piping() const { return m_piping; }
+    // 队头是管道段时返回管道和剩余字节数，否则返回-1
+    int front_pipe(size_t* len) const;
+
+    // 之后追加的数据按chunked编码，end_chunked追加结束块
+    void start_chunked() { m_chunked = true; }
+    bool end_chunked();
+    bool chunked() const { return m_chunked; }
+
+    // 挂上生产者，队列接管它的生命周期
+    void set_producer(producer* p);
+    // 在队列有空间时调用生产者，生产者失败时返回false
+    bool pump();
+    bool waiting() const { return m_waiting; }      // 生产者在等待数据
+    void resume() { m_waiting = false; }
+    bool producing() const { return m_producer != NULL; }
+
+    // 背压：排队的数据超过高水位，或者剩下的段不够追加一个chunked分块(长度行、数据、CRLF)
+    bool full() const { return m_queued >= HIGH_WATERMARK || m_count > MAX_SEGS - 3; }
+    // 所有队列分配的自有缓冲区的总字节数，计入连接的内存预算
+    static long owned_total() { return m_owned_total.load(std::memory_order_relaxed); }
+    bool empty() const { return m_count == 0; }
+    size_t queued() const { return m_queued; }
+
+    // 把待发送的段填入iv，返回段数，遇到管道段时停止
+    int fill_iov(struct iovec* iv, int max) const;
+    // 已经发送了n个字节，释放发送完的段
+    void consume(size_t n);
+
+    // 队列前window字节中第一段不在页缓存中的共享数据(最长max_len)，都在内存中时返回false。
+    // 只检查共享数据块，自有缓冲区总在内存中，文件区间由队列持有，不能交给其他线程访问
+    bool find_cold(size_t window, size_t max_len, const char** data, size_t* len, holder* owner) const;
+
+private:
+    struct segment {
+        segment() : data(NULL), len(0), head(false), owned(NULL), cap(0), map(NULL), map_len(0), pipe(-1) {}
+        const char* data;       // 下一个待发送的字节
+        size_t len;             // 剩余字节数
+        bool head;              // 数据在内嵌缓冲区中
+        char* owned;            // 分配的自有缓冲区，cap为容量
+        size_t cap;
+        void* map;              // 文件映射
+        size_t map_len;
+        holder shared;          // 共享数据块的所有者
+        int pipe;               // 管道段的读端，data不使用
+    };
+
+    bool append_raw(const char* data, size_t len);
+    bool push(segment& seg);
+    void release(segment& seg);
+    segment& at(int i) { return m_segs[(m_first + i) % MAX_SEGS]; }
+    const segment& at(int i) const { return m_segs[(m_first + i) % MAX_SEGS]; }
+    void pop_front();
+
+private:
+    segment m_segs[MAX_SEGS];   // 环形数组，m_first为队头
+    int m_first;
+    int m_count;
+    char m_head[HEAD_BUFFER];
+    size_t m_head_used;         // 内嵌缓冲区已用的字节数，其中的段都发送完后从头复用
+    int m_head_segs;            // 使用内嵌缓冲区的段数
+    size_t m_queued;            // 排队的总字节数
+    bool m_chunked;
+    bool m_piping;              // 队列中有管道段
+    producer* m_producer;
+    bool m_waiting;
+    static std::atomic<long> m_owned_total;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef ROUTE_PARAMS_H
+#define ROUTE_PARAMS_H
+
+#include <string.h>
+#include <stddef.h>
+
+// 不拥有内存的字符串片段，指向读缓冲区中的请求行或请求头，请求处理期间有效
+struct str_view {
+    str_view() : ptr(NULL), len(0) {}
+    str_view(const char* p, size_t n) : ptr(p), len(n) {}
+    const char* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    bool equals(const char* s) const { return strlen(s) == len && memcmp(s, ptr, len) == 0; }
+
+    const char* ptr;
+    size_t len;
+};
+
+// 路由匹配出的路径参数：模式中的":name"匹配一段路径，"*"匹配剩余的全部路径
+struct route_params {
+    static const int MAX_PARAMS = 8;
+
+    route_params() : count(0), pattern(NULL) {}
+
+    // 按名字取参数，不存在时返回空片段
+    str_view get(const char* name) const {
+        for (int i = 0; i < count; ++i) {
+            if (names[i].equals(name)) {
+                return values[i];
+            }
+        }
+        return str_view();
+    }
+
+    int count;
+    str_view names[MAX_PARAMS];
+    str_view values[MAX_PARAMS];
+    const char* pattern;        // 匹配到的路由模式，同一个处理器挂在多个模式上时据此区分
+};
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string.h>
+#include "request_handler.h"
+#include "route_params.h"
+
+/*
+    按方法和路径把请求分派给处理器的路由表，路径按'/'切成段组成前缀树
+    - 普通段精确匹配，":name"匹配任意一段并作为参数，"*"只能在最后，匹配剩余的全部路径(可以为空)
+    - "*.php"这样带后缀的通配同样只能在最后，匹配以该后缀结尾的剩余路径，挂在根上时匹配"/a/b/index.php"
+    - 同一位置优先尝试普通段，其次参数段，最后通配(带后缀的优先)，前面的分支匹配失败时回溯
+    - 节点放在固定大小的数组中，路由在启动时从静态的路由表一次建好，查找不分配内存
+    - 查询字符串('?'之后)不参与匹配
+*/
+class router {
+public:
+    static const int MAX_NODES = 256;
+    static const int MAX_METHODS = 8;       // 与http_conn::METHOD的取值范围一致
+
+    /*
+        FOUND               :   找到了处理器
+        NOT_FOUND           :   没有匹配的路径
+        METHOD_NOT_ALLOWED  :   路径匹配，但没有为该方法注册处理器
+    */
+    enum RESULT { FOUND, NOT_FOUND, METHOD_NOT_ALLOWED };
+
+    // 静态路由表中的一项
+    struct route {
+        int method;
+        const char* pattern;
+        handler_factory factory;
+    };
+
+public:
+    router() : m_count(1) {
+        clear_node(0, LITERAL, "", 0);
+    }
+
+    // pattern必须在路由表的生命周期内有效，通常是字符串常量
+    bool add(int method, const char* pattern, handler_factory factory) {
+        if (method < 0 || method >= MAX_METHODS || pattern[0] != '/') {
+            return false;
+        }
+        int n = 0;
+        const char* p = pattern;
+        while (*p) {
+            while (*p == '/') {
+                ++p;
+            }
+            if (!*p) {
+                break;
+            }
+            const char* end = strchr(p, '/');
+            int len = end ? end - p : strlen(p);
+            KIND kind = LITERAL;
+            if (p[0] == ':') {
+                kind = PARAM;
+            } else if (p[0] == '*') {
+                if (end || memchr(p + 1, '*', len - 1)) {
+                    return false;           // 通配只能是最后一段
+                }
+                kind = WILDCARD;
+            }
+            n = child(n, kind, p, len);
+            if (n < 0) {
+                return false;
+            }
+            p += len;
+        }
+        m_nodes[n].handlers[method] = factory;
+        m_nodes[n].pattern = pattern;
+        return true;
+    }
+
+    bool add(const route* routes, int count) {
+        for (int i = 0; i < count; ++i) {
+            if (!add(routes[i].method, routes[i].pattern, routes[i].factory)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // HEAD没有单独注册时使用GET的处理器
+    RESULT match(int method, const char* url, handler_factory* factory, route_params* params) const {
+        const char* end = url + strcspn(url, "?");
+        bool path_hit = false;
+        params->count = 0;
+        if (walk(0, url, end, method, factory, params, &path_hit)) {
+            return FOUND;
+        }
+        if (method == HEAD_METHOD) {
+            params->count = 0;
+            if (walk(0, url, end, GET_METHOD, factory, params, &path_hit)) {
+                return FOUND;
+            }
+        }
+        return path_hit ? METHOD_NOT_ALLOWED : NOT_FOUND;
+    }
+
+    // 路径上注册了处理器的方法，第i位对应方法i，用于405响应的Allow头
+    int allowed(const char* url) const {
+        int mask = 0;
+        handler_factory factory;
+        route_params params;
+        for (int m = 0; m < MAX_METHODS; ++m) {
+            if (match(m, url, &factory, &params) == FOUND) {
+                mask |= 1 << m;
+            }
+        }
+        return mask;
+    }
+
+private:
+    enum KIND { LITERAL, PARAM, WILDCARD };
+    static const int GET_METHOD = 0;
+    static const int HEAD_METHOD = 2;
+
+    struct node {
+        KIND kind;
+        const char* seg;            // 普通段的内容，参数段为名字(不含':')，通配为后缀(不含'*')
+        int seg_len;
+        const char* pattern;        // 注册到这个节点的模式
+        int first_child;
+        int next_sibling;
+        handler_factory handlers[MAX_METHODS];
+    };
+
+    void clear_node(int n, KIND kind, const char* seg, int len) {
+        m_nodes[n].kind = kind;
+        m_nodes[n].seg = seg;
+        m_nodes[n].seg_len = len;
+        m_nodes[n].first_child = -1;
+        m_nodes[n].next_sibling = -1;
+        m_nodes[n].pattern = NULL;
+        for (int i = 0; i < MAX_METHODS; ++i) {
+            m_nodes[n].handlers[i] = NULL;
+        }
+    }
+
+    // 找到或创建子节点，节点用完时返回-1
+    int child(int parent, KIND kind, const char* seg, int len) {
+        if (kind != LITERAL) {
+            ++seg;
+            --len;
+        }
+        for (int c = m_nodes[parent].first_child; c != -1; c = m_nodes[c].next_sibling) {
+            if (m_nodes[c].kind == kind && (kind == PARAM ||
+                (m_nodes[c].seg_len == len && memcmp(m_nodes[c].seg, seg, len) == 0))) {
+                return c;
+            }
+        }
+        if (m_count >= MAX_NODES) {
+            return -1;
+        }
+        int n = m_count++;
+        clear_node(n, kind, seg, len);
+        m_nodes[n].next_sibling = m_nodes[parent].first_child;
+        m_nodes[parent].first_child = n;
+        return n;
+    }
+
+    bool has_handler(int n) const {
+        for (int i = 0; i < MAX_METHODS; ++i) {
+            if (m_nodes[n].handlers[i]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 到达节点n时检查是否注册了该方法
+    bool accept(int n, int method, handler_factory* factory, route_params* params, bool* path_hit) const {
+        if (m_nodes[n].handlers[method]) {
+            *factory = m_nodes[n].handlers[method];
+            params->pattern = m_nodes[n].pattern;
+            return true;
+        }
+        if (has_handler(n)) {
+            *path_hit = true;
+        }
+        return false;
+    }
+
+    bool walk(int n, const char* p, const char* end, int method,
+              handler_factory* factory, route_params* params, bool* path_hit) const {
+        while (p < end && *p == '/') {
+            ++p;
+        }
+        if (p == end) {
+            // "*"也可以匹配空的剩余路径
+            return accept(n, method, factory, params, path_hit) ||
+                   match_wildcards(n, p, end, method, factory, params, path_hit);
+        }
+        const char* seg_end = (const char*)memchr(p, '/', end - p);
+        if (!seg_end) {
+            seg_end = end;
+        }
+        int len = seg_end - p;
+        // 先试普通段，其次参数段，最后是通配
+        for (int kind = LITERAL; kind <= PARAM; ++kind) {
+            for (int c = m_nodes[n].first_child; c != -1; c = m_nodes[c].next_sibling) {
+                const node& ch = m_nodes[c];
+                if (ch.kind != kind) {
+                    continue;
+                }
+                if (kind == LITERAL) {
+                    if (ch.seg_len == len && memcmp(ch.seg, p, len) == 0 &&
+                        walk(c, seg_end, end, method, factory, params, path_hit)) {
+                        return true;
+                    }
+                } else if (kind == PARAM) {
+                    if (params->count >= route_params::MAX_PARAMS) {
+                        continue;
+                    }
+                    int i = params->count++;
+                    params->names[i] = str_view(ch.seg, ch.seg_len);
+                    params->values[i] = str_view(p, len);
+                    if (walk(c, seg_end, end, method, factory, params, path_hit)) {
+                        return true;
+                    }
+                    --params->count;
+                }
+            }
+        }
+        return match_wildcards(n, p, end, method, factory, params, path_hit);
+    }
+
+    // 先试带后缀的通配，再试"*"
+    bool match_wildcards(int n, const char* p, const char* end, int method,
+                         handler_factory* factory, route_params* params, bool* path_hit) const {
+        for (int suffixed = 1; suffixed >= 0; --suffixed) {
+            for (int c = m_nodes[n].first_child; c != -1; c = m_nodes[c].next_sibling) {
+                if (m_nodes[c].kind == WILDCARD && (m_nodes[c].seg_len > 0) == (suffixed == 1) &&
+                    accept_wildcard(c, p, end, method, factory, params, path_hit)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool accept_wildcard(int c, const char* p, const char* end, int method,
+                         handler_factory* factory, route_params* params, bool* path_hit) const {
+        int suffix_len = m_nodes[c].seg_len;
+        if (suffix_len > 0 && (end - p <= suffix_len || memcmp(end - suffix_len, m_nodes[c].seg, suffix_len) != 0)) {
+            return false;
+        }
+        if (!accept(c, method, factory, params, path_hit)) {
+            return false;
+        }
+        if (params->count < route_params::MAX_PARAMS) {
+            params->names[params->count] = str_view("*", 1);
+            params->values[params->count] = str_view(p, end - p);
+            ++params->count;
+        }
+        return true;
+    }
+
+private:
+    node m_nodes[MAX_NODES];
+    int m_count;
+};
+
+#endif
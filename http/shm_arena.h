@@ -0,0 +1,50 @@
+#ifndef SHM_ARENA_H
+#define SHM_ARENA_H
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <exception>
+#include <new>
+
+/*
+    进程间共享的匿名映射，在fork之前创建并分配好所有对象，子进程继承同一段物理内存
+    - 只在fork之前顺序分配，之后不再分配也不释放，不需要锁
+    - 映射的内容初始为0，放在里面的对象只能使用原子变量或者自己的同步方式，不能包含指针
+*/
+class shm_arena {
+public:
+    static const size_t ALIGN = 64;     // 按缓存行对齐，不同进程写的对象不会落在同一行上
+
+    // 创建映射失败时抛出异常
+    explicit shm_arena(size_t size) : m_size(size), m_used(0) {
+        m_base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (m_base == MAP_FAILED) {
+            throw std::exception();
+        }
+    }
+    ~shm_arena() { munmap(m_base, m_size); }
+
+    // 空间不足时返回NULL
+    void* alloc(size_t size) {
+        size = (size + ALIGN - 1) / ALIGN * ALIGN;
+        if (m_used + size > m_size) {
+            return NULL;
+        }
+        void* p = m_base + m_used;
+        m_used += size;
+        return p;
+    }
+
+    template<typename T>
+    T* create() {
+        void* p = alloc(sizeof(T));
+        return p ? new (p) T() : NULL;
+    }
+
+private:
+    char* m_base;
+    size_t m_size;
+    size_t m_used;
+};
+
+#endif
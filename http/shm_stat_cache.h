@@ -0,0 +1,174 @@
+#ifndef SHM_STAT_CACHE_H
+#define SHM_STAT_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <atomic>
+
+/*
+    放在共享内存中的文件元数据缓存：url -> stat的结果或"不存在"，所有工作进程共用，
+    一个进程stat过的路径(包括扫描器探测的不存在的路径)其他进程不再stat
+    - 按url的哈希直接映射到固定的槽位，新记录覆盖旧记录
+    - 每个槽位用序号保护(seqlock)：读者不加锁，读到写了一半的记录时按未命中处理；
+      写者用CAS把序号改为奇数后再写，有其他写者时直接放弃
+    - stat之前用snapshot记下槽位序号和epoch，store时任何一个变了(期间有invalidate)就丢弃结果，
+      避免把变化之前stat到的旧结果写回去
+    - 存在的文件FOUND_TTL秒、不存在的路径ABSENT_TTL秒后过期；inotify通知变化时删除对应记录，
+      整棵目录树变化时增加epoch，之前的记录全部失效
+    对象由shm_arena构造，不能包含指针
+*/
+class shm_stat_cache {
+public:
+    static const int SLOTS = 8192;
+    static const int URL_MAX = 200;
+    static const int FOUND_TTL = 1;
+    static const int ABSENT_TTL = 10;
+    static const int MAX_SPINS = 1000;
+
+    /*
+        MISS    :   没有记录或已经过期，需要stat
+        FOUND   :   文件存在，st中是缓存的结果
+        ABSENT  :   路径不存在
+    */
+    enum LOOKUP { MISS = 0, FOUND, ABSENT };
+
+    struct version {
+        uint32_t seq;
+        uint32_t epoch;
+    };
+
+    // 在stat之前调用，结果交给store
+    version snapshot(const char* url, size_t len) const {
+        version v;
+        v.epoch = m_epoch.load(std::memory_order_acquire);
+        v.seq = m_slots[hash(url, len) % SLOTS].seq.load(std::memory_order_acquire);
+        return v;
+    }
+
+    LOOKUP find(const char* url, size_t len, struct stat* st) const {
+        if (len >= URL_MAX) {
+            return MISS;
+        }
+        uint64_t h = hash(url, len);
+        const slot& s = m_slots[h % SLOTS];
+        uint32_t seq = s.seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            return MISS;
+        }
+        record r;
+        memcpy(&r, s.body, sizeof(r));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != seq) {
+            return MISS;                // 读的过程中被改写了
+        }
+        time_t now = time(NULL);
+        if (r.hash != h || r.epoch != m_epoch.load(std::memory_order_acquire) || r.len != len ||
+            memcmp(r.url, url, len) != 0 || now >= r.expire) {
+            return MISS;
+        }
+        if (!r.exists) {
+            return ABSENT;
+        }
+        *st = r.st;
+        return FOUND;
+    }
+
+    // st为NULL表示路径不存在；v是stat之前的snapshot，之后槽位被改写过或epoch变了就不保存
+    void store(const char* url, size_t len, const struct stat* st, const version& v) {
+        if (len >= URL_MAX || (v.seq & 1)) {
+            return;
+        }
+        uint64_t h = hash(url, len);
+        slot& s = m_slots[h % SLOTS];
+        uint32_t seq = v.seq;
+        if (!s.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+            return;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        if (m_epoch.load(std::memory_order_acquire) != v.epoch) {
+            s.seq.store(seq + 2, std::memory_order_release);
+            return;
+        }
+        record& r = s.rec();
+        r.hash = h;
+        r.epoch = v.epoch;
+        r.expire = time(NULL) + (st ? FOUND_TTL : ABSENT_TTL);
+        r.exists = st != NULL;
+        if (st) {
+            r.st = *st;
+        }
+        r.len = len;
+        memcpy(r.url, url, len);
+        s.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // 删除url的记录，tree为true时整棵子树都失效(所有记录)
+    void invalidate(const char* url, size_t len, bool tree) {
+        if (tree) {
+            m_epoch.fetch_add(1, std::memory_order_acq_rel);
+            return;
+        }
+        uint64_t h = hash(url, len);
+        slot& s = m_slots[h % SLOTS];
+        uint32_t seq;
+        // 不能直接放弃：正在写的可能是变化之前的结果，等它写完再删。
+        // 写者在写的过程中崩溃时序号一直是奇数，等不到时让所有记录失效
+        int spins = 0;
+        while (!begin_write(s, &seq)) {
+            if (++spins == MAX_SPINS) {
+                m_epoch.fetch_add(1, std::memory_order_acq_rel);
+                return;
+            }
+        }
+        if (s.rec().hash == h) {
+            s.rec().hash = 0;
+        }
+        s.seq.store(seq + 2, std::memory_order_release);
+    }
+
+private:
+    struct record {
+        uint64_t hash;          // 0表示空槽位
+        uint32_t epoch;
+        bool exists;
+        time_t expire;
+        struct stat st;
+        size_t len;
+        char url[URL_MAX];
+    };
+    // 记录按字节拷贝，读者可能读到写了一半的内容，由序号判断是否有效
+    struct slot {
+        std::atomic<uint32_t> seq;
+        char body[sizeof(record)] __attribute__((aligned(8)));
+        record& rec() { return *(record*)body; }
+        const record& rec() const { return *(const record*)body; }
+    };
+
+    static bool begin_write(slot& s, uint32_t* seq) {
+        *seq = s.seq.load(std::memory_order_relaxed);
+        if ((*seq & 1) || !s.seq.compare_exchange_strong(*seq, *seq + 1, std::memory_order_acquire)) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+
+    // FNV-1a，0留作空槽位
+    static uint64_t hash(const char* key, size_t len) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (unsigned char)key[i];
+            h *= 1099511628211ULL;
+        }
+        return h ? h : 1;
+    }
+
+private:
+    std::atomic<uint32_t> m_epoch;
+    slot m_slots[SLOTS];
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SHM_STATS_H
+#define SHM_STATS_H
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+    放在共享内存中的计数器。每个工作进程只写自己的槽位，读者把所有槽位相加，
+    读写都不加锁，进程之间不会争用同一个缓存行
+*/
+struct alignas(64) worker_stats {
+    std::atomic<int> pid;                   // 0表示槽位空闲
+    std::atomic<uint64_t> generation;       // 工作进程所属的代
+    std::atomic<int> ready;                 // 已经进入事件循环，开始接受连接
+    std::atomic<uint64_t> accepted;         // 接受的连接数
+    std::atomic<int64_t> active;            // 当前的连接数
+    std::atomic<uint64_t> responses;        // HTTP/1.1的响应数
+    std::atomic<uint64_t> bytes_sent;
+    std::atomic<uint64_t> snapshot;         // 完成的最后一次快照请求
+};
+
+struct server_stats {
+    static const int MAX_WORKERS = 64;      // 同时存在的工作进程数上限，换代期间新旧两代同时存在
+
+    std::atomic<uint64_t> generation;       // 当前的代，每次换代加一
+    std::atomic<uint64_t> restarts;         // 因为崩溃而重启的工作进程数
+    std::atomic<uint64_t> snapshot_request; // 主进程要求工作进程保存缓存快照(SIGUSR1)时加一
+    worker_stats retired;                   // 已经退出的工作进程的累计值，槽位被复用前由主进程并入
+    worker_stats workers[MAX_WORKERS];
+
+    // 把槽位的累计值并入retired并释放槽位
+    void retire(int slot) {
+        worker_stats& w = workers[slot];
+        retired.accepted.fetch_add(w.accepted.exchange(0));
+        retired.responses.fetch_add(w.responses.exchange(0));
+        retired.bytes_sent.fetch_add(w.bytes_sent.exchange(0));
+        w.active.store(0);              // 连接随进程一起关闭了
+        w.pid.store(0);
+    }
+};
+
+#endif
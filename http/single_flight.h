@@ -0,0 +1,56 @@
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../pthreadpool/lcoker.h"
+
+/*
+    同一个key同时只加载一次：第一个请求者begin成功后负责加载，其他请求者park挂起等待，
+    加载者finish时取出所有等待者，由它们各自重新查找(这时通常已经在缓存中)
+    等待者是连接句柄，挂起的连接不占用线程
+*/
+class single_flight {
+public:
+    // 开始加载key，已经有人在加载时返回false
+    bool begin(const std::string& key) {
+        m_lock.lock();
+        bool first = m_flights.find(key) == m_flights.end();
+        if (first) {
+            m_flights[key];
+        }
+        m_lock.unlock();
+        return first;
+    }
+
+    // 挂到key的加载上，加载已经结束时返回false，调用者应该立即重试
+    bool park(const std::string& key, uint64_t waiter) {
+        m_lock.lock();
+        std::map<std::string, std::vector<uint64_t> >::iterator it = m_flights.find(key);
+        bool parked = it != m_flights.end();
+        if (parked) {
+            it->second.push_back(waiter);
+        }
+        m_lock.unlock();
+        return parked;
+    }
+
+    // 加载结束，取出所有等待者
+    void finish(const std::string& key, std::vector<uint64_t>* waiters) {
+        m_lock.lock();
+        std::map<std::string, std::vector<uint64_t> >::iterator it = m_flights.find(key);
+        if (it != m_flights.end()) {
+            waiters->swap(it->second);
+            m_flights.erase(it);
+        }
+        m_lock.unlock();
+    }
+
+private:
+    std::map<std::string, std::vector<uint64_t> > m_flights;
+    locker m_lock;
+};
+
+#endif
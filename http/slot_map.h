@@ -0,0 +1,143 @@
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <new>
+#include <atomic>
+
+/*
+    按需分配的对象槽位表，对象的身份是 句柄 = (代数 << 32) | 槽位下标，与fd无关
+    - 对象按页对齐的块分配，块一旦分配就不再释放，对象地址在整个生命周期内不变
+    - 槽位每次释放时代数加一，持有旧句柄的epoll事件或工作线程任务可以据此发现对象已被复用
+    - 代数从1开始，代数为0的句柄留给监听socket、信号管道等非连接fd，直接保存fd
+    所有操作都只在主线程中进行，工作线程通过对象里保存的句柄判断任务是否过期
+*/
+template<typename T>
+class slot_map {
+public:
+    static const int CHUNK_PAGES = 16;          // 每块占用的页数
+    static const int MAX_CHUNKS = 1 << 18;      // 块目录的大小，只保存指针
+
+    slot_map() : m_chunk_count(0), m_free_head(NIL), m_size(0) {
+        m_per_chunk = (CHUNK_PAGES * sysconf(_SC_PAGESIZE)) / sizeof(cell);
+        if (m_per_chunk == 0) {
+            m_per_chunk = 1;
+        }
+        m_chunk_bytes = round_up(m_per_chunk * sizeof(cell));
+        m_chunks = new cell*[MAX_CHUNKS];
+        memset(m_chunks, 0, sizeof(cell*) * MAX_CHUNKS);
+    }
+
+    ~slot_map() {
+        for (int i = 0; i < m_chunk_count; ++i) {
+            for (uint32_t j = 0; j < m_per_chunk; ++j) {
+                m_chunks[i][j].obj.~T();
+            }
+            munmap(m_chunks[i], m_chunk_bytes);
+        }
+        delete[] m_chunks;
+    }
+
+    static uint32_t generation(uint64_t handle) { return (uint32_t)(handle >> 32); }
+    static uint32_t index(uint64_t handle) { return (uint32_t)handle; }
+
+    // 分配一个槽位，返回句柄，失败(块目录用尽或内存不足)返回0
+    uint64_t alloc() {
+        if (m_free_head == NIL && !grow()) {
+            return 0;
+        }
+        uint32_t idx = m_free_head;
+        cell& c = at(idx);
+        m_free_head = c.next_free;
+        c.next_free = NIL;
+        ++m_size;
+        return ((uint64_t)c.gen.load(std::memory_order_relaxed) << 32) | idx;
+    }
+
+    // 释放槽位，之后旧句柄全部失效
+    void release(uint64_t handle) {
+        T* obj = get(handle);
+        if (!obj) {
+            return;
+        }
+        uint32_t idx = index(handle);
+        cell& c = at(idx);
+        uint32_t gen = c.gen.load(std::memory_order_relaxed) + 1;
+        c.gen.store(gen == 0 ? 1 : gen, std::memory_order_release);
+        c.next_free = m_free_head;
+        m_free_head = idx;
+        --m_size;
+    }
+
+    // 句柄过期或不是连接句柄时返回NULL
+    T* get(uint64_t handle) {
+        uint32_t gen = generation(handle);
+        uint32_t idx = index(handle);
+        if (gen == 0 || idx >= (uint32_t)m_chunk_count * m_per_chunk) {
+            return NULL;
+        }
+        cell& c = at(idx);
+        if (c.gen.load(std::memory_order_acquire) != gen || c.next_free != NIL) {
+            return NULL;
+        }
+        return &c.obj;
+    }
+
+    int size() const { return m_size; }
+    long reserved_bytes() const { return (long)m_chunk_count * m_chunk_bytes; }
+
+private:
+    static const uint32_t NIL = 0xffffffffu;
+
+    struct cell {
+        cell() : gen(1), next_free(NIL) {}
+        std::atomic<uint32_t> gen;  // 当前代数
+        uint32_t next_free;         // 空闲链表中的下一个槽位，使用中为NIL
+        T obj;
+    };
+
+    static size_t round_up(size_t bytes) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        return (bytes + page - 1) / page * page;
+    }
+
+    cell& at(uint32_t idx) {
+        return m_chunks[idx / m_per_chunk][idx % m_per_chunk];
+    }
+
+    // 新分配一块，把其中的槽位全部加入空闲链表
+    bool grow() {
+        if (m_chunk_count >= MAX_CHUNKS) {
+            return false;
+        }
+        void* mem = mmap(NULL, m_chunk_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            return false;
+        }
+        cell* chunk = (cell*)mem;
+        uint32_t base = m_chunk_count * m_per_chunk;
+        for (uint32_t j = 0; j < m_per_chunk; ++j) {
+            new (&chunk[j]) cell();
+        }
+        // 倒序入链，使低下标先被使用
+        for (uint32_t j = m_per_chunk; j-- > 0; ) {
+            chunk[j].next_free = m_free_head;
+            m_free_head = base + j;
+        }
+        m_chunks[m_chunk_count++] = chunk;
+        return true;
+    }
+
+private:
+    cell** m_chunks;            // 块目录
+    int m_chunk_count;
+    uint32_t m_per_chunk;       // 每块的槽位数
+    size_t m_chunk_bytes;
+    uint32_t m_free_head;       // 空闲链表头
+    int m_size;                 // 使用中的槽位数
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef URL_PATH_H
+#define URL_PATH_H
+
+#include <string.h>
+#include <string>
+
+/*
+    原地解码并规范化url的路径部分，查询字符串原样接在后面
+    - %XX解码，解出'\0'、'?'、'#'或格式错误时拒绝：解码后的路径会被当作查询字符串的开头截断
+    - 合并连续的'/'，去掉"."段，".."段回退一级，退到根目录之上时拒绝
+    - 结果总是以'/'开头，原路径以'/'或"."、".."段结尾时保留结尾的'/'
+    规范化只会让字符串变短，所以可以直接在读缓冲区中进行；同一个文件的不同写法得到同一个路径
+*/
+inline int url_hex(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+inline bool canonicalize_url(char* url) {
+    if (url[0] != '/') {
+        return false;
+    }
+    char* query = url + strcspn(url, "?#");
+
+    // 第一遍：百分号解码
+    char* w = url;
+    for (char* r = url; r < query; ) {
+        if (*r == '%') {
+            if (query - r < 3) {
+                return false;
+            }
+            int hi = url_hex(r[1]);
+            int lo = url_hex(r[2]);
+            if (hi < 0 || lo < 0) {
+                return false;
+            }
+            char c = (char)(hi * 16 + lo);
+            if (c == '\0' || c == '?' || c == '#') {
+                return false;
+            }
+            *w++ = c;
+            r += 3;
+        } else {
+            *w++ = *r++;
+        }
+    }
+    char* path_end = w;
+
+    // 第二遍：按段规范化，写指针总在读指针之前
+    char* out = url;
+    char* r = url;
+    bool dir = false;           // 结果是否以'/'结尾
+    while (r < path_end) {
+        while (r < path_end && *r == '/') {
+            ++r;
+        }
+        if (r == path_end) {
+            dir = true;
+            break;
+        }
+        char* seg = r;
+        while (r < path_end && *r != '/') {
+            ++r;
+        }
+        size_t len = r - seg;
+        dir = false;
+        if (len == 1 && seg[0] == '.') {
+            dir = true;
+            continue;
+        }
+        if (len == 2 && seg[0] == '.' && seg[1] == '.') {
+            if (out == url) {
+                return false;           // 跳出根目录
+            }
+            while (out > url && *--out != '/') {
+            }
+            dir = true;
+            continue;
+        }
+        *out++ = '/';
+        memmove(out, seg, len);
+        out += len;
+    }
+    if (out == url || dir) {
+        *out++ = '/';
+    }
+    if (out != query) {
+        memmove(out, query, strlen(query) + 1);
+    }
+    return true;
+}
+
+// 把解码过的路径重新百分号编码后追加到out，转发给上游时使用；查询字符串没有解码过，原样保留
+inline void encode_url(std::string& out, const char* url) {
+    static const char hex[] = "0123456789ABCDEF";
+    const char* query = url + strcspn(url, "?");
+    for (const char* p = url; p < query; ++p) {
+        unsigned char c = *p;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            strchr("/-._~!$&'()*+,;=:@", c)) {
+            out += c;
+        } else {
+            out += '%';
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+    }
+    out += query;
+}
+
+#endif
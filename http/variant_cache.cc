@@ -0,0 +1,178 @@
+#include "variant_cache.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+static const char SNAPSHOT_MAGIC[8] = { 'W', 'S', 'V', 'A', 'R', 'N', 'T', '1' };
+
+// 快照中每个版本的头部，后面依次是路径和内容
+struct snapshot_record {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t path_len;
+    uint32_t reserved;
+    uint64_t data_len;
+};
+
+bool variant_cache::same_file(const entry& e, const struct stat& st) {
+    return e.dev == st.st_dev && e.ino == st.st_ino && e.size == st.st_size &&
+           e.mtime.tv_sec == st.st_mtim.tv_sec && e.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+void variant_cache::erase(lru_list::iterator it) {
+    m_bytes -= charge(*it);
+    m_index.erase(it->path);
+    m_lru.erase(it);
+}
+
+bool variant_cache::find(const char* path, const struct stat& st, response_writer::blob* data) {
+    m_lock.lock();
+    std::map<std::string, lru_list::iterator>::iterator found = m_index.find(path);
+    if (found == m_index.end()) {
+        m_lock.unlock();
+        return false;
+    }
+    lru_list::iterator it = found->second;
+    if (!same_file(*it, st)) {
+        // 文件已经变化，旧的版本作废
+        erase(it);
+        m_lock.unlock();
+        return false;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, it);
+    *data = it->data;
+    m_lock.unlock();
+    return true;
+}
+
+void variant_cache::insert(const char* path, const struct stat& st, const response_writer::blob& data) {
+    entry e;
+    e.path = path;
+    e.dev = st.st_dev;
+    e.ino = st.st_ino;
+    e.size = st.st_size;
+    e.mtime = st.st_mtim;
+    e.data = data;
+    size_t cost = charge(e);
+    if (cost > m_budget) {
+        return;
+    }
+    m_lock.lock();
+    std::map<std::string, lru_list::iterator>::iterator found = m_index.find(e.path);
+    if (found != m_index.end()) {
+        // 另一个线程同时压缩了同一个文件
+        erase(found->second);
+    }
+    while (m_bytes + cost > m_budget && !m_lru.empty()) {
+        erase(--m_lru.end());
+    }
+    m_lru.push_front(e);
+    m_index[e.path] = m_lru.begin();
+    m_bytes += cost;
+    m_lock.unlock();
+}
+
+response_writer::blob variant_cache::gzip(const char* data, size_t len, int level) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits加16输出gzip格式的头和尾
+    if (deflateInit2(&zs, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return response_writer::blob();
+    }
+    std::string* out = new std::string;
+    out->resize(deflateBound(&zs, len));
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef*)&(*out)[0];
+    zs.avail_out = out->size();
+    int ret = deflate(&zs, Z_FINISH);
+    size_t produced = zs.total_out;
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END) {
+        delete out;
+        return response_writer::blob();
+    }
+    out->resize(produced);
+    return response_writer::blob(out);
+}
+
+bool variant_cache::save(const char* file) {
+    // 在锁外写文件，先复制一份(内容是共享的，不拷贝)；从最久没有使用的开始，载入后LRU的顺序不变
+    std::vector<entry> entries;
+    m_lock.lock();
+    for (lru_list::reverse_iterator it = m_lru.rbegin(); it != m_lru.rend(); ++it) {
+        entries.push_back(*it);
+    }
+    m_lock.unlock();
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", file, (int)getpid());
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp) {
+        return false;
+    }
+    bool ok = fwrite(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC), 1, fp) == 1;
+    for (size_t i = 0; ok && i < entries.size(); ++i) {
+        const entry& e = entries[i];
+        snapshot_record r;
+        memset(&r, 0, sizeof(r));
+        r.dev = e.dev;
+        r.ino = e.ino;
+        r.size = e.size;
+        r.mtime_sec = e.mtime.tv_sec;
+        r.mtime_nsec = e.mtime.tv_nsec;
+        r.path_len = e.path.size();
+        r.data_len = e.data->size();
+        ok = fwrite(&r, sizeof(r), 1, fp) == 1 && fwrite(e.path.data(), 1, e.path.size(), fp) == e.path.size() &&
+             fwrite(e.data->data(), 1, e.data->size(), fp) == e.data->size();
+    }
+    ok = fflush(fp) == 0 && ok;
+    fclose(fp);
+    if (!ok || rename(tmp, file) < 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+size_t variant_cache::load(const char* file) {
+    FILE* fp = fopen(file, "rb");
+    if (!fp) {
+        return 0;
+    }
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    size_t count = 0;
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+        fclose(fp);
+        return 0;
+    }
+    snapshot_record r;
+    while (fread(&r, sizeof(r), 1, fp) == 1) {
+        if (r.path_len == 0 || r.path_len > 4096 || r.data_len > m_budget) {
+            break;                      // 损坏的快照
+        }
+        std::string path(r.path_len, '\0');
+        std::string* data = new std::string(r.data_len, '\0');
+        response_writer::blob blob(data);
+        if (fread(&path[0], 1, r.path_len, fp) != r.path_len ||
+            (r.data_len > 0 && fread(&(*data)[0], 1, r.data_len, fp) != r.data_len)) {
+            break;
+        }
+        // 保存快照之后文件可能又被修改了
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0 || (uint64_t)st.st_dev != r.dev || (uint64_t)st.st_ino != r.ino ||
+            st.st_size != r.size || st.st_mtim.tv_sec != r.mtime_sec || st.st_mtim.tv_nsec != r.mtime_nsec) {
+            continue;
+        }
+        insert(path.c_str(), st, blob);
+        ++count;
+    }
+    fclose(fp);
+    return count;
+}
@@ -0,0 +1,60 @@
+#ifndef VARIANT_CACHE_H
+#define VARIANT_CACHE_H
+
+#include <sys/stat.h>
+#include <stddef.h>
+#include <list>
+#include <map>
+#include <string>
+#include "response_writer.h"
+#include "../pthreadpool/lcoker.h"
+
+/*
+    静态文件压缩后的版本，按文件的真实路径缓存
+    - 记录文件的设备号、inode、大小和修改时间，文件被替换或修改后旧的版本自动失效
+    - 压缩结果以共享数据块保存，直接挂到发送队列上，不拷贝
+    - 按字节数限制总量，超出时淘汰最久没有使用的版本
+    - 压缩后没有变小的文件缓存一个空数据块，之后直接发送原文件，不再重复压缩
+*/
+class variant_cache {
+public:
+    static const size_t DEFAULT_BUDGET = 32 * 1024 * 1024;
+
+    explicit variant_cache(size_t budget) : m_bytes(0), m_budget(budget) {}
+
+    // 命中时返回true并设置data
+    bool find(const char* path, const struct stat& st, response_writer::blob* data);
+    void insert(const char* path, const struct stat& st, const response_writer::blob& data);
+
+    // 把所有版本写入快照文件，平滑升级时新进程load之后不需要重新压缩
+    bool save(const char* file);
+    // 载入快照，文件已经变化的版本丢弃，返回载入的个数
+    size_t load(const char* file);
+
+    // 以gzip格式压缩，level与zlib相同(-1为默认级别)，失败时返回空指针
+    static response_writer::blob gzip(const char* data, size_t len, int level = -1);
+
+private:
+    struct entry {
+        std::string path;
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+        response_writer::blob data;
+    };
+    typedef std::list<entry> lru_list;
+
+    static bool same_file(const entry& e, const struct stat& st);
+    static size_t charge(const entry& e) { return e.data->size() + e.path.size() + sizeof(entry); }
+    void erase(lru_list::iterator it);
+
+private:
+    lru_list m_lru;                     // 队头是最近使用的版本
+    std::map<std::string, lru_list::iterator> m_index;
+    size_t m_bytes;
+    size_t m_budget;
+    locker m_lock;
+};
+
+#endif
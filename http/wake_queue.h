@@ -0,0 +1,55 @@
+#ifndef WAKE_QUEUE_H
+#define WAKE_QUEUE_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <exception>
+#include <vector>
+#include "../pthreadpool/lcoker.h"
+
+/*
+    工作线程把需要重新处理的连接句柄交给主线程：句柄放入队列，再通过eventfd唤醒epoll
+    连接只能在主线程中按句柄取出(slot_map不是线程安全的)，主线程取出后重新提交给线程池，
+    已经关闭的连接的句柄代数不匹配，自然被丢弃
+*/
+class wake_queue {
+public:
+    wake_queue() {
+        m_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_fd < 0) {
+            throw std::exception();
+        }
+    }
+    ~wake_queue() { close(m_fd); }
+
+    int fd() const { return m_fd; }
+
+    // 任意线程调用
+    void push(uint64_t handle) {
+        m_lock.lock();
+        m_pending.push_back(handle);
+        m_lock.unlock();
+        uint64_t one = 1;
+        ssize_t n = write(m_fd, &one, sizeof(one));
+        (void)n;
+    }
+
+    // 主线程在fd可读时调用，取出所有句柄
+    void drain(std::vector<uint64_t>* handles) {
+        uint64_t count;
+        ssize_t n = read(m_fd, &count, sizeof(count));
+        (void)n;
+        handles->clear();
+        m_lock.lock();
+        handles->swap(m_pending);
+        m_lock.unlock();
+    }
+
+private:
+    int m_fd;
+    std::vector<uint64_t> m_pending;
+    locker m_lock;
+};
+
+#endif
@@ -0,0 +1,665 @@
+#include "h2_session.h"
+#include "../http/http_conn.h"
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+std::atomic<long> h2_session::m_memory_total(0);
+
+static const char* PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const int PREFACE_LEN = 24;
+
+// 帧标志
+static const uint8_t FLAG_END_STREAM = 0x1;
+static const uint8_t FLAG_ACK = 0x1;
+static const uint8_t FLAG_END_HEADERS = 0x4;
+static const uint8_t FLAG_PADDED = 0x8;
+static const uint8_t FLAG_PRIORITY = 0x20;
+
+static uint32_t get_u32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_u32(std::vector<char>& out, uint32_t v) {
+    out.push_back((char)(v >> 24));
+    out.push_back((char)(v >> 16));
+    out.push_back((char)(v >> 8));
+    out.push_back((char)v);
+}
+
+// HTTP2-Settings头使用的base64url解码，不带填充
+static bool base64url_decode(const char* in, std::vector<uint8_t>& out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    for (; *in && *in != '='; ++in) {
+        char c = *in;
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '-' || c == '+') v = 62;
+        else if (c == '_' || c == '/') v = 63;
+        else return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back((uint8_t)(acc >> bits));
+        }
+    }
+    return true;
+}
+
+h2_session::h2_session(const sock_addr& client, bool tls)
+    : m_client(client), m_tls(tls), m_out_pos(0), m_preface(false), m_settings_sent(false), m_goaway(false), m_peer_goaway(false),
+      m_header_sid(0), m_header_end_stream(false), m_last_sid(0), m_active(0),
+      m_conn_window(DEFAULT_WINDOW), m_initial_window(DEFAULT_WINDOW),
+      m_peer_max_frame(MAX_FRAME_SIZE), m_vtime(0), m_memory(0) {
+    recount();
+}
+
+h2_session::~h2_session() {
+    while (!m_streams.empty()) {
+        close_stream(m_streams.begin()->second);
+    }
+    m_memory_total.fetch_sub(m_memory, std::memory_order_relaxed);
+}
+
+bool h2_session::is_preface(const char* data, int len) {
+    return memcmp(data, PREFACE, len < PREFACE_LEN ? len : PREFACE_LEN) == 0;
+}
+
+void h2_session::upgrade(const char* settings_b64, int method, const char* url, const str_view* headers) {
+    static const char* switching = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    m_out.insert(m_out.end(), switching, switching + strlen(switching));
+    write_settings();
+
+    std::vector<uint8_t> settings;
+    if (settings_b64 && base64url_decode(settings_b64, settings) && settings.size() % 6 == 0 && !settings.empty()) {
+        apply_settings(&settings[0], settings.size());
+    }
+    // 升级请求隐式地成为流1，并且已经处于半关闭(远端)状态，请求体已经由HTTP/1.1读完
+    m_last_sid = 1;
+    respond(create(1), method, url, headers, false);
+}
+
+void h2_session::consume(int n) {
+    m_out_pos += n;
+    if (m_out_pos >= m_out.size()) {
+        m_out.clear();
+        m_out_pos = 0;
+    }
+    recount();
+}
+
+// 会话只在持有连接的线程中访问，总数用原子变量在线程之间汇总；map的节点按流的大小加上指针估计
+void h2_session::recount() {
+    long mem = sizeof(h2_session) + m_in.capacity() + m_out.capacity() + m_header_block.capacity() +
+               m_streams.size() * (sizeof(stream) + 64) + hpack_decoder::DEFAULT_TABLE_SIZE;
+    m_memory_total.fetch_add(mem - m_memory, std::memory_order_relaxed);
+    m_memory = mem;
+}
+
+bool h2_session::feed(const char* data, int len) {
+    if (m_goaway) {
+        return false;
+    }
+    m_in.insert(m_in.end(), data, data + len);
+    size_t pos = 0;
+    if (!m_preface) {
+        if (!is_preface(&m_in[0], m_in.size())) {
+            return goaway(PROTOCOL_ERROR);
+        }
+        if (m_in.size() < (size_t)PREFACE_LEN) {
+            return true;
+        }
+        pos = PREFACE_LEN;
+        m_preface = true;
+        if (!m_settings_sent) {
+            write_settings();
+        }
+    }
+
+    while (m_in.size() - pos >= (size_t)FRAME_HEADER_LEN) {
+        const uint8_t* p = (const uint8_t*)&m_in[pos];
+        uint32_t flen = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        if (flen > (uint32_t)MAX_FRAME_SIZE) {
+            return goaway(FRAME_SIZE_ERROR);
+        }
+        if (m_in.size() - pos < FRAME_HEADER_LEN + flen) {
+            break;
+        }
+        uint32_t sid = get_u32(p + 5) & 0x7fffffff;
+        if (!handle_frame(p[3], p[4], sid, p + FRAME_HEADER_LEN, flen)) {
+            return false;
+        }
+        pos += FRAME_HEADER_LEN + flen;
+        if (out_len() > MAX_PENDING_OUT) {
+            // 对端只发不收(例如不停地PING)，应答在发送缓冲区中越积越多
+            return goaway(ENHANCE_YOUR_CALM);
+        }
+    }
+    m_in.erase(m_in.begin(), m_in.begin() + pos);
+    return true;
+}
+
+bool h2_session::handle_frame(uint8_t type, uint8_t flags, uint32_t sid, const uint8_t* payload, uint32_t len) {
+    // 头部块必须连续，中间不能插入其他帧
+    if (m_header_sid != 0 && (type != CONTINUATION || sid != m_header_sid)) {
+        return goaway(PROTOCOL_ERROR);
+    }
+
+    switch (type) {
+        case DATA:
+        {
+            if (sid == 0) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            // 不处理请求体，但要归还对端的发送窗口
+            if (len > 0) {
+                write_window_update(0, len);
+                stream* s = find(sid);
+                if (s && !(flags & FLAG_END_STREAM)) {
+                    write_window_update(sid, len);
+                }
+            }
+            return true;
+        }
+        case HEADERS:
+            return on_headers(flags, sid, payload, len);
+        case PRIORITY:
+        {
+            if (sid == 0 || len != 5) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            uint32_t dep = get_u32(payload);
+            set_priority(sid, dep & 0x7fffffff, payload[4] + 1, (dep & 0x80000000) != 0);
+            return true;
+        }
+        case RST_STREAM:
+        {
+            if (sid == 0 || len != 4) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            stream* s = find(sid);
+            if (s) {
+                close_stream(s);
+            }
+            return true;
+        }
+        case SETTINGS:
+        {
+            if (sid != 0) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            return on_settings(flags, payload, len);
+        }
+        case PING:
+        {
+            if (sid != 0 || len != 8) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            if (!(flags & FLAG_ACK)) {
+                write_frame_header(8, PING, FLAG_ACK, 0);
+                m_out.insert(m_out.end(), payload, payload + 8);
+            }
+            return true;
+        }
+        case GOAWAY:
+        {
+            m_peer_goaway = true;
+            return true;
+        }
+        case WINDOW_UPDATE:
+            return on_window_update(sid, payload, len);
+        case CONTINUATION:
+        {
+            if (m_header_sid == 0) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            if (m_header_block.size() + len > (size_t)MAX_HEADER_LIST) {
+                return goaway(ENHANCE_YOUR_CALM);
+            }
+            m_header_block.insert(m_header_block.end(), payload, payload + len);
+            if (flags & FLAG_END_HEADERS) {
+                m_header_sid = 0;
+                return end_headers(sid);
+            }
+            return true;
+        }
+        case PUSH_PROMISE:
+            // 客户端不能推送
+            return goaway(PROTOCOL_ERROR);
+        default:
+            // 未知类型的帧直接忽略
+            return true;
+    }
+}
+
+bool h2_session::on_headers(uint8_t flags, uint32_t sid, const uint8_t* payload, uint32_t len) {
+    // 客户端发起的流必须是奇数，且ID单调递增
+    if (sid == 0 || (sid & 1) == 0 || sid <= m_last_sid) {
+        return goaway(PROTOCOL_ERROR);
+    }
+    uint32_t pad = 0;
+    if (flags & FLAG_PADDED) {
+        if (len < 1) {
+            return goaway(PROTOCOL_ERROR);
+        }
+        pad = payload[0];
+        ++payload;
+        --len;
+    }
+    if (flags & FLAG_PRIORITY) {
+        if (len < 5) {
+            return goaway(PROTOCOL_ERROR);
+        }
+        uint32_t dep = get_u32(payload);
+        set_priority(sid, dep & 0x7fffffff, payload[4] + 1, (dep & 0x80000000) != 0);
+        payload += 5;
+        len -= 5;
+    }
+    if (pad > len) {
+        return goaway(PROTOCOL_ERROR);
+    }
+    m_header_block.assign(payload, payload + len - pad);
+    m_header_end_stream = (flags & FLAG_END_STREAM) != 0;
+    if (flags & FLAG_END_HEADERS) {
+        return end_headers(sid);
+    }
+    m_header_sid = sid;
+    return true;
+}
+
+bool h2_session::end_headers(uint32_t sid) {
+    std::vector<hpack_header> headers;
+    const uint8_t* block = m_header_block.empty() ? NULL : (const uint8_t*)&m_header_block[0];
+    hpack_decoder::RESULT ret = m_decoder.decode(block, m_header_block.size(), MAX_HEADER_LIST, headers);
+    m_header_block.clear();
+    if (ret != hpack_decoder::DECODED) {
+        return goaway(ret == hpack_decoder::TOO_LARGE ? ENHANCE_YOUR_CALM : COMPRESSION_ERROR);
+    }
+    m_last_sid = sid;
+    if (m_active >= MAX_STREAMS) {
+        write_rst(sid, REFUSED_STREAM);
+        return true;
+    }
+    // 每个流和HTTP/1.1上的一个请求一样消耗该IP的一个令牌
+    if (http_conn::m_limiter && !http_conn::m_limiter->on_request(m_client)) {
+        write_rst(sid, ENHANCE_YOUR_CALM);
+        return true;
+    }
+
+    // 认识的请求头按HEADER_ID放入数组，和HTTP/1.1一样交给处理器
+    const std::string* method = NULL;
+    const std::string* path = NULL;
+    str_view fields[HEADER_COUNT];
+    for (size_t i = 0; i < headers.size(); ++i) {
+        const std::string& name = headers[i].name;
+        if (name == ":method") {
+            method = &headers[i].value;
+        } else if (name == ":path") {
+            path = &headers[i].value;
+        } else if (!name.empty() && name[0] != ':') {
+            HEADER_ID id = find_header(name.data(), name.size());
+            if (id != HEADER_COUNT) {
+                fields[id] = str_view(headers[i].value.data(), headers[i].value.size());
+            }
+        }
+    }
+    stream* s = create(sid);
+    if (!method || !path || path->empty() || (*path)[0] != '/') {
+        respond_error(s, http_conn::BAD_REQUEST, NULL);
+        return true;
+    }
+    // 和HTTP/1.1一样先解码、规范化
+    std::vector<char> url(path->begin(), path->end());
+    url.push_back('\0');
+    if (!canonicalize_url(&url[0])) {
+        respond_error(s, http_conn::BAD_REQUEST, NULL);
+        return true;
+    }
+    int m = -1;
+    for (int i = http_conn::GET; i <= http_conn::CONNECT; ++i) {
+        if (*method == http_conn::method_name(i)) {
+            m = i;
+            break;
+        }
+    }
+    respond(s, m, &url[0], fields, !m_header_end_stream);
+    return true;
+}
+
+bool h2_session::on_settings(uint8_t flags, const uint8_t* payload, uint32_t len) {
+    if (flags & FLAG_ACK) {
+        return len == 0 ? true : goaway(FRAME_SIZE_ERROR);
+    }
+    if (len % 6 != 0) {
+        return goaway(FRAME_SIZE_ERROR);
+    }
+    if (!apply_settings(payload, len)) {
+        return false;
+    }
+    write_frame_header(0, SETTINGS, FLAG_ACK, 0);
+    return true;
+}
+
+bool h2_session::apply_settings(const uint8_t* payload, uint32_t len) {
+    for (uint32_t i = 0; i + 6 <= len; i += 6) {
+        uint16_t id = ((uint16_t)payload[i] << 8) | payload[i + 1];
+        uint32_t value = get_u32(payload + i + 2);
+        switch (id) {
+            case 0x2:       // SETTINGS_ENABLE_PUSH
+                if (value > 1) {
+                    return goaway(PROTOCOL_ERROR);
+                }
+                break;
+            case 0x4:       // SETTINGS_INITIAL_WINDOW_SIZE，差值作用到所有已有的流
+            {
+                if (value > 0x7fffffff) {
+                    return goaway(FLOW_CONTROL_ERROR);
+                }
+                int32_t delta = (int32_t)value - m_initial_window;
+                m_initial_window = value;
+                for (std::map<uint32_t, stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+                    it->second->window += delta;
+                }
+                break;
+            }
+            case 0x5:       // SETTINGS_MAX_FRAME_SIZE
+                if (value < 16384 || value > 16777215) {
+                    return goaway(PROTOCOL_ERROR);
+                }
+                m_peer_max_frame = value;
+                break;
+            default:        // 其余设置不影响我们的行为
+                break;
+        }
+    }
+    return true;
+}
+
+bool h2_session::on_window_update(uint32_t sid, const uint8_t* payload, uint32_t len) {
+    if (len != 4) {
+        return goaway(FRAME_SIZE_ERROR);
+    }
+    uint32_t inc = get_u32(payload) & 0x7fffffff;
+    if (sid == 0) {
+        if (inc == 0 || (int64_t)m_conn_window + inc > 0x7fffffff) {
+            return goaway(inc == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+        }
+        m_conn_window += inc;
+        return true;
+    }
+    stream* s = find(sid);
+    if (!s) {
+        return true;
+    }
+    if (inc == 0 || (int64_t)s->window + inc > 0x7fffffff) {
+        write_rst(sid, inc == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+        close_stream(s);
+        return true;
+    }
+    s->window += inc;
+    return true;
+}
+
+// 和HTTP/1.1走同一张路由表。处理器在这里同步完成：不能挂起连接，也收不到请求体
+void h2_session::respond(stream* s, int method, const char* url, const str_view* headers, bool has_body) {
+    handler_factory factory = NULL;
+    route_params params;
+    router::RESULT found = method < 0 ? router::METHOD_NOT_ALLOWED : http_conn::route(method, url, &factory, &params);
+    if (found != router::FOUND) {
+        respond_error(s, found == router::METHOD_NOT_ALLOWED ? http_conn::METHOD_NOT_ALLOWED : http_conn::NO_RESOURCE, url);
+        return;
+    }
+    request_handler* handler = factory();
+    if (!handler->serves_h2()) {
+        // 反向代理、FastCGI、上传等只在HTTP/1.1上提供，客户端收到后换HTTP/1.1重试
+        delete handler;
+        write_rst(s->id, HTTP_1_1_REQUIRED);
+        close_stream(s);
+        return;
+    }
+    const str_view& accept = headers[H_ACCEPT_ENCODING];
+    handler->set_params(params);
+    handler->set_headers(headers);
+    handler->set_accept_encoding(accept.empty() ? 0 : parse_accept_encoding(accept.data()));
+    handler->set_client(m_client, m_tls);
+    request_handler::response resp;
+    bool ok = handler->on_begin(method, url, has_body ? -1 : 0);
+    if (ok) {
+        handler->on_complete(resp);
+    }
+    delete handler;
+    if (!ok) {
+        respond_error(s, http_conn::BAD_REQUEST, url);
+        return;
+    }
+
+    // 响应体只有一段：文件映射、共享数据块或生成的内容
+    const char* body = resp.shared_data;
+    size_t len = resp.shared_len;
+    if (resp.file_map) {
+        body = (const char*)resp.file_map;
+        len = resp.file_len;
+    } else if (!resp.body.empty()) {
+        std::shared_ptr<std::string> text(new std::string);
+        text->swap(resp.body);
+        resp.shared = text;
+        body = text->data();
+        len = text->size();
+    }
+    std::vector<char> block;
+    char len_buf[24];
+    snprintf(len_buf, sizeof(len_buf), "%zu", len);
+    hpack_encoder::encode_status(resp.status, block);
+    if (resp.status != 304) {
+        hpack_encoder::encode("content-length", len_buf, block);
+        hpack_encoder::encode("content-type", resp.content_type, block);
+        if (resp.content_encoding) {
+            hpack_encoder::encode("content-encoding", resp.content_encoding, block);
+        }
+    }
+    if (resp.vary_encoding) {
+        hpack_encoder::encode("vary", "accept-encoding", block);
+    }
+    if (resp.etag) {
+        hpack_encoder::encode("etag", resp.etag, block);
+    }
+    bool empty = len == 0 || resp.status == 304 || method == http_conn::HEAD;
+    write_frame_header(block.size(), HEADERS, FLAG_END_HEADERS | (empty ? FLAG_END_STREAM : 0), s->id);
+    m_out.insert(m_out.end(), block.begin(), block.end());
+    if (empty) {
+        resp.release();
+        close_stream(s);
+        return;
+    }
+    // 文件映射或共享数据块的所有权交给流
+    s->file_addr = (char*)resp.file_map;
+    resp.file_map = NULL;
+    s->shared = resp.shared;
+    s->body = body;
+    s->body_len = len;
+    s->pending = true;
+    s->vtime = m_vtime;
+    ++m_active;
+}
+
+void h2_session::respond_error(stream* s, int code, const char* url) {
+    const char* title;
+    const char* form;
+    int status = http_conn::error_page((http_conn::HTTP_CODE)code, &title, &form);
+    std::vector<char> block;
+    char len_buf[24];
+    snprintf(len_buf, sizeof(len_buf), "%d", (int)strlen(form));
+    hpack_encoder::encode_status(status, block);
+    hpack_encoder::encode("content-length", len_buf, block);
+    hpack_encoder::encode("content-type", "text/html", block);
+    if (status == 405 && url) {
+        char methods[64];
+        http_conn::allowed_methods(url, methods, sizeof(methods));
+        hpack_encoder::encode("allow", methods, block);
+    }
+    write_frame_header(block.size(), HEADERS, FLAG_END_HEADERS, s->id);
+    m_out.insert(m_out.end(), block.begin(), block.end());
+    s->body = form;
+    s->body_len = strlen(form);
+    s->pending = true;
+    s->vtime = m_vtime;
+    ++m_active;
+}
+
+void h2_session::set_priority(uint32_t sid, uint32_t parent, int weight, bool exclusive) {
+    if (parent == sid) {
+        return;
+    }
+    stream* s = find(sid);
+    if (!s) {
+        // 只为有限数量的空闲流保存优先级信息
+        if (m_streams.size() >= (size_t)MAX_STREAMS * 2) {
+            return;
+        }
+        s = create(sid);
+    }
+    if (exclusive) {
+        // 独占依赖：原来依赖parent的流改为依赖sid
+        for (std::map<uint32_t, stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+            if (it->second->parent == parent && it->second != s) {
+                it->second->parent = sid;
+            }
+        }
+    }
+    s->parent = parent;
+    s->weight = weight;
+}
+
+h2_session::stream* h2_session::find(uint32_t sid) {
+    std::map<uint32_t, stream*>::iterator it = m_streams.find(sid);
+    return it == m_streams.end() ? NULL : it->second;
+}
+
+h2_session::stream* h2_session::create(uint32_t sid) {
+    stream* s = find(sid);
+    if (!s) {
+        s = new stream;
+        s->id = sid;
+        m_streams[sid] = s;
+    }
+    s->window = m_initial_window;
+    return s;
+}
+
+void h2_session::close_stream(stream* s) {
+    if (s->pending) {
+        --m_active;
+    }
+    if (s->file_addr) {
+        munmap(s->file_addr, s->body_len);
+    }
+    m_streams.erase(s->id);
+    delete s;
+}
+
+bool h2_session::sendable(const stream* s) const {
+    return s->pending && s->window > 0;
+}
+
+// 选出虚拟时间最小的可发送流；依赖的祖先流还能发送时，子流让路
+h2_session::stream* h2_session::pick() {
+    stream* best = NULL;
+    for (std::map<uint32_t, stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+        stream* s = it->second;
+        if (!sendable(s)) {
+            continue;
+        }
+        bool blocked = false;
+        uint32_t parent = s->parent;
+        for (int depth = 0; parent != 0 && depth < 16; ++depth) {
+            stream* p = find(parent);
+            if (!p) {
+                break;
+            }
+            if (sendable(p)) {
+                blocked = true;
+                break;
+            }
+            parent = p->parent;
+        }
+        if (!blocked && (!best || s->vtime < best->vtime)) {
+            best = s;
+        }
+    }
+    return best;
+}
+
+void h2_session::fill() {
+    // h2c升级后先等客户端的连接前言和SETTINGS，避免响应体先于对端的流量控制设置到达
+    if (!m_preface) {
+        return;
+    }
+    while (out_len() < FILL_CHUNK && m_conn_window > 0) {
+        stream* s = pick();
+        if (!s) {
+            break;
+        }
+        size_t n = s->body_len - s->offset;
+        if (n > m_peer_max_frame) n = m_peer_max_frame;
+        if (n > (size_t)m_conn_window) n = m_conn_window;
+        if (n > (size_t)s->window) n = s->window;
+        bool last = s->offset + n == s->body_len;
+
+        write_frame_header(n, DATA, last ? FLAG_END_STREAM : 0, s->id);
+        m_out.insert(m_out.end(), s->body + s->offset, s->body + s->offset + n);
+        s->offset += n;
+        s->window -= n;
+        m_conn_window -= n;
+
+        // 发送的字节按权重折算成虚拟时间，权重越大推进越慢，分到的带宽越多
+        m_vtime = s->vtime;
+        s->vtime += (uint64_t)n * 256 / s->weight;
+        if (last) {
+            close_stream(s);
+        }
+    }
+    recount();
+}
+
+void h2_session::write_frame_header(uint32_t len, uint8_t type, uint8_t flags, uint32_t sid) {
+    m_out.push_back((char)(len >> 16));
+    m_out.push_back((char)(len >> 8));
+    m_out.push_back((char)len);
+    m_out.push_back((char)type);
+    m_out.push_back((char)flags);
+    put_u32(m_out, sid & 0x7fffffff);
+}
+
+void h2_session::write_settings() {
+    write_frame_header(12, SETTINGS, 0, 0);
+    m_out.push_back(0);
+    m_out.push_back(0x3);           // SETTINGS_MAX_CONCURRENT_STREAMS
+    put_u32(m_out, MAX_STREAMS);
+    m_out.push_back(0);
+    m_out.push_back(0x6);           // SETTINGS_MAX_HEADER_LIST_SIZE
+    put_u32(m_out, MAX_HEADER_LIST);
+    m_settings_sent = true;
+}
+
+void h2_session::write_window_update(uint32_t sid, uint32_t inc) {
+    write_frame_header(4, WINDOW_UPDATE, 0, sid);
+    put_u32(m_out, inc);
+}
+
+void h2_session::write_rst(uint32_t sid, uint32_t code) {
+    write_frame_header(4, RST_STREAM, 0, sid);
+    put_u32(m_out, code);
+}
+
+bool h2_session::goaway(uint32_t code) {
+    write_frame_header(8, GOAWAY, 0, 0);
+    put_u32(m_out, m_last_sid);
+    put_u32(m_out, code);
+    m_goaway = true;
+    m_in.clear();
+    return false;
+}
@@ -0,0 +1,133 @@
+#ifndef H2_SESSION_H
+#define H2_SESSION_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <atomic>
+#include "hpack.h"
+#include "../http/response_writer.h"
+#include "../http/route_params.h"
+#include "../net/sock_addr.h"
+
+/*
+    HTTP/2会话(RFC 7540)，支持h2c升级和先知模式(prior knowledge)，一个连接一个会话
+    - feed()在工作线程中解析收到的帧，完整的请求头到达后和HTTP/1.1一样经过路由表，
+      能同步生成响应的处理器(静态文件等)直接在流上响应，其余的用HTTP_1_1_REQUIRED让客户端换HTTP/1.1
+    - fill()按流的优先级把文件内容切成DATA帧放入发送缓冲区，受连接和流两级流量控制约束
+    - 发送缓冲区由主线程在EPOLLOUT时写出，读写两侧由EPOLLONESHOT保证不会同时进行
+*/
+class h2_session {
+public:
+    static const int FRAME_HEADER_LEN = 9;
+    static const int DEFAULT_WINDOW = 65535;
+    static const int MAX_FRAME_SIZE = 16384;       // 我们接收的最大帧，使用协议默认值
+    static const int MAX_STREAMS = 100;            // 通告给对端的最大并发流数
+    static const int FILL_CHUNK = 64 * 1024;       // 每次fill最多生成的字节数
+    static const int MAX_HEADER_LIST = 16 * 1024;  // 通告的SETTINGS_MAX_HEADER_LIST_SIZE，也是头部块本身的上限
+    static const int MAX_PENDING_OUT = 4 * FILL_CHUNK;  // 对端不读数据，控制帧的应答堆积到这么多时断开
+
+    // 帧类型
+    enum FRAME_TYPE { DATA = 0, HEADERS, PRIORITY, RST_STREAM, SETTINGS, PUSH_PROMISE, PING, GOAWAY, WINDOW_UPDATE, CONTINUATION };
+    // 错误码
+    enum ERROR_CODE { NO_ERROR = 0, PROTOCOL_ERROR, INTERNAL_ERROR, FLOW_CONTROL_ERROR, SETTINGS_TIMEOUT,
+                      STREAM_CLOSED, FRAME_SIZE_ERROR, REFUSED_STREAM, CANCEL, COMPRESSION_ERROR,
+                      CONNECT_ERROR, ENHANCE_YOUR_CALM, INADEQUATE_SECURITY, HTTP_1_1_REQUIRED };
+
+    // client为客户端地址，用于按IP限流和交给处理器
+    h2_session(const sock_addr& client, bool tls);
+    ~h2_session();
+
+    // 数据是否以连接前言开头(数据不足24字节时只比较已有部分)
+    static bool is_preface(const char* data, int len);
+
+    // h2c升级：发送101响应和服务器前言，原来的HTTP/1.1请求作为流1处理，url是规范化之后的路径
+    void upgrade(const char* settings_b64, int method, const char* url, const str_view* headers);
+
+    // 解析收到的数据，协议错误时会在发送缓冲区中放入GOAWAY并返回false
+    bool feed(const char* data, int len);
+
+    // 按优先级生成DATA帧
+    void fill();
+
+    const char* out_data() const { return &m_out[0] + m_out_pos; }
+    int out_len() const { return (int)(m_out.size() - m_out_pos); }
+    void consume(int n);
+
+    bool idle() const { return m_active == 0; }                 // 没有未发完的响应
+    bool reading_frame() const { return !m_in.empty(); }        // 有未收完的帧
+    bool want_close() const { return (m_goaway || (m_peer_goaway && m_active == 0)) && out_len() == 0; }
+
+    // 所有会话占用的内存(缓冲区、流和动态表)，计入连接的内存预算
+    static long memory_total() { return m_memory_total.load(std::memory_order_relaxed); }
+
+private:
+    struct stream {
+        stream() : id(0), window(0), weight(16), parent(0), pending(false),
+                   file_addr(NULL), body(NULL), body_len(0), offset(0), vtime(0) {}
+        uint32_t id;
+        int32_t window;             // 发送窗口
+        int weight;                 // 优先级权重 1~256
+        uint32_t parent;            // 依赖的流
+        bool pending;               // 是否还有响应体没有发完
+        char* file_addr;            // 映射的文件，发送完毕后解除映射
+        response_writer::holder shared; // 缓存或资源包中的内容的所有者，发送完毕后释放引用
+        const char* body;           // 响应体(文件或错误页面)
+        size_t body_len;
+        size_t offset;              // 已发送的字节数
+        uint64_t vtime;             // 加权公平调度的虚拟时间，越小越先发送
+    };
+
+    bool handle_frame(uint8_t type, uint8_t flags, uint32_t sid, const uint8_t* payload, uint32_t len);
+    bool on_headers(uint8_t flags, uint32_t sid, const uint8_t* payload, uint32_t len);
+    bool on_settings(uint8_t flags, const uint8_t* payload, uint32_t len);
+    bool apply_settings(const uint8_t* payload, uint32_t len);
+    bool on_window_update(uint32_t sid, const uint8_t* payload, uint32_t len);
+    bool end_headers(uint32_t sid);
+    void respond(stream* s, int method, const char* url, const str_view* headers, bool has_body);
+    void respond_error(stream* s, int code, const char* url);
+    void set_priority(uint32_t sid, uint32_t parent, int weight, bool exclusive);
+
+    stream* find(uint32_t sid);
+    stream* create(uint32_t sid);
+    void close_stream(stream* s);
+    bool sendable(const stream* s) const;
+    stream* pick();
+
+    void write_frame_header(uint32_t len, uint8_t type, uint8_t flags, uint32_t sid);
+    void write_settings();
+    void write_window_update(uint32_t sid, uint32_t inc);
+    void write_rst(uint32_t sid, uint32_t code);
+    bool goaway(uint32_t code);
+    void recount();                     // 重新计算本会话占用的内存，差值计入m_memory_total
+
+private:
+    sock_addr m_client;
+    bool m_tls;
+    std::vector<char> m_in;             // 未收完的帧
+    std::vector<char> m_out;            // 待发送的数据
+    size_t m_out_pos;
+    bool m_preface;                     // 是否已收到连接前言
+    bool m_settings_sent;               // 是否已发送服务器前言(SETTINGS)
+    bool m_goaway;                      // 已发送GOAWAY，发完后关闭连接
+    bool m_peer_goaway;                 // 对端已发送GOAWAY，现有的流发完后关闭连接
+
+    hpack_decoder m_decoder;
+    std::vector<char> m_header_block;   // HEADERS + CONTINUATION拼接的头部块
+    uint32_t m_header_sid;              // 正在接收头部块的流，0表示没有
+    bool m_header_end_stream;           // 头部块所在的HEADERS帧是否带END_STREAM
+
+    std::map<uint32_t, stream*> m_streams;
+    uint32_t m_last_sid;                // 对端发起的最大流ID
+    int m_active;                       // 有数据待发送的流
+    int32_t m_conn_window;              // 连接级发送窗口
+    int32_t m_initial_window;           // 对端通告的流初始窗口
+    uint32_t m_peer_max_frame;          // 对端允许的最大帧
+    uint64_t m_vtime;                   // 全局虚拟时间
+    long m_memory;                      // 本会话计入m_memory_total的字节数
+    static std::atomic<long> m_memory_total;
+};
+
+#endif
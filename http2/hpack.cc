@@ -0,0 +1,326 @@
+#include "hpack.h"
+#include "huffman_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 静态表(RFC 7541 附录A)，下标从1开始
+static const char* static_table[][2] = {
+    { "", "" },
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+static const uint32_t STATIC_TABLE_LEN = 61;
+
+// Huffman解码树，程序启动时由编码表构建一次
+class huffman_tree {
+public:
+    huffman_tree() : m_count(1) {
+        memset(m_nodes, 0, sizeof(m_nodes));
+        for (int sym = 0; sym <= 256; ++sym) {
+            uint32_t code = huffman_codes[sym];
+            int len = huffman_code_len[sym];
+            int cur = 0;
+            for (int i = len - 1; i >= 0; --i) {
+                int bit = (code >> i) & 1;
+                if (m_nodes[cur].child[bit] == 0) {
+                    m_nodes[cur].child[bit] = m_count++;
+                }
+                cur = m_nodes[cur].child[bit];
+            }
+            m_nodes[cur].sym = sym;
+            m_nodes[cur].leaf = true;
+        }
+    }
+
+    bool decode(const uint8_t* p, size_t len, std::string& out) const {
+        int cur = 0;
+        int depth = 0;          // 当前未完成码字已读的位数
+        bool all_ones = true;   // 未完成码字是否全为1，只有这种情况才是合法的填充
+        for (size_t i = 0; i < len; ++i) {
+            for (int b = 7; b >= 0; --b) {
+                int bit = (p[i] >> b) & 1;
+                cur = m_nodes[cur].child[bit];
+                if (cur == 0) {
+                    return false;
+                }
+                ++depth;
+                all_ones = all_ones && bit;
+                if (m_nodes[cur].leaf) {
+                    if (m_nodes[cur].sym == 256) {
+                        return false;           // 不允许出现EOS
+                    }
+                    out.push_back((char)m_nodes[cur].sym);
+                    cur = 0;
+                    depth = 0;
+                    all_ones = true;
+                }
+            }
+        }
+        // 填充最多7位，且必须是EOS的前缀(全1)
+        return depth <= 7 && all_ones;
+    }
+
+private:
+    struct node {
+        int child[2];
+        int sym;
+        bool leaf;
+    };
+    node m_nodes[520];
+    int m_count;
+};
+
+static const huffman_tree huffman;
+
+bool hpack_huffman_decode(const uint8_t* p, size_t len, std::string& out) {
+    return huffman.decode(p, len, out);
+}
+
+bool hpack_decode_int(const uint8_t*& p, const uint8_t* end, int prefix_bits, uint32_t& value) {
+    if (p >= end) {
+        return false;
+    }
+    uint32_t limit = (1u << prefix_bits) - 1;
+    value = *p++ & limit;
+    if (value < limit) {
+        return true;
+    }
+    int shift = 0;
+    while (p < end) {
+        uint8_t b = *p++;
+        if (shift > 28) {
+            return false;                   // 溢出
+        }
+        value += (uint32_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void hpack_encode_int(std::vector<char>& out, uint8_t flags, int prefix_bits, uint32_t value) {
+    uint32_t limit = (1u << prefix_bits) - 1;
+    if (value < limit) {
+        out.push_back((char)(flags | value));
+        return;
+    }
+    out.push_back((char)(flags | limit));
+    value -= limit;
+    while (value >= 0x80) {
+        out.push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+// 解析一个字符串字面量，可能经过Huffman编码
+static bool decode_string(const uint8_t*& p, const uint8_t* end, std::string& out) {
+    if (p >= end) {
+        return false;
+    }
+    bool huff = (*p & 0x80) != 0;
+    uint32_t len;
+    if (!hpack_decode_int(p, end, 7, len) || len > (uint32_t)(end - p)) {
+        return false;
+    }
+    out.clear();
+    bool ok = true;
+    if (huff) {
+        ok = hpack_huffman_decode(p, len, out);
+    } else {
+        out.assign((const char*)p, len);
+    }
+    p += len;
+    return ok;
+}
+
+bool hpack_decoder::lookup(uint32_t index, hpack_header& out) const {
+    if (index == 0) {
+        return false;
+    }
+    if (index <= STATIC_TABLE_LEN) {
+        out.name = static_table[index][0];
+        out.value = static_table[index][1];
+        return true;
+    }
+    index -= STATIC_TABLE_LEN + 1;
+    if (index >= m_table.size()) {
+        return false;
+    }
+    out = m_table[index];
+    return true;
+}
+
+void hpack_decoder::evict(uint32_t limit) {
+    while (m_size > limit && !m_table.empty()) {
+        const hpack_header& h = m_table.back();
+        m_size -= h.name.size() + h.value.size() + 32;
+        m_table.pop_back();
+    }
+}
+
+void hpack_decoder::insert(const hpack_header& header) {
+    uint32_t entry = header.name.size() + header.value.size() + 32;
+    if (entry > m_max_size) {
+        // 比整个表还大的条目会清空动态表，自身也不插入
+        evict(0);
+        return;
+    }
+    evict(m_max_size - entry);
+    m_table.push_front(header);
+    m_size += entry;
+}
+
+hpack_decoder::RESULT hpack_decoder::decode(const uint8_t* data, size_t len, size_t max_list, std::vector<hpack_header>& out) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    size_t list = 0;
+    while (p < end) {
+        uint8_t b = *p;
+        hpack_header h;
+        uint32_t index;
+        if (b & 0x80) {
+            // 索引头部字段
+            if (!hpack_decode_int(p, end, 7, index) || !lookup(index, h)) {
+                return MALFORMED;
+            }
+            list += h.name.size() + h.value.size() + 32;
+            if (list > max_list) {
+                return TOO_LARGE;
+            }
+            out.push_back(h);
+            continue;
+        }
+        if ((b & 0xe0) == 0x20) {
+            // 动态表大小更新
+            if (!hpack_decode_int(p, end, 5, index) || index > DEFAULT_TABLE_SIZE) {
+                return MALFORMED;
+            }
+            m_max_size = index;
+            evict(m_max_size);
+            continue;
+        }
+        // 带索引的字面量(01)、不带索引(0000)和永不索引(0001)的字面量
+        bool indexing = (b & 0xc0) == 0x40;
+        int prefix = indexing ? 6 : 4;
+        if (!hpack_decode_int(p, end, prefix, index)) {
+            return MALFORMED;
+        }
+        if (index == 0) {
+            if (!decode_string(p, end, h.name)) {
+                return MALFORMED;
+            }
+        } else if (!lookup(index, h)) {
+            return MALFORMED;
+        }
+        if (!decode_string(p, end, h.value)) {
+            return MALFORMED;
+        }
+        if (indexing) {
+            insert(h);
+        }
+        list += h.name.size() + h.value.size() + 32;
+        if (list > max_list) {
+            return TOO_LARGE;
+        }
+        out.push_back(h);
+    }
+    return DECODED;
+}
+
+void hpack_encoder::encode_status(int status, std::vector<char>& out) {
+    // 静态表中完整收录的状态码直接发索引
+    for (uint32_t i = 8; i <= 14; ++i) {
+        if (atoi(static_table[i][1]) == status) {
+            hpack_encode_int(out, 0x80, 7, i);
+            return;
+        }
+    }
+    char buf[8];
+    snprintf(buf, sizeof(buf), "%d", status);
+    hpack_encode_int(out, 0x00, 4, 8);
+    hpack_encode_int(out, 0x00, 7, strlen(buf));
+    out.insert(out.end(), buf, buf + strlen(buf));
+}
+
+void hpack_encoder::encode(const char* name, const char* value, std::vector<char>& out) {
+    uint32_t index = 0;
+    for (uint32_t i = 1; i <= STATIC_TABLE_LEN; ++i) {
+        if (strcmp(static_table[i][0], name) == 0) {
+            index = i;
+            break;
+        }
+    }
+    // 不带索引的字面量
+    hpack_encode_int(out, 0x00, 4, index);
+    if (index == 0) {
+        size_t nlen = strlen(name);
+        hpack_encode_int(out, 0x00, 7, nlen);
+        out.insert(out.end(), name, name + nlen);
+    }
+    size_t vlen = strlen(value);
+    hpack_encode_int(out, 0x00, 7, vlen);
+    out.insert(out.end(), value, value + vlen);
+}
@@ -0,0 +1,58 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+// HPACK头部压缩(RFC 7541)
+
+struct hpack_header {
+    std::string name;
+    std::string value;
+};
+
+// 解码器，维护对端编码器对应的动态表，每个连接一个
+class hpack_decoder {
+public:
+    static const uint32_t DEFAULT_TABLE_SIZE = 4096;
+
+    /*
+        DECODED     :   解码成功
+        MALFORMED   :   格式错误，对应连接级的COMPRESSION_ERROR
+        TOO_LARGE   :   解出的头部列表超过上限，每个字段按 name + value + 32 计算
+    */
+    enum RESULT { DECODED = 0, MALFORMED, TOO_LARGE };
+
+    hpack_decoder() : m_size(0), m_max_size(DEFAULT_TABLE_SIZE) {}
+
+    // 解码一个完整的头部块(HEADERS + CONTINUATION)。引用动态表的索引只占一两个字节，
+    // 解出的内容可能比头部块大得多，超过max_list时立即停止
+    RESULT decode(const uint8_t* data, size_t len, size_t max_list, std::vector<hpack_header>& out);
+
+private:
+    bool lookup(uint32_t index, hpack_header& out) const;
+    void insert(const hpack_header& header);
+    void evict(uint32_t limit);
+
+private:
+    std::deque<hpack_header> m_table;   // 动态表，新插入的条目在前
+    uint32_t m_size;                    // 动态表当前大小，每个条目计 name + value + 32
+    uint32_t m_max_size;                // 动态表上限，不超过我们通告的SETTINGS_HEADER_TABLE_SIZE
+};
+
+// 编码器，只引用静态表，值以不加索引的字面量发送，因此不需要和对端同步动态表
+class hpack_encoder {
+public:
+    static void encode_status(int status, std::vector<char>& out);
+    static void encode(const char* name, const char* value, std::vector<char>& out);
+};
+
+// 整数和Huffman字符串的基础编解码
+bool hpack_decode_int(const uint8_t*& p, const uint8_t* end, int prefix_bits, uint32_t& value);
+void hpack_encode_int(std::vector<char>& out, uint8_t flags, int prefix_bits, uint32_t value);
+bool hpack_huffman_decode(const uint8_t* p, size_t len, std::string& out);
+
+#endif
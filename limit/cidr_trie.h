@@ -0,0 +1,178 @@
+#ifndef CIDR_TRIE_H
+#define CIDR_TRIE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include "../net/sock_addr.h"
+
+// 压缩前缀树(Patricia树)，用于匹配CIDR的允许/拒绝名单
+// 每个节点保存一段前缀，只在前缀分叉处建立节点，查找按最长前缀匹配
+// 地址是128位的，IPv4前缀按IPv4映射地址(::ffff:0:0/96)插入，和双栈socket上的IPv4客户端一致
+class cidr_trie {
+public:
+    enum ACTION { NONE = 0, ALLOW, DENY };
+
+    cidr_trie() : m_root(NULL), m_size(0) {}
+    ~cidr_trie() { destroy(m_root); }
+
+    // 插入一条前缀，addr为主机字节序
+    void insert(ip128 addr, int prefix_len, ACTION action) {
+        if (prefix_len < 0 || prefix_len > 128) {
+            return;
+        }
+        addr &= mask(prefix_len);
+        node** link = &m_root;
+        while (*link) {
+            node* cur = *link;
+            int common = common_len(cur->key, cur->len, addr, prefix_len);
+            if (common == cur->len) {
+                if (common == prefix_len) {
+                    // 前缀已存在，覆盖动作
+                    cur->action = action;
+                    return;
+                }
+                link = &cur->child[bit(addr, cur->len)];
+                continue;
+            }
+            // 在公共前缀处分裂出新的中间节点
+            node* split = new node(addr & mask(common), common, NONE);
+            split->child[bit(cur->key, common)] = cur;
+            *link = split;
+            if (common == prefix_len) {
+                split->action = action;
+            } else {
+                split->child[bit(addr, common)] = new node(addr, prefix_len, action);
+            }
+            ++m_size;
+            return;
+        }
+        *link = new node(addr, prefix_len, action);
+        ++m_size;
+    }
+
+    // 解析 "a.b.c.d/len"、"a.b.c.d"、"v6/len" 或 "v6" 形式的字符串
+    bool insert(const char* cidr, ACTION action) {
+        char buf[INET6_ADDRSTRLEN + 5];
+        strncpy(buf, cidr, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = '\0';
+
+        char* slash = strchr(buf, '/');
+        if (slash) {
+            *slash++ = '\0';
+        }
+        sock_addr addr;
+        in6_addr in6;
+        int max_len = 32;
+        if (inet_pton(AF_INET, buf, &in6) == 1) {
+            addr.set_v4(&in6, 0);
+        } else if (inet_pton(AF_INET6, buf, &in6) == 1) {
+            addr.set_v6(&in6, 0);
+            max_len = 128;
+        } else {
+            return false;
+        }
+        int prefix_len = slash ? atoi(slash) : max_len;
+        if (prefix_len < 0 || prefix_len > max_len) {
+            return false;
+        }
+        ip128 ip = 0;
+        if (!addr.ip(&ip)) {
+            return false;
+        }
+        insert(ip, prefix_len + (128 - max_len), action);
+        return true;
+    }
+
+    // 最长前缀匹配，addr为主机字节序
+    ACTION match(ip128 addr) const {
+        ACTION ret = NONE;
+        const node* cur = m_root;
+        while (cur) {
+            if (((addr ^ cur->key) & mask(cur->len)) != 0) {
+                break;
+            }
+            if (cur->action != NONE) {
+                ret = cur->action;
+            }
+            if (cur->len == 128) {
+                break;
+            }
+            cur = cur->child[bit(addr, cur->len)];
+        }
+        return ret;
+    }
+
+    // 从文件加载名单，每行一个CIDR，#开头为注释
+    int load(const char* path, ACTION action) {
+        FILE* fp = fopen(path, "r");
+        if (!fp) {
+            return -1;
+        }
+        int count = 0;
+        char line[128];
+        while (fgets(line, sizeof(line), fp)) {
+            char* text = line + strspn(line, " \t");
+            text[strcspn(text, " \t\r\n#")] = '\0';
+            if (text[0] == '\0') {
+                continue;
+            }
+            if (insert(text, action)) {
+                ++count;
+            } else {
+                printf("bad cidr in %s: %s\n", path, text);
+            }
+        }
+        fclose(fp);
+        return count;
+    }
+
+    bool empty() const { return m_root == NULL; }
+    int size() const { return m_size; }
+
+private:
+    struct node {
+        node(ip128 k, int l, ACTION a) : key(k), len(l), action(a) {
+            child[0] = child[1] = NULL;
+        }
+        ip128 key;          // 前缀(低位清零)
+        int len;            // 前缀长度
+        ACTION action;
+        node* child[2];
+    };
+
+    static ip128 mask(int len) {
+        return len == 0 ? 0 : (~(ip128)0 << (128 - len));
+    }
+
+    // 第pos位(从最高位开始计数)
+    static int bit(ip128 addr, int pos) {
+        return (int)(addr >> (127 - pos)) & 1;
+    }
+
+    static int common_len(ip128 a, int alen, ip128 b, int blen) {
+        int limit = alen < blen ? alen : blen;
+        ip128 diff = a ^ b;
+        uint64_t hi = (uint64_t)(diff >> 64);
+        uint64_t lo = (uint64_t)diff;
+        int same = hi ? __builtin_clzll(hi) : (lo ? 64 + __builtin_clzll(lo) : 128);
+        return same < limit ? same : limit;
+    }
+
+    static void destroy(node* n) {
+        if (!n) {
+            return;
+        }
+        destroy(n->child[0]);
+        destroy(n->child[1]);
+        delete n;
+    }
+
+private:
+    node* m_root;
+    int m_size;
+};
+
+#endif
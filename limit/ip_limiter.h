@@ -0,0 +1,194 @@
+#ifndef IP_LIMITER_H
+#define IP_LIMITER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../pthreadpool/lcoker.h"
+#include "cidr_trie.h"
+#include "../net/sock_addr.h"
+
+// 按客户端IP限流：令牌桶控制请求速率，同时限制每个IP的并发连接数
+// 表按IP哈希分片，每个分片是固定大小的开放寻址表，分片之间互不影响锁
+// IPv6客户端按/64计数(一个用户通常拥有整个/64)；没有IP的Unix域客户端不限制
+class ip_limiter {
+public:
+    static const int SHARD_BITS = 4;
+    static const int SHARD_COUNT = 1 << SHARD_BITS;     // 分片数
+    static const int SHARD_SLOTS = 4096;                // 每个分片的槽位数，必须是2的幂
+    static const int MAX_PROBE = 8;                     // 线性探测的最大步数
+
+    // 准入结果，TABLE_FULL表示探测窗口内都是有连接的IP，没有位置记账
+    enum VERDICT { ADMIT = 0, DENIED, TOO_MANY_CONN, RATE_LIMITED, TABLE_FULL };
+
+    ip_limiter(int max_conn, int rate, int burst)
+        : m_max_conn(max_conn), m_rate(rate), m_burst(burst) {
+        for (int i = 0; i < SHARD_COUNT; ++i) {
+            memset(m_shards[i].slots, 0, sizeof(m_shards[i].slots));
+        }
+    }
+
+    cidr_trie& acl() { return m_acl; }
+
+    // accept之后、初始化连接之前调用。*counted返回是否占用了一个并发名额，只有占用了的才能on_close：
+    // 没有IP的客户端和名单允许的IP在表满时放行但不记账
+    VERDICT on_accept(const sock_addr& addr, bool* counted) {
+        *counted = false;
+        ip128 ip;
+        if (!addr.ip(&ip)) {
+            return ADMIT;
+        }
+        cidr_trie::ACTION action = m_acl.match(ip);
+        if (action == cidr_trie::DENY) {
+            return DENIED;
+        }
+        ip = key_of(ip);
+
+        shard& s = m_shards[shard_of(ip)];
+        s.lock.lock();
+        entry* e = find(s, ip, true);
+        VERDICT ret = ADMIT;
+        if (!e && action != cidr_trie::ALLOW) {
+            ret = TABLE_FULL;
+        } else if (e && action != cidr_trie::ALLOW) {
+            if (e->conns >= m_max_conn) {
+                ret = TOO_MANY_CONN;
+            } else if (!refill(e)) {
+                ret = RATE_LIMITED;
+            }
+        }
+        if (e && ret == ADMIT) {
+            ++e->conns;
+            *counted = true;
+        }
+        s.lock.unlock();
+        return ret;
+    }
+
+    // 每个请求的第一个字节到达时调用，解析之前消耗一个令牌
+    bool on_request(const sock_addr& addr) {
+        ip128 ip;
+        if (!addr.ip(&ip) || m_acl.match(ip) == cidr_trie::ALLOW) {
+            return true;
+        }
+        ip = key_of(ip);
+        shard& s = m_shards[shard_of(ip)];
+        s.lock.lock();
+        entry* e = find(s, ip, false);
+        bool ret = !e || take_token(e);
+        s.lock.unlock();
+        return ret;
+    }
+
+    // 连接关闭时归还on_accept占用的并发名额
+    void on_close(const sock_addr& addr) {
+        ip128 ip;
+        if (!addr.ip(&ip)) {
+            return;
+        }
+        ip = key_of(ip);
+        shard& s = m_shards[shard_of(ip)];
+        s.lock.lock();
+        entry* e = find(s, ip, false);
+        if (e && e->conns > 0) {
+            --e->conns;
+        }
+        s.lock.unlock();
+    }
+
+private:
+    struct entry {
+        ip128 ip;               // 计数用的地址(见key_of)，0表示空槽
+        int conns;              // 当前并发连接数
+        int64_t tokens;         // 剩余令牌，放大1000倍保存
+        int64_t last_ms;        // 上次补充令牌的时间
+    };
+
+    struct shard {
+        locker lock;
+        entry slots[SHARD_SLOTS];
+    };
+
+    static int64_t now_ms() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    // IPv4映射地址原样计数，其他IPv6地址只保留/64前缀
+    static ip128 key_of(ip128 ip) {
+        return (ip >> 32) == 0xffff ? ip : (ip >> 64) << 64;
+    }
+
+    // 折叠成64位后做Fibonacci哈希，高位选分片，其余位选槽位
+    static uint64_t hash(ip128 ip) { return ((uint64_t)(ip >> 64) ^ (uint64_t)ip) * 11400714819323198485ull; }
+    static int shard_of(ip128 ip) { return hash(ip) >> (64 - SHARD_BITS); }
+    static int slot_of(ip128 ip) { return (hash(ip) >> 32) & (SHARD_SLOTS - 1); }
+
+    // 补充令牌，返回是否至少还有一个令牌；accept时只检查不消耗
+    bool refill(entry* e) {
+        int64_t now = now_ms();
+        e->tokens += (now - e->last_ms) * m_rate;
+        if (e->tokens > (int64_t)m_burst * 1000) {
+            e->tokens = (int64_t)m_burst * 1000;
+        }
+        e->last_ms = now;
+        return e->tokens >= 1000;
+    }
+
+    bool take_token(entry* e) {
+        if (!refill(e)) {
+            return false;
+        }
+        e->tokens -= 1000;
+        return true;
+    }
+
+    // 空闲条目：没有连接且令牌桶已经补满，可以被其他IP复用
+    bool reusable(entry* e, int64_t now) {
+        return e->conns == 0 &&
+               e->tokens + (now - e->last_ms) * m_rate >= (int64_t)m_burst * 1000;
+    }
+
+    // 在探测窗口内查找，create为true时占用空槽或可复用的条目；都不可复用时淘汰令牌最多的
+    // 没有连接的条目(只丢掉它的速率记录)。窗口内的IP都有连接时返回NULL，有连接的条目不能淘汰，
+    // 否则它们的on_close会找不到自己的名额
+    entry* find(shard& s, ip128 ip, bool create) {
+        int base = slot_of(ip);
+        entry* victim = NULL;
+        entry* idle = NULL;
+        int64_t now = create ? now_ms() : 0;
+        for (int i = 0; i < MAX_PROBE; ++i) {
+            entry* e = &s.slots[(base + i) & (SHARD_SLOTS - 1)];
+            if (e->ip == ip) {
+                return e;
+            }
+            if (create && !victim && (e->ip == 0 || reusable(e, now))) {
+                victim = e;
+            }
+            if (create && e->conns == 0 && (!idle || e->tokens > idle->tokens)) {
+                idle = e;
+            }
+        }
+        if (!victim) {
+            victim = idle;
+        }
+        if (victim) {
+            victim->ip = ip;
+            victim->conns = 0;
+            victim->tokens = (int64_t)m_burst * 1000;
+            victim->last_ms = now;
+        }
+        return victim;
+    }
+
+private:
+    int m_max_conn;         // 每个IP的最大并发连接数
+    int m_rate;             // 每秒补充的令牌数
+    int m_burst;            // 令牌桶容量
+    cidr_trie m_acl;        // 允许/拒绝名单
+    shard m_shards[SHARD_COUNT];
+};
+
+#endif
@@ -11,16 +11,60 @@
 #include <signal.h>
 #include <errno.h>
 #include "http/http_conn.h"
+#include "http/slot_map.h"
 #include "timer/lst_timer.h"
+#include "handler/echo_handler.h"
+#include "handler/upload_handler.h"
+#include "handler/static_handler.h"
+#include "handler/stats_handler.h"
+#include "handler/proxy_handler.h"
+#include "handler/fastcgi_handler.h"
+#include "http/fs_watcher.h"
+#include "http/shm_arena.h"
+#include "prefork/master.h"
+#include "prefork/handoff.h"
+#include "net/listener.h"
+#include "upstream/upstream.h"
 #include <assert.h>
 
-#define MAXFD 65535    // 支持的最大客户端数
+#define MAXFD 65535    // 支持的最大客户端数，连接对象按需分配，与fd的数值无关
 #define MAX_EVENT_NUMBER 10000   // 监听最大数
 #define TIMESLOT 5
+#define CONN_MEMORY_BUDGET (256L * 1024 * 1024)    // 连接占用内存的上限，包括请求体缓冲块、TLS和HTTP/2会话
+#define PER_IP_MAX_CONN 64       // 每个IP的最大并发连接数
+#define PER_IP_RATE 50           // 每个IP每秒允许的请求数
+#define PER_IP_BURST 100         // 每个IP允许的突发请求数
+#define ALLOW_LIST "conf/allow.list"
+#define DENY_LIST "conf/deny.list"
+#define TLS_CERT_FILE "conf/server.crt"     // 由conf/gen_cert.sh生成的自签名证书
+#define TLS_KEY_FILE "conf/server.key"
+#define PREFETCH_THREADS 4       // 预读冷文件的I/O线程数
+#define ASSET_BUNDLE "conf/assets.bundle"   // 由tools/pack_assets生成的资源包，不存在时直接读doc_root
+#define HOT_LIST "conf/hot.list"            // 退出时保存的热点文件列表，启动时据此预热页缓存
+#define HOT_LIST_SIZE 1024
+#define MLOCK_BUDGET ((size_t)0)            // 锁定在内存中的字节数(热点文件和请求体缓冲块)，0为不锁定
+#define BODY_BUFFER_RESERVE 64              // 启动时在大页上预分配的请求体缓冲块数
+#define SHM_ARENA_SIZE (8L * 1024 * 1024)   // 工作进程共享的计数器和文件元数据缓存
+#define VARIANT_SNAPSHOT "conf/variants.snapshot"   // 平滑升级时保存的压缩版本，新进程启动时载入
+#define DRAIN_TIMEOUT 30                    // 排空时等待已有连接处理完的最长时间(秒)
+#define LISTEN_CONF "conf/listen.conf"      // 启动参数之外的监听(IPv6、Unix域socket、PROXY协议等)，写法见net/listener.h
+#define UPSTREAM_CONF "conf/upstreams.conf" // 反向代理的路径前缀和后端，写法见upstream/upstream.h
+#define FASTCGI_CONF "conf/fastcgi.conf"    // FastCGI的路由模式和应用进程池，写法见fastcgi/fcgi_pool.h
+#define FASTCGI_ROOT "/home/master/Desktop/WebServer/scripts"  // FastCGI脚本的目录，不能放在doc_root下，否则脚本源码可以被直接下载
+
+// 路由表，模式的写法见http/router.h
+static const router::route routes[] = {
+    { http_conn::POST, "/echo", echo_handler::create },
+    { http_conn::PUT, "/echo", echo_handler::create },
+    { http_conn::PUT, "/mirror/*", upload_handler::create },    // PUT上传的文件只能放在doc_root下的这个目录中
+    { http_conn::GET, "/server-status", stats_handler::create },
+    { http_conn::GET, "/*", static_handler::create },
+};
 
 static int pipefd[2];
 static sort_timer_lst timer_lst;
 static int epollfd = 0;
+static slot_map<http_conn> users;      // 保存所有客户端信息，epoll事件中携带的是连接的句柄
 
 // 添加信号捕捉
 void addsig(int sig, void(handle)(int)) {
@@ -49,41 +93,277 @@ void add_sig(int sig) {
 
 
 // 定时器回调函数，它删除非活动连接socket上的注册事件，并关闭之。
+// 定时器到期时连接可能已经进入了下一个阶段(例如请求头已收完)，此时按新阶段的截止时间重新计时；
+// 工作线程正在处理的连接不关闭，下一次tick再检查
 void cb_func(http_conn* user_data)
 {
+    util_timer* timer = &user_data->timer;
+    if (!user_data->try_own()) {
+        timer->expire = time(NULL) + 1;
+        timer_lst.add_timer(timer);
+        return;
+    }
+    time_t expire = user_data->deadline();
+    if (expire > time(NULL)) {
+        user_data->disown();
+        timer->expire = expire;
+        timer_lst.add_timer(timer);
+        return;
+    }
+    uint64_t handle = user_data->handle();
     user_data->close_conn();
+    users.release(handle);
+    user_data->disown();
+}
+
+// 关闭连接，移除对应的定时器并归还槽位，之后该连接旧句柄上的事件和任务都会被丢弃
+void close_user(http_conn* user) {
+    uint64_t handle = user->handle();
+    user->close_conn();
+    timer_lst.del_timer(&user->timer);
+    users.release(handle);
+}
+
+// 线程池的队列已满时任务没有入队，而事件已经被EPOLLONESHOT消耗，连接不会再被触发，拒绝后由EPOLLRDHUP回收
+static void dispatch(threadpool<http_conn>* pool, http_conn* user, uint64_t key) {
+    if (!pool->append(user, key)) {
+        user->reject_overloaded();
+    }
+}
+
+// 按连接当前阶段的截止时间调整定时器，截止时间可能提前也可能推后
+void refresh_timer(http_conn* user) {
+    util_timer* timer = &user->timer;
+    time_t expire = user->deadline();
+    if (timer->expire != expire) {
+        timer->expire = expire;
+        timer_lst.mod_timer(timer);
+    }
 }
 
 void time_handler() {
     // 定时处理任务，实际上就是调用tick()函数
     timer_lst.tick();
+    // 资源包被替换后切换到新版本
+    http_conn::reload_assets();
     // 因为一次alarm调用只会引起一次SIGALARM信号，所以我们要重新定时，以不断触发SIGALARM信号。
     alarm(TIMESLOT);
 }
 
+// 保存热点列表和压缩版本，供下一个进程预热
+static void save_snapshot() {
+    if (!http_conn::save_hot_list(HOT_LIST, HOT_LIST_SIZE)) {
+        printf("failed to save %s\n", HOT_LIST);
+    }
+    if (!http_conn::save_variants(VARIANT_SNAPSHOT)) {
+        printf("failed to save %s\n", VARIANT_SNAPSHOT);
+    }
+}
+
+// 启动参数中的端口转换成双栈通配地址的监听，再加上配置文件中的监听
+static bool configure_listeners(int port, int https_port, std::vector<listener>* ls) {
+    char spec[32];
+    listener l;
+    if (port > 0) {
+        snprintf(spec, sizeof(spec), "%d", port);
+        if (!parse_listener(spec, &l)) {
+            return false;
+        }
+        ls->push_back(l);
+    }
+    if (https_port > 0) {
+        snprintf(spec, sizeof(spec), "%d tls", https_port);
+        if (!parse_listener(spec, &l)) {
+            return false;
+        }
+        ls->push_back(l);
+    }
+    return load_listeners(LISTEN_CONF, ls) >= 0 && !ls->empty();
+}
+
+static std::vector<int> listen_fds(const std::vector<listener>& ls) {
+    std::vector<int> fds;
+    for (size_t i = 0; i < ls.size(); ++i) {
+        fds.push_back(ls[i].fd);
+    }
+    return fds;
+}
+
+// 每个上游前缀本身和它下面的路径都转发，优先于静态文件的"/*"
+static bool add_upstream_routes(const upstream_table& upstreams) {
+    static const http_conn::METHOD methods[] = {
+        http_conn::GET, http_conn::POST, http_conn::PUT, http_conn::DELETE, http_conn::OPTIONS,
+    };
+    for (size_t i = 0; i < upstreams.groups().size(); ++i) {
+        const upstream_group* g = upstreams.groups()[i];
+        for (size_t j = 0; j < sizeof(methods) / sizeof(methods[0]); ++j) {
+            if (!http_conn::add_handler(methods[j], g->pattern.c_str(), proxy_handler::create)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// FastCGI池的模式和上游前缀一样优先于静态文件的"/*"，HEAD使用GET的路由
+static bool add_fastcgi_routes(const fcgi_table& pools) {
+    static const http_conn::METHOD methods[] = {
+        http_conn::GET, http_conn::POST, http_conn::PUT, http_conn::DELETE, http_conn::OPTIONS,
+    };
+    for (size_t i = 0; i < pools.pools().size(); ++i) {
+        const fcgi_pool* p = pools.pools()[i];
+        for (size_t j = 0; j < sizeof(methods) / sizeof(methods[0]); ++j) {
+            if (!http_conn::add_handler(methods[j], p->pattern.c_str(), fastcgi_handler::create)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// 读取PROXY头，完成后返回true，之后按普通连接处理；头不完整或出错时返回false，出错的连接已经关闭
+static bool accept_proxy(http_conn* user) {
+    if (!user->read_proxy()) {
+        close_user(user);
+        return false;
+    }
+    return !user->proxy_pending();
+}
+
 // 添加文件描述符到epoll中
-extern void addfd(int epollfd, int fd, bool one_shot);
+extern void addfd(int epollfd, int fd, bool one_shot, uint64_t key);
 
 // 删除文件描述符到epoll中
 extern void removefd(int epollfd, int fd);
 
 extern void setnonblocking(int fd);
 
+// 网站的根目录
+extern const char* doc_root;
+
 // 修改文件描述符(epoll)
-extern void modfd(int epollfd, int fd, int ev);
+extern void modfd(int epollfd, int fd, int ev, uint64_t key);
+
+// 把监听socket加入epoll。多个工作进程共享同一个监听socket时加上EPOLLEXCLUSIVE，新连接只唤醒其中一个进程
+static void add_listener(int epollfd, int fd, bool exclusive) {
+    if (!exclusive) {
+        addfd(epollfd, fd, false, fd);
+        return;
+    }
+    epoll_event event;
+    event.data.u64 = fd;
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    setnonblocking(fd);
+}
+
 int main(int argc, char* argv[])
 {
     if (argc <= 1) {
-        printf("usage: port\n");
+        printf("usage: port [https_port [workers]]\n");
+        printf("port or https_port 0 disables it; more listeners can be added in %s\n", LISTEN_CONF);
         return 1;
     }
 
-    // 获取端口号
+    // 获取端口号；workers大于0时以prefork模式运行，https_port为0表示不监听HTTPS
     int port = atoi(argv[1]);
+    int https_port = argc > 2 ? atoi(argv[2]) : 0;
+    int workers = argc > 3 ? atoi(argv[3]) : 0;
 
     // 对SIGPIE信号进行处理
     addsig(SIGPIPE, SIG_IGN);
 
+    // 按IP限流，名单文件不存在时忽略
+    ip_limiter* limiter = new ip_limiter(PER_IP_MAX_CONN, PER_IP_RATE, PER_IP_BURST);
+    limiter->acl().load(DENY_LIST, cidr_trie::DENY);
+    limiter->acl().load(ALLOW_LIST, cidr_trie::ALLOW);
+    http_conn::m_limiter = limiter;
+    http_conn::m_max_conn = MAXFD;
+    http_conn::m_mem_budget = CONN_MEMORY_BUDGET;
+
+    // 路由表，没有匹配到其他路由的GET/HEAD请求由静态文件处理器处理
+    if (!http_conn::add_routes(routes, sizeof(routes) / sizeof(routes[0]))) {
+        printf("invalid route table\n");
+        return 1;
+    }
+
+    // 反向代理的路由挂在静态路由之后，同一个模式以后注册的为准
+    upstream_table* upstreams = new upstream_table;
+    if (upstreams->load(UPSTREAM_CONF) < 0 || !add_upstream_routes(*upstreams)) {
+        printf("invalid %s\n", UPSTREAM_CONF);
+        return 1;
+    }
+    proxy_handler::m_upstreams = upstreams;
+
+    // FastCGI的应用进程由单独的监管进程管理，在打开监听socket、创建线程和prefork之前启动
+    fcgi_table* fastcgi = new fcgi_table;
+    if (fastcgi->load(FASTCGI_CONF) < 0 || !add_fastcgi_routes(*fastcgi) || !fastcgi->start()) {
+        printf("invalid %s\n", FASTCGI_CONF);
+        return 1;
+    }
+    fastcgi_handler::m_pools = fastcgi;
+    fastcgi_handler::m_script_root = FASTCGI_ROOT;
+
+    http_conn::load_assets(ASSET_BUNDLE);
+
+    std::vector<listener> listeners;
+    if (!configure_listeners(port, https_port, &listeners)) {
+        printf("no valid listener\n");
+        return 1;
+    }
+
+    // 有HTTPS监听时加载证书，失败时不启动
+    tls_context* tls = NULL;
+    for (size_t i = 0; i < listeners.size() && !tls; ++i) {
+        if (listeners[i].tls) {
+            tls = new tls_context;
+            if (!tls->init(TLS_CERT_FILE, TLS_KEY_FILE)) {
+                return 1;
+            }
+        }
+    }
+
+    // 由平滑升级启动时沿用旧进程的监听socket，predecessor在新进程就绪后退出；配置中新增的地址重新bind
+    pid_t predecessor = 0;
+    std::vector<int> inherited;
+    if (inherited_listeners(&inherited, &predecessor)) {
+        adopt_listeners(inherited, &listeners);
+    }
+    for (size_t i = 0; i < listeners.size(); ++i) {
+        if (listeners[i].fd == -1 && !open_listener(&listeners[i])) {
+            return 1;
+        }
+    }
+    int ret = 0;
+
+    // 共享内存在fork之前创建，单进程模式下同样使用
+    shm_arena* arena = NULL;
+    try {
+        arena = new shm_arena(SHM_ARENA_SIZE);
+    }
+    catch(...) {
+        return 1;
+    }
+    server_stats* stats = arena->create<server_stats>();
+    http_conn::m_stat_cache = arena->create<shm_stat_cache>();
+    if (!stats || !http_conn::m_stat_cache) {
+        printf("SHM_ARENA_SIZE too small\n");
+        return 1;
+    }
+    http_conn::m_server_stats = stats;
+    int slot = 0;
+    if (workers > 0) {
+        // 主进程在这里一直运行到退出；工作进程从这里返回，之后的线程、epoll和定时器都属于各个工作进程
+        master m(workers, stats, argv, listen_fds(listeners), predecessor);
+        slot = m.run();
+        if (slot < 0) {
+            return 0;
+        }
+    } else {
+        stats->workers[0].pid.store(getpid());
+    }
+    http_conn::m_stats = &stats->workers[slot];
+
     // 创建线程池,并初始化
     threadpool<http_conn>* pool = NULL;
     try {
@@ -93,63 +373,84 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    // 创建数组保存所有客户端信息
-    http_conn* users = new http_conn[MAXFD];
-
-    // socket
-    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    /*if (listenfd == -1) {
-        perror("socket");
-        exit(-1);
-    }*/
-
-    // 端口复用
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-
-    // 绑定端口
-    struct sockaddr_in saddr;
-    bzero(&saddr, sizeof(saddr));
-    saddr.sin_family = AF_INET;
-    saddr.sin_port = htons(port);
-    saddr.sin_addr.s_addr = INADDR_ANY;
-    int ret = bind(listenfd, (struct sockaddr*)&saddr, sizeof(saddr));
-    /*if (ret == -1) {
-        perror("bind");
-        exit(-1);
-    }
-*/
-    // 监听
-    ret = listen(listenfd, 8);
-   /* if (ret == -1) {
-        perror("listen");
-        exit(-1);
-    }*/
-
     // 创建epoll对象，添加事件数组
     epoll_event events[MAX_EVENT_NUMBER];
     int epollfd = epoll_create(5);
 
     // 将监听文件描述符添加到epoll中
-    addfd(epollfd, listenfd, false);
+    for (size_t i = 0; i < listeners.size(); ++i) {
+        add_listener(epollfd, listeners[i].fd, workers > 0);
+    }
     http_conn::m_epollfd = epollfd;
 
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert(ret != -1);
     setnonblocking(pipefd[1]);
     // addfd(epollfd, pipefd[0], false);
-    addfd(epollfd, pipefd[0], false);
-    // 设置信号处理函数
+    addfd(epollfd, pipefd[0], false, pipefd[0]);
+
+    // 监视doc_root，文件变化时使缓存失效；不可用时文件缓存定期重新验证
+    fs_watcher watcher;
+    if (watcher.init(doc_root, http_conn::file_changed)) {
+        addfd(epollfd, watcher.fd(), false, watcher.fd());
+    }
+    http_conn::set_watched(watcher.complete());
+    // 等待文件加载或预读的连接在完成后从这里重新交给线程池
+    wake_queue wakeups;
+    http_conn::m_wake = &wakeups;
+    addfd(epollfd, wakeups.fd(), false, wakeups.fd());
+    try {
+        http_conn::m_prefetch = new prefetch_pool(PREFETCH_THREADS, &wakeups);
+    }
+    catch(...) {
+        return 1;
+    }
+    // 处理器等待的上游fd直接注册在这个epoll上，就绪后连接重新交给线程池
+    fd_waiters waiters;
+    http_conn::m_fd_waiters = &waiters;
+    if (!upstreams->start_health_checks()) {
+        return 1;
+    }
+    // 预热：缓冲块先于热点文件占用锁定的预算
+    size_t lock_budget = MLOCK_BUDGET;
+    size_t pinned = http_conn::reserve_buffers(BODY_BUFFER_RESERVE, lock_budget);
+    http_conn::prewarm(HOT_LIST, lock_budget > pinned ? lock_budget - pinned : 0);
+    http_conn::load_variants(VARIANT_SNAPSHOT);
+    // 设置信号处理函数；prefork模式下SIGUSR2由主进程处理
     add_sig(SIGALRM);
     add_sig(SIGTERM);
+    add_sig(SIGQUIT);
+    add_sig(SIGUSR1);
+    if (workers == 0) {
+        add_sig(SIGUSR2);
+    }
 
     bool stop_server = false;
+    bool draining = false;
+    time_t drain_deadline = 0;
 
     bool timeout = false;
     alarm(TIMESLOT);                                    // 定时,5秒后产生SIGALARM信号
 
+    // 开始接受连接；由升级启动的单进程服务器在这里通知旧进程排空
+    http_conn::m_stats->ready.store(1);
+    if (workers == 0 && predecessor > 0 && getppid() == predecessor) {
+        kill(predecessor, SIGQUIT);
+    }
+
     while (!stop_server) {
-        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        if (draining) {
+            // 排空：空闲的keep-alive连接直接关闭，其余连接处理完当前请求后关闭
+            http_conn* idle = NULL;
+            while ((idle = http_conn::idle_acquire())) {
+                close_user(idle);
+                idle->disown();
+            }
+            if (http_conn::m_user_count == 0 || time(NULL) >= drain_deadline) {
+                break;
+            }
+        }
+        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, draining ? 1000 : -1);
         if ((num < 0) && (errno != EINTR)) {
             printf("epoll failed\n");
             break;
@@ -157,40 +458,89 @@ int main(int argc, char* argv[])
 
         // 遍历事件数组
         for (int i = 0; i < num; ++i) {
-            int socketfd = events[i].data.fd;
-            if (socketfd == listenfd) {
+            uint64_t key = events[i].data.u64;
+            // 代数为0的是监听socket和信号管道，key就是fd；其余是连接句柄，过期的句柄取不到连接
+            int socketfd = slot_map<http_conn>::generation(key) == 0 ? (int)key : -1;
+            http_conn* user = users.get(key);
+            if (socketfd == -1 && !user) {
+                // 连接在本轮事件处理中已被关闭，槽位可能已被复用
+                continue;
+            }
+            listener* from = socketfd != -1 ? find_listener(listeners, socketfd) : NULL;
+            // 处理器等待的上游fd，key同样是fd本身，取出等待它的连接句柄
+            uint64_t waiter = socketfd != -1 && !from ? waiters.take(socketfd) : 0;
+            if (from) {
                 // 有客户端连接
                 
-                struct sockaddr_in clientaddr;
-                socklen_t len = sizeof(clientaddr);
-                int connectfd = accept(listenfd, (struct sockaddr*)&clientaddr, &len);
+                sock_addr clientaddr;
+                clientaddr.len = sizeof(clientaddr.ss);
+                int connectfd = accept(socketfd, clientaddr.get(), &clientaddr.len);
                 if (connectfd < 0) {
                     printf("errno is %d\n", errno);
                     continue;
                 }
 
-                if (http_conn::m_user_count >= MAXFD) {
-                    // 目前连接的数已满
+                // 超出预算时先关闭最久未活动的空闲keep-alive连接，给新客户端腾出名额
+                http_conn* idle = NULL;
+                while (http_conn::over_budget() && (idle = http_conn::idle_acquire())) {
+                    close_user(idle);
+                    idle->disown();
+                }
+                if (http_conn::over_budget()) {
+                    // 目前连接的数已满，且没有可以回收的空闲连接
+                    close(connectfd);
+                    continue;
+                }
+                // proxy监听的对端是代理本身，读到PROXY头之后再按真实地址准入
+                bool counted = false;
+                if (!from->proxy && limiter->on_accept(clientaddr, &counted) != ip_limiter::ADMIT) {
+                    // 在名单中被拒绝，或者该IP的连接数/请求速率超限，或者限流表没有位置
                     close(connectfd);
                     continue;
                 }
-                users[connectfd].init(connectfd, clientaddr);
-                util_timer* timer = new util_timer;
-                timer->user_data = &users[connectfd];
+                uint64_t handle = users.alloc();
+                if (handle == 0) {
+                    close(connectfd);
+                    if (counted) {
+                        limiter->on_close(clientaddr);
+                    }
+                    continue;
+                }
+                http_conn* conn = users.get(handle);
+                conn->init(connectfd, clientaddr, handle, counted);
+                if (from->proxy) {
+                    conn->expect_proxy();
+                }
+                if (from->tls) {
+                    SSL* ssl = tls->new_ssl(connectfd);
+                    if (!ssl) {
+                        conn->close_conn();
+                        users.release(handle);
+                        continue;
+                    }
+                    conn->start_tls(ssl);
+                }
+                // 定时器嵌入在连接对象中，建立连接不再分配内存
+                util_timer* timer = &conn->timer;
+                timer->user_data = conn;
                 timer->cb_func = cb_func;
-                time_t cur = time(NULL);
-                timer->expire = cur + 3 * TIMESLOT;
-                users[connectfd].timer = timer;
-                // users[connectfd].user_data->timer = timer;
+                timer->expire = conn->deadline();
                 timer_lst.add_timer(timer); 
                 
             }
+            else if (waiter != 0) {
+                // 上游fd就绪(包括上游关闭或出错，由处理器自己读出来)，等待期间超时被关闭的连接取不到
+                http_conn* waiting = users.get(waiter);
+                if (waiting) {
+                    refresh_timer(waiting);
+                    dispatch(pool, waiting, waiter);
+                }
+            }
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {         
                 // 错误，关闭连接
-                users[socketfd].close_conn();
-                if (users[socketfd].timer) {
-                        timer_lst.del_timer(users[socketfd].timer);
-                    }
+                if (user) {
+                    close_user(user);
+                }
             }
             else if (socketfd == pipefd[0] && events[i].events & EPOLLIN) {
                 // 处理信号
@@ -218,24 +568,78 @@ int main(int argc, char* argv[])
                             case SIGTERM:
                             {
                                 stop_server = true;
+                                break;
+                            }
+                            case SIGUSR1:
+                            {
+                                // 主进程在升级前要求保存缓存快照
+                                save_snapshot();
+                                http_conn::m_stats->snapshot.store(stats->snapshot_request.load());
+                                break;
+                            }
+                            case SIGUSR2:
+                            {
+                                // 单进程模式的平滑升级，新进程就绪后会发来SIGQUIT
+                                save_snapshot();
+                                pid_t pid = start_upgrade(argv, listen_fds(listeners));
+                                if (pid > 0) {
+                                    printf("upgrade: started %d\n", pid);
+                                }
+                                break;
+                            }
+                            case SIGQUIT:
+                            {
+                                // 停止接受连接，监听socket留给新进程
+                                if (!draining) {
+                                    draining = true;
+                                    drain_deadline = time(NULL) + DRAIN_TIMEOUT;
+                                    http_conn::m_draining = true;
+                                    for (size_t j = 0; j < listeners.size(); ++j) {
+                                        epoll_ctl(epollfd, EPOLL_CTL_DEL, listeners[j].fd, NULL);
+                                    }
+                                }
+                                break;
                             }
                         }
                     }
                 }
             }
+            else if (socketfd != -1 && socketfd == watcher.fd()) {
+                watcher.dispatch();
+                // 新目录可能因为监视数达到上限而没有加入监视
+                http_conn::set_watched(watcher.complete());
+            }
+            else if (socketfd != -1 && socketfd == wakeups.fd()) {
+                std::vector<uint64_t> handles;
+                wakeups.drain(&handles);
+                for (size_t j = 0; j < handles.size(); ++j) {
+                    // 等待期间超时被关闭的连接取不到
+                    http_conn* parked = users.get(handles[j]);
+                    if (parked) {
+                        dispatch(pool, parked, handles[j]);
+                    }
+                }
+            }
+            else if (!user) {
+                continue;
+            }
+            else if (user->proxy_pending() && !accept_proxy(user)) {
+                // PROXY头还没有读完(已重新注册EPOLLIN)，或者连接已被关闭
+                continue;
+            }
+            else if (user->tls_handshaking()) {
+                // TLS握手的计算量较大，读写事件都交给工作线程推进，不阻塞事件循环
+                dispatch(pool, user, key);
+            }
             else if (events[i].events & EPOLLIN) {              // 有数据到来
                     printf("213213123\n");
-                if (users[socketfd].read()) {                   // 读完成，提交给pool
-                    pool->append(users + socketfd);
-                        time_t cur = time(NULL);
-                        users[socketfd].timer->expire = cur + 3 * TIMESLOT;
-                        timer_lst.adjust_timer(users[socketfd].timer);
+                if (user->read()) {                             // 读完成，提交给pool
+                    // 请求头阶段的截止时间不因收到数据而延长
+                    refresh_timer(user);
+                    dispatch(pool, user, key);
                 }
                 else {
-                    users[socketfd].close_conn();
-                    if (users[socketfd].timer) {
-                        timer_lst.del_timer(users[socketfd].timer);
-                    }
+                    close_user(user);
                 }
                 // memset(users[socketfd].m_read_buf, '\0', BUFFER_SIZE);
                 /*ret = users[socketfd].read();
@@ -263,19 +667,13 @@ int main(int argc, char* argv[])
                 }*/
             }
             else if (events[i].events & EPOLLOUT) {             // 线程池中工作线程注册写，将数据写到socket，发送到客户端
-                util_timer* timer = users[socketfd].timer;
                 printf("wwwwwwwwwwwwwwwwwww\n");
-                if (!users[socketfd].write()) {                 // 写失败     
-                    users[socketfd].close_conn();
-                    if (timer) {
-                        timer_lst.del_timer(timer);
-                    }
+                if (!user->write()) {                           // 写失败     
+                    close_user(user);
+                }
+                else {
+                    refresh_timer(user);
                 }
-
-                    time_t cur = time(NULL);
-                    timer->expire = cur + 3 * TIMESLOT;
-                    timer_lst.adjust_timer(timer);
-           
             }
         }
         if( timeout ) {
@@ -285,12 +683,22 @@ int main(int argc, char* argv[])
         }     
     }
 
-    close( listenfd );
+    // 排空退出时新进程已经载入了升级前的快照，不再覆盖
+    if (!draining) {
+        save_snapshot();
+    }
+    // Unix域socket文件不删除：平滑升级后新进程还在使用，下次启动时由open_listener清理
+    for (size_t i = 0; i < listeners.size(); ++i) {
+        close(listeners[i].fd);
+    }
     close( pipefd[1] );
     close( pipefd[0] );
     close(epollfd);
-    delete[] users;
+    // 工作线程是分离的，可能还在使用上游表，表本身不释放，只停止健康检查线程
+    upstreams->stop_health_checks();
     delete pool;
+    delete limiter;
+    delete tls;
 
     return 0;
 }
@@ -0,0 +1,225 @@
+#include "listener.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <netinet/tcp.h>
+
+static bool parse_option(const std::string& opt, listener* out) {
+    size_t eq = opt.find('=');
+    std::string name = opt.substr(0, eq);
+    const char* value = eq == std::string::npos ? NULL : opt.c_str() + eq + 1;
+    if (!value) {
+        if (name == "tls") {
+            out->tls = true;
+        } else if (name == "proxy") {
+            out->proxy = true;
+        } else if (name == "v6only") {
+            out->v6only = true;
+        } else if (name == "reuseport") {
+            out->reuseport = true;
+        } else if (name == "nodelay") {
+            out->nodelay = true;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    char* end;
+    long n = strtol(value, &end, name == "mode" ? 8 : 10);
+    if (*value == '\0' || *end != '\0' || n < 0 || n > 0x7fffffff) {
+        return false;
+    }
+    if (name == "backlog") {
+        out->backlog = n;
+    } else if (name == "defer_accept") {
+        out->defer_accept = n;
+    } else if (name == "rcvbuf") {
+        out->rcvbuf = n;
+    } else if (name == "sndbuf") {
+        out->sndbuf = n;
+    } else if (name == "mode") {
+        out->mode = n;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_listener(const char* line, listener* out) {
+    *out = listener();
+    std::vector<std::string> words;
+    const char* p = line;
+    while (*p) {
+        p += strspn(p, " \t");
+        size_t n = strcspn(p, " \t");
+        if (n > 0) {
+            words.push_back(std::string(p, n));
+        }
+        p += n;
+    }
+    if (words.empty() || !out->addr.parse(words[0], true, &out->any)) {
+        return false;
+    }
+    for (size_t i = 1; i < words.size(); ++i) {
+        if (!parse_option(words[i], out)) {
+            return false;
+        }
+    }
+    out->spec = line;
+    return true;
+}
+
+int load_listeners(const char* path, std::vector<listener>* out) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        return 0;
+    }
+    int count = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        char* text = line + strspn(line, " \t");
+        text[strcspn(text, "\r\n#")] = '\0';
+        size_t len = strlen(text);
+        while (len > 0 && (text[len - 1] == ' ' || text[len - 1] == '\t')) {
+            text[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        listener l;
+        if (!parse_listener(text, &l)) {
+            printf("bad listener in %s: %s\n", path, text);
+            count = -1;
+            break;
+        }
+        out->push_back(l);
+        ++count;
+    }
+    fclose(fp);
+    return count;
+}
+
+// 上一次运行留下的socket文件：还有进程在监听时不能删除
+static bool remove_stale(const sock_addr& addr) {
+    const char* path = addr.unix_path();
+    struct stat st;
+    if (lstat(path, &st) < 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        printf("%s exists and is not a socket\n", path);
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool in_use = fd < 0 || connect(fd, addr.get(), addr.len) == 0 || errno != ECONNREFUSED;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (in_use) {
+        printf("%s is in use\n", path);
+        return false;
+    }
+    return unlink(path) == 0;
+}
+
+bool open_listener(listener* l) {
+    int fd = socket(l->addr.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 && l->any && errno == EAFNOSUPPORT) {
+        // 没有IPv6时退回IPv4的通配地址
+        in_addr any;
+        any.s_addr = htonl(INADDR_ANY);
+        l->addr.set_v4(&any, htons(l->addr.port()));
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+    if (fd < 0) {
+        perror(l->spec.c_str());
+        return false;
+    }
+    int family = l->addr.family();
+    int on = 1;
+    if (family != AF_UNIX) {
+        // 端口复用
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (l->nodelay) {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        if (l->defer_accept > 0) {
+            setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &l->defer_accept, sizeof(l->defer_accept));
+        }
+    }
+    if (family == AF_INET6) {
+        int v6only = l->v6only;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    }
+    if (l->reuseport) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    }
+    if (l->rcvbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &l->rcvbuf, sizeof(l->rcvbuf));
+    }
+    if (l->sndbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &l->sndbuf, sizeof(l->sndbuf));
+    }
+    if (family == AF_UNIX && !remove_stale(l->addr)) {
+        close(fd);
+        return false;
+    }
+    if (bind(fd, l->addr.get(), l->addr.len) < 0 ||
+        (family == AF_UNIX && l->mode >= 0 && chmod(l->addr.unix_path(), l->mode) < 0) ||
+        listen(fd, l->backlog < 0 ? SOMAXCONN : l->backlog) < 0) {
+        perror(l->spec.c_str());
+        close(fd);
+        return false;
+    }
+    l->fd = fd;
+    return true;
+}
+
+// 通配地址的监听在没有IPv6时绑定的是IPv4的通配地址
+static bool matches(const listener& l, const sock_addr& bound) {
+    if (l.addr.same(bound)) {
+        return true;
+    }
+    ip128 ip;
+    return l.any && bound.ip(&ip) && (ip == 0 || ip == sock_addr::v4_mapped(INADDR_ANY)) &&
+           bound.port() == l.addr.port();
+}
+
+void adopt_listeners(const std::vector<int>& fds, std::vector<listener>* ls) {
+    for (size_t i = 0; i < fds.size(); ++i) {
+        sock_addr bound;
+        bound.len = sizeof(bound.ss);
+        listener* owner = NULL;
+        if (getsockname(fds[i], bound.get(), &bound.len) == 0) {
+            for (size_t j = 0; j < ls->size() && !owner; ++j) {
+                if ((*ls)[j].fd == -1 && matches((*ls)[j], bound)) {
+                    owner = &(*ls)[j];
+                }
+            }
+        }
+        char name[128];
+        if (!owner) {
+            // 新的配置中已经去掉了这个监听
+            printf("closing inherited listener %s\n", bound.format(name, sizeof(name)));
+            close(fds[i]);
+            continue;
+        }
+        owner->addr = bound;
+        owner->fd = fds[i];
+        // 继承的fd在exec时去掉了FD_CLOEXEC，这里恢复
+        fcntl(owner->fd, F_SETFD, FD_CLOEXEC);
+        printf("inherited listener %s\n", bound.format(name, sizeof(name)));
+    }
+}
+
+listener* find_listener(std::vector<listener>& ls, int fd) {
+    for (size_t i = 0; i < ls.size(); ++i) {
+        if (ls[i].fd == fd) {
+            return &ls[i];
+        }
+    }
+    return NULL;
+}
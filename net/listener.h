@@ -0,0 +1,62 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <string>
+#include <vector>
+#include "sock_addr.h"
+
+/*
+    监听socket：一个进程可以同时监听多个地址，每个监听有自己的socket选项
+    配置写法(一行一个，启动参数中的端口也按这种写法转换)：地址 [选项...]
+      8080 或 *:8080            IPv6双栈，IPv4客户端以映射地址出现；系统不支持IPv6时退回IPv4
+      0.0.0.0:8080              只监听IPv4
+      [::1]:8080                IPv6地址，默认同样接受IPv4(对具体地址没有意义)
+      unix:/run/webserver.sock  Unix域stream socket，同机的代理不经过TCP协议栈
+    选项：
+      tls                       连接使用TLS
+      proxy                     连接以PROXY协议v2头开始，客户端地址取自头中的源地址
+      v6only                    IPv6监听不接受IPv4
+      backlog=N                 listen的队列长度，默认SOMAXCONN
+      reuseport                 SO_REUSEPORT
+      nodelay                   TCP_NODELAY，accept的连接继承
+      defer_accept=N            TCP_DEFER_ACCEPT：连接有数据(或N秒后)才唤醒accept
+      rcvbuf=N sndbuf=N         socket缓冲区大小
+      mode=0660                 Unix域socket文件的权限
+*/
+struct listener {
+    listener()
+        : tls(false), proxy(false), any(false), v6only(false), reuseport(false), nodelay(false),
+          backlog(-1), defer_accept(0), rcvbuf(0), sndbuf(0), mode(-1), fd(-1) {}
+
+    std::string spec;       // 配置中的原文，用于日志
+    sock_addr addr;
+    bool tls;
+    bool proxy;
+    bool any;               // 通配地址，双栈不可用时可以退回IPv4
+    bool v6only;
+    bool reuseport;
+    bool nodelay;
+    int backlog;
+    int defer_accept;
+    int rcvbuf;
+    int sndbuf;
+    int mode;
+    int fd;
+};
+
+// 解析一行配置，格式错误时返回false
+bool parse_listener(const char* line, listener* out);
+
+// 从文件加载监听配置，#开头为注释；文件不存在返回0，有错误的行返回-1
+int load_listeners(const char* path, std::vector<listener>* out);
+
+// 创建socket、设置选项、bind和listen，失败时打印原因并返回false
+bool open_listener(listener* l);
+
+// 平滑升级时把继承的fd按绑定的地址分给配置中的监听(fd为-1的)，用不上的fd关闭
+void adopt_listeners(const std::vector<int>& fds, std::vector<listener>* ls);
+
+// 按fd查找，不是监听socket时返回NULL
+listener* find_listener(std::vector<listener>& ls, int fd);
+
+#endif
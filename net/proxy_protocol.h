@@ -0,0 +1,74 @@
+#ifndef PROXY_PROTOCOL_H
+#define PROXY_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "sock_addr.h"
+
+/*
+    PROXY协议v2(二进制格式)的解析，同一台机器上的代理通过它把真实的客户端地址传过来
+    头部：12字节签名、版本和命令、地址族和协议、2字节长度(网络字节序)，之后是地址和TLV
+    - PROXY命令：源地址就是客户端地址，支持TCP over IPv4/IPv6和Unix域stream
+    - LOCAL命令(代理自己的健康检查)或不认识的地址族：保留连接本身的地址
+    TLV不解析，整个头超过PROXY_V2_MAX时按格式错误处理
+*/
+static const char PROXY_V2_SIGNATURE[12] = { '\r', '\n', '\r', '\n', '\0', '\r', '\n', 'Q', 'U', 'I', 'T', '\n' };
+static const size_t PROXY_V2_HEADER = 16;
+static const size_t PROXY_V2_MAX = 1024;
+
+enum PROXY_PARSE { PROXY_INCOMPLETE = 0, PROXY_INVALID, PROXY_OK };
+
+// 解析buf开头的头部，成功时*consumed为整个头的长度，src带有客户端地址时len大于0
+inline PROXY_PARSE parse_proxy_v2(const char* buf, size_t len, size_t* consumed, sock_addr* src) {
+    // 签名不完整时也要尽早发现不是PROXY头的连接
+    size_t check = len < sizeof(PROXY_V2_SIGNATURE) ? len : sizeof(PROXY_V2_SIGNATURE);
+    if (memcmp(buf, PROXY_V2_SIGNATURE, check) != 0) {
+        return PROXY_INVALID;
+    }
+    if (len < PROXY_V2_HEADER) {
+        return PROXY_INCOMPLETE;
+    }
+    const uint8_t* p = (const uint8_t*)buf;
+    int version = p[12] >> 4;
+    int command = p[12] & 0xf;
+    int family = p[13] >> 4;
+    int protocol = p[13] & 0xf;
+    size_t body = ((size_t)p[14] << 8) | p[15];
+    if (version != 2 || command > 1 || PROXY_V2_HEADER + body > PROXY_V2_MAX) {
+        return PROXY_INVALID;
+    }
+    if (len < PROXY_V2_HEADER + body) {
+        return PROXY_INCOMPLETE;
+    }
+    *consumed = PROXY_V2_HEADER + body;
+    src->len = 0;
+    if (command == 0 || protocol != 1) {
+        return PROXY_OK;                // LOCAL，或者不是stream
+    }
+    const uint8_t* addr = p + PROXY_V2_HEADER;
+    if (family == 1) {
+        // 源地址、目的地址、源端口、目的端口
+        if (body < 12) {
+            return PROXY_INVALID;
+        }
+        uint16_t port;
+        memcpy(&port, addr + 8, 2);
+        src->set_v4(addr, port);
+    } else if (family == 2) {
+        if (body < 36) {
+            return PROXY_INVALID;
+        }
+        uint16_t port;
+        memcpy(&port, addr + 32, 2);
+        src->set_v6(addr, port);
+    } else if (family == 3) {
+        if (body < 216) {
+            return PROXY_INVALID;
+        }
+        src->set_unix((const char*)addr, strnlen((const char*)addr, 108));
+    }
+    return PROXY_OK;
+}
+
+#endif
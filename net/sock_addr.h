@@ -0,0 +1,190 @@
+#ifndef SOCK_ADDR_H
+#define SOCK_ADDR_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// 128位IP地址，主机字节序；IPv4按IPv4映射地址(::ffff:a.b.c.d)保存，与双栈socket上的IPv4连接一致
+typedef unsigned __int128 ip128;
+
+// 任意协议族的socket地址：IPv4、IPv6或Unix域，accept、getsockname和PROXY协议头都填到这里
+struct sock_addr {
+    sockaddr_storage ss;
+    socklen_t len;
+
+    sock_addr() : len(0) { memset(&ss, 0, sizeof(ss)); }
+
+    sockaddr* get() { return (sockaddr*)&ss; }
+    const sockaddr* get() const { return (const sockaddr*)&ss; }
+    int family() const { return len > 0 ? ss.ss_family : AF_UNSPEC; }
+
+    static ip128 v4_mapped(uint32_t addr) { return ((ip128)0xffff << 32) | addr; }
+
+    // 取IP地址，Unix域socket没有IP时返回false
+    bool ip(ip128* out) const {
+        if (family() == AF_INET) {
+            *out = v4_mapped(ntohl(((const sockaddr_in*)&ss)->sin_addr.s_addr));
+            return true;
+        }
+        if (family() == AF_INET6) {
+            const uint8_t* b = ((const sockaddr_in6*)&ss)->sin6_addr.s6_addr;
+            ip128 v = 0;
+            for (int i = 0; i < 16; ++i) {
+                v = (v << 8) | b[i];
+            }
+            *out = v;
+            return true;
+        }
+        return false;
+    }
+
+    uint16_t port() const {
+        if (family() == AF_INET) {
+            return ntohs(((const sockaddr_in*)&ss)->sin_port);
+        }
+        if (family() == AF_INET6) {
+            return ntohs(((const sockaddr_in6*)&ss)->sin6_port);
+        }
+        return 0;
+    }
+
+    // addr和port为网络字节序
+    void set_v4(const void* addr, uint16_t port) {
+        memset(&ss, 0, sizeof(ss));
+        sockaddr_in* sin = (sockaddr_in*)&ss;
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr, addr, 4);
+        sin->sin_port = port;
+        len = sizeof(sockaddr_in);
+    }
+
+    void set_v6(const void* addr, uint16_t port) {
+        memset(&ss, 0, sizeof(ss));
+        sockaddr_in6* sin6 = (sockaddr_in6*)&ss;
+        sin6->sin6_family = AF_INET6;
+        memcpy(&sin6->sin6_addr, addr, 16);
+        sin6->sin6_port = port;
+        len = sizeof(sockaddr_in6);
+    }
+
+    // 路径过长时返回false
+    bool set_unix(const char* path, size_t path_len) {
+        memset(&ss, 0, sizeof(ss));
+        sockaddr_un* sun = (sockaddr_un*)&ss;
+        if (path_len >= sizeof(sun->sun_path)) {
+            len = 0;
+            return false;
+        }
+        sun->sun_family = AF_UNIX;
+        memcpy(sun->sun_path, path, path_len);
+        len = offsetof(sockaddr_un, sun_path) + path_len + 1;
+        return true;
+    }
+
+    const char* unix_path() const {
+        return family() == AF_UNIX ? ((const sockaddr_un*)&ss)->sun_path : "";
+    }
+
+    /*
+        解析地址，格式错误时返回false
+          a.b.c.d:port、[v6]:port   IPv4、IPv6地址
+          unix:/path                Unix域socket
+          port、*:port              通配地址(IPv6双栈)，只有allow_any时接受，*any设为true
+    */
+    bool parse(const std::string& text, bool allow_any, bool* any) {
+        *any = false;
+        if (text.compare(0, 5, "unix:") == 0) {
+            return text.size() > 5 && set_unix(text.c_str() + 5, text.size() - 5);
+        }
+        uint16_t port;
+        if (!text.empty() && text[0] == '[') {
+            size_t close = text.find("]:");
+            in6_addr in6;
+            if (close == std::string::npos || inet_pton(AF_INET6, text.substr(1, close - 1).c_str(), &in6) != 1 ||
+                !parse_port(text.c_str() + close + 2, &port)) {
+                return false;
+            }
+            set_v6(&in6, port);
+            return true;
+        }
+        size_t colon = text.rfind(':');
+        if (colon == std::string::npos || text.compare(0, colon, "*") == 0) {
+            if (!allow_any || !parse_port(text.c_str() + (colon == std::string::npos ? 0 : colon + 1), &port)) {
+                return false;
+            }
+            set_v6(&in6addr_any, port);
+            *any = true;
+            return true;
+        }
+        in_addr in;
+        if (inet_pton(AF_INET, text.substr(0, colon).c_str(), &in) != 1 || !parse_port(text.c_str() + colon + 1, &port)) {
+            return false;
+        }
+        set_v4(&in, port);
+        return true;
+    }
+
+    // 十进制端口号，结果为网络字节序
+    static bool parse_port(const char* s, uint16_t* port) {
+        char* end;
+        long n = strtol(s, &end, 10);
+        if (*s == '\0' || *end != '\0' || n <= 0 || n > 65535) {
+            return false;
+        }
+        *port = htons(n);
+        return true;
+    }
+
+    // 协议族、地址和端口(Unix域为路径)都相同
+    bool same(const sock_addr& other) const {
+        if (family() != other.family()) {
+            return false;
+        }
+        if (family() == AF_UNIX) {
+            return strcmp(unix_path(), other.unix_path()) == 0;
+        }
+        ip128 a, b;
+        return ip(&a) && other.ip(&b) && a == b && port() == other.port();
+    }
+
+    // 不带端口的IP地址文本，IPv4映射地址写成IPv4的形式；Unix域socket返回NULL
+    const char* host(char* buf, size_t size) const {
+        ip128 v;
+        if (!ip(&v)) {
+            return NULL;
+        }
+        if ((v >> 32) == 0xffff) {
+            in_addr in;
+            in.s_addr = htonl((uint32_t)v);
+            return inet_ntop(AF_INET, &in, buf, size);
+        }
+        return inet_ntop(AF_INET6, &((const sockaddr_in6*)&ss)->sin6_addr, buf, size);
+    }
+
+    // "a.b.c.d:port"、"[v6]:port"或"unix:path"，用于日志
+    const char* format(char* buf, size_t size) const {
+        char host[INET6_ADDRSTRLEN] = "";
+        if (family() == AF_INET) {
+            inet_ntop(AF_INET, &((const sockaddr_in*)&ss)->sin_addr, host, sizeof(host));
+            snprintf(buf, size, "%s:%u", host, port());
+        } else if (family() == AF_INET6) {
+            inet_ntop(AF_INET6, &((const sockaddr_in6*)&ss)->sin6_addr, host, sizeof(host));
+            snprintf(buf, size, "[%s]:%u", host, port());
+        } else if (family() == AF_UNIX) {
+            snprintf(buf, size, "unix:%s", unix_path());
+        } else {
+            snprintf(buf, size, "unknown");
+        }
+        return buf;
+    }
+};
+
+#endif
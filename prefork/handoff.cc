@@ -0,0 +1,80 @@
+#include "handoff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+// 继承的fd不能带FD_CLOEXEC
+static void keep_on_exec(int fd) {
+    int flags = fcntl(fd, F_GETFD);
+    fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC);
+}
+
+pid_t start_upgrade(char* const argv[], const std::vector<int>& fds) {
+    char num[16];
+    snprintf(num, sizeof(num), "%d:", (int)getpid());
+    std::string value = num;
+    for (size_t i = 0; i < fds.size(); ++i) {
+        snprintf(num, sizeof(num), i == 0 ? "%d" : ",%d", fds[i]);
+        value += num;
+        keep_on_exec(fds[i]);
+    }
+    // 环境变量在fork之前设置好，子进程在exec之前只调用async-signal-safe的函数
+    setenv(LISTEN_FDS_ENV, value.c_str(), 1);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // 主进程阻塞了信号，屏蔽字会被exec继承
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    unsetenv(LISTEN_FDS_ENV);
+    if (pid < 0) {
+        perror("fork");
+    }
+    return pid;
+}
+
+static bool is_listener(int fd) {
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    return getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == 0 && listening;
+}
+
+bool inherited_listeners(std::vector<int>* fds, pid_t* predecessor) {
+    const char* value = getenv(LISTEN_FDS_ENV);
+    if (!value) {
+        return false;
+    }
+    int pid = 0;
+    int used = 0;
+    bool ok = sscanf(value, "%d:%n", &pid, &used) == 1 && used > 0;
+    std::vector<int> got;
+    for (const char* p = value + used; ok && *p; ) {
+        int fd = -1;
+        int n = 0;
+        ok = sscanf(p, "%d%n", &fd, &n) == 1 && is_listener(fd);
+        got.push_back(fd);
+        p += n;
+        if (*p == ',') {
+            ++p;
+        }
+    }
+    ok = ok && !got.empty();
+    if (!ok) {
+        printf("ignoring invalid %s=%s\n", LISTEN_FDS_ENV, value);
+    }
+    // 不再传给之后由这个进程启动的进程
+    unsetenv(LISTEN_FDS_ENV);
+    if (!ok) {
+        return false;
+    }
+    fds->swap(got);
+    *predecessor = pid;
+    return true;
+}
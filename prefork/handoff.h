@@ -0,0 +1,23 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <sys/types.h>
+#include <vector>
+
+/*
+    平滑升级：启动新的可执行文件并通过继承把监听socket交给它，监听socket始终打开，升级期间不会拒绝连接
+    - 新进程从环境变量LISTEN_FDS_ENV("旧进程的pid:fd,fd,...")中取得继承的socket，按绑定的地址分给自己的监听配置，
+      配置中仍然存在的地址不再bind
+    - 可执行文件按argv[0]重新查找，部署时替换的新文件生效
+    旧进程在新进程就绪后停止accept，处理完已有的连接后退出
+*/
+#define LISTEN_FDS_ENV "WEBSERVER_LISTEN_FDS"
+
+// 启动argv描述的新进程，把所有监听socket交给它。成功时返回新进程的pid，失败时返回-1
+pid_t start_upgrade(char* const argv[], const std::vector<int>& fds);
+
+// 取得从旧进程继承的监听socket和旧进程的pid，不是由升级启动的进程返回false。
+// 新进程就绪(开始接受连接)后向旧进程发送SIGQUIT，旧进程收到后才停止接受连接
+bool inherited_listeners(std::vector<int>* fds, pid_t* predecessor);
+
+#endif
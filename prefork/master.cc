@@ -0,0 +1,296 @@
+#include "master.h"
+#include "handoff.h"
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <vector>
+
+static volatile sig_atomic_t got_child = 0;
+static volatile sig_atomic_t got_hup = 0;
+static volatile sig_atomic_t got_upgrade = 0;
+static volatile sig_atomic_t got_quit = 0;
+static volatile sig_atomic_t got_stop = 0;
+
+static void on_signal(int sig) {
+    switch (sig) {
+        case SIGCHLD: got_child = 1; break;
+        case SIGHUP: got_hup = 1; break;
+        case SIGUSR2: got_upgrade = 1; break;
+        case SIGQUIT: got_quit = 1; break;
+        default: got_stop = 1; break;
+    }
+}
+
+static void set_handler(int sig, void (*handler)(int)) {
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = handler;
+    sigfillset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+}
+
+static const int MASTER_SIGNALS[] = { SIGCHLD, SIGHUP, SIGUSR2, SIGQUIT, SIGTERM, SIGINT };
+
+master::master(int workers, server_stats* stats, char* const argv[], const std::vector<int>& listen_fds, pid_t predecessor)
+    : m_count(workers), m_stats(stats), m_generation(0), m_argv(argv), m_listen_fds(listen_fds),
+      m_predecessor(predecessor), m_successor(0), m_quitting(false) {
+    if (m_count > MAX_WORKERS) {
+        m_count = MAX_WORKERS;
+    }
+}
+
+int master::free_slot() const {
+    for (int i = 0; i < server_stats::MAX_WORKERS; ++i) {
+        if (m_stats->workers[i].pid.load() == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 在主进程中返回-1，在新的工作进程中返回它的槽位
+int master::spawn(uint64_t generation) {
+    int slot = free_slot();
+    if (slot < 0) {
+        printf("no free worker slot\n");
+        return -1;
+    }
+    worker_stats& stats = m_stats->workers[slot];
+    stats.generation.store(generation);
+    stats.active.store(0);
+    stats.ready.store(0);
+    stats.pid.store(-1);                // 占住槽位
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        stats.pid.store(0);
+        return -1;
+    }
+    if (pid == 0) {
+        // 工作进程：恢复信号的默认处理，主进程退出时随之退出
+        for (size_t i = 0; i < sizeof(MASTER_SIGNALS) / sizeof(MASTER_SIGNALS[0]); ++i) {
+            set_handler(MASTER_SIGNALS[i], SIG_DFL);
+        }
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() == 1) {
+            _exit(0);                   // fork之后主进程已经退出
+        }
+        stats.pid.store(getpid());
+        return slot;
+    }
+    stats.pid.store(pid);
+    worker w;
+    w.slot = slot;
+    w.generation = generation;
+    w.started = time(NULL);
+    w.retiring = false;
+    m_workers[pid] = w;
+    printf("worker %d started in slot %d, generation %llu\n", pid, slot, (unsigned long long)generation);
+    return -1;
+}
+
+// 回收退出的工作进程，需要时重启；在新的工作进程中返回它的槽位，否则返回-1
+int master::reap() {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == m_successor) {
+            printf("upgrade: new process %d exited (status %d), keeping the current one\n", pid, status);
+            m_successor = 0;
+            continue;
+        }
+        std::map<pid_t, worker>::iterator it = m_workers.find(pid);
+        if (it == m_workers.end()) {
+            continue;
+        }
+        worker w = it->second;
+        m_workers.erase(it);
+        m_stats->retire(w.slot);
+        bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (w.retiring || m_quitting || got_stop) {
+            continue;
+        }
+        printf("worker %d exited (status %d), restarting\n", pid, status);
+        if (!clean) {
+            m_stats->restarts.fetch_add(1);
+        }
+        if (time(NULL) - w.started < 1) {
+            sleep(1);
+        }
+        int slot = spawn(m_generation);
+        if (slot >= 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// 等generation代的工作进程都进入事件循环，最多等READY_TIMEOUT
+void master::wait_ready(uint64_t generation) {
+    for (int waited = 0; waited < READY_TIMEOUT; waited += 10) {
+        bool ready = true;
+        for (std::map<pid_t, worker>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+            if (it->second.generation == generation && !m_stats->workers[it->second.slot].ready.load()) {
+                ready = false;
+                break;
+            }
+        }
+        if (ready) {
+            return;
+        }
+        usleep(10 * 1000);
+    }
+}
+
+// 为每个当前代的工作进程启动一个新一代的进程，就绪后让旧的排空退出
+int master::next_generation() {
+    ++m_generation;
+    m_stats->generation.store(m_generation);
+    std::vector<pid_t> old;
+    for (std::map<pid_t, worker>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+        if (!it->second.retiring) {
+            old.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < old.size(); ++i) {
+        int slot = spawn(m_generation);
+        if (slot >= 0) {
+            return slot;
+        }
+    }
+    wait_ready(m_generation);
+    for (size_t i = 0; i < old.size(); ++i) {
+        m_workers[old[i]].retiring = true;
+        kill(old[i], SIGQUIT);
+    }
+    printf("generation %llu: replaced %zu workers\n", (unsigned long long)m_generation, old.size());
+    return -1;
+}
+
+// 让处理响应最多的工作进程保存缓存快照，等它完成或超时
+void master::snapshot() {
+    int busiest = -1;
+    uint64_t most = 0;
+    for (std::map<pid_t, worker>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+        uint64_t n = m_stats->workers[it->second.slot].responses.load();
+        if (busiest < 0 || n > most) {
+            busiest = it->second.slot;
+            most = n;
+        }
+    }
+    if (busiest < 0) {
+        return;
+    }
+    uint64_t request = m_stats->snapshot_request.fetch_add(1) + 1;
+    worker_stats& w = m_stats->workers[busiest];
+    kill(w.pid.load(), SIGUSR1);
+    for (int waited = 0; waited < SNAPSHOT_TIMEOUT && w.snapshot.load() < request; waited += 10) {
+        usleep(10 * 1000);
+    }
+}
+
+// 启动新的可执行文件，当前的工作进程继续服务，直到新的进程就绪后发来SIGQUIT
+void master::upgrade() {
+    snapshot();
+    pid_t pid = start_upgrade(m_argv, m_listen_fds);
+    if (pid > 0) {
+        printf("upgrade: started %d\n", pid);
+        m_successor = pid;
+    }
+}
+
+void master::quit() {
+    m_quitting = true;
+    m_successor = 0;
+    for (std::map<pid_t, worker>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+        it->second.retiring = true;
+        kill(it->first, SIGQUIT);
+    }
+}
+
+void master::stop() {
+    for (std::map<pid_t, worker>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+        kill(it->first, SIGTERM);
+    }
+    while (!m_workers.empty()) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            break;
+        }
+        std::map<pid_t, worker>::iterator it = m_workers.find(pid);
+        if (it != m_workers.end()) {
+            m_stats->retire(it->second.slot);
+            m_workers.erase(it);
+        }
+    }
+}
+
+int master::run() {
+    // 信号只在sigsuspend中处理，标志和工作进程表不会被打断到一半
+    sigset_t mask, old;
+    sigemptyset(&mask);
+    for (size_t i = 0; i < sizeof(MASTER_SIGNALS) / sizeof(MASTER_SIGNALS[0]); ++i) {
+        sigaddset(&mask, MASTER_SIGNALS[i]);
+        set_handler(MASTER_SIGNALS[i], on_signal);
+    }
+    sigprocmask(SIG_BLOCK, &mask, &old);
+
+    for (int i = 0; i < m_count; ++i) {
+        int slot = spawn(m_generation);
+        if (slot >= 0) {
+            return slot;
+        }
+    }
+    if (m_predecessor > 0 && getppid() == m_predecessor) {
+        // 由升级启动：工作进程都开始接受连接后，旧的进程才停止接受
+        wait_ready(m_generation);
+        kill(m_predecessor, SIGQUIT);
+    }
+    while (true) {
+        while (!got_child && !got_hup && !got_upgrade && !got_quit && !got_stop) {
+            sigsuspend(&old);
+        }
+        if (got_stop) {
+            stop();
+            return -1;
+        }
+        if (got_quit) {
+            got_quit = 0;
+            quit();
+        }
+        if (got_child) {
+            got_child = 0;
+            int slot = reap();
+            if (slot >= 0) {
+                return slot;
+            }
+        }
+        if (m_quitting) {
+            if (m_workers.empty()) {
+                return -1;
+            }
+            got_hup = got_upgrade = 0;
+            continue;
+        }
+        if (got_upgrade) {
+            got_upgrade = 0;
+            if (m_successor == 0) {
+                upgrade();
+            }
+        }
+        if (got_hup) {
+            got_hup = 0;
+            int slot = next_generation();
+            if (slot >= 0) {
+                return slot;
+            }
+        }
+    }
+}
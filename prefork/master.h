@@ -0,0 +1,64 @@
+#ifndef MASTER_H
+#define MASTER_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <vector>
+#include "../http/shm_stats.h"
+
+/*
+    prefork模式的主进程：监听socket和共享内存在fork之前由调用者创建好，工作进程各自运行完整的事件循环
+    - 工作进程异常退出时在同一个槽位上重新启动，一秒内连续崩溃时推迟重启，避免fork风暴
+    - SIGHUP：换代，先为每个工作进程启动一个新一代的进程，等它们开始接受连接后再让旧的进程排空退出(SIGQUIT)
+    - SIGUSR2：平滑升级，让最忙的工作进程保存缓存快照，再启动新的可执行文件并把监听socket交给它。
+      升级期间旧的工作进程继续接受连接，新的进程就绪后向这里发送SIGQUIT
+    - SIGQUIT：让所有工作进程停止接受连接，处理完已有的连接后退出，主进程随之返回
+    - SIGTERM/SIGINT：让所有工作进程立即退出，等它们结束后主进程返回
+    - 主进程退出时工作进程收到SIGTERM(PR_SET_PDEATHSIG)
+    run在主进程中不创建线程，fork出的工作进程从run返回，继续初始化自己的线程池和epoll
+*/
+class master {
+public:
+    static const int MAX_WORKERS = server_stats::MAX_WORKERS / 2;     // 换代期间新旧两代同时存在
+    static const int SNAPSHOT_TIMEOUT = 3000;      // 等待工作进程保存快照的时间(毫秒)
+    static const int READY_TIMEOUT = 5000;         // 等待新的工作进程开始接受连接的时间(毫秒)
+
+    // predecessor为升级前的进程，工作进程都就绪后通知它退出，不是由升级启动时为0
+    master(int workers, server_stats* stats, char* const argv[], const std::vector<int>& listen_fds, pid_t predecessor);
+
+    // 在工作进程中返回它在stats中的槽位；主进程在所有工作进程退出后返回-1
+    int run();
+
+private:
+    struct worker {
+        int slot;
+        uint64_t generation;
+        time_t started;
+        bool retiring;          // 被替换或正在排空的进程，退出后不重启
+    };
+
+    int spawn(uint64_t generation);
+    int free_slot() const;
+    int reap();
+    int next_generation();
+    void wait_ready(uint64_t generation);
+    void snapshot();
+    void upgrade();
+    void quit();
+    void stop();
+
+private:
+    int m_count;
+    server_stats* m_stats;
+    uint64_t m_generation;
+    std::map<pid_t, worker> m_workers;
+    char* const* m_argv;
+    std::vector<int> m_listen_fds;     // 升级时交给新进程的监听socket
+    pid_t m_predecessor;
+    pid_t m_successor;          // 升级启动的新进程，还没有就绪
+    bool m_quitting;            // 工作进程都在排空，全部退出后返回
+};
+
+#endif
@@ -27,6 +27,11 @@ public:
         return pthread_mutex_unlock(&m_mutex);
     }
 
+    // 不等待，已被别的线程持有时返回false
+    bool try_lock() {
+        return pthread_mutex_trylock(&m_mutex) == 0;
+    }
+
     pthread_mutex_t* get() {
         return &m_mutex;
     }
@@ -2,7 +2,7 @@
 #define THREADPOOL_Y
 
 #include <pthread.h>
-#include <list>
+#include <stdint.h>
 #include "lcoker.h"
 #include <cstdio>
 
@@ -12,7 +12,8 @@ class threadpool {
 public:
     threadpool (int thread_number = 8, int m_max_requests = 10000);
     ~threadpool();
-    bool append(T* request);
+    // tag随任务一起入队，交给T::process(tag)判断任务是否已经过期
+    bool append(T* request, uint64_t tag);
 
 private:
     static void* worker(void* arg);
@@ -28,8 +29,15 @@ private:
     // 请求队列中最多被允许的数量
     int m_max_requests;
 
-    // 请求队列
-    std::list<T*> m_workqueue;
+    struct task {
+        T* request;
+        uint64_t tag;
+    };
+
+    // 请求队列，容量为m_max_requests的环形数组，构造时一次性分配，入队出队不再分配内存
+    task* m_workqueue;
+    int m_queue_head;
+    int m_queue_size;
 
     // 互斥锁
     locker m_queuelocker;
@@ -44,11 +52,13 @@ private:
 template<typename T>
 threadpool<T>::threadpool(int thread_number, int max_requests):
     m_thread_number(thread_number), m_threads(NULL),
-    m_max_requests(max_requests), m_stop(false) {
+    m_max_requests(max_requests), m_workqueue(NULL), m_queue_head(0), m_queue_size(0), m_stop(false) {
         if ((thread_number <= 0) || (m_max_requests <= 0)) {
             throw std::exception();
         }
 
+        m_workqueue = new task[m_max_requests];
+
         m_threads = new pthread_t[m_thread_number];
         if (!m_threads) {
             throw std::exception();
@@ -59,11 +69,13 @@ threadpool<T>::threadpool(int thread_number, int max_requests):
             printf("create the %dth thread\n", i);
             if (pthread_create(m_threads + i, NULL, worker, this) != 0) {
                 delete[] m_threads;
+                delete[] m_workqueue;
                 throw std::exception();
             }
 
             if (pthread_detach(m_threads[i])) {
                 delete[] m_threads;
+                delete[] m_workqueue;
                 throw std::exception();
             }
         }
@@ -72,18 +84,22 @@ threadpool<T>::threadpool(int thread_number, int max_requests):
 template<typename T>
 threadpool<T>::~threadpool() {
     delete[] m_threads;
+    delete[] m_workqueue;
     m_stop = true;
 }
 
 template<typename T>
-bool threadpool<T>::append(T* request) {
+bool threadpool<T>::append(T* request, uint64_t tag) {
     m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_requests) {
+    if (m_queue_size >= m_max_requests) {
         m_queuelocker.unlock();
         return false;
     }
 
-    m_workqueue.push_back(request);
+    task& t = m_workqueue[(m_queue_head + m_queue_size) % m_max_requests];
+    t.request = request;
+    t.tag = tag;
+    ++m_queue_size;
     m_queuelocker.unlock();
     m_queuestat.post();
 
@@ -103,20 +119,21 @@ void threadpool<T>::run() {
     while (!m_stop) {
         m_queuestat.wait();
         m_queuelocker.lock();
-        if (m_workqueue.empty()) {
+        if (m_queue_size == 0) {
             m_queuelocker.unlock();
             continue;
         }
 
-        T* requset = m_workqueue.front();
-        m_workqueue.pop_front();
+        task t = m_workqueue[m_queue_head];
+        m_queue_head = (m_queue_head + 1) % m_max_requests;
+        --m_queue_size;
         m_queuelocker.unlock();
 
-        if (!requset) {
+        if (!t.request) {
             continue;
         }
 
-        requset->process();
+        t.request->process(t.tag);
     }
 }
 
@@ -18,7 +18,7 @@ struct client_data
     util_timer* timer;          // 定时器
 };
 
-// 定时器类
+// 定时器类，作为成员嵌入到连接对象中，链表只负责串联，不负责分配和释放
 class util_timer {
 public:
     util_timer() : prev(NULL), next(NULL){}
@@ -35,13 +35,10 @@ public:
 class sort_timer_lst {
 public:
     sort_timer_lst() : head( NULL ), tail( NULL ) {}
-    // 链表被销毁时，删除其中所有的定时器
+    // 链表被销毁时，摘下其中所有的定时器，定时器本身由所在的连接对象持有
     ~sort_timer_lst() {
-        util_timer* tmp = head;
-        while( tmp ) {
-            head = tmp->next;
-            delete tmp;
-            tmp = head;
+        while( head ) {
+            unlink_timer( head );
         }
     }
     
@@ -90,70 +87,67 @@ public:
             add_timer( timer, timer->next );
         }
     }
-    // 将目标定时器 timer 从链表中删除
-    void del_timer( util_timer* timer )
+    /* 超时时间可能变短也可能变长时使用（例如连接进入了截止时间更早的阶段），
+       先把定时器从链表中摘下，再按新的超时时间重新插入 */
+    void mod_timer( util_timer* timer )
     {
         if( !timer ) {
             return;
         }
-        // 下面这个条件成立表示链表中只有一个定时器，即目标定时器
-        if( ( timer == head ) && ( timer == tail ) ) {
-            delete timer;
-            head = NULL;
-            tail = NULL;
-            return;
-        }
-        /* 如果链表中至少有两个定时器，且目标定时器是链表的头节点，
-         则将链表的头节点重置为原头节点的下一个节点，然后删除目标定时器。 */
-        if( timer == head ) {
-            head = head->next;
-            head->prev = NULL;
-            delete timer;
-            return;
-        }
-        /* 如果链表中至少有两个定时器，且目标定时器是链表的尾节点，
-        则将链表的尾节点重置为原尾节点的前一个节点，然后删除目标定时器。*/
-        if( timer == tail ) {
-            tail = tail->prev;
-            tail->next = NULL;
-            delete timer;
+        unlink_timer( timer );
+        add_timer( timer );
+    }
+
+    // 将目标定时器 timer 从链表中删除，不在链表中时什么也不做
+    void del_timer( util_timer* timer )
+    {
+        if( !timer ) {
             return;
         }
-        // 如果目标定时器位于链表的中间，则把它前后的定时器串联起来，然后删除目标定时器
-        timer->prev->next = timer->next;
-        timer->next->prev = timer->prev;
-        delete timer;
+        unlink_timer( timer );
     }
 
-    /* SIGALARM 信号每次被触发就在其信号处理函数中执行一次 tick() 函数，以处理链表上到期任务。*/
+    /* SIGALARM 信号每次被触发就在其信号处理函数中执行一次 tick() 函数，以处理链表上到期任务。
+       到期的定时器先从链表中摘下再调用回调函数，回调函数可以更新超时时间后重新 add_timer */
     void tick() {
         if( !head ) {
             return;
         }
         printf( "timer tick\n" );
         time_t cur = time( NULL );  // 获取当前系统时间
-        util_timer* tmp = head;
         // 从头节点开始依次处理每个定时器，直到遇到一个尚未到期的定时器
-        while( tmp ) {
+        while( head ) {
+            util_timer* tmp = head;
             /* 因为每个定时器都使用绝对时间作为超时值，所以可以把定时器的超时值和系统当前时间，
             比较以判断定时器是否到期*/
             if( cur < tmp->expire ) {
                 break;
             }
-
+            unlink_timer( tmp );
             // 调用定时器的回调函数，以执行定时任务
             tmp->cb_func( tmp->user_data );
-            // 执行完定时器中的定时任务之后，就将它从链表中删除，并重置链表头节点
-            head = tmp->next;
-            if( head ) {
-                head->prev = NULL;
-            }
-            delete tmp;
-            tmp = head;
         }
     }
 
 private:
+    // 将定时器从链表中摘下，但不释放
+    void unlink_timer( util_timer* timer ) {
+        if( timer == head ) {
+            head = head->next;
+        }
+        if( timer == tail ) {
+            tail = tail->prev;
+        }
+        if( timer->prev ) {
+            timer->prev->next = timer->next;
+        }
+        if( timer->next ) {
+            timer->next->prev = timer->prev;
+        }
+        timer->prev = NULL;
+        timer->next = NULL;
+    }
+
     /* 一个重载的辅助函数，它被公有的 add_timer 函数和 adjust_timer 函数调用
     该函数表示将目标定时器 timer 添加到节点 lst_head 之后的部分链表中 */
     void add_timer(util_timer* timer, util_timer* lst_head)  {
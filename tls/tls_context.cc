@@ -0,0 +1,64 @@
+#include "tls_context.h"
+#include <stdio.h>
+#include <string.h>
+
+// 服务端支持的应用层协议，按优先级排列
+static const unsigned char alpn_protos[] = { 2, 'h', '2', 8, 'h', 't', 't', 'p', '/', '1', '.', '1' };
+
+bool tls_context::init(const char* cert_file, const char* key_file) {
+    m_ctx = SSL_CTX_new(TLS_server_method());
+    if (!m_ctx) {
+        ERR_print_errors_fp(stdout);
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+    // 非阻塞写：允许部分写入，重试时缓冲区地址可以变化
+    SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(m_ctx, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(m_ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(m_ctx) != 1) {
+        printf("load certificate %s / %s failed\n", cert_file, key_file);
+        ERR_print_errors_fp(stdout);
+        return false;
+    }
+
+    // 会话恢复：服务端缓存(会话ID)和无状态票据，票据密钥由OpenSSL随机生成
+    static const unsigned char sid_ctx[] = "webserver";
+    SSL_CTX_set_session_id_context(m_ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(m_ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(m_ctx, SESSION_TIMEOUT);
+    SSL_CTX_clear_options(m_ctx, SSL_OP_NO_TICKET);
+
+    SSL_CTX_set_alpn_select_cb(m_ctx, alpn_select, NULL);
+    return true;
+}
+
+SSL* tls_context::new_ssl(int fd) {
+    SSL* ssl = SSL_new(m_ctx);
+    if (!ssl) {
+        return NULL;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+bool tls_context::alpn_h2(SSL* ssl) {
+    const unsigned char* proto = NULL;
+    unsigned int len = 0;
+    SSL_get0_alpn_selected(ssl, &proto, &len);
+    return len == 2 && memcmp(proto, "h2", 2) == 0;
+}
+
+int tls_context::alpn_select(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                             const unsigned char* in, unsigned int inlen, void* arg) {
+    if (SSL_select_next_proto((unsigned char**)out, outlen, alpn_protos, sizeof(alpn_protos), in, inlen)
+            != OPENSSL_NPN_NEGOTIATED) {
+        // 客户端没有我们支持的协议时不使用ALPN，按HTTP/1.1处理
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
@@ -0,0 +1,45 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+/*
+    HTTPS监听使用的TLS上下文，所有连接共享
+    - 服务端会话缓存和会话票据两种方式都支持会话恢复
+    - ALPN协商h2和http/1.1
+    - 开启SSL_OP_ENABLE_KTLS，内核支持时握手完成后加解密交给内核(TLS_TX/TLS_RX)，
+      发送方向可以继续直接对socket做writev，文件内容不需要经过用户态的SSL_write
+*/
+class tls_context {
+public:
+    static const int SESSION_CACHE_SIZE = 20480;    // 服务端会话缓存的条目数
+    static const int SESSION_TIMEOUT = 3600;        // 会话(以及票据)的有效期(秒)
+
+    tls_context() : m_ctx(NULL) {}
+    ~tls_context() {
+        if (m_ctx) {
+            SSL_CTX_free(m_ctx);
+        }
+    }
+
+    // 加载证书和私钥，失败时打印OpenSSL的错误并返回false
+    bool init(const char* cert_file, const char* key_file);
+
+    // 为新连接创建SSL对象，处于服务端握手状态
+    SSL* new_ssl(int fd);
+
+    static bool ktls_send(SSL* ssl) { return BIO_get_ktls_send(SSL_get_wbio(ssl)) == 1; }
+    static bool ktls_recv(SSL* ssl) { return BIO_get_ktls_recv(SSL_get_rbio(ssl)) == 1; }
+    // 协商出的应用层协议是否为h2
+    static bool alpn_h2(SSL* ssl);
+
+private:
+    static int alpn_select(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                           const unsigned char* in, unsigned int inlen, void* arg);
+
+private:
+    SSL_CTX* m_ctx;
+};
+
+#endif
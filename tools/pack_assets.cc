@@ -0,0 +1,268 @@
+/*
+    离线打包静态资源：把一个目录(例如resources/)打成服务器直接mmap使用的资源包，格式见http/asset_format.h
+    用法：pack_assets <目录> <输出文件>
+    编译：g++ -std=c++11 -o pack_assets tools/pack_assets.cc http/variant_cache.cc -lz -lpthread
+    - 目录中的x.gz、x.br在x存在时作为x的预压缩版本，不单独打包
+    - 可压缩的类型没有.gz时用gzip -9压缩，压缩后没有变小的不保存
+    - 先写临时文件再rename到输出文件，运行中的服务器在下一次定时检查时切换到新版本；
+      不要原地修改正在使用的资源包
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../http/asset_format.h"
+#include "../http/mime_types.h"
+#include "../http/variant_cache.h"
+
+struct asset {
+    std::string path;                           // 以'/'开头的url路径
+    std::string file;                           // 磁盘上的文件
+    std::string sidecar[VARIANT_COUNT];         // 预压缩版本的文件
+    std::string body[VARIANT_COUNT];
+    bundle_entry entry;
+};
+
+static bool read_file(const std::string& file, std::string* out) {
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char buf[65536];
+    ssize_t n;
+    out->clear();
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        out->append(buf, n);
+    }
+    close(fd);
+    return n == 0;
+}
+
+// 递归收集普通文件，path为相对于根目录的url路径
+static bool collect(const std::string& dir, const std::string& path, std::map<std::string, std::string>* files) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        perror(dir.c_str());
+        return false;
+    }
+    bool ok = true;
+    struct dirent* ent;
+    while (ok && (ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.') {
+            continue;                   // 隐藏文件以及"."、".."
+        }
+        std::string file = dir + "/" + ent->d_name;
+        std::string url = path + "/" + ent->d_name;
+        struct stat st;
+        if (stat(file.c_str(), &st) < 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            ok = collect(file, url, files);
+        } else if (S_ISREG(st.st_mode)) {
+            (*files)[url] = file;
+        }
+    }
+    closedir(d);
+    return ok;
+}
+
+static bool ends_with(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() > n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// 字符串区：每个字符串后面加'\0'，返回相对于字符串区开头的位置
+static bundle_span add_string(std::string& strings, const std::string& s) {
+    bundle_span span = { strings.size(), s.size() };
+    strings.append(s);
+    strings.push_back('\0');
+    return span;
+}
+
+static uint64_t align_up(uint64_t n, uint64_t a) {
+    return (n + a - 1) / a * a;
+}
+
+static bool write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        printf("usage: %s <dir> <bundle>\n", argv[0]);
+        return 1;
+    }
+    std::string root = argv[1];
+    std::map<std::string, std::string> files;
+    if (!collect(root, "", &files)) {
+        return 1;
+    }
+
+    // 区分资源和它们的预压缩版本
+    std::vector<asset> assets;
+    for (std::map<std::string, std::string>::iterator it = files.begin(); it != files.end(); ++it) {
+        const std::string& url = it->first;
+        if ((ends_with(url, ".gz") || ends_with(url, ".br")) && files.count(url.substr(0, url.size() - 3))) {
+            continue;
+        }
+        asset a;
+        a.path = url;
+        a.file = it->second;
+        if (files.count(url + ".gz")) {
+            a.sidecar[VARIANT_GZIP] = files[url + ".gz"];
+        }
+        if (files.count(url + ".br")) {
+            a.sidecar[VARIANT_BR] = files[url + ".br"];
+        }
+        assets.push_back(a);
+    }
+
+    // 读入内容，生成各个版本
+    for (size_t i = 0; i < assets.size(); ++i) {
+        asset& a = assets[i];
+        if (!read_file(a.file, &a.body[VARIANT_IDENTITY])) {
+            perror(a.file.c_str());
+            return 1;
+        }
+        for (int v = VARIANT_GZIP; v < VARIANT_COUNT; ++v) {
+            if (!a.sidecar[v].empty() && !read_file(a.sidecar[v], &a.body[v])) {
+                perror(a.sidecar[v].c_str());
+                return 1;
+            }
+        }
+        const std::string& raw = a.body[VARIANT_IDENTITY];
+        const mime_type* type = find_mime_type(a.path.c_str());
+        if (type->compressible && a.body[VARIANT_GZIP].empty() && !raw.empty()) {
+            response_writer::blob zipped = variant_cache::gzip(raw.data(), raw.size(), 9);
+            if (zipped && zipped->size() < raw.size()) {
+                a.body[VARIANT_GZIP] = *zipped;
+            }
+        }
+        memset(&a.entry, 0, sizeof(a.entry));
+        a.entry.compressible = type->compressible || !a.body[VARIANT_GZIP].empty() || !a.body[VARIANT_BR].empty();
+    }
+
+    // 布局：头部、槽位、条目、字符串区、页对齐的内容
+    uint32_t slot_count = 16;
+    while (slot_count < assets.size() * 2) {
+        slot_count *= 2;
+    }
+    bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.version = BUNDLE_VERSION;
+    header.entry_count = assets.size();
+    header.slot_count = slot_count;
+    header.slots_offset = align_up(sizeof(header), 8);
+    header.entries_offset = align_up(header.slots_offset + slot_count * sizeof(uint32_t), 8);
+    uint64_t strings_offset = header.entries_offset + assets.size() * sizeof(bundle_entry);
+
+    static const char* const suffixes[VARIANT_COUNT] = { "", "-gz", "-br" };
+    static const char* const encodings[VARIANT_COUNT] = { NULL, "gzip", "br" };
+    std::string strings;
+    for (size_t i = 0; i < assets.size(); ++i) {
+        asset& a = assets[i];
+        bundle_entry& e = a.entry;
+        const mime_type* type = find_mime_type(a.path.c_str());
+        const std::string& raw = a.body[VARIANT_IDENTITY];
+        e.hash = bundle_hash(a.path.data(), a.path.size());
+        e.path = add_string(strings, a.path);
+        e.content_type = add_string(strings, type->name);
+        for (int v = 0; v < VARIANT_COUNT; ++v) {
+            if (v != VARIANT_IDENTITY && a.body[v].empty()) {
+                e.etag[v] = add_string(strings, "");
+                e.headers[v] = add_string(strings, "");
+                continue;
+            }
+            char etag[48];
+            snprintf(etag, sizeof(etag), "\"%016llx%s\"",
+                     (unsigned long long)bundle_hash(raw.data(), raw.size()), suffixes[v]);
+            e.etag[v] = add_string(strings, etag);
+            // 与http_conn::process_write生成的实体头一致
+            char line[1024];
+            std::string headers;
+            snprintf(line, sizeof(line), "Content-Type:%s\r\nContent-Length: %zu\r\n", type->name, a.body[v].size());
+            headers += line;
+            if (encodings[v]) {
+                snprintf(line, sizeof(line), "Content-Encoding: %s\r\n", encodings[v]);
+                headers += line;
+            }
+            if (e.compressible) {
+                headers += "Vary: Accept-Encoding\r\n";
+            }
+            snprintf(line, sizeof(line), "ETag: %s\r\n", etag);
+            headers += line;
+            e.headers[v] = add_string(strings, headers);
+        }
+    }
+
+    // 字符串的偏移改为相对于文件开头，再给内容分配页对齐的位置
+    uint64_t offset = align_up(strings_offset + strings.size(), BUNDLE_ALIGN);
+    std::vector<uint32_t> slots(slot_count, 0);
+    for (size_t i = 0; i < assets.size(); ++i) {
+        bundle_entry& e = assets[i].entry;
+        e.path.offset += strings_offset;
+        e.content_type.offset += strings_offset;
+        for (int v = 0; v < VARIANT_COUNT; ++v) {
+            e.etag[v].offset += strings_offset;
+            e.headers[v].offset += strings_offset;
+            e.body[v].offset = offset;
+            e.body[v].length = assets[i].body[v].size();
+            offset = align_up(offset + e.body[v].length, BUNDLE_ALIGN);
+        }
+        uint32_t s = e.hash & (slot_count - 1);
+        while (slots[s] != 0) {
+            s = (s + 1) & (slot_count - 1);
+        }
+        slots[s] = i + 1;
+    }
+    header.file_size = offset;
+
+    std::string out = argv[2];
+    std::string tmp = out + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(tmp.c_str());
+        return 1;
+    }
+    bool ok = ftruncate(fd, header.file_size) == 0 &&
+              pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+              pwrite(fd, &slots[0], slots.size() * sizeof(uint32_t), header.slots_offset) ==
+                  (ssize_t)(slots.size() * sizeof(uint32_t));
+    for (size_t i = 0; ok && i < assets.size(); ++i) {
+        ok = pwrite(fd, &assets[i].entry, sizeof(bundle_entry), header.entries_offset + i * sizeof(bundle_entry)) ==
+             (ssize_t)sizeof(bundle_entry);
+    }
+    ok = ok && lseek(fd, strings_offset, SEEK_SET) >= 0 && write_all(fd, strings.data(), strings.size());
+    for (size_t i = 0; ok && i < assets.size(); ++i) {
+        for (int v = 0; ok && v < VARIANT_COUNT; ++v) {
+            const std::string& body = assets[i].body[v];
+            ok = lseek(fd, assets[i].entry.body[v].offset, SEEK_SET) >= 0 && write_all(fd, body.data(), body.size());
+        }
+    }
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    // rename是原子的，服务器要么看到旧版本，要么看到完整的新版本
+    if (!ok || rename(tmp.c_str(), out.c_str()) < 0) {
+        perror(out.c_str());
+        unlink(tmp.c_str());
+        return 1;
+    }
+    printf("%s: %zu assets, %llu bytes\n", out.c_str(), assets.size(), (unsigned long long)header.file_size);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# 编译并运行tools/test_*.cc，最后运行test_error_pages.sh
+# 用法：tools/run_tests.sh [端口]，在仓库根目录下运行(需要conf/)
+cd "$(dirname "$0")/.."
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+SERVER_SRCS="http/*.cc http2/*.cc tls/*.cc prefork/*.cc net/*.cc upstream/*.cc handler/*.cc fastcgi/*.cc"
+
+fail=0
+for src in tools/test_*.cc; do
+    name=$(basename "$src" .cc)
+    # 只依赖头文件的单独编译，其余的和服务器的源文件(main1.cc除外)一起链接
+    if grep -q '"../http2/h2_session.h"' "$src"; then
+        deps=$SERVER_SRCS
+    else
+        deps=
+    fi
+    if ! g++ -std=c++11 -O2 -Wall -o "$OUT/$name" "$src" $deps -lpthread -lssl -lcrypto -lz; then
+        echo "$name: build failed"
+        fail=1
+        continue
+    fi
+    printf '%s: ' "$name"
+    "$OUT/$name" || fail=1
+done
+
+printf 'test_error_pages: '
+sh tools/test_error_pages.sh ${1:-18090} 2>/dev/null || fail=1
+exit $fail
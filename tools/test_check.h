@@ -0,0 +1,27 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <stdio.h>
+
+/*
+    tools/test_*.cc共用的检查宏：失败时打印位置和表达式，继续执行后面的检查
+    main的最后return test_result()，全部通过时打印ok并返回0
+*/
+static int g_failed = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: FAIL: %s\n", __FILE__, __LINE__, #cond); \
+            ++g_failed; \
+        } \
+    } while (0)
+
+inline int test_result() {
+    if (g_failed == 0) {
+        printf("ok\n");
+    }
+    return g_failed == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+    http/chunked_decoder.h的测试：任意位置切开的输入、块扩展和trailer、格式错误和超长的块长度
+    编译：g++ -std=c++11 -o test_chunked tools/test_chunked.cc
+*/
+#include <string.h>
+#include <string>
+#include "../http/chunked_decoder.h"
+#include "test_check.h"
+
+// 每次最多喂step个字节，返回最后的结果，解出的数据放在body中
+static chunked_decoder::RESULT run(const std::string& input, size_t step, std::string* body, size_t* rest) {
+    chunked_decoder d;
+    body->clear();
+    size_t pos = 0;
+    size_t end = 0;
+    chunked_decoder::RESULT ret = chunked_decoder::NEED_MORE;
+    while (pos < input.size()) {
+        end = pos + step < input.size() ? pos + step : input.size();
+        for (;;) {
+            size_t used = 0;
+            const char* chunk = NULL;
+            size_t chunk_len = 0;
+            ret = d.decode(input.data() + pos, end - pos, &used, &chunk, &chunk_len);
+            if (ret == chunked_decoder::DATA) {
+                body->append(chunk, chunk_len);
+                pos += used;
+                continue;
+            }
+            if (ret == chunked_decoder::DONE) {
+                pos += used;
+                *rest = input.size() - pos;
+                return ret;
+            }
+            if (ret == chunked_decoder::BAD) {
+                return ret;
+            }
+            pos = end;
+            break;
+        }
+    }
+    *rest = 0;
+    return ret;
+}
+
+int main() {
+    const std::string good = "5\r\nhello\r\n7;ext=1\r\n, world\r\n0\r\nTrailer: x\r\n\r\nGET";
+    std::string body;
+    size_t rest = 0;
+    for (size_t step = 1; step <= good.size(); ++step) {
+        CHECK(run(good, step, &body, &rest) == chunked_decoder::DONE);
+        CHECK(body == "hello, world");
+        CHECK(rest == 3);           // 后面的流水线请求不被消耗
+    }
+
+    CHECK(run("A\r\n0123456789\r\n0\r\n\r\n", 4, &body, &rest) == chunked_decoder::DONE && body == "0123456789");
+    CHECK(run("a\r\n0123456789\r\n0\r\n\r\n", 100, &body, &rest) == chunked_decoder::DONE);
+    CHECK(run("5\r\nhel", 100, &body, &rest) == chunked_decoder::NEED_MORE && body == "hel");
+
+    CHECK(run("\r\n", 100, &body, &rest) == chunked_decoder::BAD);                  // 没有长度
+    CHECK(run("g\r\n", 100, &body, &rest) == chunked_decoder::BAD);
+    CHECK(run("5\r\nhelloX\r\n", 100, &body, &rest) == chunked_decoder::BAD);       // 数据后面不是CRLF
+    CHECK(run("5\rhello", 100, &body, &rest) == chunked_decoder::BAD);
+    CHECK(run("1000000000000000\r\n", 100, &body, &rest) == chunked_decoder::BAD);  // 超过15位
+    CHECK(run("fffffffffffffff\r\n", 100, &body, &rest) == chunked_decoder::NEED_MORE);
+    CHECK(run("-1\r\n", 100, &body, &rest) == chunked_decoder::BAD);
+    return test_result();
+}
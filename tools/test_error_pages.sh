@@ -0,0 +1,36 @@
+#!/bin/sh
+# 用-O2编译服务器，检查400等错误页面能正常返回、服务器没有崩溃
+# 用法：tools/test_error_pages.sh [端口]，在仓库根目录下运行(需要conf/)
+cd "$(dirname "$0")/.."
+PORT=${1:-18090}
+OUT=$(mktemp -d)
+trap 'kill $PID 2>/dev/null; rm -rf "$OUT"' EXIT
+
+g++ -std=c++11 -O2 -Wall -o "$OUT/server" main1.cc http/*.cc http2/*.cc tls/*.cc prefork/*.cc \
+    net/*.cc upstream/*.cc handler/*.cc fastcgi/*.cc -lpthread -lssl -lcrypto -lz || exit 1
+
+"$OUT/server" $PORT > "$OUT/server.log" 2>&1 &
+PID=$!
+sleep 1
+
+fail=0
+check() {
+    code=$(curl -s -o /dev/null -w '%{http_code}' --path-as-is -X "$1" "http://127.0.0.1:$PORT$2")
+    if [ "$code" != "$3" ]; then
+        echo "FAIL: $1 $2 -> $code, expected $3"
+        fail=1
+    fi
+    if ! kill -0 $PID 2>/dev/null; then
+        echo "FAIL: server exited after $1 $2"
+        exit 1
+    fi
+}
+
+check GET "/../../etc/passwd" 400
+check GET "/%2e%2e/%2e%2e/etc/passwd" 400
+check DELETE "/index.html" 405
+check GET "/index.html/../../../etc/passwd" 400
+check GET "/index.html%3F.php" 400
+
+[ $fail -eq 0 ] && echo "ok"
+exit $fail
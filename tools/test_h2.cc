@@ -0,0 +1,239 @@
+/*
+    HPACK和HTTP/2帧处理的测试：RFC 7541附录C的解码示例、头部列表上限，
+    以及h2_session对CONTINUATION和PING洪水的上限(GOAWAY ENHANCE_YOUR_CALM)、每个流消耗一个令牌
+    h2_session依赖http_conn，需要和服务器除main1.cc以外的源文件一起编译，见tools/run_tests.sh
+*/
+#include <string>
+#include <vector>
+#include "../http2/hpack.h"
+#include "../http2/h2_session.h"
+#include "../http/http_conn.h"
+#include "../limit/ip_limiter.h"
+#include "test_check.h"
+
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+struct frame {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t sid;
+    std::string payload;
+};
+
+static std::string unhex(const char* s) {
+    std::string out;
+    for (; s[0] && s[1]; s += 2) {
+        out += (char)strtol(std::string(s, 2).c_str(), NULL, 16);
+    }
+    return out;
+}
+
+static std::string make_frame(uint8_t type, uint8_t flags, uint32_t sid, const std::string& payload) {
+    std::string f;
+    f += (char)(payload.size() >> 16);
+    f += (char)(payload.size() >> 8);
+    f += (char)payload.size();
+    f += (char)type;
+    f += (char)flags;
+    f += (char)(sid >> 24);
+    f += (char)(sid >> 16);
+    f += (char)(sid >> 8);
+    f += (char)sid;
+    return f + payload;
+}
+
+static std::string request_block(const char* method, const char* path) {
+    std::vector<char> out;
+    hpack_encoder::encode(":method", method, out);
+    hpack_encoder::encode(":scheme", "http", out);
+    hpack_encoder::encode(":path", path, out);
+    hpack_encoder::encode(":authority", "localhost", out);
+    return std::string(out.begin(), out.end());
+}
+
+// 取出会话发送缓冲区中的全部帧
+static std::vector<frame> drain(h2_session& s) {
+    std::vector<frame> frames;
+    std::string out(s.out_data(), s.out_len());
+    s.consume(s.out_len());
+    size_t pos = 0;
+    while (out.size() - pos >= 9) {
+        const uint8_t* p = (const uint8_t*)out.data() + pos;
+        uint32_t len = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        frame f;
+        f.type = p[3];
+        f.flags = p[4];
+        f.sid = (((uint32_t)p[5] << 24) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 8) | p[8]) & 0x7fffffff;
+        f.payload = out.substr(pos + 9, len);
+        frames.push_back(f);
+        pos += 9 + len;
+    }
+    return frames;
+}
+
+static uint32_t u32(const std::string& s, size_t off) {
+    const uint8_t* p = (const uint8_t*)s.data() + off;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// 最后一个GOAWAY的错误码，没有时返回-1
+static long goaway_code(const std::vector<frame>& frames) {
+    long code = -1;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (frames[i].type == h2_session::GOAWAY && frames[i].payload.size() >= 8) {
+            code = u32(frames[i].payload, 4);
+        }
+    }
+    return code;
+}
+
+static sock_addr client() {
+    sock_addr addr;
+    bool any = false;
+    addr.parse("192.0.2.10:40000", false, &any);
+    return addr;
+}
+
+// 前言和空的SETTINGS
+static void open_session(h2_session& s) {
+    std::string hello = std::string(PREFACE) + make_frame(h2_session::SETTINGS, 0, 0, "");
+    CHECK(s.feed(hello.data(), hello.size()));
+    drain(s);
+}
+
+static void test_hpack() {
+    // C.3：不使用Huffman编码的三个请求，共用一个动态表
+    hpack_decoder d;
+    std::vector<hpack_header> h;
+    std::string b = unhex("828684410f7777772e6578616d706c652e636f6d");
+    CHECK(d.decode((const uint8_t*)b.data(), b.size(), 4096, h) == hpack_decoder::DECODED);
+    CHECK(h.size() == 4 && h[0].name == ":method" && h[0].value == "GET" && h[2].value == "/" &&
+          h[3].name == ":authority" && h[3].value == "www.example.com");
+    h.clear();
+    b = unhex("828684be58086e6f2d6361636865");
+    CHECK(d.decode((const uint8_t*)b.data(), b.size(), 4096, h) == hpack_decoder::DECODED);
+    CHECK(h.size() == 5 && h[3].value == "www.example.com" && h[4].name == "cache-control" && h[4].value == "no-cache");
+
+    // C.4.1：Huffman编码
+    hpack_decoder d2;
+    h.clear();
+    b = unhex("828684418cf1e3c2e5f23a6ba0ab90f4ff");
+    CHECK(d2.decode((const uint8_t*)b.data(), b.size(), 4096, h) == hpack_decoder::DECODED);
+    CHECK(h.size() == 4 && h[3].value == "www.example.com");
+
+    // 头部列表上限：4个字段各计32字节，":method GET"共42字节
+    hpack_decoder d3;
+    h.clear();
+    b = unhex("828684410f7777772e6578616d706c652e636f6d");
+    CHECK(d3.decode((const uint8_t*)b.data(), b.size(), 100, h) == hpack_decoder::TOO_LARGE);
+    // 引用动态表的索引只占一个字节，解出的内容可以大得多
+    hpack_decoder d4;
+    std::vector<char> big;
+    hpack_encode_int(big, 0x40, 6, 0);              // 加索引的字面量，名字是新的
+    hpack_encode_int(big, 0, 7, 4);
+    big.insert(big.end(), "name", "name" + 4);
+    std::string value(4000, 'v');
+    hpack_encode_int(big, 0, 7, value.size());
+    big.insert(big.end(), value.begin(), value.end());
+    for (int i = 0; i < 100; ++i) {
+        big.push_back((char)0xbe);                  // 索引62：刚插入的条目
+    }
+    h.clear();
+    CHECK(d4.decode((const uint8_t*)&big[0], big.size(), h2_session::MAX_HEADER_LIST, h) == hpack_decoder::TOO_LARGE);
+
+    // 格式错误
+    hpack_decoder d5;
+    h.clear();
+    b = unhex("410f7777");                          // 值被截断
+    CHECK(d5.decode((const uint8_t*)b.data(), b.size(), 4096, h) == hpack_decoder::MALFORMED);
+    h.clear();
+    b = unhex("ff00");                              // 索引超出范围
+    CHECK(d5.decode((const uint8_t*)b.data(), b.size(), 4096, h) == hpack_decoder::MALFORMED);
+
+    // 编码器的输出能被解码器还原
+    std::vector<char> enc;
+    hpack_encoder::encode_status(404, enc);
+    hpack_encoder::encode("content-type", "text/html", enc);
+    hpack_decoder d6;
+    h.clear();
+    CHECK(d6.decode((const uint8_t*)&enc[0], enc.size(), 4096, h) == hpack_decoder::DECODED);
+    CHECK(h.size() == 2 && h[0].name == ":status" && h[0].value == "404" && h[1].value == "text/html");
+}
+
+static void test_continuation_flood() {
+    h2_session s(client(), false);
+    open_session(s);
+    // 不带END_HEADERS的HEADERS之后是源源不断的CONTINUATION
+    std::string data = make_frame(h2_session::HEADERS, 0x1, 1, request_block("GET", "/"));
+    std::string filler(1000, 'x');
+    bool ok = s.feed(data.data(), data.size());
+    for (int i = 0; ok && i < 100; ++i) {
+        data = make_frame(h2_session::CONTINUATION, 0, 1, filler);
+        ok = s.feed(data.data(), data.size());
+    }
+    CHECK(!ok);
+    CHECK(goaway_code(drain(s)) == h2_session::ENHANCE_YOUR_CALM);
+}
+
+static void test_ping_flood() {
+    h2_session s(client(), false);
+    open_session(s);
+    // 一直发PING，从不读应答
+    std::string ping = make_frame(h2_session::PING, 0, 0, "12345678");
+    bool ok = true;
+    int sent = 0;
+    for (; ok && sent < 100000; ++sent) {
+        ok = s.feed(ping.data(), ping.size());
+    }
+    CHECK(!ok);
+    CHECK(s.out_len() < h2_session::MAX_PENDING_OUT + 1024);
+    CHECK(goaway_code(drain(s)) == h2_session::ENHANCE_YOUR_CALM);
+
+    // 及时读走应答的对端不受影响
+    h2_session s2(client(), false);
+    open_session(s2);
+    for (int i = 0; i < 100000 && ok; ++i) {
+        ok = s2.feed(ping.data(), ping.size());
+        drain(s2);
+    }
+    CHECK(s2.feed(ping.data(), ping.size()));
+}
+
+static void test_stream_tokens() {
+    // 令牌桶容量2：前两个流正常响应(路由表为空，404)，第三个被RST
+    http_conn::m_limiter = new ip_limiter(10, 1, 2);
+    bool counted = false;
+    CHECK(http_conn::m_limiter->on_accept(client(), &counted) == ip_limiter::ADMIT && counted);
+    h2_session s(client(), false);
+    open_session(s);
+    std::string data;
+    for (uint32_t sid = 1; sid <= 5; sid += 2) {
+        data += make_frame(h2_session::HEADERS, 0x4 | 0x1, sid, request_block("GET", "/missing"));
+    }
+    CHECK(s.feed(data.data(), data.size()));
+    s.fill();
+    std::vector<frame> frames = drain(s);
+    int responses = 0;
+    int rst = 0;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (frames[i].type == h2_session::HEADERS) {
+            CHECK(frames[i].sid == 1 || frames[i].sid == 3);
+            ++responses;
+        }
+        if (frames[i].type == h2_session::RST_STREAM) {
+            CHECK(frames[i].sid == 5 && u32(frames[i].payload, 0) == h2_session::ENHANCE_YOUR_CALM);
+            ++rst;
+        }
+    }
+    CHECK(responses == 2 && rst == 1);
+    delete http_conn::m_limiter;
+    http_conn::m_limiter = NULL;
+}
+
+int main() {
+    test_hpack();
+    test_continuation_flood();
+    test_ping_flood();
+    test_stream_tokens();
+    return test_result();
+}
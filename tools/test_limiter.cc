@@ -0,0 +1,79 @@
+/*
+    limit/ip_limiter.h的测试：并发名额、令牌桶、名单，以及探测窗口满时不再放行
+    编译：g++ -std=c++11 -o test_limiter tools/test_limiter.cc -lpthread
+*/
+#include <string>
+#include "../limit/ip_limiter.h"
+#include "test_check.h"
+
+static sock_addr v4(const char* ip) {
+    sock_addr addr;
+    bool any = false;
+    addr.parse(std::string(ip) + ":1234", false, &any);
+    return addr;
+}
+
+int main() {
+    // 每个IP最多2个连接，每秒1个令牌，桶容量3
+    ip_limiter* lim = new ip_limiter(2, 1, 3);
+    sock_addr a = v4("10.0.0.1");
+    bool counted = false;
+
+    CHECK(lim->on_accept(a, &counted) == ip_limiter::ADMIT && counted);
+    CHECK(lim->on_accept(a, &counted) == ip_limiter::ADMIT && counted);
+    CHECK(lim->on_accept(a, &counted) == ip_limiter::TOO_MANY_CONN && !counted);
+    lim->on_close(a);
+    // accept只检查令牌，每个请求消耗一个
+    CHECK(lim->on_request(a));
+    CHECK(lim->on_request(a));
+    CHECK(lim->on_request(a));
+    CHECK(!lim->on_request(a));
+    CHECK(lim->on_accept(a, &counted) == ip_limiter::RATE_LIMITED && !counted);
+    lim->on_close(a);
+
+    // 名单
+    CHECK(lim->acl().insert("10.1.0.0/16", cidr_trie::DENY));
+    CHECK(lim->acl().insert("10.2.0.0/16", cidr_trie::ALLOW));
+    CHECK(lim->on_accept(v4("10.1.2.3"), &counted) == ip_limiter::DENIED && !counted);
+    sock_addr ok = v4("10.2.2.3");
+    for (int i = 0; i < 10; ++i) {
+        CHECK(lim->on_accept(ok, &counted) == ip_limiter::ADMIT);
+        CHECK(lim->on_request(ok));
+    }
+
+    // 占满一个IP的探测窗口：窗口内的条目都有连接时新IP得到TABLE_FULL，不能绕过限制
+    ip_limiter* small = new ip_limiter(1, 1, 1);
+    int admitted = 0, full = 0;
+    char ip[32];
+    for (int i = 0; i < 200000 && full == 0; ++i) {
+        snprintf(ip, sizeof(ip), "11.%d.%d.%d", (i >> 16) & 255, (i >> 8) & 255, i & 255);
+        ip_limiter::VERDICT v = small->on_accept(v4(ip), &counted);
+        if (v == ip_limiter::ADMIT) {
+            CHECK(counted);
+            ++admitted;
+        } else {
+            CHECK(v == ip_limiter::TABLE_FULL && !counted);
+            ++full;
+        }
+    }
+    CHECK(full == 1);
+    CHECK(admitted >= ip_limiter::MAX_PROBE);
+
+    // 没有连接的条目可以被淘汰，给新IP让位
+    ip_limiter* evict = new ip_limiter(1, 1, 1);
+    for (int i = 0; i < 200000; ++i) {
+        snprintf(ip, sizeof(ip), "12.%d.%d.%d", (i >> 16) & 255, (i >> 8) & 255, i & 255);
+        sock_addr addr = v4(ip);
+        ip_limiter::VERDICT v = evict->on_accept(addr, &counted);
+        CHECK(v == ip_limiter::ADMIT && counted);
+        evict->on_close(addr);
+        if (v != ip_limiter::ADMIT) {
+            break;
+        }
+    }
+
+    delete lim;
+    delete small;
+    delete evict;
+    return test_result();
+}
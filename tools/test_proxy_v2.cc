@@ -0,0 +1,89 @@
+/*
+    net/proxy_protocol.h的测试：IPv4/IPv6/Unix域的PROXY头、LOCAL命令、分段到达和各种格式错误
+    编译：g++ -std=c++11 -o test_proxy_v2 tools/test_proxy_v2.cc
+*/
+#include <arpa/inet.h>
+#include <string>
+#include "../net/proxy_protocol.h"
+#include "test_check.h"
+
+// 签名 + 版本/命令 + 地址族/协议 + 长度 + 地址
+static std::string header(uint8_t ver_cmd, uint8_t fam_proto, const std::string& body) {
+    std::string h(PROXY_V2_SIGNATURE, sizeof(PROXY_V2_SIGNATURE));
+    h += (char)ver_cmd;
+    h += (char)fam_proto;
+    h += (char)(body.size() >> 8);
+    h += (char)(body.size() & 0xff);
+    return h + body;
+}
+
+static std::string v4_body(const char* src, const char* dst, uint16_t sport, uint16_t dport) {
+    char b[12];
+    inet_pton(AF_INET, src, b);
+    inet_pton(AF_INET, dst, b + 4);
+    sport = htons(sport);
+    dport = htons(dport);
+    memcpy(b + 8, &sport, 2);
+    memcpy(b + 10, &dport, 2);
+    return std::string(b, sizeof(b));
+}
+
+static PROXY_PARSE parse(const std::string& data, size_t* consumed, sock_addr* src) {
+    return parse_proxy_v2(data.data(), data.size(), consumed, src);
+}
+
+int main() {
+    size_t consumed = 0;
+    sock_addr src;
+    char buf[64];
+
+    // TCP over IPv4，后面跟着的请求不属于头部
+    std::string v4 = header(0x21, 0x11, v4_body("203.0.113.7", "10.0.0.1", 51000, 80));
+    CHECK(parse(v4 + "GET / HTTP/1.1\r\n", &consumed, &src) == PROXY_OK);
+    CHECK(consumed == v4.size());
+    CHECK(src.family() == AF_INET && src.port() == 51000);
+    CHECK(src.host(buf, sizeof(buf)) && strcmp(buf, "203.0.113.7") == 0);
+
+    // 每个前缀都是不完整，不是格式错误
+    for (size_t i = 0; i < v4.size(); ++i) {
+        CHECK(parse(v4.substr(0, i), &consumed, &src) == PROXY_INCOMPLETE);
+    }
+
+    // 带TLV的IPv4：TLV跳过
+    std::string tlv = header(0x21, 0x11, v4_body("198.51.100.1", "10.0.0.1", 1, 2) + std::string("\x04\x00\x01x", 4));
+    CHECK(parse(tlv, &consumed, &src) == PROXY_OK && consumed == tlv.size());
+    CHECK(src.host(buf, sizeof(buf)) && strcmp(buf, "198.51.100.1") == 0);
+
+    // TCP over IPv6
+    char b6[36] = {0};
+    inet_pton(AF_INET6, "2001:db8::1", b6);
+    inet_pton(AF_INET6, "2001:db8::2", b6 + 16);
+    uint16_t port = htons(443);
+    memcpy(b6 + 32, &port, 2);
+    std::string v6 = header(0x21, 0x21, std::string(b6, sizeof(b6)));
+    CHECK(parse(v6, &consumed, &src) == PROXY_OK && consumed == v6.size());
+    CHECK(src.family() == AF_INET6 && src.port() == 443);
+    CHECK(src.host(buf, sizeof(buf)) && strcmp(buf, "2001:db8::1") == 0);
+
+    // Unix域stream
+    std::string path(216, '\0');
+    memcpy(&path[0], "/run/client.sock", 16);
+    CHECK(parse(header(0x21, 0x31, path), &consumed, &src) == PROXY_OK);
+    CHECK(src.family() == AF_UNIX && strcmp(src.unix_path(), "/run/client.sock") == 0);
+
+    // LOCAL命令和UDP：保留连接本身的地址
+    CHECK(parse(header(0x20, 0x00, ""), &consumed, &src) == PROXY_OK && consumed == 16 && src.len == 0);
+    CHECK(parse(header(0x21, 0x12, v4_body("1.2.3.4", "5.6.7.8", 1, 2)), &consumed, &src) == PROXY_OK && src.len == 0);
+
+    // 格式错误
+    CHECK(parse("GET / HTTP/1.1\r\n\r\n", &consumed, &src) == PROXY_INVALID);
+    CHECK(parse("\r\nX", &consumed, &src) == PROXY_INVALID);                  // 签名前几个字节就不对
+    CHECK(parse(header(0x11, 0x11, v4_body("1.2.3.4", "5.6.7.8", 1, 2)), &consumed, &src) == PROXY_INVALID);   // 版本1
+    CHECK(parse(header(0x22, 0x11, v4_body("1.2.3.4", "5.6.7.8", 1, 2)), &consumed, &src) == PROXY_INVALID);   // 未知命令
+    CHECK(parse(header(0x21, 0x11, "short"), &consumed, &src) == PROXY_INVALID);
+    CHECK(parse(header(0x21, 0x21, v4_body("1.2.3.4", "5.6.7.8", 1, 2)), &consumed, &src) == PROXY_INVALID);
+    CHECK(parse(header(0x21, 0x31, "/tmp/x"), &consumed, &src) == PROXY_INVALID);
+    CHECK(parse(header(0x21, 0x11, std::string(PROXY_V2_MAX, 'x')), &consumed, &src) == PROXY_INVALID);
+    CHECK(parse(header(0x21, 0x11, std::string(PROXY_V2_MAX, 'x')).substr(0, 16), &consumed, &src) == PROXY_INVALID);
+    return test_result();
+}
@@ -0,0 +1,77 @@
+/*
+    http/router.h的测试：普通段、参数、通配和后缀通配的匹配顺序，HEAD回退到GET，405和Allow的方法集合
+    编译：g++ -std=c++11 -o test_router tools/test_router.cc
+*/
+#include <string>
+#include "../http/router.h"
+#include "test_check.h"
+
+// 方法编号与http_conn::METHOD一致
+enum { GET = 0, POST, HEAD, PUT, DELETE };
+
+static request_handler* h_index() { return NULL; }
+static request_handler* h_user() { return NULL; }
+static request_handler* h_user_post() { return NULL; }
+static request_handler* h_static() { return NULL; }
+static request_handler* h_php() { return NULL; }
+static request_handler* h_profile() { return NULL; }
+
+static const router::route routes[] = {
+    { GET, "/", h_index },
+    { GET, "/users/:id", h_user },
+    { POST, "/users/:id", h_user_post },
+    { GET, "/users/me/profile", h_profile },
+    { GET, "/static/*", h_static },
+    { GET, "/*.php", h_php },
+    { POST, "/*.php", h_php },
+};
+
+static std::string param(const route_params& p, const char* name) {
+    str_view v = p.get(name);
+    return std::string(v.data() ? v.data() : "", v.size());
+}
+
+int main() {
+    router r;
+    CHECK(r.add(routes, sizeof(routes) / sizeof(routes[0])));
+    CHECK(!r.add(GET, "/a/*/b", h_static));            // 通配只能在最后
+    CHECK(!r.add(GET, "relative", h_static));
+    CHECK(!r.add(router::MAX_METHODS, "/x", h_static));
+
+    handler_factory f = NULL;
+    route_params p;
+    CHECK(r.match(GET, "/", &f, &p) == router::FOUND && f == h_index);
+    CHECK(r.match(GET, "/users/42", &f, &p) == router::FOUND && f == h_user);
+    CHECK(param(p, "id") == "42");
+    CHECK(p.pattern && strcmp(p.pattern, "/users/:id") == 0);
+    CHECK(r.match(POST, "/users/42?x=1", &f, &p) == router::FOUND && f == h_user_post);
+    CHECK(param(p, "id") == "42");
+
+    // 普通段优先于参数段，失败时回溯
+    CHECK(r.match(GET, "/users/me/profile", &f, &p) == router::FOUND && f == h_profile);
+    CHECK(r.match(GET, "/users/me", &f, &p) == router::FOUND && f == h_user);
+    CHECK(param(p, "id") == "me");
+    CHECK(r.match(GET, "/users/42/profile", &f, &p) == router::NOT_FOUND);
+
+    // 通配匹配剩余路径，后缀通配挂在根上时匹配任意深度
+    CHECK(r.match(GET, "/static/css/a.css", &f, &p) == router::FOUND && f == h_static);
+    CHECK(r.match(GET, "/a/b/index.php?q=1", &f, &p) == router::FOUND && f == h_php);
+    CHECK(r.match(GET, "/a/b/index.html", &f, &p) == router::NOT_FOUND);
+
+    // HEAD没有注册时用GET的处理器；其他方法不回退
+    CHECK(r.match(HEAD, "/users/42", &f, &p) == router::FOUND && f == h_user);
+    CHECK(r.match(DELETE, "/users/42", &f, &p) == router::METHOD_NOT_ALLOWED);
+    CHECK(r.match(PUT, "/static/a", &f, &p) == router::METHOD_NOT_ALLOWED);
+    CHECK(r.match(PUT, "/nothing/here", &f, &p) == router::NOT_FOUND);
+
+    // 405的Allow
+    CHECK(r.allowed("/users/42") == ((1 << GET) | (1 << POST) | (1 << HEAD)));
+    CHECK(r.allowed("/static/x") == ((1 << GET) | (1 << HEAD)));
+    CHECK(r.allowed("/x.php") == ((1 << GET) | (1 << POST) | (1 << HEAD)));
+    CHECK(r.allowed("/nothing/here") == 0);
+
+    // 同一个模式以后注册的为准
+    CHECK(r.add(GET, "/users/:id", h_profile));
+    CHECK(r.match(GET, "/users/1", &f, &p) == router::FOUND && f == h_profile);
+    return test_result();
+}
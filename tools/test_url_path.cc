@@ -0,0 +1,52 @@
+/*
+    http/url_path.h的测试：百分号解码、"."和".."段、跳出根目录，不能解出'\0'、'?'、'#'，以及转发时的重新编码
+    编译：g++ -std=c++11 -o test_url_path tools/test_url_path.cc
+*/
+#include <string>
+#include "../http/url_path.h"
+#include "test_check.h"
+
+// 规范化失败时返回"!"
+static std::string canon(const char* url) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", url);
+    return canonicalize_url(buf) ? std::string(buf) : std::string("!");
+}
+
+int main() {
+    CHECK(canon("/") == "/");
+    CHECK(canon("/index.html") == "/index.html");
+    CHECK(canon("//a///b") == "/a/b");
+    CHECK(canon("/a/./b/") == "/a/b/");
+    CHECK(canon("/a/b/..") == "/a/");
+    CHECK(canon("/a/b/../c?x=/../..") == "/a/c?x=/../..");      // 查询字符串原样保留
+    CHECK(canon("/a/%62%2Fc") == "/a/b/c");
+    CHECK(canon("/%41%42") == "/AB");
+    CHECK(canon("/a b") == "/a b");
+
+    // 跳出根目录
+    CHECK(canon("/..") == "!");
+    CHECK(canon("/a/../../etc/passwd") == "!");
+    CHECK(canon("/%2e%2e/etc/passwd") == "!");
+    CHECK(canon("/a/%2E%2E/%2e%2e/x") == "!");
+
+    // 格式错误
+    CHECK(canon("relative") == "!");
+    CHECK(canon("/%") == "!");
+    CHECK(canon("/%4") == "!");
+    CHECK(canon("/%zz") == "!");
+    CHECK(canon("/a%4?b") == "!");
+
+    // 解码后会改变含义的字符
+    CHECK(canon("/a%00.html") == "!");
+    CHECK(canon("/index.php%3F.html") == "!");
+    CHECK(canon("/index.php%3f") == "!");
+    CHECK(canon("/secret%23.html") == "!");
+    CHECK(canon("/a?%3F") == "/a?%3F");                         // 查询字符串里的不解码
+
+    // 转发给上游时重新编码
+    std::string out;
+    encode_url(out, "/a b/c%#?q=a b");
+    CHECK(out == "/a%20b/c%25%23?q=a b");
+    return test_result();
+}
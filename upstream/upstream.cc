@@ -0,0 +1,289 @@
+#include "upstream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/tcp.h>
+
+upstream_server::~upstream_server() {
+    for (size_t i = 0; i < m_idle.size(); ++i) {
+        close(m_idle[i].fd);
+    }
+}
+
+// 空闲期间后端关闭了连接(或者发来了不该有的数据)时窥视到EOF或数据，这样的连接不能再用
+static bool still_open(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int upstream_server::connect(bool* reused) {
+    time_t now = time(NULL);
+    m_lock.lock();
+    while (!m_idle.empty()) {
+        idle_conn c = m_idle.back();
+        m_idle.pop_back();
+        if (now - c.since < IDLE_TIMEOUT && still_open(c.fd)) {
+            m_lock.unlock();
+            *reused = true;
+            return c.fd;
+        }
+        close(c.fd);
+    }
+    m_lock.unlock();
+
+    *reused = false;
+    int fd = socket(m_addr.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (m_addr.family() != AF_UNIX) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (::connect(fd, m_addr.get(), m_addr.len) < 0 && errno != EINPROGRESS) {
+        // Unix域socket的监听队列满时返回EAGAIN，同样按失败处理
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void upstream_server::put(int fd) {
+    idle_conn c;
+    c.fd = fd;
+    c.since = time(NULL);
+    m_lock.lock();
+    if ((int)m_idle.size() < MAX_IDLE) {
+        m_idle.push_back(c);
+        fd = -1;
+    }
+    m_lock.unlock();
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+void upstream_server::failed() {
+    if (m_fails.fetch_add(1) + 1 >= MAX_FAILS && m_healthy.exchange(false)) {
+        printf("upstream %s is down\n", m_name.c_str());
+    }
+}
+
+void upstream_server::succeeded() {
+    m_fails.store(0, std::memory_order_relaxed);
+    if (!m_healthy.exchange(true)) {
+        printf("upstream %s is up\n", m_name.c_str());
+    }
+}
+
+upstream_group::~upstream_group() {
+    for (size_t i = 0; i < servers.size(); ++i) {
+        delete servers[i];
+    }
+}
+
+upstream_server* upstream_group::pick() {
+    size_t n = servers.size();
+    if (n == 0) {
+        return NULL;
+    }
+    // 从轮转位置开始找，请求数相同时先遇到的胜出，负载轻时请求依次分到每台后端
+    size_t start = m_next.fetch_add(1, std::memory_order_relaxed) % n;
+    upstream_server* best = NULL;
+    for (int pass = 0; pass < 2 && !best; ++pass) {
+        for (size_t i = 0; i < n; ++i) {
+            upstream_server* s = servers[(start + i) % n];
+            if ((pass == 0 && !s->healthy()) || (best && best->outstanding() <= s->outstanding())) {
+                continue;
+            }
+            best = s;
+        }
+    }
+    best->start();
+    return best;
+}
+
+upstream_table::~upstream_table() {
+    stop_health_checks();
+    for (size_t i = 0; i < m_groups.size(); ++i) {
+        delete m_groups[i];
+    }
+}
+
+// 一行配置：前缀 地址... [health=/path]
+static upstream_group* parse_group(char* text) {
+    upstream_group* g = new upstream_group;
+    char* save = NULL;
+    char* word = strtok_r(text, " \t", &save);
+    if (!word || word[0] != '/') {
+        delete g;
+        return NULL;
+    }
+    g->prefix = word;
+    while (!g->prefix.empty() && g->prefix[g->prefix.size() - 1] == '/') {
+        g->prefix.erase(g->prefix.size() - 1);
+    }
+    g->pattern = g->prefix + "/*";
+    while ((word = strtok_r(NULL, " \t", &save))) {
+        if (strncmp(word, "health=", 7) == 0) {
+            g->health = word + 7;
+            if (g->health.empty() || g->health[0] != '/') {
+                delete g;
+                return NULL;
+            }
+            continue;
+        }
+        sock_addr addr;
+        bool any;
+        if (!addr.parse(word, false, &any)) {
+            delete g;
+            return NULL;
+        }
+        g->servers.push_back(new upstream_server(word, addr));
+    }
+    if (g->servers.empty()) {
+        delete g;
+        return NULL;
+    }
+    return g;
+}
+
+int upstream_table::load(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        return 0;
+    }
+    int count = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        char* text = line + strspn(line, " \t");
+        text[strcspn(text, "\r\n#")] = '\0';
+        if (text[strspn(text, " \t")] == '\0') {
+            continue;
+        }
+        std::string spec = text;
+        upstream_group* g = parse_group(text);
+        if (!g) {
+            printf("bad upstream in %s: %s\n", path, spec.c_str());
+            count = -1;
+            break;
+        }
+        m_groups.push_back(g);
+        ++count;
+    }
+    fclose(fp);
+    return count;
+}
+
+upstream_group* upstream_table::find(const char* url) const {
+    upstream_group* best = NULL;
+    for (size_t i = 0; i < m_groups.size(); ++i) {
+        const std::string& prefix = m_groups[i]->prefix;
+        if (strncmp(url, prefix.c_str(), prefix.size()) != 0 || (best && best->prefix.size() >= prefix.size())) {
+            continue;
+        }
+        // 按整段匹配，"/app"不匹配"/application"
+        char next = url[prefix.size()];
+        if (next == '\0' || next == '/' || next == '?') {
+            best = m_groups[i];
+        }
+    }
+    return best;
+}
+
+bool upstream_table::start_health_checks() {
+    if (m_groups.empty()) {
+        return true;
+    }
+    if (pthread_create(&m_health_thread, NULL, health_worker, this) != 0) {
+        return false;
+    }
+    m_health_running = true;
+    return true;
+}
+
+void upstream_table::stop_health_checks() {
+    if (!m_health_running) {
+        return;
+    }
+    m_stop_lock.lock();
+    m_stop = true;
+    m_stop_cond.signal();
+    m_stop_lock.unlock();
+    pthread_join(m_health_thread, NULL);
+    m_health_running = false;
+}
+
+void* upstream_table::health_worker(void* arg) {
+    upstream_table* table = (upstream_table*)arg;
+    table->m_stop_lock.lock();
+    while (!table->m_stop) {
+        table->m_stop_lock.unlock();
+        table->check_all();
+        table->m_stop_lock.lock();
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += HEALTH_INTERVAL;
+        while (!table->m_stop && table->m_stop_cond.timewait(table->m_stop_lock.get(), deadline)) {
+        }
+    }
+    table->m_stop_lock.unlock();
+    return table;
+}
+
+void upstream_table::check_all() {
+    for (size_t i = 0; i < m_groups.size(); ++i) {
+        upstream_group* g = m_groups[i];
+        for (size_t j = 0; j < g->servers.size(); ++j) {
+            upstream_server* s = g->servers[j];
+            if (probe(s, g->health)) {
+                s->succeeded();
+            } else {
+                s->failed();
+            }
+        }
+    }
+}
+
+// 阻塞的短连接，超时由SO_SNDTIMEO/SO_RCVTIMEO控制(connect也受SO_SNDTIMEO限制)；
+// 有健康检查路径时状态码小于500才算健康
+bool upstream_table::probe(const upstream_server* s, const std::string& path) {
+    const sock_addr& addr = s->address();
+    int fd = socket(addr.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct timeval tv;
+    tv.tv_sec = HEALTH_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    bool ok = ::connect(fd, addr.get(), addr.len) == 0;
+    if (ok && !path.empty()) {
+        char req[512];
+        int len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+                           path.c_str());
+        ok = len < (int)sizeof(req) && send(fd, req, len, MSG_NOSIGNAL) == len;
+        // "HTTP/1.1 200"
+        char status[13];
+        size_t got = 0;
+        while (ok && got < 12) {
+            ssize_t n = recv(fd, status + got, 12 - got, 0);
+            ok = n > 0;
+            got += ok ? n : 0;
+        }
+        if (ok) {
+            status[12] = '\0';
+            int code = atoi(status + 9);
+            ok = strncmp(status, "HTTP/1.", 7) == 0 && code >= 200 && code < 500;
+        }
+    }
+    close(fd);
+    return ok;
+}
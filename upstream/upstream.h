@@ -0,0 +1,116 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stddef.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../net/sock_addr.h"
+#include "../pthreadpool/lcoker.h"
+
+/*
+    反向代理的上游后端：TCP或Unix域socket上的HTTP/1.1服务器
+    - 每台后端有自己的keep-alive连接池，请求结束后连接放回池中，下一个请求直接复用，不再握手
+    - 连续失败MAX_FAILS次(请求中连接或读写出错，或者健康检查失败)后标记为不健康，不再参与选择，
+      健康检查成功后恢复
+*/
+class upstream_server {
+public:
+    static const int MAX_IDLE = 32;         // 连接池中最多保留的空闲连接数
+    static const int IDLE_TIMEOUT = 30;     // 空闲超过该时间(秒)的连接不再复用，后端很可能已经关闭了它
+    static const int MAX_FAILS = 3;
+
+    upstream_server(const std::string& spec, const sock_addr& addr)
+        : m_name(spec), m_addr(addr), m_outstanding(0), m_healthy(true), m_fails(0) {}
+    ~upstream_server();
+
+    // 优先取出空闲连接(*reused为true)，没有时发起非阻塞连接(连接可能还在进行中)，失败返回-1
+    int connect(bool* reused);
+    // 请求正常结束，连接还可以复用时放回连接池
+    void put(int fd);
+
+    // 被选中处理一个请求，请求结束时调用done
+    void start() { m_outstanding.fetch_add(1); }
+    void done() { m_outstanding.fetch_sub(1); }
+    int outstanding() const { return m_outstanding.load(std::memory_order_relaxed); }
+
+    bool healthy() const { return m_healthy.load(std::memory_order_relaxed); }
+    void failed();
+    void succeeded();
+
+    const std::string& name() const { return m_name; }
+    const sock_addr& address() const { return m_addr; }
+
+private:
+    struct idle_conn {
+        int fd;
+        time_t since;
+    };
+
+    std::string m_name;         // 配置中的写法，用于日志
+    sock_addr m_addr;
+    std::atomic<int> m_outstanding;
+    std::atomic<bool> m_healthy;
+    std::atomic<int> m_fails;
+    std::vector<idle_conn> m_idle;  // 队尾是最近放回的连接，先取出
+    locker m_lock;
+};
+
+// 一个路径前缀下的一组后端
+class upstream_group {
+public:
+    upstream_group() : m_next(0) {}
+    ~upstream_group();
+
+    // 健康的后端中进行中的请求最少的一台，相同时轮流；都不健康时在全部后端中选。已经计入进行中的请求
+    upstream_server* pick();
+
+    std::string prefix;         // 路径前缀，不以'/'结尾，根为空
+    std::string pattern;        // 注册到路由表的模式prefix + "/*"，路由表保存指针，不能再修改
+    std::string health;         // 健康检查的路径，为空时只检查能否建立连接
+    std::vector<upstream_server*> servers;
+
+private:
+    std::atomic<unsigned> m_next;
+};
+
+/*
+    上游配置，一行一组，#开头为注释：前缀 后端地址... [health=/path]
+      /api 127.0.0.1:9001 127.0.0.1:9002 health=/healthz
+      /app unix:/run/app.sock
+    前缀下的请求(包括前缀本身)原样转发，路径不改写；多个前缀都匹配时最长的优先
+*/
+class upstream_table {
+public:
+    static const int HEALTH_INTERVAL = 5;   // 健康检查的间隔(秒)
+    static const int HEALTH_TIMEOUT = 2;    // 健康检查连接和读写的超时(秒)
+
+    upstream_table() : m_health_running(false), m_stop(false) {}
+    ~upstream_table();
+
+    // 文件不存在返回0，有错误的行返回-1，否则返回组数
+    int load(const char* path);
+    upstream_group* find(const char* url) const;
+    const std::vector<upstream_group*>& groups() const { return m_groups; }
+
+    // 启动健康检查线程，prefork模式下每个工作进程各自检查，在fork之后调用
+    bool start_health_checks();
+    // 通知健康检查线程退出并等待它结束，析构时自动调用
+    void stop_health_checks();
+
+private:
+    static void* health_worker(void* arg);
+    void check_all();
+    static bool probe(const upstream_server* s, const std::string& path);
+
+private:
+    std::vector<upstream_group*> m_groups;
+    pthread_t m_health_thread;
+    bool m_health_running;
+    bool m_stop;                // 由m_stop_lock保护，两次检查之间的等待被m_stop_cond提前唤醒
+    locker m_stop_lock;
+    cond m_stop_cond;
+};
+
+#endif